@@ -69,7 +69,7 @@
 
 /* defines for config.c */
 
-#define SERVER_MAX 8
+#define SERVER_MAX 8	/* no longer a limit, the pools grow as needed */
 
 #define AUTH_LOCAL_FST	(1<<0)
 #define AUTH_RADIUS_FST	(1<<1)
@@ -78,10 +78,14 @@
 
 typedef struct server {
 	int max;
-	char *name[SERVER_MAX];
-	uint16_t port[SERVER_MAX];
-	char *secret[SERVER_MAX];
-	double deadtime_ends[SERVER_MAX];
+	char **name;
+	uint16_t *port;
+	char **secret;
+	double *deadtime_ends;
+	int size;				//!< Entries allocated in the arrays above.
+	struct rc_server_ring *ring;		//!< Consistent hash ring, see server_hash_key.
+	struct rc_server_admit *admit;		//!< Admission control, see server_max_outstanding.
+	struct rc_server_breaker *breaker;	//!< Outlier detection, see server_breaker_window.
 } SERVER;
 
 typedef struct pw_auth_hdr
@@ -93,9 +97,53 @@ typedef struct pw_auth_hdr
 	uint8_t		data[2];
 } AUTH_HDR;
 
+/* priority classes of requests queued by admission control, see rc_aaa_prio() */
+#define RC_PRIO_DEFAULT		-1	//!< Pick the class from the request.
+#define RC_PRIO_AUTH		0	//!< Access-Request and anything not accounting.
+#define RC_PRIO_ACCT		1	//!< Accounting other than Interim-Update.
+#define RC_PRIO_INTERIM		2	//!< Accounting Interim-Update.
+#define RC_PRIO_CLASSES		3
+
+/** Typed copy of the options needed on every request, see rc_config_compile() */
+struct rc_conf_opts
+{
+	int			radius_timeout;
+	int			radius_retries;
+	int			radius_deadtime;
+	int			radius_deadline;	//!< Milliseconds a request may take in all, 0 for no limit.
+	struct server		*authserver;
+	struct server		*acctserver;
+	char const		*servers;		//!< Path of the servers file.
+	char const		*bindaddr;
+	unsigned		require_message_authenticator;
+	struct dict_attr const	*server_hash_attr;	//!< Routing key, once the dictionary is read.
+	char const		*daemon_socket;		//!< Where radclientd listens, if requests go through it.
+	int			server_max_outstanding;	//!< Requests in flight per server, 0 for no cap.
+	int			server_rate;		//!< Requests per second per server, 0 for no pacing.
+	int			server_burst;		//!< Requests sent back to back under server_rate.
+	unsigned		server_overload_fail;	//!< Refuse rather than wait when a server is busy.
+	unsigned		server_priority_weighted; //!< Share slots between classes by weight, not rank.
+	int			server_priority_weight[RC_PRIO_CLASSES];
+	int			server_breaker_window;	//!< Seconds of history judged, 0 for no breakers.
+	int			server_breaker_errors;	//!< Percentage of errors that ejects a server.
+	int			server_breaker_latency;	//!< Mean latency that ejects a server, milliseconds.
+	int			server_breaker_latency_factor; //!< Ejects a server this many times slower than its peers.
+	int			server_breaker_eject;	//!< Seconds of the first ejection.
+	int			server_breaker_probes;	//!< Requests that must do well before a server is restored.
+};
+
+/** One line of the servers file, see rc_read_servers() */
+struct rc_servers_entry
+{
+	struct addrinfo		*info;
+	char			secret[MAX_SECRET_LENGTH + 1];
+	struct rc_servers_entry	*next;
+};
+
 struct rc_conf
 {
 	struct _option		*config_options;
+	struct rc_conf_opts	opts;			//!< Compiled from config_options.
 	struct sockaddr_storage	own_bind_addr;
 	unsigned		own_bind_addr_set;
 
@@ -106,10 +154,21 @@ struct rc_conf
 	char			buf[256];
 	char			buf1[14];
 	char			ifname[512];
+
+	struct rc_hmac_cache	*hmac_cache;		//!< Message-Authenticator key schedules, per secret.
+	struct rc_stats		*stats;			//!< Per-server counters, see rc_stats_snapshot().
+	struct rc_trace_hook	*trace;			//!< Lifecycle callback, see rc_trace_set().
+	struct rc_servers_entry	*servers_cache;		//!< Parsed servers file, if servers_cached.
+	unsigned		servers_cached;
+	struct rc_health	*health;		//!< Shared with other processes, see server_health_shm.
+	struct rc_admit		*admit;			//!< Admission state per server name.
 };
 
 typedef struct rc_conf rc_handle;
 
+/** Atomically replaceable configuration snapshots, see rc_reload() */
+typedef struct rc_reload RC_RELOAD;
+
 #define AUTH_HDR_LEN			20
 #define CHAP_VALUE_LENGTH		16
 
@@ -409,6 +468,8 @@ typedef struct value_pair
 #define OK_RC		0
 #define TIMEOUT_RC	1
 #define REJECT_RC	2
+#define BUSY_RC		-3	//!< Every server was at its cap or rate, see rc_busy().
+#define DEADLINE_RC	-4	//!< The deadline of the request passed before it got an answer.
 
 typedef struct send_data /* Used to pass information to sendserver() function */
 {
@@ -421,8 +482,125 @@ typedef struct send_data /* Used to pass information to sendserver() function */
 	int            retries;
 	VALUE_PAIR     *send_pairs;     //!< More a/v pairs to send.
 	VALUE_PAIR     *receive_pairs;  //!< Where to place received a/v pairs.
+	double         deadline;	//!< rc_getmtime() by which to give up, 0 for none.
 } SEND_DATA;
 
+/*
+ * Log-linear histogram: values below 2^RC_HIST_SUB_BITS have a bucket
+ * each, above that every power of two is split into 2^RC_HIST_SUB_BITS
+ * buckets, so the relative error stays below 1/2^RC_HIST_SUB_BITS.
+ * Values of 2^RC_HIST_MAX_BITS and more land in the last bucket.
+ */
+#define RC_HIST_SUB_BITS	4
+#define RC_HIST_MAX_BITS	40
+#define RC_HIST_BUCKETS		((RC_HIST_MAX_BITS - RC_HIST_SUB_BITS + 1) << RC_HIST_SUB_BITS)
+
+typedef struct rc_histogram
+{
+	uint64_t	count;			//!< Number of recorded values.
+	uint64_t	sum;			//!< Sum of recorded values.
+	uint64_t	max;			//!< Largest recorded value.
+	uint64_t	bucket[RC_HIST_BUCKETS];
+} RC_HISTOGRAM;
+
+/* request lifecycle stages reported to a trace hook */
+typedef enum rc_trace_stage {
+	RC_TRACE_BUILT = 0,		//!< rc_buildreq() filled in the request for a server.
+	RC_TRACE_ENCODED,		//!< attributes packed and authenticators computed.
+	RC_TRACE_SENT,			//!< first transmission.
+	RC_TRACE_RETRANSMIT,		//!< resent after a timeout; value is the retransmission number.
+	RC_TRACE_RECEIVED,		//!< a reply arrived.
+	RC_TRACE_VERIFIED,		//!< the reply was checked; value is %OK_RC or %BADRESP_RC.
+	RC_TRACE_FAILOVER		//!< rc_aaa() moves on to the next server; value is the last result.
+} RC_TRACE_STAGE;
+
+typedef struct rc_trace_event
+{
+	RC_TRACE_STAGE	stage;
+	double		time;			//!< Monotonic timestamp, as rc_getmtime().
+	struct send_data const *data;		//!< The request, stable for a whole rc_aaa() call.
+	int		value;			//!< Stage specific, see #RC_TRACE_STAGE.
+} RC_TRACE_EVENT;
+
+typedef void (*rc_trace_fn)(void *ctx, RC_TRACE_EVENT const *event);
+
+typedef void (*rc_log_sink_fn)(void *ctx, int prio, char const *msg);
+
+#define RC_STATS_MAX_SERVERS	32	//!< Servers tracked per handle; the rest are summed under "*".
+
+typedef struct rc_server_stats
+{
+	char		server[256];		//!< Server name as configured.
+	int		port;			//!< Destination port, 0 for the default.
+	unsigned	type;			//!< %AUTH or %ACCT.
+	uint64_t	requests;		//!< Calls to rc_send_server().
+	uint64_t	retransmits;		//!< Packets resent after a timeout.
+	uint64_t	timeouts;		//!< Requests that got no reply at all.
+	uint64_t	accepts;		//!< Access-Accept and Accounting-Response.
+	uint64_t	rejects;		//!< Access-Reject.
+	uint64_t	badresp;		//!< Replies failing verification, or of an unexpected code.
+	uint64_t	errors;			//!< Local failures (resolution, socket, ...).
+	uint64_t	deadtime_enter;		//!< Times rc_aaa() marked the server dead.
+	uint64_t	deadtime_exit;		//!< Times rc_aaa() found it alive again.
+	uint64_t	busy;			//!< Requests refused by admission control.
+	uint64_t	deadline;		//!< Requests cut short by their deadline.
+	RC_HISTOGRAM	latency;		//!< Microseconds from first send to a valid reply.
+} RC_SERVER_STATS;
+
+/** States of the circuit breaker of a server */
+typedef enum rc_breaker_state {
+	RC_BREAKER_CLOSED = 0,			//!< Requests flow normally.
+	RC_BREAKER_OPEN,			//!< Ejected; only tried when every other server failed.
+	RC_BREAKER_HALF_OPEN			//!< A few probe requests decide whether it is restored.
+} RC_BREAKER_STATE;
+
+/** The circuit breaker of a server, see rc_breaker_get() */
+typedef struct rc_breaker_info {
+	RC_BREAKER_STATE state;
+	double		open_for;		//!< Seconds left before probing, when open.
+	int		ejections;		//!< Since the server was last healthy for a whole window.
+	uint32_t	requests;		//!< Answers and timeouts in the window.
+	uint32_t	errors;			//!< Timeouts and bad replies in the window.
+	uint32_t	latency;		//!< Mean latency of the answers in the window, microseconds.
+} RC_BREAKER_INFO;
+
+/** Health of a server as shared between processes, see rc_health_get() */
+typedef struct rc_server_health {
+	double		dead_for;		//!< Seconds of deadtime left, 0 if alive.
+	uint32_t	srtt;			//!< Smoothed round trip time, microseconds.
+	uint32_t	failures;		//!< Timeouts since the server last answered.
+} RC_SERVER_HEALTH;
+
+/** Replies and faults of a stand-in server, see rc_responder_start() */
+typedef struct rc_responder_conf {
+	char const	*secret;
+	unsigned short	port;			//!< 0 to pick a free one, see rc_responder_port().
+	int		ipv6;			//!< Listen on ::1 rather than 127.0.0.1.
+	int		access_code;		//!< Answer to Access-Request, 0 for %PW_ACCESS_ACCEPT.
+	VALUE_PAIR	*access_pairs;		//!< Attributes of that answer.
+	VALUE_PAIR	*acct_pairs;		//!< Attributes of Accounting-Response.
+	double		loss;			//!< Share of requests left unanswered, 0 to 1.
+	double		duplicate;		//!< Share of replies sent twice.
+	double		reorder;		//!< Share of replies held back until after the next one.
+	double		bad_auth;		//!< Share of replies with a corrupt authenticator.
+	unsigned	delay_ms;		//!< Added before every reply.
+	unsigned	jitter_ms;		//!< Random extra delay, up to this.
+	uint64_t	seed;			//!< Seed of the faults, 0 for a random one.
+} RC_RESPONDER_CONF;
+
+/** Counters of a stand-in server, see rc_responder_stats() */
+typedef struct rc_responder_stats {
+	uint64_t	requests;		//!< Valid requests received.
+	uint64_t	invalid;		//!< Packets dropped as malformed or failing verification.
+	uint64_t	replies;		//!< Replies sent, duplicates included.
+	uint64_t	lost;			//!< Requests left unanswered on purpose.
+	uint64_t	duplicated;
+	uint64_t	reordered;
+	uint64_t	corrupted;		//!< Replies sent with a bad authenticator.
+} RC_RESPONDER_STATS;
+
+typedef struct rc_responder RC_RESPONDER;
+
 #ifndef MIN
 #define MIN(a, b)     ((a) < (b) ? (a) : (b))
 #endif
@@ -446,6 +624,10 @@ __BEGIN_DECLS
 
 /* Function prototypes */
 
+/* admit.c */
+
+int rc_busy(rc_handle const *, unsigned);
+
 /* avpair.c */
 
 VALUE_PAIR *rc_avpair_add(rc_handle const *, VALUE_PAIR **, uint32_t, void const *, int, uint32_t);
@@ -459,6 +641,11 @@ int rc_avpair_parse(rc_handle const *, char const *, VALUE_PAIR **);
 int rc_avpair_tostr(rc_handle const *, VALUE_PAIR *, char *, int, char *, int);
 char *rc_avpair_log(rc_handle const *, VALUE_PAIR *, char *buf, size_t buf_len);
 VALUE_PAIR *rc_avpair_readin(rc_handle const *, FILE *);
+int rc_avpair_readin_record(rc_handle const *, FILE *, VALUE_PAIR **);
+
+/* breaker.c */
+
+int rc_breaker_get(rc_handle const *, unsigned, int, RC_BREAKER_INFO *);
 
 /* buildreq.c */
 
@@ -472,6 +659,10 @@ int rc_check(rc_handle *, char *, char *, unsigned short, char *);
 
 int rc_aaa(rc_handle *rh, uint32_t client_port, VALUE_PAIR *send, VALUE_PAIR **received,
     char *msg, int add_nas_port, int request_type);
+int rc_aaa_prio(rc_handle *rh, uint32_t client_port, VALUE_PAIR *send, VALUE_PAIR **received,
+    char *msg, int add_nas_port, int request_type, int prio);
+int rc_aaa_deadline(rc_handle *rh, uint32_t client_port, VALUE_PAIR *send, VALUE_PAIR **received,
+    char *msg, int add_nas_port, int request_type, int prio, unsigned deadline_ms);
 
 /* clientid.c */
 
@@ -488,8 +679,16 @@ SERVER *rc_conf_srv(rc_handle const *, char const *);
 void rc_config_free(rc_handle *);
 int rc_add_config(rc_handle *, char const *, char const *, char const *, int);
 rc_handle *rc_config_init(rc_handle *);
+void rc_config_compile(rc_handle *);
+int rc_read_servers(rc_handle *);
+void rc_servers_free(rc_handle *);
 int test_config(rc_handle const *, char const *);
 
+/* daemon.c */
+
+int rc_daemon_listen(char const *, mode_t);
+void rc_daemon_serve(RC_RELOAD *, int);
+
 /* dict.c */
 
 int rc_read_dictionary(rc_handle *, char const *);
@@ -502,6 +701,10 @@ DICT_VENDOR *rc_dict_getvend(rc_handle const *, uint32_t);
 DICT_VALUE * rc_dict_getval(rc_handle const *, uint32_t, char const *);
 void rc_dict_free(rc_handle *);
 
+/* health.c */
+
+int rc_health_get(rc_handle const *, char const *, int, unsigned, RC_SERVER_HEALTH *);
+
 /* ip_util.c */
 
 
@@ -516,11 +719,43 @@ int rc_get_srcaddr(struct sockaddr *, const struct sockaddr *);
 
 void rc_openlog(char const *);
 void rc_log(int, char const *, ...);
+void rc_log_set_sink(rc_log_sink_fn, void *);
+void rc_log_set_level(int);
+int rc_log_enabled(int);
+void rc_log_set_ratelimit(unsigned, double);
+int rc_log_async_start(size_t);
+void rc_log_async_stop(void);
+
+/* reload.c */
+
+RC_RELOAD *rc_reload_open(char const *);
+int rc_reload(RC_RELOAD *);
+rc_handle *rc_reload_acquire(RC_RELOAD *);
+void rc_reload_release(RC_RELOAD *, rc_handle *);
+void rc_reload_close(RC_RELOAD *);
+
+/* responder.c */
+
+RC_RESPONDER *rc_responder_start(rc_handle const *, RC_RESPONDER_CONF const *);
+int rc_responder_port(RC_RESPONDER const *);
+void rc_responder_stats(RC_RESPONDER const *, RC_RESPONDER_STATS *);
+void rc_responder_stop(RC_RESPONDER *);
 
 /* sendserver.c */
 
 int rc_send_server(rc_handle const*, SEND_DATA *, char *, unsigned flags);
 
+/* stats.c */
+
+void rc_hist_record(RC_HISTOGRAM *, uint64_t);
+uint64_t rc_hist_percentile(RC_HISTOGRAM const *, double);
+void rc_hist_merge(RC_HISTOGRAM *, RC_HISTOGRAM const *);
+int rc_stats_snapshot(rc_handle const *, RC_SERVER_STATS *, int);
+
+/* trace.c */
+
+int rc_trace_set(rc_handle *, rc_trace_fn, void *);
+
 /* util.c */
 
 void rc_str2tm(char const *, struct tm *);
@@ -542,7 +777,14 @@ int rc_import_env(struct env *, char const **);
 
 /* md5.c */
 
-void rc_md5_calc(unsigned char *, unsigned char const *, unsigned int);
+void rc_md5_calc(unsigned char *, unsigned char const *, size_t);
+void rc_md5_calc_multi(unsigned char **, unsigned char const **, size_t const *, unsigned int);
+
+/* rc-md5.c */
+
+int rc_md5_set_backend(char const *);
+char const *rc_md5_get_backend(void);
+double rc_md5_benchmark(char const *);
 
 __END_DECLS
 
@@ -0,0 +1,455 @@
+/*
+ * admit.c	Admission control: outstanding request caps, pacing and priorities per server.
+ *
+ * License:	BSD
+ *
+ */
+
+#include <config.h>
+#include <includes.h>
+#include <freeradius-client.h>
+#include "util.h"
+
+#ifdef HAVE_PTHREAD_CREATE
+# include <pthread.h>
+#endif
+
+/*
+ *  The state is kept per server name, so an authentication and an
+ *  accounting pool listing the same host share its limits and compete
+ *  for them under the priority classes.
+ *
+ *  Pacing is the generic cell rate algorithm: each server keeps only the
+ *  theoretical arrival time of its next request, advanced by one
+ *  interval per request admitted with a single compare-and-swap.  A
+ *  request arriving before that time, less the burst tolerance, has to
+ *  wait for it; a waiting request has already reserved its place, so
+ *  paced callers go out one interval apart in arrival order.
+ *
+ *  The outstanding count is an atomic counter, taken without a lock
+ *  while nobody is queued.  Callers finding a server at its cap queue
+ *  by priority class; a reply freeing a slot hands it to one queued
+ *  class, picked strictly by rank or by weight, instead of letting the
+ *  waiters race for it.
+ */
+struct rc_admit {
+	char		*name;
+	int64_t		tat;		//!< theoretical arrival time, microseconds.
+	int		outstanding;
+	int		waiting;	//!< callers queued in any class.
+#ifdef HAVE_PTHREAD_CREATE
+	pthread_mutex_t	lock;
+	int		waiters[RC_PRIO_CLASSES];
+	int		grants[RC_PRIO_CLASSES];	//!< slots handed to a class, not yet taken.
+	int		credit[RC_PRIO_CLASSES];	//!< smooth weighted round robin state.
+	pthread_cond_t	cond[RC_PRIO_CLASSES];
+#endif
+	struct rc_admit	*next;
+};
+
+struct rc_server_admit {
+	int		servers;	//!< srv->max when the state was built.
+	struct rc_admit	*server[1];
+};
+
+static int64_t admit_now(void)
+{
+	return (int64_t)(rc_getmtime() * 1000000);
+}
+
+static void admit_sleep(int64_t usec)
+{
+	struct timespec ts;
+
+	ts.tv_sec = usec / 1000000;
+	ts.tv_nsec = (usec % 1000000) * 1000;
+	while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+		;
+}
+
+/** Find the admission state of a server name, adding it on first use
+ *
+ * @param rh a handle to parsed configuration.
+ * @param name the server name.
+ * @return the state, or NULL when out of memory.
+ */
+static struct rc_admit *admit_host(rc_handle *rh, char const *name)
+{
+	struct rc_admit	*a;
+	int		i;
+
+	for (a = rh->admit; a != NULL; a = a->next) {
+		if (strcmp(a->name, name) == 0)
+			return a;
+	}
+
+	a = malloc(sizeof(*a));
+	if (a == NULL)
+		return NULL;
+	memset(a, 0, sizeof(*a));
+	a->name = strdup(name);
+	if (a->name == NULL) {
+		free(a);
+		return NULL;
+	}
+
+#ifdef HAVE_PTHREAD_CREATE
+	pthread_mutex_init(&a->lock, NULL);
+	for (i = 0; i < RC_PRIO_CLASSES; i++)
+		pthread_cond_init(&a->cond[i], NULL);
+#else
+	(void)i;
+#endif
+
+	a->next = rh->admit;
+	rh->admit = a;
+
+	return a;
+}
+
+/** Attach admission state to every server of a pool
+ *
+ * Does nothing if the pool is already covered.
+ *
+ * @param rh a handle to parsed configuration.
+ * @param srv the server pool.
+ * @return 0 on success, -1 when out of memory.
+ */
+int rc_server_admit_build(rc_handle *rh, SERVER *srv)
+{
+	struct rc_server_admit	*admit;
+	int			i;
+
+	if (srv->admit != NULL && srv->admit->servers == srv->max)
+		return 0;
+
+	rc_server_admit_free(srv);
+	if (srv->max == 0)
+		return 0;
+
+	admit = malloc(sizeof(*admit) + (size_t)srv->max * sizeof(admit->server[0]));
+	if (admit == NULL) {
+		rc_log(LOG_CRIT, "rc_server_admit_build: out of memory");
+		return -1;
+	}
+
+	for (i = 0; i < srv->max; i++) {
+		admit->server[i] = admit_host(rh, srv->name[i]);
+		if (admit->server[i] == NULL) {
+			rc_log(LOG_CRIT, "rc_server_admit_build: out of memory");
+			free(admit);
+			return -1;
+		}
+	}
+
+	admit->servers = srv->max;
+	srv->admit = admit;
+
+	return 0;
+}
+
+/** Detach the admission state of a server pool
+ *
+ * @param srv the server pool.
+ */
+void rc_server_admit_free(SERVER *srv)
+{
+	free(srv->admit);
+	srv->admit = NULL;
+}
+
+/** Free the admission state of every server of a handle
+ *
+ * @param rh a handle to parsed configuration.
+ */
+void rc_admit_free(rc_handle *rh)
+{
+	struct rc_admit	*a, *next;
+#ifdef HAVE_PTHREAD_CREATE
+	int		i;
+#endif
+
+	for (a = rh->admit; a != NULL; a = next) {
+		next = a->next;
+#ifdef HAVE_PTHREAD_CREATE
+		pthread_mutex_destroy(&a->lock);
+		for (i = 0; i < RC_PRIO_CLASSES; i++)
+			pthread_cond_destroy(&a->cond[i]);
+#endif
+		free(a->name);
+		free(a);
+	}
+	rh->admit = NULL;
+}
+
+/** The priority class of a request
+ *
+ * @param send the pairs of the request.
+ * @param request_type its RADIUS code.
+ * @return %RC_PRIO_AUTH, %RC_PRIO_ACCT or %RC_PRIO_INTERIM.
+ */
+int rc_prio_class(VALUE_PAIR *send, int request_type)
+{
+	VALUE_PAIR *vp;
+
+	if (request_type != PW_ACCOUNTING_REQUEST)
+		return RC_PRIO_AUTH;
+
+	vp = rc_avpair_get(send, PW_ACCT_STATUS_TYPE, 0);
+	if (vp != NULL && vp->lvalue == PW_STATUS_ALIVE)
+		return RC_PRIO_INTERIM;
+
+	return RC_PRIO_ACCT;
+}
+
+#ifdef HAVE_PTHREAD_CREATE
+/** Pick the queued class to hand a freed slot to; called with the lock held
+ *
+ * @param opts the options of the handle.
+ * @param a the admission state of the server.
+ * @return the class, or -1 if every queued caller already has a slot.
+ */
+static int admit_pick(struct rc_conf_opts const *opts, struct rc_admit *a)
+{
+	int c, best = -1, total = 0;
+
+	for (c = 0; c < RC_PRIO_CLASSES; c++) {
+		if (a->waiters[c] <= a->grants[c])
+			continue;
+		if (!opts->server_priority_weighted)
+			return c;
+
+		a->credit[c] += opts->server_priority_weight[c];
+		total += opts->server_priority_weight[c];
+		if (best < 0 || a->credit[c] > a->credit[best])
+			best = c;
+	}
+	if (best >= 0)
+		a->credit[best] -= total;
+
+	return best;
+}
+#endif
+
+/** Take an outstanding request slot of a server
+ *
+ * @param opts the options of the handle.
+ * @param a the admission state of the server.
+ * @param prio the priority class of the request.
+ * @param deadline when to give up waiting, microseconds; 0 to fail at once.
+ * @return 0 on success, -1 if the server stayed at its cap.
+ */
+static int admit_slot(struct rc_conf_opts const *opts, struct rc_admit *a, int prio, int64_t deadline)
+{
+	int		max = opts->server_max_outstanding;
+#ifdef HAVE_PTHREAD_CREATE
+	struct timespec	ts;
+	int64_t		left;
+	int		c, ahead = 0, rc = -1;
+#endif
+
+	if (__atomic_load_n(&a->waiting, __ATOMIC_SEQ_CST) == 0) {
+		if (__atomic_add_fetch(&a->outstanding, 1, __ATOMIC_SEQ_CST) <= max)
+			return 0;
+		__atomic_sub_fetch(&a->outstanding, 1, __ATOMIC_SEQ_CST);
+	}
+
+#ifdef HAVE_PTHREAD_CREATE
+	if (deadline == 0)
+		return -1;
+
+	/*
+	 *  Queueing before trying again means a slot freed after the
+	 *  attempt is seen by rc_admit_done(), which then hands it over.
+	 */
+	pthread_mutex_lock(&a->lock);
+	__atomic_add_fetch(&a->waiting, 1, __ATOMIC_SEQ_CST);
+	a->waiters[prio]++;
+
+	for (c = 0; c <= prio; c++)
+		ahead += a->waiters[c] - a->grants[c];
+	if (ahead == 1) {
+		if (__atomic_add_fetch(&a->outstanding, 1, __ATOMIC_SEQ_CST) <= max)
+			rc = 0;
+		else
+			__atomic_sub_fetch(&a->outstanding, 1, __ATOMIC_SEQ_CST);
+	}
+
+	while (rc != 0) {
+		if (a->grants[prio] > 0) {
+			a->grants[prio]--;
+			rc = 0;
+			break;
+		}
+
+		left = deadline - admit_now();
+		if (left <= 0)
+			break;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += left / 1000000;
+		ts.tv_nsec += (left % 1000000) * 1000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&a->cond[prio], &a->lock, &ts);
+	}
+
+	a->waiters[prio]--;
+	__atomic_sub_fetch(&a->waiting, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&a->lock);
+
+	return rc;
+#else
+	return -1;
+#endif
+}
+
+/** Reserve the next send time of a server under its rate
+ *
+ * @param a the admission state of the server.
+ * @param rate requests per second.
+ * @param burst requests allowed back to back.
+ * @param deadline latest acceptable send time, microseconds; 0 to refuse any wait.
+ * @return 0 once the request may be sent, -1 if it would have to wait too long.
+ */
+static int admit_pace(struct rc_admit *a, int rate, int burst, int64_t deadline)
+{
+	int64_t	interval = 1000000 / rate, tolerance = (int64_t)(burst - 1) * interval;
+	int64_t	now, tat, start, wait;
+
+	tat = __atomic_load_n(&a->tat, __ATOMIC_RELAXED);
+	do {
+		now = admit_now();
+		start = tat > now ? tat : now;
+		wait = start - tolerance - now;
+		if (wait > 0 && (deadline == 0 || now + wait > deadline))
+			return -1;
+	} while (!__atomic_compare_exchange_n(&a->tat, &tat, start + interval, 1,
+					      __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	if (wait > 0)
+		admit_sleep(wait);
+
+	return 0;
+}
+
+/** Admit a request to a server, waiting for room if so configured
+ *
+ * With server_overload set to fail, a server at its cap or ahead of its
+ * rate refuses at once; otherwise the caller waits up to radius_timeout
+ * seconds, or until the deadline of the request if sooner, behind queued
+ * callers of higher priority classes.  Every request admitted must be
+ * finished with rc_admit_done().
+ *
+ * @param rh a handle to parsed configuration.
+ * @param srv the server pool.
+ * @param s the server.
+ * @param prio the priority class of the request, see rc_prio_class().
+ * @param until the deadline of the request as rc_getmtime(), or 0.
+ * @return 0 if the request may be sent, -1 if the server is too busy.
+ */
+int rc_admit(rc_handle const *rh, SERVER *srv, int s, int prio, double until)
+{
+	struct rc_conf_opts const	*opts = &rh->opts;
+	struct rc_admit			*a;
+	int64_t				deadline = 0;
+
+	if (__builtin_expect(srv->admit == NULL, 1))
+		return 0;
+	a = srv->admit->server[s];
+
+	if (!opts->server_overload_fail) {
+		deadline = admit_now() + (int64_t)opts->radius_timeout * 1000000;
+		if (until > 0 && deadline > (int64_t)(until * 1000000))
+			deadline = (int64_t)(until * 1000000);
+	}
+
+	if (opts->server_max_outstanding > 0 &&
+	    admit_slot(opts, a, prio, deadline) != 0)
+		return -1;
+
+	if (opts->server_rate > 0 &&
+	    admit_pace(a, opts->server_rate, opts->server_burst, deadline) != 0) {
+		rc_admit_done(rh, srv, s);
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Release the outstanding request slot taken by rc_admit()
+ *
+ * @param rh a handle to parsed configuration.
+ * @param srv the server pool.
+ * @param s the server.
+ */
+void rc_admit_done(rc_handle const *rh, SERVER *srv, int s)
+{
+	struct rc_admit	*a;
+#ifdef HAVE_PTHREAD_CREATE
+	int		c;
+#endif
+
+	if (__builtin_expect(srv->admit == NULL, 1) || rh->opts.server_max_outstanding <= 0)
+		return;
+	a = srv->admit->server[s];
+
+	__atomic_sub_fetch(&a->outstanding, 1, __ATOMIC_SEQ_CST);
+#ifdef HAVE_PTHREAD_CREATE
+	if (__atomic_load_n(&a->waiting, __ATOMIC_SEQ_CST) == 0)
+		return;
+
+	pthread_mutex_lock(&a->lock);
+	c = admit_pick(&rh->opts, a);
+	if (c >= 0) {
+		/* take the slot back on behalf of the class, unless a newcomer got it first */
+		if (__atomic_add_fetch(&a->outstanding, 1, __ATOMIC_SEQ_CST) <= rh->opts.server_max_outstanding) {
+			a->grants[c]++;
+			pthread_cond_signal(&a->cond[c]);
+		} else {
+			__atomic_sub_fetch(&a->outstanding, 1, __ATOMIC_SEQ_CST);
+		}
+	}
+	pthread_mutex_unlock(&a->lock);
+#endif
+}
+
+/** Whether the servers of a pool are all too busy to take a request now
+ *
+ * A request made while this holds waits in rc_aaa(), or fails with
+ * %BUSY_RC when server_overload is fail.  Callers producing requests in
+ * bulk can poll it to slow down before that happens.
+ *
+ * @param rh a handle to parsed configuration.
+ * @param type %AUTH or %ACCT.
+ * @return 1 if every server is at its outstanding cap or ahead of its rate, 0 otherwise.
+ */
+int rc_busy(rc_handle const *rh, unsigned type)
+{
+	struct rc_conf_opts const	*opts = &rh->opts;
+	SERVER const			*srv = type == ACCT ? opts->acctserver : opts->authserver;
+	struct rc_admit			*a;
+	int64_t				now, interval;
+	int				s;
+
+	if (srv == NULL || srv->admit == NULL)
+		return 0;
+
+	now = admit_now();
+	for (s = 0; s < srv->max; s++) {
+		a = srv->admit->server[s];
+		if (opts->server_max_outstanding > 0 &&
+		    __atomic_load_n(&a->outstanding, __ATOMIC_RELAXED) >= opts->server_max_outstanding)
+			continue;
+		if (opts->server_rate > 0) {
+			interval = 1000000 / opts->server_rate;
+			if (__atomic_load_n(&a->tat, __ATOMIC_RELAXED) -
+			    (int64_t)(opts->server_burst - 1) * interval > now)
+				continue;
+		}
+		return 0;
+	}
+
+	return 1;
+}
@@ -191,7 +191,7 @@ VALUE_PAIR *rc_avpair_gen(rc_handle const *rh, VALUE_PAIR *pair, unsigned char c
 	VALUE_PAIR *rpair;
 	char buffer[(AUTH_STRING_LEN * 2) + 1];
 	/* For hex string conversion. */
-	char hex[3];
+	static char const hex[] = "0123456789ABCDEF";
 
 	if (length < 2) {
 		rc_log(LOG_ERR, "rc_avpair_gen: received attribute with "
@@ -241,12 +241,17 @@ VALUE_PAIR *rc_avpair_gen(rc_handle const *rh, VALUE_PAIR *pair, unsigned char c
 	/* Normal */
 	attr = rc_dict_get_vendor_attr(rh, attribute, vendorpec);
 	if (attr == NULL) {
-		buffer[0] = '\0';	/* Initial length. */
+		/* Skip the hex dump when nobody is going to see it */
+		if (!rc_log_enabled(LOG_WARNING))
+			goto skipit;
+
 		x_ptr = ptr;
-		for (x_len = attrlen; x_len > 0; x_len--, x_ptr++) {
-			snprintf(hex, sizeof(hex), "%2.2X", x_ptr[0]);
-			strcat(buffer, hex);
+		for (x_len = 0; x_len < attrlen; x_len++, x_ptr++) {
+			buffer[x_len * 2] = hex[x_ptr[0] >> 4];
+			buffer[x_len * 2 + 1] = hex[x_ptr[0] & 0x0f];
 		}
+		buffer[attrlen * 2] = '\0';
+
 		if (vendorpec == 0) {
 			rc_log(LOG_WARNING, "rc_avpair_gen: received "
 			    "unknown attribute %d of length %d: 0x%s",
@@ -886,3 +891,48 @@ VALUE_PAIR *rc_avpair_readin(rc_handle const *rh, FILE *input)
 
 	return vp;
 }
+
+/** Get one record of attribute value pairs from the file input
+ *
+ * Records are separated by blank lines, so that a stream of them can be
+ * read one at a time.  Blank lines before a record and comments are
+ * skipped.  A malformed line consumes the rest of its record.
+ *
+ * @param rh a handle to parsed configuration.
+ * @param input a %FILE handle.
+ * @param[out] vp will hold the value pairs of the record, or NULL.
+ * @return 1 when a record was read, 0 at the end of input, -1 for a malformed record.
+ */
+int rc_avpair_readin_record(rc_handle const *rh, FILE *input, VALUE_PAIR **vp)
+{
+	char buffer[1024], *q;
+	int result = 0;
+
+	*vp = NULL;
+	while (fgets(buffer, sizeof(buffer), input) != NULL)
+	{
+		q = buffer;
+
+		while(*q && isspace(*q)) q++;
+
+		if (*q == '\0') {
+			if (result != 0)
+				break;
+			continue;
+		}
+
+		if (*q == '#' || result < 0)
+			continue;
+
+		result = 1;
+
+		if (rc_avpair_parse(rh, q, vp) < 0) {
+			rc_log(LOG_ERR, "rc_avpair_readin_record: malformed attribute: %s", buffer);
+			rc_avpair_free(*vp);
+			*vp = NULL;
+			result = -1;
+		}
+	}
+
+	return result;
+}
@@ -0,0 +1,389 @@
+/*
+ * breaker.c	Outlier detection and circuit breaking per server.
+ *
+ * License:	BSD
+ *
+ */
+
+#include <config.h>
+#include <includes.h>
+#include <freeradius-client.h>
+#include "util.h"
+
+#define BREAKER_BUCKETS		10	//!< slices of the sliding window.
+#define BREAKER_MIN_REQUESTS	10	//!< answers needed in the window before judging a server.
+#define BREAKER_MAX_DOUBLINGS	6	//!< the ejection interval grows up to 64 times.
+
+/*
+ *  Every server keeps its recent outcomes in BREAKER_BUCKETS slices of
+ *  the window, each stamped with the slice of time it counts; a slice
+ *  found stale is claimed by compare-and-swap and cleared by its
+ *  claimer, so recording never takes a lock (a sample landing during
+ *  the clear may be lost, which an estimate can afford).
+ *
+ *  A closed breaker opens when the window shows too many errors, or a
+ *  mean latency above the absolute limit or too far above that of the
+ *  other servers of the pool.  It stays open for server_breaker_eject
+ *  seconds, doubled for each ejection since the server was last healthy
+ *  for a whole window, then lets server_breaker_probes requests through;
+ *  if they all do well it closes, otherwise it opens again for longer.
+ */
+struct rc_breaker_bucket {
+	int64_t		slice;
+	uint32_t	requests;
+	uint32_t	errors;
+	uint64_t	latency;	//!< sum over answered requests, microseconds.
+};
+
+struct rc_breaker {
+	int				state;		//!< RC_BREAKER_STATE.
+	int				ejections;
+	int64_t				open_until;	//!< microseconds.
+	int64_t				closed_at;
+	int				probes_out;
+	int				probes_ok;
+	struct rc_breaker_bucket	bucket[BREAKER_BUCKETS];
+};
+
+struct rc_server_breaker {
+	int			servers;	//!< srv->max when the state was built.
+	struct rc_breaker	server[1];
+};
+
+static int64_t breaker_now(void)
+{
+	return (int64_t)(rc_getmtime() * 1000000);
+}
+
+static int64_t breaker_width(rc_handle const *rh)
+{
+	return (int64_t)rh->opts.server_breaker_window * 1000000 / BREAKER_BUCKETS;
+}
+
+/** Allocate the breakers of a server pool
+ *
+ * Does nothing if the pool is already covered.
+ *
+ * @param srv the server pool.
+ * @return 0 on success, -1 when out of memory.
+ */
+int rc_server_breaker_build(SERVER *srv)
+{
+	struct rc_server_breaker	*breaker;
+	size_t				size;
+
+	if (srv->breaker != NULL && srv->breaker->servers == srv->max)
+		return 0;
+
+	rc_server_breaker_free(srv);
+	if (srv->max == 0)
+		return 0;
+
+	size = sizeof(*breaker) + (size_t)srv->max * sizeof(breaker->server[0]);
+	breaker = malloc(size);
+	if (breaker == NULL) {
+		rc_log(LOG_CRIT, "rc_server_breaker_build: out of memory");
+		return -1;
+	}
+	memset(breaker, 0, size);
+
+	breaker->servers = srv->max;
+	srv->breaker = breaker;
+
+	return 0;
+}
+
+/** Free the breakers of a server pool
+ *
+ * @param srv the server pool.
+ */
+void rc_server_breaker_free(SERVER *srv)
+{
+	free(srv->breaker);
+	srv->breaker = NULL;
+}
+
+/** Add up the window of a server
+ *
+ * @param rh a handle to parsed configuration.
+ * @param b the breaker of the server.
+ * @param now the time, microseconds.
+ * @param[out] requests requests in the window.
+ * @param[out] errors errors in the window.
+ * @return the mean latency of the answered requests, microseconds, or 0.
+ */
+static uint64_t breaker_window(rc_handle const *rh, struct rc_breaker *b, int64_t now,
+			       uint32_t *requests, uint32_t *errors)
+{
+	struct rc_breaker_bucket	*k;
+	int64_t				slice = now / breaker_width(rh);
+	uint64_t			latency = 0;
+	uint32_t			answered;
+	int				i;
+
+	*requests = *errors = 0;
+	for (i = 0; i < BREAKER_BUCKETS; i++) {
+		k = &b->bucket[i];
+		if (__atomic_load_n(&k->slice, __ATOMIC_ACQUIRE) <= slice - BREAKER_BUCKETS)
+			continue;
+		*requests += __atomic_load_n(&k->requests, __ATOMIC_RELAXED);
+		*errors += __atomic_load_n(&k->errors, __ATOMIC_RELAXED);
+		latency += __atomic_load_n(&k->latency, __ATOMIC_RELAXED);
+	}
+
+	answered = *requests - (*errors < *requests ? *errors : *requests);
+	return answered ? latency / answered : 0;
+}
+
+/** Forget the window of a server, e.g. once it is restored */
+static void breaker_clear(struct rc_breaker *b)
+{
+	int i;
+
+	for (i = 0; i < BREAKER_BUCKETS; i++)
+		__atomic_store_n(&b->bucket[i].slice, 0, __ATOMIC_RELEASE);
+}
+
+/** The mean latency of the other servers of a pool with enough answers
+ *
+ * @return microseconds, or 0 if no other server has enough answers.
+ */
+static uint64_t breaker_peers(rc_handle const *rh, SERVER const *srv, int s, int64_t now)
+{
+	uint64_t	sum = 0, latency;
+	uint32_t	requests, errors;
+	int		i, n = 0;
+
+	for (i = 0; i < srv->max; i++) {
+		if (i == s)
+			continue;
+		latency = breaker_window(rh, &srv->breaker->server[i], now, &requests, &errors);
+		if (requests - errors < BREAKER_MIN_REQUESTS || latency == 0)
+			continue;
+		sum += latency;
+		n++;
+	}
+
+	return n ? sum / n : 0;
+}
+
+/** Whether a latency makes a server an outlier
+ *
+ * @return a short reason, or NULL if the latency is acceptable.
+ */
+static char const *breaker_slow(rc_handle const *rh, SERVER const *srv, int s, int64_t now, uint64_t latency)
+{
+	struct rc_conf_opts const	*opts = &rh->opts;
+	uint64_t			peers;
+
+	if (opts->server_breaker_latency > 0 && latency > (uint64_t)opts->server_breaker_latency * 1000)
+		return "latency above limit";
+
+	if (opts->server_breaker_latency_factor > 0) {
+		peers = breaker_peers(rh, srv, s, now);
+		if (peers != 0 && latency > peers * opts->server_breaker_latency_factor)
+			return "latency far above the other servers";
+	}
+
+	return NULL;
+}
+
+/** Open the breaker of a server
+ *
+ * @param rh a handle to parsed configuration.
+ * @param srv the server pool.
+ * @param s the server.
+ * @param from the state the breaker must be in.
+ * @param now the time, microseconds.
+ * @param why the reason, for the log.
+ */
+static void breaker_open(rc_handle const *rh, SERVER const *srv, int s, int from, int64_t now, char const *why)
+{
+	struct rc_breaker	*b = &srv->breaker->server[s];
+	int64_t			eject;
+	int			n;
+
+	if (!__atomic_compare_exchange_n(&b->state, &from, RC_BREAKER_OPEN, 0,
+					 __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+		return;
+
+	/* healthy for a whole window since the last ejection: start over */
+	if (from == RC_BREAKER_CLOSED &&
+	    now - __atomic_load_n(&b->closed_at, __ATOMIC_RELAXED) > (int64_t)rh->opts.server_breaker_window * 1000000)
+		__atomic_store_n(&b->ejections, 0, __ATOMIC_RELAXED);
+
+	n = __atomic_fetch_add(&b->ejections, 1, __ATOMIC_RELAXED);
+	if (n > BREAKER_MAX_DOUBLINGS)
+		n = BREAKER_MAX_DOUBLINGS;
+	eject = ((int64_t)rh->opts.server_breaker_eject * 1000000) << n;
+	__atomic_store_n(&b->open_until, now + eject, __ATOMIC_RELEASE);
+
+	rc_log(LOG_WARNING, "server %s:%d ejected for %llds: %s", srv->name[s], srv->port[s],
+	       (long long)(eject / 1000000), why);
+}
+
+/** Whether a request may go to a server, as far as its breaker is concerned
+ *
+ * Moves an open breaker whose interval is over to half open.  The value
+ * returned must be passed to rc_breaker_done() once the request is over.
+ *
+ * @param rh a handle to parsed configuration.
+ * @param srv the server pool.
+ * @param s the server.
+ * @return 0 if the server is ejected, 1 if the request may go, 2 if it goes as a probe.
+ */
+int rc_breaker_allow(rc_handle const *rh, SERVER *srv, int s)
+{
+	struct rc_breaker	*b;
+	int			state;
+
+	if (__builtin_expect(srv->breaker == NULL, 1))
+		return 1;
+	b = &srv->breaker->server[s];
+
+	state = __atomic_load_n(&b->state, __ATOMIC_ACQUIRE);
+	if (state == RC_BREAKER_CLOSED)
+		return 1;
+
+	if (state == RC_BREAKER_OPEN) {
+		if (breaker_now() < __atomic_load_n(&b->open_until, __ATOMIC_ACQUIRE))
+			return 0;
+		__atomic_store_n(&b->probes_ok, 0, __ATOMIC_RELAXED);
+		__atomic_compare_exchange_n(&b->state, &state, RC_BREAKER_HALF_OPEN, 0,
+					    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+	}
+
+	if (__atomic_add_fetch(&b->probes_out, 1, __ATOMIC_ACQ_REL) <= rh->opts.server_breaker_probes)
+		return 2;
+	__atomic_sub_fetch(&b->probes_out, 1, __ATOMIC_ACQ_REL);
+
+	return 0;
+}
+
+/** Whether the breaker of a server is not closed
+ *
+ * @param srv the server pool.
+ * @param s the server.
+ * @return 1 if the server is ejected or on probation, 0 otherwise.
+ */
+int rc_breaker_ejected(SERVER const *srv, int s)
+{
+	if (__builtin_expect(srv->breaker == NULL, 1))
+		return 0;
+
+	return __atomic_load_n(&srv->breaker->server[s].state, __ATOMIC_ACQUIRE) != RC_BREAKER_CLOSED;
+}
+
+/** Record the outcome of a request and judge the server
+ *
+ * @param rh a handle to parsed configuration.
+ * @param srv the server pool.
+ * @param s the server.
+ * @param ticket the value rc_breaker_allow() returned for the request.
+ * @param result the result of rc_send_server(), or %BUSY_RC if it was never sent.
+ * @param latency seconds spent in rc_send_server().
+ */
+void rc_breaker_done(rc_handle const *rh, SERVER *srv, int s, int ticket, int result, double latency)
+{
+	struct rc_breaker		*b;
+	struct rc_breaker_bucket	*k;
+	int64_t				now, slice, old;
+	uint64_t			mean, usec = (uint64_t)(latency * 1000000);
+	uint32_t			requests, errors;
+	char const			*why;
+	int				error, state;
+
+	if (__builtin_expect(srv->breaker == NULL, 1))
+		return;
+	b = &srv->breaker->server[s];
+
+	if (ticket == 2)
+		__atomic_sub_fetch(&b->probes_out, 1, __ATOMIC_ACQ_REL);
+
+	/* only the server's own answers, or lack of them, say anything about it */
+	if (result != OK_RC && result != REJECT_RC && result != TIMEOUT_RC && result != BADRESP_RC)
+		return;
+	error = result == TIMEOUT_RC || result == BADRESP_RC;
+
+	now = breaker_now();
+	slice = now / breaker_width(rh);
+	k = &b->bucket[slice % BREAKER_BUCKETS];
+	old = __atomic_load_n(&k->slice, __ATOMIC_ACQUIRE);
+	if (old != slice && __atomic_compare_exchange_n(&k->slice, &old, slice, 0,
+							__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		__atomic_store_n(&k->requests, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&k->errors, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&k->latency, 0, __ATOMIC_RELAXED);
+	}
+	__atomic_add_fetch(&k->requests, 1, __ATOMIC_RELAXED);
+	if (error)
+		__atomic_add_fetch(&k->errors, 1, __ATOMIC_RELAXED);
+	else
+		__atomic_add_fetch(&k->latency, usec, __ATOMIC_RELAXED);
+
+	state = __atomic_load_n(&b->state, __ATOMIC_ACQUIRE);
+
+	if (state == RC_BREAKER_HALF_OPEN) {
+		if (ticket != 2)
+			return;
+		why = error ? "probe failed" : breaker_slow(rh, srv, s, now, usec);
+		if (why != NULL) {
+			breaker_open(rh, srv, s, RC_BREAKER_HALF_OPEN, now, why);
+			return;
+		}
+		if (__atomic_add_fetch(&b->probes_ok, 1, __ATOMIC_ACQ_REL) >= rh->opts.server_breaker_probes) {
+			breaker_clear(b);
+			__atomic_store_n(&b->closed_at, now, __ATOMIC_RELAXED);
+			if (__atomic_compare_exchange_n(&b->state, &state, RC_BREAKER_CLOSED, 0,
+							__ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+				rc_log(LOG_NOTICE, "server %s:%d restored", srv->name[s], srv->port[s]);
+		}
+		return;
+	}
+
+	if (state != RC_BREAKER_CLOSED)
+		return;
+
+	mean = breaker_window(rh, b, now, &requests, &errors);
+	if (requests < BREAKER_MIN_REQUESTS)
+		return;
+
+	if (rh->opts.server_breaker_errors > 0 &&
+	    errors * 100 >= requests * (uint32_t)rh->opts.server_breaker_errors)
+		why = "too many errors";
+	else if (requests - errors >= BREAKER_MIN_REQUESTS)
+		why = breaker_slow(rh, srv, s, now, mean);
+	else
+		why = NULL;
+
+	if (why != NULL)
+		breaker_open(rh, srv, s, RC_BREAKER_CLOSED, now, why);
+}
+
+/** Read the breaker of a server
+ *
+ * @param rh a handle to parsed configuration.
+ * @param type %AUTH or %ACCT.
+ * @param server the index of the server in its pool, in configuration order.
+ * @param[out] info receives the state of the breaker and its window.
+ * @return 0 on success, -1 if breakers are off or there is no such server.
+ */
+int rc_breaker_get(rc_handle const *rh, unsigned type, int server, RC_BREAKER_INFO *info)
+{
+	SERVER const		*srv = type == ACCT ? rh->opts.acctserver : rh->opts.authserver;
+	struct rc_breaker	*b;
+	int64_t			now, left;
+
+	if (srv == NULL || srv->breaker == NULL || server < 0 || server >= srv->max)
+		return -1;
+	b = &srv->breaker->server[server];
+
+	now = breaker_now();
+	info->state = __atomic_load_n(&b->state, __ATOMIC_ACQUIRE);
+	left = __atomic_load_n(&b->open_until, __ATOMIC_ACQUIRE) - now;
+	info->open_for = (info->state == RC_BREAKER_OPEN && left > 0) ? left / 1000000.0 : 0;
+	info->ejections = __atomic_load_n(&b->ejections, __ATOMIC_RELAXED);
+	info->latency = breaker_window(rh, b, now, &info->requests, &info->errors);
+
+	return 0;
+}
@@ -13,6 +13,8 @@
 #include <freeradius-client.h>
 #include "util.h"
 
+#define ORDER_STACK	32	//!< servers ordered without malloc.
+
 /** Build a skeleton RADIUS request using information from the config file
  *
  * @param rh a handle to parsed configuration.
@@ -33,7 +35,10 @@ void rc_buildreq(rc_handle const *rh, SEND_DATA *data, int code, char *server, u
 	data->seq_nbr = rc_get_id();
 	data->timeout = timeout;
 	data->retries = retries;
+	data->deadline = 0;
 	data->code = code;
+
+	RC_TRACE(rh, RC_TRACE_BUILT, data, 0);
 }
 
 /** Generates a random ID
@@ -42,7 +47,37 @@ void rc_buildreq(rc_handle const *rh, SEND_DATA *data, int code, char *server, u
  */
 unsigned char rc_get_id()
 {
-	return (unsigned char)(rc_random() & UCHAR_MAX);
+	unsigned char id;
+
+	rc_random_bytes(&id, sizeof(id));
+	return id;
+}
+
+/** Whether a server is in its deadtime, found by this handle or by another process
+ *
+ * @param rh a handle to parsed configuration.
+ * @param srv the server pool.
+ * @param s the server.
+ * @param type %AUTH or %ACCT.
+ * @param start_time when the request started.
+ * @return 1 if the server is dead, 0 otherwise.
+ */
+static int server_dead(rc_handle const *rh, SERVER const *srv, int s, unsigned type, double start_time)
+{
+	if (srv->deadtime_ends[s] != -1 && srv->deadtime_ends[s] > start_time)
+		return 1;
+
+	return rc_health_dead(rh, srv->name[s], srv->port[s], type);
+}
+
+/** Whether the deadline of a request has passed
+ *
+ * @param deadline the deadline as rc_getmtime(), or 0 for none.
+ * @return 1 if it has passed, 0 otherwise.
+ */
+static int deadline_passed(double deadline)
+{
+	return deadline > 0 && rc_getmtime() >= deadline;
 }
 
 /** Builds an authentication/accounting request for port id client_port with the value_pairs send and submits it to a server
@@ -60,25 +95,87 @@ unsigned char rc_get_id()
  */
 int rc_aaa(rc_handle *rh, uint32_t client_port, VALUE_PAIR *send, VALUE_PAIR **received,
 	   char *msg, int add_nas_port, int request_type)
+{
+	return rc_aaa_prio(rh, client_port, send, received, msg, add_nas_port, request_type, RC_PRIO_DEFAULT);
+}
+
+/** Builds and sends a request like rc_aaa(), in a given priority class
+ *
+ * The class only matters when admission control makes requests queue for
+ * a server: queued requests of a lower class go first, or get the larger
+ * share with server_priority set to weighted.
+ *
+ * @param rh a handle to parsed configuration.
+ * @param client_port the client port number to use (may be zero to use any available).
+ * @param send a #VALUE_PAIR array of values (e.g., %PW_USER_NAME).
+ * @param received an allocated array of received values.
+ * @param msg must be an array of %PW_MAX_MSG_SIZE or %NULL; will contain the concatenation of any
+ *	%PW_REPLY_MESSAGE received.
+ * @param add_nas_port if non-zero it will include %PW_NAS_PORT in sent pairs.
+ * @param request_type one of standard RADIUS codes (e.g., %PW_ACCESS_REQUEST).
+ * @param prio %RC_PRIO_AUTH, %RC_PRIO_ACCT, %RC_PRIO_INTERIM, or %RC_PRIO_DEFAULT to pick
+ *	the class from request_type and Acct-Status-Type.
+ * @return as rc_aaa().
+ */
+int rc_aaa_prio(rc_handle *rh, uint32_t client_port, VALUE_PAIR *send, VALUE_PAIR **received,
+		char *msg, int add_nas_port, int request_type, int prio)
+{
+	return rc_aaa_deadline(rh, client_port, send, received, msg, add_nas_port, request_type, prio,
+			       rh->opts.radius_deadline);
+}
+
+/** Builds and sends a request like rc_aaa_prio(), giving up once a time budget is spent
+ *
+ * The budget covers queueing, every retransmission and every server tried.
+ * No packet is sent that could not be answered in the time left, and the
+ * call returns %DEADLINE_RC as soon as the budget runs out.
+ *
+ * @param rh a handle to parsed configuration.
+ * @param client_port the client port number to use (may be zero to use any available).
+ * @param send a #VALUE_PAIR array of values (e.g., %PW_USER_NAME).
+ * @param received an allocated array of received values.
+ * @param msg must be an array of %PW_MAX_MSG_SIZE or %NULL; will contain the concatenation of any
+ *	%PW_REPLY_MESSAGE received.
+ * @param add_nas_port if non-zero it will include %PW_NAS_PORT in sent pairs.
+ * @param request_type one of standard RADIUS codes (e.g., %PW_ACCESS_REQUEST).
+ * @param prio the priority class, as for rc_aaa_prio().
+ * @param deadline_ms the budget in milliseconds, or 0 for none.
+ * @return as rc_aaa(), or %DEADLINE_RC if the budget ran out first.
+ */
+int rc_aaa_deadline(rc_handle *rh, uint32_t client_port, VALUE_PAIR *send, VALUE_PAIR **received,
+		    char *msg, int add_nas_port, int request_type, int prio, unsigned deadline_ms)
 {
 	SEND_DATA       data;
-	VALUE_PAIR	*adt_vp = NULL;
+	VALUE_PAIR	*adt_vp = NULL, *key_vp;
 	int		result;
-	int		i, skip_count;
+	int		i, s, skip_count, attempts = 0, ticket, dead;
+	int		order_buf[ORDER_STACK], *order = NULL;
 	SERVER		*aaaserver;
-	int		timeout = rc_conf_int(rh, "radius_timeout");
-	int		retries = rc_conf_int(rh, "radius_retries");
-	int		radius_deadtime = rc_conf_int(rh, "radius_deadtime");
+	int		timeout = rh->opts.radius_timeout;
+	int		retries = rh->opts.radius_retries;
+	int		radius_deadtime = rh->opts.radius_deadtime;
 	double		start_time = 0;
-	double		now = 0;
+	double		now = 0, sent, deadline = 0;
 	time_t		dtime;
 	unsigned	type;
 
+	if (deadline_ms > 0)
+		deadline = rc_getmtime() + deadline_ms / 1000.0;
+
+	/* with daemon_socket, radclientd sends the request unless it is down */
+	if (rh->opts.daemon_socket != NULL &&
+	    rc_daemon_aaa(rh, client_port, send, received, msg, add_nas_port, request_type, prio,
+			  deadline, &result) == 0)
+		return result;
+
+	if (prio < 0 || prio >= RC_PRIO_CLASSES)
+		prio = rc_prio_class(send, request_type);
+
 	if (request_type != PW_ACCOUNTING_REQUEST) {
-		aaaserver = rc_conf_srv(rh, "authserver");
+		aaaserver = rh->opts.authserver;
 		type = AUTH;
 	} else {
-		aaaserver = rc_conf_srv(rh, "acctserver");
+		aaaserver = rh->opts.acctserver;
 		type = ACCT;
 	}
 	if (aaaserver == NULL)
@@ -114,31 +211,70 @@ int rc_aaa(rc_handle *rh, uint32_t client_port, VALUE_PAIR *send, VALUE_PAIR **r
 		}
 	}
 
+	/* with server_hash_key, try the servers in ring order from the owner of the key */
+	if (aaaserver->ring != NULL && rh->opts.server_hash_attr != NULL &&
+	    (key_vp = rc_avpair_get(data.send_pairs, rh->opts.server_hash_attr->value,
+				    rh->opts.server_hash_attr->vendor)) != NULL) {
+		order = aaaserver->max <= ORDER_STACK ? order_buf : malloc(aaaserver->max * sizeof(*order));
+		if (order != NULL && rc_server_ring_order(aaaserver, key_vp, order) != 0) {
+			if (order != order_buf)
+				free(order);
+			order = NULL;
+		}
+	}
+
 	skip_count = 0;
 	result = ERROR_RC;
 	for (i=0; (i < aaaserver->max) && (result != OK_RC) && (result != REJECT_RC)
 	    ; i++, now = rc_getmtime())
 	{
-		if (aaaserver->deadtime_ends[i] != -1 &&
-		    aaaserver->deadtime_ends[i] > start_time) {
+		s = order != NULL ? order[i] : i;
+		if (deadline_passed(deadline)) {
+			result = DEADLINE_RC;
+			goto exit;
+		}
+		if (server_dead(rh, aaaserver, s, type, start_time)) {
 			skip_count++;
 			continue;
 		}
+		ticket = rc_breaker_allow(rh, aaaserver, s);
+		if (ticket == 0) {
+			skip_count++;
+			continue;
+		}
+		if (rc_admit(rh, aaaserver, s, prio, deadline) != 0) {
+			rc_breaker_done(rh, aaaserver, s, ticket, BUSY_RC, 0);
+			RC_STATS_INC(rc_stats_server(rh, aaaserver->name[s], aaaserver->port[s], type), busy);
+			result = BUSY_RC;
+			continue;
+		}
+		if (attempts++ > 0)
+			RC_TRACE(rh, RC_TRACE_FAILOVER, &data, result);
 		if (data.receive_pairs != NULL) {
 			rc_avpair_free(data.receive_pairs);
 			data.receive_pairs = NULL;
 		}
-		rc_buildreq(rh, &data, request_type, aaaserver->name[i],
-		    aaaserver->port[i], aaaserver->secret[i], timeout, retries);
+		rc_buildreq(rh, &data, request_type, aaaserver->name[s],
+		    aaaserver->port[s], aaaserver->secret[s], timeout, retries);
+		data.deadline = deadline;
 
 		if (request_type == PW_ACCOUNTING_REQUEST) {
-			dtime = now - start_time;
+			dtime = rc_getmtime() - start_time;
 			rc_avpair_assign(adt_vp, &dtime, 0);
 		}
 
+		sent = rc_getmtime();
 		result = rc_send_server (rh, &data, msg, type);
-		if (result == TIMEOUT_RC && radius_deadtime > 0)
-			aaaserver->deadtime_ends[i] = start_time + (double)radius_deadtime;
+		rc_admit_done(rh, aaaserver, s);
+		rc_breaker_done(rh, aaaserver, s, ticket, result, rc_getmtime() - sent);
+		if (result == TIMEOUT_RC && radius_deadtime > 0) {
+			aaaserver->deadtime_ends[s] = start_time + (double)radius_deadtime;
+			rc_health_mark_dead(rh, aaaserver->name[s], aaaserver->port[s], type, radius_deadtime);
+			RC_STATS_INC(rc_stats_server(rh, aaaserver->name[s], aaaserver->port[s], type),
+				     deadtime_enter);
+		}
+		if (result == DEADLINE_RC)
+			goto exit;
 	}
 	if (result == OK_RC || result == REJECT_RC || skip_count == 0)
 		goto exit;
@@ -147,28 +283,52 @@ int rc_aaa(rc_handle *rh, uint32_t client_port, VALUE_PAIR *send, VALUE_PAIR **r
 	for (i=0; (i < aaaserver->max) && (result != OK_RC) && (result != REJECT_RC)
 	    ; i++)
 	{
-		if (aaaserver->deadtime_ends[i] == -1 ||
-		    aaaserver->deadtime_ends[i] <= start_time) {
+		s = order != NULL ? order[i] : i;
+		if (deadline_passed(deadline)) {
+			result = DEADLINE_RC;
+			goto exit;
+		}
+		/* last resort: servers found dead or ejected by their breaker */
+		dead = server_dead(rh, aaaserver, s, type, start_time);
+		if (!dead && !rc_breaker_ejected(aaaserver, s))
+			continue;
+		if (rc_admit(rh, aaaserver, s, prio, deadline) != 0) {
+			RC_STATS_INC(rc_stats_server(rh, aaaserver->name[s], aaaserver->port[s], type), busy);
+			result = BUSY_RC;
 			continue;
 		}
+		if (attempts++ > 0)
+			RC_TRACE(rh, RC_TRACE_FAILOVER, &data, result);
 		if (data.receive_pairs != NULL) {
 			rc_avpair_free(data.receive_pairs);
 			data.receive_pairs = NULL;
 		}
-		rc_buildreq(rh, &data, request_type, aaaserver->name[i],
-		    aaaserver->port[i], aaaserver->secret[i], timeout, retries);
+		rc_buildreq(rh, &data, request_type, aaaserver->name[s],
+		    aaaserver->port[s], aaaserver->secret[s], timeout, retries);
+		data.deadline = deadline;
 
 		if (request_type == PW_ACCOUNTING_REQUEST) {
 			dtime = rc_getmtime() - start_time;
 			rc_avpair_assign(adt_vp, &dtime, 0);
 		}
 
+		sent = rc_getmtime();
 		result = rc_send_server (rh, &data, msg, type);
-		if (result != TIMEOUT_RC)
-			aaaserver->deadtime_ends[i] = -1;
+		rc_admit_done(rh, aaaserver, s);
+		rc_breaker_done(rh, aaaserver, s, 1, result, rc_getmtime() - sent);
+		if (dead && result != TIMEOUT_RC && result != DEADLINE_RC) {
+			aaaserver->deadtime_ends[s] = -1;
+			RC_STATS_INC(rc_stats_server(rh, aaaserver->name[s], aaaserver->port[s], type),
+				     deadtime_exit);
+		}
+		if (result == DEADLINE_RC)
+			goto exit;
 	}
 
 exit:
+	if (order != NULL && order != order_buf)
+		free(order);
+
 	if (request_type != PW_ACCOUNTING_REQUEST) {
 		*received = data.receive_pairs;
 	} else {
@@ -256,8 +416,8 @@ int rc_check(rc_handle *rh, char *host, char *secret, unsigned short port, char
 	SEND_DATA       data;
 	int		result;
 	uint32_t		service_type;
-	int		timeout = rc_conf_int(rh, "radius_timeout");
-	int		retries = rc_conf_int(rh, "radius_retries");
+	int		timeout = rh->opts.radius_timeout;
+	int		retries = rh->opts.radius_retries;
 
 	data.send_pairs = data.receive_pairs = NULL;
 
@@ -87,6 +87,71 @@ static int set_option_int(char const *filename, int line, OPTION *option, char c
 	return 0;
 }
 
+/** Make room for one more server in a pool
+ *
+ * @param serv the server pool.
+ * @return 0 on success, -1 when out of memory.
+ */
+static int server_grow(SERVER *serv)
+{
+	char		**name, **secret;
+	uint16_t	*port;
+	double		*deadtime_ends;
+	int		size;
+
+	if (serv->max < serv->size)
+		return 0;
+
+	size = serv->size ? serv->size * 2 : SERVER_MAX;
+
+	name = realloc(serv->name, size * sizeof(*name));
+	if (name != NULL)
+		serv->name = name;
+	secret = realloc(serv->secret, size * sizeof(*secret));
+	if (secret != NULL)
+		serv->secret = secret;
+	port = realloc(serv->port, size * sizeof(*port));
+	if (port != NULL)
+		serv->port = port;
+	deadtime_ends = realloc(serv->deadtime_ends, size * sizeof(*deadtime_ends));
+	if (deadtime_ends != NULL)
+		serv->deadtime_ends = deadtime_ends;
+
+	if (name == NULL || secret == NULL || port == NULL || deadtime_ends == NULL)
+		return -1;
+
+	memset(serv->name + serv->size, 0, (size - serv->size) * sizeof(*name));
+	memset(serv->secret + serv->size, 0, (size - serv->size) * sizeof(*secret));
+	serv->size = size;
+
+	return 0;
+}
+
+/** Free a server pool
+ *
+ * @param serv the server pool, may be NULL.
+ */
+static void server_free(SERVER *serv)
+{
+	int i;
+
+	if (serv == NULL)
+		return;
+
+	for (i = 0; i < serv->max; i++) {
+		free(serv->name[i]);
+		free(serv->secret[i]);
+	}
+	free(serv->name);
+	free(serv->secret);
+	free(serv->port);
+	free(serv->deadtime_ends);
+	rc_server_ring_free(serv);
+	rc_server_admit_free(serv);
+	rc_server_breaker_free(serv);
+	free(serv);
+}
+
 static int set_option_srv(char const *filename, int line, OPTION *option, char const *p)
 {
 	SERVER *serv;
@@ -117,6 +182,14 @@ static int set_option_srv(char const *filename, int line, OPTION *option, char c
 		serv->max = 0;
 	}
 
+	if (server_grow(serv) < 0) {
+		rc_log(LOG_CRIT, "read_config: out of memory");
+		free(p_dupe);
+		if (option->val == NULL)
+			server_free(serv);
+		return -1;
+	}
+
 	p_pointer = strtok_r(p_dupe, ", \t", &p_save);
 
 	/* check to see for '[IPv6]:port' syntax */
@@ -147,7 +220,7 @@ static int set_option_srv(char const *filename, int line, OPTION *option, char c
 				rc_log(LOG_CRIT, "read_config: out of memory");
 				if (option->val == NULL) {
 					free(p_dupe);
-					free(serv);
+					server_free(serv);
 				}
 				return -1;
 			}
@@ -167,7 +240,7 @@ static int set_option_srv(char const *filename, int line, OPTION *option, char c
 				rc_log(LOG_CRIT, "read_config: out of memory");
 				if (option->val == NULL) {
 					free(p_dupe);
-					free(serv);
+					server_free(serv);
 				}
 				return -1;
 			}
@@ -191,7 +264,7 @@ static int set_option_srv(char const *filename, int line, OPTION *option, char c
 			rc_log(LOG_ERR, "%s: line %d: no default port for %s", filename, line, option->name);
 			if (option->val == NULL) {
 				free(p_dupe);
-				free(serv);
+				server_free(serv);
 			}
 			return -1;
 		}
@@ -202,7 +275,7 @@ static int set_option_srv(char const *filename, int line, OPTION *option, char c
 		rc_log(LOG_CRIT, "read_config: out of memory");
 		if (option->val == NULL) {
 			free(p_dupe);
-			free(serv);
+			server_free(serv);
 		}
 		return -1;
 	}
@@ -326,13 +399,135 @@ int rc_add_config(rc_handle *rh, char const *option_name, char const *option_val
 	if (strcmp(option->name, "bindaddr") == 0) {
 		memset(&rh->own_bind_addr, 0, sizeof(rh->own_bind_addr));
 		rh->own_bind_addr_set = 0;
-		rc_own_bind_addr(rh, &rh->own_bind_addr);
-		rh->own_bind_addr_set = 1;
 	}
 
+	if (strcmp(option->name, "md5_backend") == 0 && option->val != NULL) {
+		if (rc_md5_set_backend((char *)option->val) != 0)
+			return -1;
+	}
+
+	rc_config_compile(rh);
 	return 0;
 }
 
+/** Copy the options used on every request into rh->opts
+ *
+ * rc_read_config(), rc_config_init() and rc_add_config() call this, so
+ * it is only needed after changing config_options some other way.  The
+ * bind address is resolved here as well, rather than once per request.
+ * rc_conf_str(), rc_conf_int() and rc_conf_srv() keep working for every
+ * option, but look them up by name.
+ *
+ * @param rh a handle to parsed configuration.
+ */
+void rc_config_compile(rc_handle *rh)
+{
+	struct rc_conf_opts *opts = &rh->opts;
+	OPTION *option;
+	char const *p;
+	int weight[RC_PRIO_CLASSES], i;
+
+	memset(opts, 0, sizeof(*opts));
+
+	if ((option = find_option(rh, "radius_timeout", OT_INT)) != NULL && option->val != NULL)
+		opts->radius_timeout = *(int *)option->val;
+	if ((option = find_option(rh, "radius_retries", OT_INT)) != NULL && option->val != NULL)
+		opts->radius_retries = *(int *)option->val;
+	if ((option = find_option(rh, "radius_deadtime", OT_INT)) != NULL && option->val != NULL)
+		opts->radius_deadtime = *(int *)option->val;
+	if ((option = find_option(rh, "radius_deadline", OT_INT)) != NULL && option->val != NULL &&
+	    *(int *)option->val > 0)
+		opts->radius_deadline = *(int *)option->val;
+
+	if ((option = find_option(rh, "authserver", OT_SRV)) != NULL)
+		opts->authserver = option->val;
+	if ((option = find_option(rh, "acctserver", OT_SRV)) != NULL)
+		opts->acctserver = option->val;
+
+	if ((option = find_option(rh, "servers", OT_STR)) != NULL)
+		opts->servers = option->val;
+	if ((option = find_option(rh, "bindaddr", OT_STR)) != NULL)
+		opts->bindaddr = option->val;
+	if ((option = find_option(rh, "daemon_socket", OT_STR)) != NULL)
+		opts->daemon_socket = option->val;
+
+	if ((option = find_option(rh, "require_message_authenticator", OT_STR)) != NULL &&
+	    (p = option->val) != NULL && strcasecmp(p, "yes") == 0)
+		opts->require_message_authenticator = 1;
+
+	if ((option = find_option(rh, "server_max_outstanding", OT_INT)) != NULL && option->val != NULL)
+		opts->server_max_outstanding = *(int *)option->val;
+	if ((option = find_option(rh, "server_rate", OT_INT)) != NULL && option->val != NULL)
+		opts->server_rate = *(int *)option->val;
+	opts->server_burst = 1;
+	if ((option = find_option(rh, "server_burst", OT_INT)) != NULL && option->val != NULL &&
+	    *(int *)option->val > 1)
+		opts->server_burst = *(int *)option->val;
+	if ((option = find_option(rh, "server_overload", OT_STR)) != NULL &&
+	    (p = option->val) != NULL && strcasecmp(p, "fail") == 0)
+		opts->server_overload_fail = 1;
+
+	opts->server_priority_weight[RC_PRIO_AUTH] = 8;
+	opts->server_priority_weight[RC_PRIO_ACCT] = 4;
+	opts->server_priority_weight[RC_PRIO_INTERIM] = 1;
+	if ((option = find_option(rh, "server_priority", OT_STR)) != NULL &&
+	    (p = option->val) != NULL && strncasecmp(p, "weighted", 8) == 0) {
+		opts->server_priority_weighted = 1;
+		/* "weighted auth:acct:interim", weights of at least 1 */
+		if (sscanf(p + 8, " %d:%d:%d", &weight[RC_PRIO_AUTH], &weight[RC_PRIO_ACCT],
+			   &weight[RC_PRIO_INTERIM]) == 3) {
+			for (i = 0; i < RC_PRIO_CLASSES; i++)
+				opts->server_priority_weight[i] = weight[i] < 1 ? 1 : weight[i];
+		}
+	}
+
+	if (opts->server_max_outstanding > 0 || opts->server_rate > 0) {
+		if (opts->authserver != NULL)
+			rc_server_admit_build(rh, opts->authserver);
+		if (opts->acctserver != NULL)
+			rc_server_admit_build(rh, opts->acctserver);
+	}
+
+	if ((option = find_option(rh, "server_breaker_window", OT_INT)) != NULL && option->val != NULL)
+		opts->server_breaker_window = *(int *)option->val;
+	opts->server_breaker_errors = 50;
+	if ((option = find_option(rh, "server_breaker_errors", OT_INT)) != NULL && option->val != NULL)
+		opts->server_breaker_errors = *(int *)option->val;
+	if ((option = find_option(rh, "server_breaker_latency", OT_INT)) != NULL && option->val != NULL)
+		opts->server_breaker_latency = *(int *)option->val;
+	if ((option = find_option(rh, "server_breaker_latency_factor", OT_INT)) != NULL && option->val != NULL)
+		opts->server_breaker_latency_factor = *(int *)option->val;
+	opts->server_breaker_eject = 30;
+	if ((option = find_option(rh, "server_breaker_eject", OT_INT)) != NULL && option->val != NULL &&
+	    *(int *)option->val > 0)
+		opts->server_breaker_eject = *(int *)option->val;
+	opts->server_breaker_probes = 3;
+	if ((option = find_option(rh, "server_breaker_probes", OT_INT)) != NULL && option->val != NULL &&
+	    *(int *)option->val > 0)
+		opts->server_breaker_probes = *(int *)option->val;
+
+	if (opts->server_breaker_window > 0) {
+		if (opts->authserver != NULL)
+			rc_server_breaker_build(opts->authserver);
+		if (opts->acctserver != NULL)
+			rc_server_breaker_build(opts->acctserver);
+	}
+
+	/* the attribute is only known once the dictionary is read, which compiles again */
+	if ((option = find_option(rh, "server_hash_key", OT_STR)) != NULL && (p = option->val) != NULL) {
+		opts->server_hash_attr = rc_dict_findattr(rh, p);
+		if (opts->authserver != NULL)
+			rc_server_ring_build(opts->authserver);
+		if (opts->acctserver != NULL)
+			rc_server_ring_build(opts->acctserver);
+	}
+
+	if (!rh->own_bind_addr_set) {
+		rc_own_bind_addr(rh, &rh->own_bind_addr);
+		rh->own_bind_addr_set = 1;
+	}
+}
+
 /** Initialise a configuration structure
  *
  * Initialize the configuration structure from an external program.  For use when not
@@ -343,7 +538,6 @@ int rc_add_config(rc_handle *rh, char const *option_name, char const *option_val
  */
 rc_handle *rc_config_init(rc_handle *rh)
 {
-	int i;
 	SERVER *authservers;
 	SERVER *acctservers;
 	OPTION *acct;
@@ -373,18 +567,13 @@ rc_handle *rc_config_init(rc_handle *rh)
 	}
 
 
-	authservers->max = 0;
-	acctservers->max = 0;
+	memset(authservers, 0, sizeof(*authservers));
+	memset(acctservers, 0, sizeof(*acctservers));
 
-	for(i=0; i < SERVER_MAX; i++)
-	{
-		authservers->name[i] = NULL;
-		authservers->secret[i] = NULL;
-		acctservers->name[i] = NULL;
-		acctservers->secret[i] = NULL;
-	}
 	acct->val = acctservers;
 	auth->val = authservers;
+
+	rc_config_compile(rh);
 	return rh;
 }
 
@@ -504,6 +693,18 @@ rc_handle *rc_read_config(char const *filename)
 		rc_destroy(rh);
 		return NULL;
 	}
+
+	/* process-wide: this selects the backend for every handle */
+	if ((p = rc_conf_str(rh, "md5_backend")) != NULL && rc_md5_set_backend(p) != 0) {
+		rc_log(LOG_ERR, "%s: invalid md5_backend: %s", filename, p);
+		rc_destroy(rh);
+		return NULL;
+	}
+
+	if ((p = rc_conf_str(rh, "server_health_shm")) != NULL && strcasecmp(p, "yes") == 0)
+		rc_health_attach(rh, filename);
+
+	rc_config_compile(rh);
 	return rh;
 }
 
@@ -727,6 +928,102 @@ static int rc_is_myname(const struct addrinfo *info)
  	return 1;
 }
 
+/** Parse the servers file once and keep it with the handle
+ *
+ * Afterwards rc_find_server_addr() looks secrets up in memory instead of
+ * reading the file on every request; changes to the file then only take
+ * effect with a new handle, see rc_reload().  Host names are resolved
+ * here, entries that do not resolve are skipped.
+ *
+ * @param rh a handle to parsed configuration.
+ * @return 0 on success, -1 on failure.
+ */
+int rc_read_servers(rc_handle *rh)
+{
+	FILE		*clientfd;
+	char		buffer[128];
+	char		hostnm[AUTH_ID_LEN + 1];
+	char		*h, *s;
+	char		*buffer_save;
+	char		*hostnm_save;
+	struct rc_servers_entry *entry, **last;
+
+	if (rh->opts.servers == NULL) {
+		rc_log(LOG_ERR, "rc_read_servers: no servers file configured");
+		return -1;
+	}
+
+	if ((clientfd = fopen (rh->opts.servers, "r")) == NULL)
+	{
+		rc_log(LOG_ERR, "rc_read_servers: couldn't open file: %s: %s", strerror(errno), rh->opts.servers);
+		return -1;
+	}
+
+	rc_servers_free(rh);
+	last = &rh->servers_cache;
+
+	while (fgets (buffer, sizeof (buffer), clientfd) != NULL)
+	{
+		if (*buffer == '#')
+			continue;
+
+		if ((h = strtok_r(buffer, " \t\n", &buffer_save)) == NULL) /* first hostname */
+			continue;
+
+		strlcpy (hostnm, h, AUTH_ID_LEN);
+
+		if ((s = strtok_r (NULL, " \t\n", &buffer_save)) == NULL) /* and secret field */
+			continue;
+
+		entry = malloc(sizeof(*entry));
+		if (entry == NULL) {
+			rc_log(LOG_CRIT, "rc_read_servers: out of memory");
+			fclose(clientfd);
+			rc_servers_free(rh);
+			return -1;
+		}
+		memset(entry, 0, sizeof(*entry));
+		strlcpy (entry->secret, s, MAX_SECRET_LENGTH);
+
+		/* for the <name1>/<name2> paired form, name1 is matched like rc_find_server_addr() does */
+		if (strchr (hostnm, '/'))
+			strtok_r(hostnm, "/", &hostnm_save);
+
+		entry->info = rc_getaddrinfo(hostnm, 0);
+		if (entry->info == NULL) {
+			memset(entry, 0, sizeof(*entry));
+			free(entry);
+			continue;
+		}
+
+		*last = entry;
+		last = &entry->next;
+	}
+	fclose (clientfd);
+	memset (buffer, '\0', sizeof (buffer));
+
+	rh->servers_cached = 1;
+	return 0;
+}
+
+/** Free the servers file parsed by rc_read_servers()
+ *
+ * @param rh a handle to parsed configuration.
+ */
+void rc_servers_free(rc_handle *rh)
+{
+	struct rc_servers_entry *entry, *next;
+
+	for (entry = rh->servers_cache; entry != NULL; entry = next) {
+		next = entry->next;
+		freeaddrinfo(entry->info);
+		memset(entry, 0, sizeof(*entry));
+		free(entry);
+	}
+	rh->servers_cache = NULL;
+	rh->servers_cached = 0;
+}
+
 /** Locate a server in the rh config or if not found, check for a servers file
  *
  * @param rh a handle to parsed configuration.
@@ -759,7 +1056,7 @@ int rc_find_server_addr (rc_handle const *rh, char const *server_name,
 
 	if (flags == AUTH) {
 		/* Check to see if the server secret is defined in the rh config */
-		if( (authservers = rc_conf_srv(rh, "authserver")) != NULL )
+		if( (authservers = rh->opts.authserver) != NULL )
 		{
 			for( i = 0; i < authservers->max; i++ )
 			{
@@ -773,7 +1070,7 @@ int rc_find_server_addr (rc_handle const *rh, char const *server_name,
 			}
 		}
 	} else if (flags == ACCT) {
-		if( (acctservers = rc_conf_srv(rh, "acctserver")) != NULL )
+		if( (acctservers = rh->opts.acctserver) != NULL )
 		{
 			for( i = 0; i < acctservers->max; i++ )
 			{
@@ -792,9 +1089,27 @@ int rc_find_server_addr (rc_handle const *rh, char const *server_name,
 	 * servers file to define the secret(s)
 	 */
 
-	if ((clientfd = fopen (rc_conf_str(rh, "servers"), "r")) == NULL)
+	if (rh->servers_cached)
 	{
-		rc_log(LOG_ERR, "rc_find_server: couldn't open file: %s: %s", strerror(errno), rc_conf_str(rh, "servers"));
+		struct rc_servers_entry *entry;
+
+		for (entry = rh->servers_cache; entry != NULL; entry = entry->next)
+		{
+			if (find_match (*info, entry->info) == 0)
+			{
+				strlcpy (secret, entry->secret, MAX_SECRET_LENGTH);
+				return 0;
+			}
+		}
+
+		rc_log(LOG_ERR, "rc_find_server: couldn't find RADIUS server %s in %s",
+			 server_name, rh->opts.servers);
+		goto fail;
+	}
+
+	if ((clientfd = fopen (rh->opts.servers, "r")) == NULL)
+	{
+		rc_log(LOG_ERR, "rc_find_server: couldn't open file: %s: %s", strerror(errno), rh->opts.servers);
 		goto fail;
 	}
 
@@ -862,7 +1177,7 @@ int rc_find_server_addr (rc_handle const *rh, char const *server_name,
 		memset (buffer, '\0', sizeof (buffer));
 		memset (secret, '\0', MAX_SECRET_LENGTH);
 		rc_log(LOG_ERR, "rc_find_server: couldn't find RADIUS server %s in %s",
-			 server_name, rc_conf_str(rh, "servers"));
+			 server_name, rh->opts.servers);
 		goto fail;
 	}
 	
@@ -891,8 +1206,7 @@ int rc_find_server_addr (rc_handle const *rh, char const *server_name,
 void
 rc_config_free(rc_handle *rh)
 {
-	int i, j;
-	SERVER *serv;
+	int i;
 
 	if (rh->config_options == NULL)
 		return;
@@ -901,16 +1215,13 @@ rc_config_free(rc_handle *rh)
 		if (rh->config_options[i].val == NULL)
 			continue;
 		if (rh->config_options[i].type == OT_SRV) {
-		        serv = (SERVER *)rh->config_options[i].val;
-			for (j = 0; j < serv->max; j++){
-				free(serv->name[j]);
-				if(serv->secret[j]) free(serv->secret[j]);
-			}
-			free(serv);
+			server_free(rh->config_options[i].val);
 		} else {
 			free(rh->config_options[i].val);
 		}
 	}
 	free(rh->config_options);
 	rh->config_options = NULL;
+	memset(&rh->opts, 0, sizeof(rh->opts));
+	rc_servers_free(rh);
 }
@@ -0,0 +1,284 @@
+/*
+ * csprng.c	Buffered ChaCha20 keystream for Request Authenticators
+ *		and request IDs, one per thread, seeded from the system.
+ *
+ * License:	BSD
+ *
+ */
+
+#include <config.h>
+#include <includes.h>
+#include <freeradius-client.h>
+#include <pathnames.h>
+
+#if (defined(__APPLE__) || defined(__FreeBSD__)) && defined(HAVE_GETENTROPY)
+# include <sys/random.h>
+#endif
+
+#ifdef HAVE_PTHREAD_ATFORK
+# include <pthread.h>
+#endif
+
+#include "util.h"
+
+#define CSPRNG_KEY_LEN		32
+#define CSPRNG_BLOCK_LEN	64
+#define CSPRNG_BLOCKS		16
+#define CSPRNG_BUF_LEN		(CSPRNG_BLOCKS * CSPRNG_BLOCK_LEN)
+
+/*
+ *  Every refill produces CSPRNG_BLOCKS of keystream. The first 32 bytes
+ *  immediately replace the key and the rest is handed out, each byte
+ *  being wiped as it goes ("fast key erasure"), so a later compromise
+ *  of the state reveals nothing about authenticators already sent.
+ */
+struct csprng {
+	unsigned	generation;		//!< fork generation the key was seeded in.
+	int		seeded;
+	size_t		avail;			//!< unused bytes at the end of buf.
+	uint8_t		key[CSPRNG_KEY_LEN];
+	uint8_t		buf[CSPRNG_BUF_LEN];
+};
+
+#ifdef HAVE_THREAD_LOCAL
+static __thread struct csprng csprng_state;
+#endif
+
+/* bumped in the child after fork(), so that both processes reseed */
+static unsigned csprng_generation;
+
+#define ROTL32(v, n)	(((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTERROUND(a, b, c, d) \
+	a += b; d ^= a; d = ROTL32(d, 16); \
+	c += d; b ^= c; b = ROTL32(b, 12); \
+	a += b; d ^= a; d = ROTL32(d, 8); \
+	c += d; b ^= c; b = ROTL32(b, 7)
+
+static uint32_t load32_le(uint8_t const *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void store32_le(uint8_t *p, uint32_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = (v >> 24) & 0xff;
+}
+
+/** Produce one 64-byte ChaCha20 block
+ *
+ * @param input the 16-word input state.
+ * @param[out] out the keystream block.
+ */
+static void chacha20_block(uint32_t const input[16], uint8_t *out)
+{
+	uint32_t	x[16];
+	int		i;
+
+	memcpy(x, input, sizeof(x));
+	for (i = 0; i < 10; i++) {
+		QUARTERROUND(x[0], x[4], x[8],  x[12]);
+		QUARTERROUND(x[1], x[5], x[9],  x[13]);
+		QUARTERROUND(x[2], x[6], x[10], x[14]);
+		QUARTERROUND(x[3], x[7], x[11], x[15]);
+		QUARTERROUND(x[0], x[5], x[10], x[15]);
+		QUARTERROUND(x[1], x[6], x[11], x[12]);
+		QUARTERROUND(x[2], x[7], x[8],  x[13]);
+		QUARTERROUND(x[3], x[4], x[9],  x[14]);
+	}
+
+	for (i = 0; i < 16; i++)
+		store32_le(out + 4 * i, x[i] + input[i]);
+
+	memset(x, 0, sizeof(x));
+}
+
+/** Read random bytes from the operating system
+ *
+ * @param[out] out the buffer to fill.
+ * @param len the number of bytes, at most 256.
+ * @return 0 on success, -1 if no source worked.
+ */
+static int csprng_system_bytes(uint8_t *out, size_t len)
+{
+#if defined(HAVE_GETENTROPY)
+	if (getentropy(out, len) == 0)
+		return 0;
+#endif
+#if defined(HAVE_DEV_URANDOM)
+	{
+		int	fd;
+		ssize_t	n;
+		size_t	done = 0;
+
+		fd = open(_PATH_DEV_URANDOM, O_RDONLY);
+		if (fd < 0)
+			return -1;
+
+		while (done < len) {
+			n = read(fd, out + done, len - done);
+			if (n > 0) {
+				done += n;
+			} else if (n == 0 || (errno != EINTR && errno != EAGAIN)) {
+				close(fd);
+				return -1;
+			}
+		}
+		close(fd);
+		return 0;
+	}
+#else
+	return -1;
+#endif
+}
+
+#ifdef HAVE_PTHREAD_ATFORK
+static void csprng_atfork_child(void)
+{
+	__atomic_add_fetch(&csprng_generation, 1, __ATOMIC_RELAXED);
+}
+
+static void csprng_atfork_register(void)
+{
+	pthread_atfork(NULL, NULL, csprng_atfork_child);
+}
+#endif
+
+/** Returns the current fork generation
+ *
+ * Without pthread_atfork() the process id stands in for it.
+ */
+static unsigned csprng_current_generation(void)
+{
+#ifdef HAVE_PTHREAD_ATFORK
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+	pthread_once(&once, csprng_atfork_register);
+	return __atomic_load_n(&csprng_generation, __ATOMIC_RELAXED);
+#else
+	return (unsigned)getpid() + csprng_generation;
+#endif
+}
+
+/** Fill a buffer directly from the system, without the keystream
+ *
+ * Falls back to the time, process id and random() as a last resort,
+ * which is logged since the result is predictable.
+ *
+ * @param[out] out the buffer to fill.
+ * @param len the number of bytes.
+ */
+static void csprng_fallback_bytes(uint8_t *out, size_t len)
+{
+	size_t	chunk;
+	long	r;
+
+	while (len > 0) {
+		chunk = len > 256 ? 256 : len;
+		if (csprng_system_bytes(out, chunk) != 0)
+			break;
+		out += chunk;
+		len -= chunk;
+	}
+
+	if (len == 0)
+		return;
+
+	rc_log(LOG_WARNING, "rc_random_bytes: no system entropy source available");
+	srandom((unsigned int)(time(NULL) + getpid() + (long)(rc_getmtime() * 1000000)));
+	while (len > 0) {
+		r = random();
+		chunk = len > sizeof(r) ? sizeof(r) : len;
+		memcpy(out, &r, chunk);
+		out += chunk;
+		len -= chunk;
+	}
+}
+
+#ifdef HAVE_THREAD_LOCAL
+/** Produce a fresh buffer of keystream and rotate the key
+ *
+ * @param st the generator state.
+ */
+static void csprng_refill(struct csprng *st)
+{
+	uint32_t	input[16];
+	int		i;
+
+	input[0] = 0x61707865;		/* "expand 32-byte k" */
+	input[1] = 0x3320646e;
+	input[2] = 0x79622d32;
+	input[3] = 0x6b206574;
+	for (i = 0; i < 8; i++)
+		input[4 + i] = load32_le(st->key + 4 * i);
+	input[13] = input[14] = input[15] = 0;
+
+	for (i = 0; i < CSPRNG_BLOCKS; i++) {
+		input[12] = i;
+		chacha20_block(input, st->buf + i * CSPRNG_BLOCK_LEN);
+	}
+
+	memcpy(st->key, st->buf, CSPRNG_KEY_LEN);
+	memset(st->buf, 0, CSPRNG_KEY_LEN);
+	st->avail = CSPRNG_BUF_LEN - CSPRNG_KEY_LEN;
+
+	memset(input, 0, sizeof(input));
+}
+
+/** Seed the generator state of this thread from the system
+ *
+ * @param st the generator state.
+ * @param generation the current fork generation.
+ */
+static void csprng_seed(struct csprng *st, unsigned generation)
+{
+	csprng_fallback_bytes(st->key, CSPRNG_KEY_LEN);
+	memset(st->buf, 0, sizeof(st->buf));
+	st->avail = 0;
+	st->generation = generation;
+	st->seeded = 1;
+}
+#endif
+
+/** Fill a buffer with cryptographically secure random bytes
+ *
+ * Bytes come from a per-thread ChaCha20 keystream, so the system is only
+ * asked for entropy when a thread first needs it and after fork().  When
+ * the compiler lacks thread-local storage every call reads the system
+ * source instead.
+ *
+ * @param[out] out the buffer to fill.
+ * @param len the number of bytes.
+ */
+void rc_random_bytes(void *out, size_t len)
+{
+#ifdef HAVE_THREAD_LOCAL
+	struct csprng	*st = &csprng_state;
+	uint8_t		*dst = out;
+	uint8_t		*src;
+	unsigned	generation;
+	size_t		n;
+
+	generation = csprng_current_generation();
+	if (!st->seeded || st->generation != generation)
+		csprng_seed(st, generation);
+
+	while (len > 0) {
+		if (st->avail == 0)
+			csprng_refill(st);
+
+		n = len < st->avail ? len : st->avail;
+		src = st->buf + CSPRNG_BUF_LEN - st->avail;
+		memcpy(dst, src, n);
+		memset(src, 0, n);
+		st->avail -= n;
+		dst += n;
+		len -= n;
+	}
+#else
+	csprng_fallback_bytes(out, len);
+#endif
+}
@@ -0,0 +1,508 @@
+/*
+ * daemon.c	Submitting requests to a local radclientd over a Unix-domain socket.
+ *
+ * License:	BSD
+ *
+ */
+
+#include <config.h>
+#include <includes.h>
+#include <freeradius-client.h>
+#include <sys/un.h>
+#include "util.h"
+#include "daemon.h"
+
+#ifdef MSG_NOSIGNAL
+# define DAEMON_SEND_FLAGS	MSG_NOSIGNAL
+#else
+# define DAEMON_SEND_FLAGS	0
+#endif
+
+static int daemon_self;		//!< set in radclientd, whose requests must not loop back.
+
+/** The number of bytes of strvalue that carry the value of a pair
+ *
+ * @param vp the pair.
+ * @return the length.
+ */
+static uint32_t daemon_pair_len(VALUE_PAIR const *vp)
+{
+	switch (vp->type) {
+	case PW_TYPE_STRING:
+	case PW_TYPE_IPV6ADDR:
+	case PW_TYPE_IPV6PREFIX:
+		return vp->lvalue > AUTH_STRING_LEN ? AUTH_STRING_LEN : vp->lvalue;
+
+	default:
+		return 0;
+	}
+}
+
+/** Frame a list of pairs and a message
+ *
+ * @param hdr the header, whose length, pairs and msglen are filled in.
+ * @param vp the pairs.
+ * @param msg the message, or NULL.
+ * @param[out] len the length of the frame.
+ * @return the frame (free with free()), or NULL when out of memory.
+ */
+static char *daemon_encode(struct daemon_hdr *hdr, VALUE_PAIR const *vp, char const *msg, size_t *len)
+{
+	VALUE_PAIR const	*p;
+	struct daemon_pair	dp;
+	size_t			size, off;
+	char			*buf;
+
+	hdr->pairs = 0;
+	size = sizeof(*hdr);
+	for (p = vp; p != NULL; p = p->next) {
+		size += sizeof(dp) + daemon_pair_len(p);
+		hdr->pairs++;
+	}
+	hdr->msglen = msg != NULL ? strlen(msg) : 0;
+	size += hdr->msglen;
+	hdr->length = size - sizeof(*hdr);
+
+	buf = malloc(size);
+	if (buf == NULL) {
+		rc_log(LOG_CRIT, "daemon_encode: out of memory");
+		return NULL;
+	}
+
+	memcpy(buf, hdr, sizeof(*hdr));
+	off = sizeof(*hdr);
+	for (p = vp; p != NULL; p = p->next) {
+		memset(&dp, 0, sizeof(dp));
+		strlcpy(dp.name, p->name, sizeof(dp.name));
+		dp.vendor = p->vendor;
+		dp.attribute = p->attribute;
+		dp.type = p->type;
+		dp.lvalue = p->lvalue;
+		dp.len = daemon_pair_len(p);
+		memcpy(buf + off, &dp, sizeof(dp));
+		off += sizeof(dp);
+		memcpy(buf + off, p->strvalue, dp.len);
+		off += dp.len;
+	}
+	if (hdr->msglen != 0)
+		memcpy(buf + off, msg, hdr->msglen);
+
+	*len = size;
+	return buf;
+}
+
+/** Unpack the pairs and message of a frame
+ *
+ * The peer is not trusted: pairs must be in the dictionary with the type
+ * given there, and all of them must fit in one RADIUS packet.
+ *
+ * @param rh a handle to parsed configuration.
+ * @param hdr the header of the frame.
+ * @param buf the hdr->length bytes following the header.
+ * @param[out] vp receives the pairs.
+ * @param msg receives the message if non-NULL, an array of %PW_MAX_MSG_SIZE.
+ * @return 0 on success, -1 if the frame is malformed.
+ */
+static int daemon_decode(rc_handle const *rh, struct daemon_hdr const *hdr, char const *buf,
+			 VALUE_PAIR **vp, char *msg)
+{
+	VALUE_PAIR		*head = NULL, **tail = &head, *p;
+	struct daemon_pair	dp;
+	DICT_ATTR		*da;
+	size_t			off = 0, len, packed = 0;
+	uint32_t		i;
+
+	for (i = 0; i < hdr->pairs; i++) {
+		if (hdr->length - off < sizeof(dp))
+			goto bad;
+		memcpy(&dp, buf + off, sizeof(dp));
+		off += sizeof(dp);
+		if (dp.len > AUTH_STRING_LEN || hdr->length - off < dp.len)
+			goto bad;
+
+		/* the peer is not trusted with lengths: rc_pack_list() copies
+		 * lvalue bytes of strings and addresses */
+		switch (dp.type) {
+		case PW_TYPE_STRING:
+			dp.lvalue = dp.len;
+			break;
+		case PW_TYPE_IPV6ADDR:
+			if (dp.len != 16)
+				goto bad;
+			dp.lvalue = dp.len;
+			break;
+		case PW_TYPE_IPV6PREFIX:
+			if (dp.len < 2 || dp.len > 18)
+				goto bad;
+			dp.lvalue = dp.len;
+			break;
+		case PW_TYPE_INTEGER:
+		case PW_TYPE_IPADDR:
+		case PW_TYPE_DATE:
+			if (dp.len != 0)
+				goto bad;
+			break;
+		default:
+			goto bad;
+		}
+
+		/* rc_pack_list() can only send what the dictionary knows */
+		if (dp.attribute > 0xff)
+			goto bad;
+		if (dp.vendor != 0 && rc_dict_getvend(rh, dp.vendor) == NULL)
+			goto bad;
+		da = rc_dict_get_vendor_attr(rh, dp.attribute, dp.vendor);
+		if (da == NULL || da->type != dp.type)
+			goto bad;
+
+		packed += (dp.len != 0 ? dp.len : sizeof(uint32_t)) + 2 + (dp.vendor != 0 ? 6 : 0);
+		if (packed > RC_MAX_PACKET_LEN - AUTH_HDR_LEN)
+			goto bad;
+
+		p = malloc(sizeof(*p));
+		if (p == NULL) {
+			rc_log(LOG_CRIT, "daemon_decode: out of memory");
+			rc_avpair_free(head);
+			return -1;
+		}
+		memset(p, 0, sizeof(*p));
+		memcpy(p->name, dp.name, NAME_LENGTH);
+		p->vendor = dp.vendor;
+		p->attribute = dp.attribute;
+		p->type = dp.type;
+		p->lvalue = dp.lvalue;
+		memcpy(p->strvalue, buf + off, dp.len);
+		off += dp.len;
+
+		*tail = p;
+		tail = &p->next;
+	}
+
+	if (hdr->length - off != hdr->msglen)
+		goto bad;
+	if (msg != NULL) {
+		len = hdr->msglen < PW_MAX_MSG_SIZE ? hdr->msglen : PW_MAX_MSG_SIZE - 1;
+		memcpy(msg, buf + off, len);
+		msg[len] = '\0';
+	}
+
+	*vp = head;
+	return 0;
+
+bad:
+	rc_log(LOG_ERR, "daemon_decode: malformed message");
+	rc_avpair_free(head);
+	return -1;
+}
+
+static int daemon_write(int fd, char const *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = send(fd, buf, len, DAEMON_SEND_FLAGS);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/** Read exactly len bytes
+ *
+ * @return 0 on success, 1 on end of file before the first byte, -1 on error.
+ */
+static int daemon_read(int fd, void *buf, size_t len)
+{
+	char	*p = buf;
+	ssize_t	n;
+
+	while (len > 0) {
+		n = read(fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n == 0)
+			return p == buf ? 1 : -1;
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/** Read a frame
+ *
+ * @param fd the connection.
+ * @param hdr receives the header.
+ * @param[out] buf receives the rest of the frame (free with free()).
+ * @return 0 on success, 1 on end of file, -1 on error.
+ */
+static int daemon_recv(int fd, struct daemon_hdr *hdr, char **buf)
+{
+	int rc;
+
+	rc = daemon_read(fd, hdr, sizeof(*hdr));
+	if (rc != 0)
+		return rc;
+
+	if (hdr->magic != DAEMON_MAGIC || hdr->length > DAEMON_MAX_LENGTH ||
+	    hdr->pairs > DAEMON_MAX_PAIRS || hdr->msglen > hdr->length) {
+		rc_log(LOG_ERR, "daemon_recv: malformed message header");
+		return -1;
+	}
+
+	*buf = malloc(hdr->length + 1);
+	if (*buf == NULL) {
+		rc_log(LOG_CRIT, "daemon_recv: out of memory");
+		return -1;
+	}
+	if (daemon_read(fd, *buf, hdr->length) != 0) {
+		free(*buf);
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Connect to the daemon socket
+ *
+ * @param path the path of the socket.
+ * @return the connection, or -1.
+ */
+static int daemon_connect(char const *path)
+{
+	struct sockaddr_un	sun;
+	int			fd;
+
+	if (strlen(path) >= sizeof(sun.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strcpy(sun.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/** Hand a request of rc_aaa() over to radclientd
+ *
+ * Called for handles configured with daemon_socket.  The daemon sends the
+ * request with its own handle, so servers, deadtime and sockets are those
+ * it has learned over its lifetime rather than this process's.
+ *
+ * @param rh a handle to parsed configuration.
+ * @param client_port the client port number to use (may be zero to use any available).
+ * @param send a #VALUE_PAIR array of values.
+ * @param received where to store the received pairs of an authentication request.
+ * @param msg must be an array of %PW_MAX_MSG_SIZE or %NULL.
+ * @param add_nas_port if non-zero it will include %PW_NAS_PORT in sent pairs.
+ * @param request_type one of standard RADIUS codes (e.g., %PW_ACCESS_REQUEST).
+ * @param prio the priority class, as given to rc_aaa_prio().
+ * @param deadline the deadline as rc_getmtime(), or 0; the daemon keeps to what is left of it.
+ * @param[out] result the result of the request, as from rc_aaa().
+ * @return 0 if the daemon handled the request, -1 if it could not be reached
+ *	and the request was not sent.
+ */
+int rc_daemon_aaa(rc_handle const *rh, uint32_t client_port, VALUE_PAIR *send, VALUE_PAIR **received,
+		  char *msg, int add_nas_port, int request_type, int prio, double deadline, int *result)
+{
+	struct daemon_hdr	hdr;
+	VALUE_PAIR		*vp = NULL;
+	char			*buf;
+	size_t			len;
+	double			left = 0;
+	int			fd;
+
+	if (daemon_self)
+		return -1;
+
+	if (deadline > 0) {
+		left = deadline - rc_getmtime();
+		if (left < 0.001) {
+			*result = DEADLINE_RC;
+			return 0;
+		}
+	}
+
+	fd = daemon_connect(rh->opts.daemon_socket);
+	if (fd < 0) {
+		rc_log(LOG_WARNING, "rc_daemon_aaa: can't reach %s: %s, sending directly",
+		       rh->opts.daemon_socket, strerror(errno));
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = DAEMON_MAGIC;
+	hdr.code = request_type;
+	hdr.client_port = client_port;
+	hdr.add_nas_port = add_nas_port;
+	hdr.prio = prio;
+	hdr.deadline = left * 1000;
+
+	buf = daemon_encode(&hdr, send, NULL, &len);
+	if (buf == NULL) {
+		close(fd);
+		return -1;
+	}
+	if (daemon_write(fd, buf, len) != 0) {
+		rc_log(LOG_WARNING, "rc_daemon_aaa: can't send to %s: %s, sending directly",
+		       rh->opts.daemon_socket, strerror(errno));
+		free(buf);
+		close(fd);
+		return -1;
+	}
+	free(buf);
+
+	/* the daemon may have sent the request by now, so never fall back past here */
+	*result = ERROR_RC;
+	if (msg != NULL)
+		msg[0] = '\0';
+
+	if (daemon_recv(fd, &hdr, &buf) != 0) {
+		rc_log(LOG_ERR, "rc_daemon_aaa: no reply from %s", rh->opts.daemon_socket);
+		close(fd);
+		return 0;
+	}
+	close(fd);
+
+	if (daemon_decode(rh, &hdr, buf, &vp, msg) == 0) {
+		*result = hdr.code;
+		if (request_type != PW_ACCOUNTING_REQUEST)
+			*received = vp;
+		else
+			rc_avpair_free(vp);
+	}
+	free(buf);
+
+	return 0;
+}
+
+/** Create the socket radclientd listens on
+ *
+ * A socket left behind at path by a daemon that is no longer running is
+ * replaced; one that still accepts connections is an error.  Requests
+ * served by this process are from then on sent directly, even if its
+ * configuration names a daemon_socket.
+ *
+ * @param path the path of the socket.
+ * @param mode the permissions of the socket, which decide who may submit requests.
+ * @return the listening socket, or -1 on failure.
+ */
+int rc_daemon_listen(char const *path, mode_t mode)
+{
+	struct sockaddr_un	sun;
+	struct stat		st;
+	int			fd;
+
+	if (strlen(path) >= sizeof(sun.sun_path)) {
+		rc_log(LOG_ERR, "rc_daemon_listen: socket path too long: %s", path);
+		return -1;
+	}
+
+	if (lstat(path, &st) == 0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			rc_log(LOG_ERR, "rc_daemon_listen: %s exists and is not a socket", path);
+			return -1;
+		}
+		fd = daemon_connect(path);
+		if (fd >= 0) {
+			close(fd);
+			rc_log(LOG_ERR, "rc_daemon_listen: a daemon is already listening on %s", path);
+			return -1;
+		}
+		unlink(path);
+	}
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strcpy(sun.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		rc_log(LOG_ERR, "rc_daemon_listen: socket: %s", strerror(errno));
+		return -1;
+	}
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0 || chmod(path, mode) < 0 ||
+	    listen(fd, SOMAXCONN) < 0) {
+		rc_log(LOG_ERR, "rc_daemon_listen: %s: %s", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	daemon_self = 1;
+	return fd;
+}
+
+/** Serve the requests of one connection to radclientd
+ *
+ * Each request is sent with the snapshot current when it arrives.
+ * Requests with pairs that cannot be sent are answered with %ERROR_RC.
+ * Returns when the client closes the connection or breaks the framing.
+ *
+ * @param rl the configuration of the daemon.
+ * @param fd the connection, which is closed on return.
+ */
+void rc_daemon_serve(RC_RELOAD *rl, int fd)
+{
+	struct daemon_hdr	hdr;
+	rc_handle		*rh;
+	VALUE_PAIR		*send, *received;
+	char			*buf, msg[PW_MAX_MSG_SIZE];
+	size_t			len;
+	int			result;
+
+	while (daemon_recv(fd, &hdr, &buf) == 0) {
+		send = NULL;
+		received = NULL;
+		msg[0] = '\0';
+		rh = rc_reload_acquire(rl);
+		result = daemon_decode(rh, &hdr, buf, &send, NULL);
+		free(buf);
+
+		/* the bad frame was read whole, so answer it and carry on */
+		if (result != 0)
+			result = ERROR_RC;
+		else if (hdr.deadline > 0)
+			result = rc_aaa_deadline(rh, hdr.client_port, send, &received, msg,
+						 hdr.add_nas_port, hdr.code, hdr.prio, hdr.deadline);
+		else
+			result = rc_aaa_prio(rh, hdr.client_port, send, &received, msg,
+					     hdr.add_nas_port, hdr.code, hdr.prio);
+		rc_reload_release(rl, rh);
+		rc_avpair_free(send);
+
+		hdr.code = result;
+		buf = daemon_encode(&hdr, received, msg, &len);
+		rc_avpair_free(received);
+		if (buf == NULL)
+			break;
+		result = daemon_write(fd, buf, len);
+		free(buf);
+		if (result != 0)
+			break;
+	}
+
+	close(fd);
+}
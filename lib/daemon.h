@@ -0,0 +1,46 @@
+/*
+ * daemon.h	Framing of the messages between radclientd and its clients.
+ *
+ * License:	BSD
+ *
+ */
+
+#ifndef DAEMON_H
+# define DAEMON_H
+
+#include <freeradius-client.h>
+
+#define DAEMON_MAGIC		0x52434433	//!< "RCD3", bumped on any change to the framing.
+#define DAEMON_MAX_PAIRS	1024
+#define DAEMON_MAX_LENGTH	(DAEMON_MAX_PAIRS * (sizeof(struct daemon_pair) + AUTH_STRING_LEN) + PW_MAX_MSG_SIZE)
+
+/*
+ *  Both ends run on the same host, so the framing uses native byte
+ *  order.  Every message is a header followed by 'pairs' attributes,
+ *  each a daemon_pair and its value, then 'msglen' bytes of
+ *  Reply-Message text in replies.  Pairs travel with their name and
+ *  type, so they survive the trip exactly as rc_avpair_gen() made them;
+ *  the daemon only sends those its dictionary knows with that type.
+ */
+struct daemon_hdr {
+	uint32_t	magic;
+	uint32_t	length;		//!< bytes following the header.
+	int32_t		code;		//!< request type, or the result in replies.
+	uint32_t	client_port;
+	int32_t		add_nas_port;
+	int32_t		prio;		//!< priority class, see rc_aaa_prio().
+	uint32_t	deadline;	//!< milliseconds left to the deadline, 0 for none.
+	uint32_t	pairs;
+	uint32_t	msglen;
+};
+
+struct daemon_pair {
+	char		name[NAME_LENGTH + 1];
+	uint32_t	vendor;
+	uint32_t	attribute;
+	int32_t		type;
+	uint32_t	lvalue;
+	uint32_t	len;		//!< bytes of strvalue following.
+};
+
+#endif /* DAEMON_H */
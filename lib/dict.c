@@ -359,6 +359,11 @@ int rc_read_dictionary (rc_handle *rh, char const *filename)
                 }
 	}
 	fclose (dictfd);
+
+	/* resolve attribute names used by the configuration */
+	if (rh->config_options != NULL)
+		rc_config_compile(rh);
+
 	return 0;
 }
 
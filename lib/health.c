@@ -0,0 +1,286 @@
+/*
+ * health.c	Server health shared between the processes of a host.
+ *
+ * License:	BSD
+ *
+ */
+
+#include <config.h>
+#include <includes.h>
+#include <freeradius-client.h>
+#include "util.h"
+
+#ifdef HAVE_SHM_OPEN
+# include <sys/mman.h>
+#endif
+
+#define HEALTH_MAGIC		0x52434831	//!< "RCH1", bumped on any change to the layout.
+#define HEALTH_SLOTS		64
+
+/*
+ *  One slot per server, claimed by whichever process first talks to it
+ *  by swapping its key in; slots are never given back.  The segment
+ *  starts zero filled, which is a valid empty table, so there is nothing
+ *  to initialise beyond the magic and no lock anywhere: every field is
+ *  read and written with atomics.  Times are rc_getmtime() microseconds,
+ *  which come from the monotonic clock and so compare across processes.
+ */
+struct rc_health_slot {
+	uint64_t	key;		//!< hash of type, name and port; 0 while free.
+	int64_t		dead_until;
+	uint32_t	srtt;		//!< microseconds.
+	uint32_t	failures;
+};
+
+struct rc_health {
+	uint32_t		magic;
+	uint32_t		slots;
+	struct rc_health_slot	slot[HEALTH_SLOTS];
+};
+
+static uint64_t health_hash(char const *s, uint64_t h)
+{
+	while (*s != '\0') {
+		h ^= (uint8_t)*s++;
+		h *= 0x100000001b3ULL;
+	}
+
+	return h;
+}
+
+static int64_t health_now(void)
+{
+	return (int64_t)(rc_getmtime() * 1000000);
+}
+
+/** Find the slot of a server, claiming one if it has none
+ *
+ * @param rh a handle to parsed configuration.
+ * @param server the server name.
+ * @param port the destination port.
+ * @param type %AUTH or %ACCT.
+ * @param claim whether to claim a slot for a server not in the table.
+ * @return the slot, or NULL if the handle shares no health or the table is full.
+ */
+static struct rc_health_slot *health_slot(rc_handle const *rh, char const *server, int port,
+					  unsigned type, int claim)
+{
+	struct rc_health_slot	*slot;
+	char			buf[16];
+	uint64_t		key, found;
+	int			i, n;
+
+	if (rh->health == NULL)
+		return NULL;
+
+	snprintf(buf, sizeof(buf), "%u:%d:", type, port);
+	key = health_hash(server, health_hash(buf, 0xcbf29ce484222325ULL));
+	if (key == 0)
+		key = 1;
+
+	for (i = 0; i < HEALTH_SLOTS; i++) {
+		n = (key + i) % HEALTH_SLOTS;
+		slot = &rh->health->slot[n];
+
+		found = __atomic_load_n(&slot->key, __ATOMIC_ACQUIRE);
+		if (found == key)
+			return slot;
+		if (found != 0)
+			continue;
+		if (!claim)
+			return NULL;
+
+		if (__atomic_compare_exchange_n(&slot->key, &found, key, 0,
+						__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) || found == key)
+			return slot;
+	}
+
+	return NULL;
+}
+
+/** Map the health table shared by every process reading a configuration file
+ *
+ * The segment is named after the real path of the file and the effective
+ * user, so processes of other users cannot mark this user's servers dead.
+ * Failing to map it is not an error; the handle then keeps deadtime to itself.
+ *
+ * @param rh a handle to parsed configuration.
+ * @param filename the configuration file.
+ */
+void rc_health_attach(rc_handle *rh, char const *filename)
+{
+#ifdef HAVE_SHM_OPEN
+	struct rc_health	*health;
+	struct stat		st;
+	char			path[PATH_MAX], name[64];
+	uint32_t		magic = 0;
+	int			fd;
+
+	if (realpath(filename, path) == NULL)
+		strlcpy(path, filename, sizeof(path));
+	snprintf(name, sizeof(name), "/radiusclient-%u-%016llx", (unsigned)geteuid(),
+		 (unsigned long long)health_hash(path, 0xcbf29ce484222325ULL));
+
+	fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+	if (fd < 0) {
+		rc_log(LOG_WARNING, "rc_health_attach: shm_open %s: %s", name, strerror(errno));
+		return;
+	}
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	/* growing a fresh segment zero fills it; one already the right size is left alone */
+	if (fstat(fd, &st) < 0 ||
+	    (st.st_size < (off_t)sizeof(*health) && ftruncate(fd, sizeof(*health)) < 0)) {
+		rc_log(LOG_WARNING, "rc_health_attach: %s: %s", name, strerror(errno));
+		close(fd);
+		return;
+	}
+
+	health = mmap(NULL, sizeof(*health), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (health == MAP_FAILED) {
+		rc_log(LOG_WARNING, "rc_health_attach: mmap %s: %s", name, strerror(errno));
+		return;
+	}
+
+	if (!__atomic_compare_exchange_n(&health->magic, &magic, HEALTH_MAGIC, 0,
+					 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) &&
+	    magic != HEALTH_MAGIC) {
+		rc_log(LOG_WARNING, "rc_health_attach: %s was made by another version, not sharing health", name);
+		munmap(health, sizeof(*health));
+		return;
+	}
+	health->slots = HEALTH_SLOTS;
+
+	rh->health = health;
+#else
+	rc_log(LOG_WARNING, "rc_health_attach: built without shm_open, not sharing health");
+#endif
+}
+
+/** Unmap the health table of a handle
+ *
+ * @param rh a handle to parsed configuration.
+ */
+void rc_health_detach(rc_handle *rh)
+{
+#ifdef HAVE_SHM_OPEN
+	if (rh->health != NULL)
+		munmap(rh->health, sizeof(*rh->health));
+#endif
+	rh->health = NULL;
+}
+
+/** Whether another process has found a server dead
+ *
+ * @param rh a handle to parsed configuration.
+ * @param server the server name.
+ * @param port the destination port.
+ * @param type %AUTH or %ACCT.
+ * @return 1 if the server is in its deadtime, 0 otherwise.
+ */
+int rc_health_dead(rc_handle const *rh, char const *server, int port, unsigned type)
+{
+	struct rc_health_slot *slot;
+
+	slot = health_slot(rh, server, port, type, 0);
+	if (slot == NULL)
+		return 0;
+
+	return __atomic_load_n(&slot->dead_until, __ATOMIC_RELAXED) > health_now();
+}
+
+/** Start the deadtime of a server for every process sharing the table
+ *
+ * @param rh a handle to parsed configuration.
+ * @param server the server name.
+ * @param port the destination port.
+ * @param type %AUTH or %ACCT.
+ * @param deadtime seconds.
+ */
+void rc_health_mark_dead(rc_handle const *rh, char const *server, int port, unsigned type, int deadtime)
+{
+	struct rc_health_slot *slot;
+
+	slot = health_slot(rh, server, port, type, 1);
+	if (slot == NULL)
+		return;
+
+	__atomic_store_n(&slot->dead_until, health_now() + (int64_t)deadtime * 1000000, __ATOMIC_RELAXED);
+}
+
+/** Record the outcome of a request to a server
+ *
+ * An answer of any kind ends the deadtime of the server and its run of
+ * failures; a timeout adds to the run.
+ *
+ * @param rh a handle to parsed configuration.
+ * @param server the server name.
+ * @param port the destination port.
+ * @param type %AUTH or %ACCT.
+ * @param result the result of rc_send_server().
+ * @param rtt microseconds from the first transmission to the reply, or 0 if unknown.
+ */
+void rc_health_update(rc_handle const *rh, char const *server, int port, unsigned type,
+		      int result, uint64_t rtt)
+{
+	struct rc_health_slot	*slot;
+	uint32_t		srtt;
+
+	if (result != OK_RC && result != REJECT_RC && result != TIMEOUT_RC)
+		return;
+
+	slot = health_slot(rh, server, port, type, 1);
+	if (slot == NULL)
+		return;
+
+	if (result == TIMEOUT_RC) {
+		__atomic_add_fetch(&slot->failures, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	if (__atomic_load_n(&slot->failures, __ATOMIC_RELAXED) != 0)
+		__atomic_store_n(&slot->failures, 0, __ATOMIC_RELAXED);
+	if (__atomic_load_n(&slot->dead_until, __ATOMIC_RELAXED) != 0)
+		__atomic_store_n(&slot->dead_until, 0, __ATOMIC_RELAXED);
+
+	if (rtt == 0)
+		return;
+	if (rtt > UINT32_MAX)
+		rtt = UINT32_MAX;
+
+	/* gain 1/8, as TCP; racing updates lose a sample, which an estimate can afford */
+	srtt = __atomic_load_n(&slot->srtt, __ATOMIC_RELAXED);
+	if (srtt == 0)
+		srtt = rtt;
+	else
+		srtt = srtt + ((int64_t)rtt - (int64_t)srtt) / 8;
+	__atomic_store_n(&slot->srtt, srtt, __ATOMIC_RELAXED);
+}
+
+/** Read the shared health of a server
+ *
+ * @param rh a handle to parsed configuration, read with server_health_shm enabled.
+ * @param server the server name.
+ * @param port the destination port.
+ * @param type %AUTH or %ACCT.
+ * @param[out] health receives the health.
+ * @return 0 on success, -1 if the handle shares no health or has never seen the server.
+ */
+int rc_health_get(rc_handle const *rh, char const *server, int port, unsigned type,
+		  RC_SERVER_HEALTH *health)
+{
+	struct rc_health_slot	*slot;
+	int64_t			left;
+
+	slot = health_slot(rh, server, port, type, 0);
+	if (slot == NULL)
+		return -1;
+
+	left = __atomic_load_n(&slot->dead_until, __ATOMIC_RELAXED) - health_now();
+	health->dead_for = left > 0 ? left / 1000000.0 : 0;
+	health->srtt = __atomic_load_n(&slot->srtt, __ATOMIC_RELAXED);
+	health->failures = __atomic_load_n(&slot->failures, __ATOMIC_RELAXED);
+
+	return 0;
+}
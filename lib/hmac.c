@@ -0,0 +1,250 @@
+/*
+ * hmac.c	HMAC-MD5 as used by Message-Authenticator (RFC 2869),
+ *		with the keyed MD5 states cached per shared secret.
+ *
+ * License:	BSD
+ *
+ */
+
+#include <config.h>
+#include <includes.h>
+#include <freeradius-client.h>
+#include "rc-md5.h"
+#include "util.h"
+
+#define HMAC_BLOCK_LEN		64
+#define HMAC_CACHE_SLOTS	16
+
+/*
+ *  The MD5 states after absorbing (key ^ ipad) and (key ^ opad).
+ *  A published key is never modified, so any number of threads may
+ *  copy from it without locking.
+ */
+struct rc_hmac_key {
+	RC_HMAC_CTX	state;
+	size_t		secretlen;
+	char		secret[1];
+};
+
+/*
+ *  Slots are filled at most once, left to right, by compare-and-swap,
+ *  and only released by rc_hmac_cache_free().  A handle rarely talks
+ *  to more than a few distinct secrets; once every slot is taken the
+ *  key schedule is simply computed per packet.
+ */
+struct rc_hmac_cache {
+	struct rc_hmac_key *slot[HMAC_CACHE_SLOTS];
+};
+
+/** Compute the inner and outer keyed states for a secret
+ *
+ * @param state the context whose inner and outer states are initialised.
+ * @param secret the shared secret.
+ * @param secretlen the length of the secret.
+ */
+static void hmac_key_schedule(RC_HMAC_CTX *state, char const *secret, size_t secretlen)
+{
+	unsigned char	k[HMAC_BLOCK_LEN];
+	unsigned char	pad[HMAC_BLOCK_LEN];
+	int		i;
+
+	memset(k, 0, sizeof(k));
+	if (secretlen > HMAC_BLOCK_LEN)
+		rc_md5_calc(k, (unsigned char const *)secret, secretlen);
+	else
+		memcpy(k, secret, secretlen);
+
+	for (i = 0; i < HMAC_BLOCK_LEN; i++)
+		pad[i] = k[i] ^ 0x36;
+	rc_md5_init(&state->inner);
+	rc_md5_update(&state->inner, pad, sizeof(pad));
+
+	for (i = 0; i < HMAC_BLOCK_LEN; i++)
+		pad[i] = k[i] ^ 0x5c;
+	rc_md5_init(&state->outer);
+	rc_md5_update(&state->outer, pad, sizeof(pad));
+
+	memset(k, 0, sizeof(k));
+	memset(pad, 0, sizeof(pad));
+}
+
+static struct rc_hmac_key *hmac_key_new(char const *secret, size_t secretlen)
+{
+	struct rc_hmac_key *key;
+
+	key = malloc(sizeof(*key) + secretlen);
+	if (key == NULL)
+		return NULL;
+
+	hmac_key_schedule(&key->state, secret, secretlen);
+	key->secretlen = secretlen;
+	memcpy(key->secret, secret, secretlen);
+	key->secret[secretlen] = '\0';
+
+	return key;
+}
+
+static void hmac_key_free(struct rc_hmac_key *key)
+{
+	rc_md5_cleanup(&key->state.inner);
+	rc_md5_cleanup(&key->state.outer);
+	memset(key->secret, 0, key->secretlen);
+	free(key);
+}
+
+static int hmac_key_match(struct rc_hmac_key const *key, char const *secret, size_t secretlen)
+{
+	return key->secretlen == secretlen && memcmp(key->secret, secret, secretlen) == 0;
+}
+
+/** Find the cached key for a secret, adding it if there is a free slot
+ *
+ * @param cache the cache of a handle, may be NULL.
+ * @param secret the shared secret.
+ * @param secretlen the length of the secret.
+ * @return the cached key, or NULL if it could not be cached.
+ */
+static struct rc_hmac_key *hmac_cache_get(struct rc_hmac_cache *cache, char const *secret, size_t secretlen)
+{
+	struct rc_hmac_key *key, *found;
+	int i;
+
+	if (cache == NULL)
+		return NULL;
+
+	for (i = 0; i < HMAC_CACHE_SLOTS; i++) {
+		found = __atomic_load_n(&cache->slot[i], __ATOMIC_ACQUIRE);
+		if (found == NULL)
+			break;
+		if (hmac_key_match(found, secret, secretlen))
+			return found;
+	}
+
+	if (i == HMAC_CACHE_SLOTS)
+		return NULL;
+
+	key = hmac_key_new(secret, secretlen);
+	if (key == NULL)
+		return NULL;
+
+	for (; i < HMAC_CACHE_SLOTS; i++) {
+		found = NULL;
+		if (__atomic_compare_exchange_n(&cache->slot[i], &found, key, 0,
+						__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return key;
+
+		/* another thread filled this slot first */
+		if (hmac_key_match(found, secret, secretlen)) {
+			hmac_key_free(key);
+			return found;
+		}
+	}
+
+	hmac_key_free(key);
+	return NULL;
+}
+
+/** Allocate an empty HMAC key cache
+ *
+ * @return a new cache, or NULL when out of memory.
+ */
+struct rc_hmac_cache *rc_hmac_cache_new(void)
+{
+	struct rc_hmac_cache *cache;
+
+	cache = malloc(sizeof(*cache));
+	if (cache == NULL) {
+		rc_log(LOG_CRIT, "rc_hmac_cache_new: out of memory");
+		return NULL;
+	}
+	memset(cache, 0, sizeof(*cache));
+
+	return cache;
+}
+
+/** Free a HMAC key cache and wipe the cached key schedules
+ *
+ * @param cache the cache to free, may be NULL.
+ */
+void rc_hmac_cache_free(struct rc_hmac_cache *cache)
+{
+	int i;
+
+	if (cache == NULL)
+		return;
+
+	for (i = 0; i < HMAC_CACHE_SLOTS; i++) {
+		if (cache->slot[i] != NULL)
+			hmac_key_free(cache->slot[i]);
+	}
+	free(cache);
+}
+
+/** Start an incremental HMAC-MD5 computation keyed by a shared secret
+ *
+ * The key schedule of the secret is looked up in the cache of the handle,
+ * so only the data itself is hashed for every computation after the first.
+ *
+ * @param rh a handle to parsed configuration.
+ * @param ctx the context to initialise; release it with rc_hmac_md5_final().
+ * @param secret the shared secret.
+ */
+void rc_hmac_md5_init(rc_handle const *rh, RC_HMAC_CTX *ctx, char const *secret)
+{
+	struct rc_hmac_key	*key;
+	size_t			secretlen;
+
+	secretlen = strlen(secret);
+	key = hmac_cache_get(rh->hmac_cache, secret, secretlen);
+	if (key == NULL) {
+		hmac_key_schedule(ctx, secret, secretlen);
+		return;
+	}
+
+	rc_md5_copy(&ctx->inner, &key->state.inner);
+	rc_md5_copy(&ctx->outer, &key->state.outer);
+}
+
+/** Add data to an incremental HMAC-MD5 computation
+ *
+ * @param ctx an initialised context.
+ * @param data the data to authenticate.
+ * @param len the length of data.
+ */
+void rc_hmac_md5_update(RC_HMAC_CTX *ctx, void const *data, size_t len)
+{
+	rc_md5_update(&ctx->inner, data, len);
+}
+
+/** Finish an incremental HMAC-MD5 computation and release the context
+ *
+ * @param[out] digest will hold the 16-byte HMAC.
+ * @param ctx an initialised context.
+ */
+void rc_hmac_md5_final(unsigned char *digest, RC_HMAC_CTX *ctx)
+{
+	unsigned char		inner[AUTH_VECTOR_LEN];
+
+	rc_md5_final(inner, &ctx->inner);
+	rc_md5_update(&ctx->outer, inner, sizeof(inner));
+	rc_md5_final(digest, &ctx->outer);
+	memset(inner, 0, sizeof(inner));
+}
+
+/** Compute HMAC-MD5 keyed by a shared secret
+ *
+ * @param rh a handle to parsed configuration.
+ * @param[out] digest will hold the 16-byte HMAC.
+ * @param data the data to authenticate.
+ * @param len the length of data.
+ * @param secret the shared secret.
+ */
+void rc_hmac_md5(rc_handle const *rh, unsigned char *digest, unsigned char const *data,
+		 size_t len, char const *secret)
+{
+	RC_HMAC_CTX		ctx;
+
+	rc_hmac_md5_init(rh, &ctx, secret);
+	rc_hmac_md5_update(&ctx, data, len);
+	rc_hmac_md5_final(digest, &ctx);
+}
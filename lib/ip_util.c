@@ -156,7 +156,7 @@ int rc_get_srcaddr(struct sockaddr *lia, const struct sockaddr *ria)
  **/
 void rc_own_bind_addr(rc_handle const *rh, struct sockaddr_storage *lia)
 {
-	char *txtaddr = rc_conf_str(rh, "bindaddr");
+	char const *txtaddr = rh->opts.bindaddr;
 	struct addrinfo *info;
 
 	if (rh->own_bind_addr_set) {
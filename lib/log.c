@@ -12,6 +12,46 @@
 #include <config.h>
 #include <includes.h>
 #include <freeradius-client.h>
+#include "util.h"
+
+#if defined(HAVE_PTHREAD_CREATE) && defined(HAVE_SEMAPHORE_H)
+# define RC_LOG_ASYNC 1
+# include <pthread.h>
+# include <semaphore.h>
+#endif
+
+#define LOG_MSG_LEN		1024
+#define LOG_RATE_SLOTS		64
+
+static void log_syslog_sink(void *ctx, int prio, char const *msg)
+{
+#ifndef _MSC_VER /* TODO: Fix me */
+	syslog(prio, "%s", msg);
+#endif
+}
+
+static rc_log_sink_fn	log_sink = log_syslog_sink;
+static void		*log_sink_ctx;
+static int		log_level = LOG_DEBUG;
+
+/*
+ *  Rate limiting is per call site: the format string pointer is hashed
+ *  into a small table.  Colliding formats share a slot, which at worst
+ *  resets each other's windows; that is good enough for flood control.
+ */
+static unsigned		log_rate_burst;
+static uint64_t		log_rate_interval;	/* microseconds */
+
+struct log_rate {
+	char const	*format;
+	uint64_t	window_start;		/* microseconds */
+	unsigned	count;
+	unsigned	suppressed;
+};
+
+static struct log_rate	log_rate_table[LOG_RATE_SLOTS];
+
+static void log_write(int prio, char const *msg);
 
 /** Opens system log
  *
@@ -24,21 +64,370 @@ void rc_openlog(char const *ident)
 #endif
 }
 
+/** Send log messages somewhere else than syslog
+ *
+ * Set it before logging from several threads; the sink itself must be
+ * thread-safe unless the asynchronous writer is running.
+ *
+ * @param fn the sink, or NULL to restore syslog.
+ * @param ctx passed to the sink unchanged.
+ */
+void rc_log_set_sink(rc_log_sink_fn fn, void *ctx)
+{
+	log_sink_ctx = ctx;
+	log_sink = fn ? fn : log_syslog_sink;
+}
+
+/** Discard messages less important than a syslog priority
+ *
+ * Discarded messages are dropped before they are formatted.
+ *
+ * @param prio the least important priority still logged (e.g. %LOG_WARNING).
+ */
+void rc_log_set_level(int prio)
+{
+	__atomic_store_n(&log_level, prio, __ATOMIC_RELAXED);
+}
+
+/** Check whether a message of a given priority would be logged
+ *
+ * Lets callers skip building expensive arguments, such as hex dumps.
+ *
+ * @param prio the syslog priority.
+ * @return non-zero if it would be logged.
+ */
+int rc_log_enabled(int prio)
+{
+	return prio <= __atomic_load_n(&log_level, __ATOMIC_RELAXED);
+}
+
+/** Limit how often a single rc_log() call site may log
+ *
+ * At most burst messages per interval are logged from each call site,
+ * the rest are counted and reported once the interval is over.
+ *
+ * @param burst messages allowed per interval, 0 to disable rate limiting.
+ * @param interval the interval in seconds.
+ */
+void rc_log_set_ratelimit(unsigned burst, double interval)
+{
+	__atomic_store_n(&log_rate_interval, (uint64_t)(interval * 1000000), __ATOMIC_RELAXED);
+	__atomic_store_n(&log_rate_burst, burst, __ATOMIC_RELAXED);
+}
+
+/** Decide whether a call site may log now
+ *
+ * @param prio the priority of the message, used for the suppression report.
+ * @param format identifies the call site.
+ * @return 1 to log the message, 0 to suppress it.
+ */
+static int log_rate_allow(int prio, char const *format)
+{
+	struct log_rate	*rate;
+	unsigned	burst, suppressed;
+	uint64_t	now, start;
+	char		msg[128];
+
+	burst = __atomic_load_n(&log_rate_burst, __ATOMIC_RELAXED);
+	if (burst == 0)
+		return 1;
+
+	rate = &log_rate_table[((uintptr_t)format >> 3) % LOG_RATE_SLOTS];
+	now = (uint64_t)(rc_getmtime() * 1000000);
+
+	if (__atomic_load_n(&rate->format, __ATOMIC_RELAXED) != format) {
+		__atomic_store_n(&rate->format, format, __ATOMIC_RELAXED);
+		__atomic_store_n(&rate->count, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&rate->suppressed, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&rate->window_start, now, __ATOMIC_RELAXED);
+	}
+
+	start = __atomic_load_n(&rate->window_start, __ATOMIC_RELAXED);
+	if (now - start >= __atomic_load_n(&log_rate_interval, __ATOMIC_RELAXED) &&
+	    __atomic_compare_exchange_n(&rate->window_start, &start, now, 0,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		/* the caller opening a new window reports what was dropped */
+		__atomic_store_n(&rate->count, 0, __ATOMIC_RELAXED);
+		suppressed = __atomic_exchange_n(&rate->suppressed, 0, __ATOMIC_RELAXED);
+		if (suppressed > 0) {
+			snprintf(msg, sizeof(msg), "rc_log: suppressed %u messages like \"%.60s\"",
+				 suppressed, format);
+			log_write(prio, msg);
+		}
+	}
+
+	if (__atomic_add_fetch(&rate->count, 1, __ATOMIC_RELAXED) <= burst)
+		return 1;
+
+	__atomic_add_fetch(&rate->suppressed, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+#ifdef RC_LOG_ASYNC
+/*
+ *  Bounded multi-producer queue (after Dmitry Vyukov): every cell
+ *  carries a sequence number telling producers and the single consumer
+ *  whose turn it is, so enqueueing is one compare-and-swap and never
+ *  blocks.  When the writer falls behind, messages are dropped and
+ *  counted instead.
+ */
+struct log_cell {
+	size_t		seq;
+	int		prio;
+	char		msg[LOG_MSG_LEN];
+};
+
+static struct log_cell	*log_ring;
+static size_t		log_ring_mask;
+static size_t		log_enqueue_pos;
+static size_t		log_dequeue_pos;
+static unsigned		log_dropped;
+static int		log_async_running;
+static int		log_async_stopping;
+static sem_t		log_async_sem;
+static pthread_t	log_async_thread;
+
+/** Claim a free cell in the ring
+ *
+ * @return the cell to fill and publish, or NULL if the ring is full.
+ */
+static struct log_cell *log_ring_claim(size_t *pos)
+{
+	struct log_cell	*cell;
+	size_t		seq;
+	intptr_t	dif;
+
+	*pos = __atomic_load_n(&log_enqueue_pos, __ATOMIC_RELAXED);
+	for (;;) {
+		cell = &log_ring[*pos & log_ring_mask];
+		seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		dif = (intptr_t)seq - (intptr_t)*pos;
+		if (dif == 0) {
+			if (__atomic_compare_exchange_n(&log_enqueue_pos, pos, *pos + 1, 1,
+							__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				return cell;
+		} else if (dif < 0) {
+			return NULL;
+		} else {
+			*pos = __atomic_load_n(&log_enqueue_pos, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+static void log_ring_publish(struct log_cell *cell, size_t pos)
+{
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+	sem_post(&log_async_sem);
+}
+
+/** Hand every queued message to the sink
+ *
+ * Only called by the writer thread, or after it was joined.
+ */
+static void log_ring_drain(void)
+{
+	struct log_cell	*cell;
+	unsigned	dropped;
+	char		msg[64];
+
+	for (;;) {
+		cell = &log_ring[log_dequeue_pos & log_ring_mask];
+		if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != log_dequeue_pos + 1)
+			break;
+
+		log_sink(log_sink_ctx, cell->prio, cell->msg);
+		__atomic_store_n(&cell->seq, log_dequeue_pos + log_ring_mask + 1, __ATOMIC_RELEASE);
+		log_dequeue_pos++;
+	}
+
+	dropped = __atomic_exchange_n(&log_dropped, 0, __ATOMIC_RELAXED);
+	if (dropped > 0) {
+		snprintf(msg, sizeof(msg), "rc_log: dropped %u messages, log writer too slow", dropped);
+		log_sink(log_sink_ctx, LOG_WARNING, msg);
+	}
+}
+
+static void *log_async_main(void *arg)
+{
+	while (!__atomic_load_n(&log_async_stopping, __ATOMIC_ACQUIRE)) {
+		while (sem_wait(&log_async_sem) != 0 && errno == EINTR)
+			;
+		log_ring_drain();
+	}
+	return NULL;
+}
+
+static void log_async_atfork_child(void)
+{
+	/* the writer thread does not exist in the child */
+	log_async_running = 0;
+}
+
+/** Format and log through the ring buffer
+ *
+ * @return 0 if queued or dropped, -1 if the writer is not running.
+ */
+static int log_async_vlog(int prio, char const *format, va_list ap)
+{
+	struct log_cell	*cell;
+	size_t		pos;
+
+	if (!__atomic_load_n(&log_async_running, __ATOMIC_ACQUIRE))
+		return -1;
+
+	cell = log_ring_claim(&pos);
+	if (cell == NULL) {
+		__atomic_add_fetch(&log_dropped, 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+
+	cell->prio = prio;
+	vsnprintf(cell->msg, sizeof(cell->msg), format, ap);
+	log_ring_publish(cell, pos);
+
+	return 0;
+}
+#endif
+
+/** Start a background thread that writes log messages
+ *
+ * rc_log() then only formats the message into a lock-free ring buffer
+ * and returns; the sink runs in the background thread.
+ *
+ * @param slots the capacity of the ring, rounded up to a power of two.
+ * @return 0 on success, -1 on failure or when threads are unavailable.
+ */
+int rc_log_async_start(size_t slots)
+{
+#ifdef RC_LOG_ASYNC
+	static int atfork_registered = 0;
+	size_t size, i;
+
+	if (log_async_running)
+		return 0;
+
+	for (size = 2; size < slots; size <<= 1)
+		;
+
+	log_ring = malloc(size * sizeof(*log_ring));
+	if (log_ring == NULL) {
+		rc_log(LOG_CRIT, "rc_log_async_start: out of memory");
+		return -1;
+	}
+	for (i = 0; i < size; i++)
+		log_ring[i].seq = i;
+	log_ring_mask = size - 1;
+	log_enqueue_pos = 0;
+	log_dequeue_pos = 0;
+	log_async_stopping = 0;
+
+	if (sem_init(&log_async_sem, 0, 0) != 0) {
+		free(log_ring);
+		log_ring = NULL;
+		rc_log(LOG_ERR, "rc_log_async_start: sem_init: %s", strerror(errno));
+		return -1;
+	}
+
+	if (pthread_create(&log_async_thread, NULL, log_async_main, NULL) != 0) {
+		sem_destroy(&log_async_sem);
+		free(log_ring);
+		log_ring = NULL;
+		rc_log(LOG_ERR, "rc_log_async_start: cannot create writer thread");
+		return -1;
+	}
+
+	if (!atfork_registered) {
+		pthread_atfork(NULL, NULL, log_async_atfork_child);
+		atfork_registered = 1;
+	}
+
+	__atomic_store_n(&log_async_running, 1, __ATOMIC_RELEASE);
+	return 0;
+#else
+	rc_log(LOG_ERR, "rc_log_async_start: not supported on this platform");
+	return -1;
+#endif
+}
+
+/** Stop the background writer after it wrote every queued message
+ *
+ * No other thread may be logging while this runs.
+ */
+void rc_log_async_stop(void)
+{
+#ifdef RC_LOG_ASYNC
+	if (!log_async_running)
+		return;
+
+	__atomic_store_n(&log_async_running, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&log_async_stopping, 1, __ATOMIC_RELEASE);
+	sem_post(&log_async_sem);
+	pthread_join(log_async_thread, NULL);
+
+	log_ring_drain();
+	sem_destroy(&log_async_sem);
+	free(log_ring);
+	log_ring = NULL;
+#endif
+}
+
+/** Deliver a formatted message to the sink, queued if possible
+ *
+ * @param prio the syslog priority.
+ * @param msg the message.
+ */
+static void log_write(int prio, char const *msg)
+{
+#ifdef RC_LOG_ASYNC
+	struct log_cell	*cell;
+	size_t		pos;
+
+	if (__atomic_load_n(&log_async_running, __ATOMIC_ACQUIRE)) {
+		cell = log_ring_claim(&pos);
+		if (cell == NULL) {
+			__atomic_add_fetch(&log_dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}
+		cell->prio = prio;
+		strlcpy(cell->msg, msg, sizeof(cell->msg));
+		log_ring_publish(cell, pos);
+		return;
+	}
+#endif
+	log_sink(log_sink_ctx, prio, msg);
+}
+
 /** Logs information on system log
+ *
+ * Messages below the level set with rc_log_set_level() are dropped before
+ * formatting, then the per call site rate limit applies, if any.
  *
  * @param prio the syslog priority.
  * @param format the format of the data to print.
  */
 void rc_log(int prio, char const *format, ...)
 {
-	char buff[1024];
+	char buff[LOG_MSG_LEN];
 	va_list ap;
 
+	if (!rc_log_enabled(prio))
+		return;
+
+	if (!log_rate_allow(prio, format))
+		return;
+
+#ifdef RC_LOG_ASYNC
+	va_start(ap, format);
+	if (log_async_vlog(prio, format, ap) == 0) {
+		va_end(ap);
+		return;
+	}
+	va_end(ap);
+#endif
+
 	va_start(ap,format);
 	vsnprintf(buff, sizeof(buff), format, ap);
 	va_end(ap);
 
-#ifndef _MSC_VER /* TODO: Fix me */
-	syslog(prio, "%s", buff);
-#endif
+	log_sink(log_sink_ctx, prio, buff);
 }
@@ -0,0 +1,397 @@
+/*
+ * md5-mb.c	Multi-buffer MD5 for hashing several independent
+ *		messages at once.
+ *
+ * License:	BSD
+ *
+ */
+
+#include <config.h>
+#include <includes.h>
+#include <freeradius-client.h>
+#include "util.h"
+
+#ifdef HAVE_SIMD_MD5
+#include <immintrin.h>
+#endif
+
+#define MD5_MB_BLOCK_LENGTH	64
+#define MD5_MB_MAX_LANES	8
+
+/*
+ * The 64 MD5 steps as (function, a, b, c, d, message word, constant, shift).
+ * Each lane implementation supplies its own STEP and F1-F4 macros.
+ */
+#define MD5_MB_ROUNDS(STEP, F1, F2, F3, F4) \
+	STEP(F1, a, b, c, d,  0, 0xd76aa478,  7); \
+	STEP(F1, d, a, b, c,  1, 0xe8c7b756, 12); \
+	STEP(F1, c, d, a, b,  2, 0x242070db, 17); \
+	STEP(F1, b, c, d, a,  3, 0xc1bdceee, 22); \
+	STEP(F1, a, b, c, d,  4, 0xf57c0faf,  7); \
+	STEP(F1, d, a, b, c,  5, 0x4787c62a, 12); \
+	STEP(F1, c, d, a, b,  6, 0xa8304613, 17); \
+	STEP(F1, b, c, d, a,  7, 0xfd469501, 22); \
+	STEP(F1, a, b, c, d,  8, 0x698098d8,  7); \
+	STEP(F1, d, a, b, c,  9, 0x8b44f7af, 12); \
+	STEP(F1, c, d, a, b, 10, 0xffff5bb1, 17); \
+	STEP(F1, b, c, d, a, 11, 0x895cd7be, 22); \
+	STEP(F1, a, b, c, d, 12, 0x6b901122,  7); \
+	STEP(F1, d, a, b, c, 13, 0xfd987193, 12); \
+	STEP(F1, c, d, a, b, 14, 0xa679438e, 17); \
+	STEP(F1, b, c, d, a, 15, 0x49b40821, 22); \
+	STEP(F2, a, b, c, d,  1, 0xf61e2562,  5); \
+	STEP(F2, d, a, b, c,  6, 0xc040b340,  9); \
+	STEP(F2, c, d, a, b, 11, 0x265e5a51, 14); \
+	STEP(F2, b, c, d, a,  0, 0xe9b6c7aa, 20); \
+	STEP(F2, a, b, c, d,  5, 0xd62f105d,  5); \
+	STEP(F2, d, a, b, c, 10, 0x02441453,  9); \
+	STEP(F2, c, d, a, b, 15, 0xd8a1e681, 14); \
+	STEP(F2, b, c, d, a,  4, 0xe7d3fbc8, 20); \
+	STEP(F2, a, b, c, d,  9, 0x21e1cde6,  5); \
+	STEP(F2, d, a, b, c, 14, 0xc33707d6,  9); \
+	STEP(F2, c, d, a, b,  3, 0xf4d50d87, 14); \
+	STEP(F2, b, c, d, a,  8, 0x455a14ed, 20); \
+	STEP(F2, a, b, c, d, 13, 0xa9e3e905,  5); \
+	STEP(F2, d, a, b, c,  2, 0xfcefa3f8,  9); \
+	STEP(F2, c, d, a, b,  7, 0x676f02d9, 14); \
+	STEP(F2, b, c, d, a, 12, 0x8d2a4c8a, 20); \
+	STEP(F3, a, b, c, d,  5, 0xfffa3942,  4); \
+	STEP(F3, d, a, b, c,  8, 0x8771f681, 11); \
+	STEP(F3, c, d, a, b, 11, 0x6d9d6122, 16); \
+	STEP(F3, b, c, d, a, 14, 0xfde5380c, 23); \
+	STEP(F3, a, b, c, d,  1, 0xa4beea44,  4); \
+	STEP(F3, d, a, b, c,  4, 0x4bdecfa9, 11); \
+	STEP(F3, c, d, a, b,  7, 0xf6bb4b60, 16); \
+	STEP(F3, b, c, d, a, 10, 0xbebfbc70, 23); \
+	STEP(F3, a, b, c, d, 13, 0x289b7ec6,  4); \
+	STEP(F3, d, a, b, c,  0, 0xeaa127fa, 11); \
+	STEP(F3, c, d, a, b,  3, 0xd4ef3085, 16); \
+	STEP(F3, b, c, d, a,  6, 0x04881d05, 23); \
+	STEP(F3, a, b, c, d,  9, 0xd9d4d039,  4); \
+	STEP(F3, d, a, b, c, 12, 0xe6db99e5, 11); \
+	STEP(F3, c, d, a, b, 15, 0x1fa27cf8, 16); \
+	STEP(F3, b, c, d, a,  2, 0xc4ac5665, 23); \
+	STEP(F4, a, b, c, d,  0, 0xf4292244,  6); \
+	STEP(F4, d, a, b, c,  7, 0x432aff97, 10); \
+	STEP(F4, c, d, a, b, 14, 0xab9423a7, 15); \
+	STEP(F4, b, c, d, a,  5, 0xfc93a039, 21); \
+	STEP(F4, a, b, c, d, 12, 0x655b59c3,  6); \
+	STEP(F4, d, a, b, c,  3, 0x8f0ccc92, 10); \
+	STEP(F4, c, d, a, b, 10, 0xffeff47d, 15); \
+	STEP(F4, b, c, d, a,  1, 0x85845dd1, 21); \
+	STEP(F4, a, b, c, d,  8, 0x6fa87e4f,  6); \
+	STEP(F4, d, a, b, c, 15, 0xfe2ce6e0, 10); \
+	STEP(F4, c, d, a, b,  6, 0xa3014314, 15); \
+	STEP(F4, b, c, d, a, 13, 0x4e0811a1, 21); \
+	STEP(F4, a, b, c, d,  4, 0xf7537e82,  6); \
+	STEP(F4, d, a, b, c, 11, 0xbd3af235, 10); \
+	STEP(F4, c, d, a, b,  2, 0x2ad7d2bb, 15); \
+	STEP(F4, b, c, d, a,  9, 0xeb86d391, 21)
+
+/** Per-lane view of a message: full blocks are read in place, the padded
+ * tail (one or two blocks) is built in a small local buffer.
+ */
+typedef struct md5_mb_lane {
+	unsigned char const	*input;
+	size_t			full_blocks;	//!< blocks read directly from input.
+	size_t			blocks;		//!< total blocks including the padded tail.
+	unsigned char		tail[2 * MD5_MB_BLOCK_LENGTH];
+} MD5_MB_LANE;
+
+static void md5_mb_lane_init(MD5_MB_LANE *lane, unsigned char const *input, size_t inlen)
+{
+	size_t rest;
+	uint64_t bits = (uint64_t)inlen << 3;
+	int i;
+
+	lane->input = input;
+	lane->full_blocks = inlen / MD5_MB_BLOCK_LENGTH;
+	rest = inlen % MD5_MB_BLOCK_LENGTH;
+
+	memset(lane->tail, 0, sizeof(lane->tail));
+	if (rest)
+		memcpy(lane->tail, input + lane->full_blocks * MD5_MB_BLOCK_LENGTH, rest);
+	lane->tail[rest] = 0x80;
+
+	lane->blocks = lane->full_blocks + ((rest + 1 + 8 > MD5_MB_BLOCK_LENGTH) ? 2 : 1);
+	for (i = 0; i < 8; i++)
+		lane->tail[(lane->blocks - lane->full_blocks) * MD5_MB_BLOCK_LENGTH - 8 + i] =
+			(unsigned char)(bits >> (8 * i));
+}
+
+static unsigned char const *md5_mb_lane_block(MD5_MB_LANE const *lane, size_t block)
+{
+	if (block < lane->full_blocks)
+		return lane->input + block * MD5_MB_BLOCK_LENGTH;
+
+	return lane->tail + (block - lane->full_blocks) * MD5_MB_BLOCK_LENGTH;
+}
+
+static uint32_t md5_mb_load32(unsigned char const *p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void md5_mb_store32(unsigned char *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+#ifdef HAVE_SIMD_MD5
+
+#define MD5_MB_IV_A	0x67452301
+#define MD5_MB_IV_B	0xefcdab89
+#define MD5_MB_IV_C	0x98badcfe
+#define MD5_MB_IV_D	0x10325476
+
+/* SSE2: four lanes of 32-bit words per register */
+#define SSE_F1(x, y, z)	_mm_xor_si128(z, _mm_and_si128(x, _mm_xor_si128(y, z)))
+#define SSE_F2(x, y, z)	SSE_F1(z, x, y)
+#define SSE_F3(x, y, z)	_mm_xor_si128(_mm_xor_si128(x, y), z)
+#define SSE_F4(x, y, z)	_mm_xor_si128(y, _mm_or_si128(x, _mm_xor_si128(z, ones)))
+#define SSE_STEP(f, w, x, y, z, i, k, s) do { \
+	w = _mm_add_epi32(w, _mm_add_epi32(f(x, y, z), \
+	    _mm_add_epi32(in[i], _mm_set1_epi32((int)(k))))); \
+	w = _mm_or_si128(_mm_slli_epi32(w, s), _mm_srli_epi32(w, 32 - (s))); \
+	w = _mm_add_epi32(w, x); \
+} while (0)
+
+__attribute__((target("sse2")))
+static void md5_mb_sse2(unsigned char **output, MD5_MB_LANE *lanes, int nlanes)
+{
+	__m128i a, b, c, d, sa, sb, sc, sd, mask, in[16];
+	__m128i const ones = _mm_set1_epi32(-1);
+	uint32_t word[4], active[4], out[4][4];
+	unsigned char const *blk[4];
+	size_t block, max_blocks = 0;
+	int i, l;
+
+	for (l = 0; l < nlanes; l++)
+		if (lanes[l].blocks > max_blocks)
+			max_blocks = lanes[l].blocks;
+
+	a = _mm_set1_epi32((int)MD5_MB_IV_A);
+	b = _mm_set1_epi32((int)MD5_MB_IV_B);
+	c = _mm_set1_epi32((int)MD5_MB_IV_C);
+	d = _mm_set1_epi32((int)MD5_MB_IV_D);
+
+	for (block = 0; block < max_blocks; block++) {
+		for (l = 0; l < 4; l++) {
+			if (l < nlanes && block < lanes[l].blocks) {
+				blk[l] = md5_mb_lane_block(&lanes[l], block);
+				active[l] = 0xffffffff;
+			} else {
+				blk[l] = lanes[0].tail;
+				active[l] = 0;
+			}
+		}
+		for (i = 0; i < 16; i++) {
+			for (l = 0; l < 4; l++)
+				word[l] = md5_mb_load32(blk[l] + 4 * i);
+			in[i] = _mm_loadu_si128((__m128i const *)word);
+		}
+		mask = _mm_loadu_si128((__m128i const *)active);
+
+		sa = a; sb = b; sc = c; sd = d;
+		MD5_MB_ROUNDS(SSE_STEP, SSE_F1, SSE_F2, SSE_F3, SSE_F4);
+		a = _mm_add_epi32(a, sa);
+		b = _mm_add_epi32(b, sb);
+		c = _mm_add_epi32(c, sc);
+		d = _mm_add_epi32(d, sd);
+
+		/* finished lanes keep their state */
+		a = _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, sa));
+		b = _mm_or_si128(_mm_and_si128(mask, b), _mm_andnot_si128(mask, sb));
+		c = _mm_or_si128(_mm_and_si128(mask, c), _mm_andnot_si128(mask, sc));
+		d = _mm_or_si128(_mm_and_si128(mask, d), _mm_andnot_si128(mask, sd));
+	}
+
+	_mm_storeu_si128((__m128i *)out[0], a);
+	_mm_storeu_si128((__m128i *)out[1], b);
+	_mm_storeu_si128((__m128i *)out[2], c);
+	_mm_storeu_si128((__m128i *)out[3], d);
+	for (l = 0; l < nlanes; l++)
+		for (i = 0; i < 4; i++)
+			md5_mb_store32(output[l] + 4 * i, out[i][l]);
+}
+
+/* AVX2: eight lanes of 32-bit words per register */
+#define AVX_F1(x, y, z)	_mm256_xor_si256(z, _mm256_and_si256(x, _mm256_xor_si256(y, z)))
+#define AVX_F2(x, y, z)	AVX_F1(z, x, y)
+#define AVX_F3(x, y, z)	_mm256_xor_si256(_mm256_xor_si256(x, y), z)
+#define AVX_F4(x, y, z)	_mm256_xor_si256(y, _mm256_or_si256(x, _mm256_xor_si256(z, ones)))
+#define AVX_STEP(f, w, x, y, z, i, k, s) do { \
+	w = _mm256_add_epi32(w, _mm256_add_epi32(f(x, y, z), \
+	    _mm256_add_epi32(in[i], _mm256_set1_epi32((int)(k))))); \
+	w = _mm256_or_si256(_mm256_slli_epi32(w, s), _mm256_srli_epi32(w, 32 - (s))); \
+	w = _mm256_add_epi32(w, x); \
+} while (0)
+
+__attribute__((target("avx2")))
+static void md5_mb_avx2(unsigned char **output, MD5_MB_LANE *lanes, int nlanes)
+{
+	__m256i a, b, c, d, sa, sb, sc, sd, mask, in[16];
+	__m256i const ones = _mm256_set1_epi32(-1);
+	uint32_t word[8], active[8], out[4][8];
+	unsigned char const *blk[8];
+	size_t block, max_blocks = 0;
+	int i, l;
+
+	for (l = 0; l < nlanes; l++)
+		if (lanes[l].blocks > max_blocks)
+			max_blocks = lanes[l].blocks;
+
+	a = _mm256_set1_epi32((int)MD5_MB_IV_A);
+	b = _mm256_set1_epi32((int)MD5_MB_IV_B);
+	c = _mm256_set1_epi32((int)MD5_MB_IV_C);
+	d = _mm256_set1_epi32((int)MD5_MB_IV_D);
+
+	for (block = 0; block < max_blocks; block++) {
+		for (l = 0; l < 8; l++) {
+			if (l < nlanes && block < lanes[l].blocks) {
+				blk[l] = md5_mb_lane_block(&lanes[l], block);
+				active[l] = 0xffffffff;
+			} else {
+				blk[l] = lanes[0].tail;
+				active[l] = 0;
+			}
+		}
+		for (i = 0; i < 16; i++) {
+			for (l = 0; l < 8; l++)
+				word[l] = md5_mb_load32(blk[l] + 4 * i);
+			in[i] = _mm256_loadu_si256((__m256i const *)word);
+		}
+		mask = _mm256_loadu_si256((__m256i const *)active);
+
+		sa = a; sb = b; sc = c; sd = d;
+		MD5_MB_ROUNDS(AVX_STEP, AVX_F1, AVX_F2, AVX_F3, AVX_F4);
+		a = _mm256_add_epi32(a, sa);
+		b = _mm256_add_epi32(b, sb);
+		c = _mm256_add_epi32(c, sc);
+		d = _mm256_add_epi32(d, sd);
+
+		/* finished lanes keep their state */
+		a = _mm256_blendv_epi8(sa, a, mask);
+		b = _mm256_blendv_epi8(sb, b, mask);
+		c = _mm256_blendv_epi8(sc, c, mask);
+		d = _mm256_blendv_epi8(sd, d, mask);
+	}
+
+	_mm256_storeu_si256((__m256i *)out[0], a);
+	_mm256_storeu_si256((__m256i *)out[1], b);
+	_mm256_storeu_si256((__m256i *)out[2], c);
+	_mm256_storeu_si256((__m256i *)out[3], d);
+	for (l = 0; l < nlanes; l++)
+		for (i = 0; i < 4; i++)
+			md5_mb_store32(output[l] + 4 * i, out[i][l]);
+}
+
+#endif /* HAVE_SIMD_MD5 */
+
+typedef void (*md5_mb_func)(unsigned char **, MD5_MB_LANE *, int);
+
+/* messages hashed per call, 0 until chosen; read and written atomically */
+static int md5_mb_lanes = 0;
+
+/** Find the widest multi-buffer implementation the CPU supports
+ *
+ * @param max the most lanes to use.
+ * @return the number of lanes, 1 for the scalar fallback.
+ */
+static int md5_mb_widest(int max)
+{
+#ifdef HAVE_SIMD_MD5
+	__builtin_cpu_init();
+	if (max >= 8 && __builtin_cpu_supports("avx2"))
+		return 8;
+	if (max >= 4 && __builtin_cpu_supports("sse2"))
+		return 4;
+#else
+	(void)max;
+#endif
+	return 1;
+}
+
+/** Get the implementation hashing a given number of lanes
+ *
+ * @param lanes a value returned by md5_mb_widest().
+ * @return the implementation, or NULL for the scalar fallback.
+ */
+static md5_mb_func md5_mb_func_for(int lanes)
+{
+#ifdef HAVE_SIMD_MD5
+	if (lanes == 8)
+		return md5_mb_avx2;
+	if (lanes == 4)
+		return md5_mb_sse2;
+#else
+	(void)lanes;
+#endif
+	return NULL;
+}
+
+/** Choose the number of lanes rc_md5_calc_multi() uses
+ *
+ * Without a call to this function the widest the CPU supports is used. The
+ * choice is process-wide; it exists to test each implementation.
+ *
+ * @param lanes 8 for AVX2, 4 for SSE2, 1 for rc_md5_calc() on each buffer, or 0
+ *	for the widest supported.
+ * @return 0 on success, -1 if the CPU or the build lacks that implementation.
+ */
+int rc_md5_calc_multi_set_lanes(int lanes)
+{
+	int width = md5_mb_widest(lanes > 0 ? lanes : MD5_MB_MAX_LANES);
+
+	if (lanes > 0 && width != lanes)
+		return -1;
+
+	__atomic_store_n(&md5_mb_lanes, width, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/** Hash several independent buffers using MD5
+ *
+ * The buffers are hashed in groups using SIMD lanes (8 with AVX2, 4 with SSE2) when
+ * the CPU supports it, otherwise each one is passed to rc_md5_calc(). Buffers of
+ * similar length make the best use of the lanes.
+ *
+ * @param[out] output an array of count pointers, each to a 16-byte checksum.
+ * @param[in] input an array of count pointers to data to hash.
+ * @param[in] inlen an array of count input lengths.
+ * @param[in] count the number of buffers.
+ */
+void rc_md5_calc_multi(unsigned char **output, unsigned char const **input,
+		       size_t const *inlen, unsigned int count)
+{
+	md5_mb_func func;
+	MD5_MB_LANE lane[MD5_MB_MAX_LANES];
+	unsigned int i, n, l, lanes;
+
+	lanes = __atomic_load_n(&md5_mb_lanes, __ATOMIC_RELAXED);
+	if (lanes == 0) {
+		lanes = md5_mb_widest(MD5_MB_MAX_LANES);
+		__atomic_store_n(&md5_mb_lanes, lanes, __ATOMIC_RELAXED);
+	}
+	func = md5_mb_func_for(lanes);
+
+	for (i = 0; i < count; i += n) {
+		n = count - i;
+		if (n > lanes)
+			n = lanes;
+
+		/* a single message gains nothing from the lanes */
+		if (func == NULL || n == 1) {
+			for (l = 0; l < n; l++)
+				rc_md5_calc(output[i + l], input[i + l], inlen[i + l]);
+			continue;
+		}
+
+		for (l = 0; l < n; l++)
+			md5_mb_lane_init(&lane[l], input[i + l], inlen[i + l]);
+		func(output + i, lane, (int)n);
+	}
+}
@@ -1,3 +1,4 @@
+#include <config.h>
 #include "md5.h"
 
 /*	The below was retrieved from
@@ -9,13 +9,7 @@
 #ifndef _RCRAD_MD5_H
 #define _RCRAD_MD5_H
 
-#include "config.h"
-
-#ifdef HAVE_NETTLE
-
-#include <nettle/md5-compat.h>
-
-#else
+/* config.h must come first in the file including this one */
 
 #ifdef HAVE_INTTYPES_H
 #include <inttypes.h>
@@ -81,6 +75,4 @@ void	 MD5Transform(uint32_t [4], uint8_t const [MD5_BLOCK_LENGTH])
 /*		__attribute__((__bounded__(__minbytes__,2,MD5_BLOCK_LENGTH)))*/;
 /* __END_DECLS */
 
-#endif /* HAVE_NETTLE */
-
 #endif /* _RCRAD_MD5_H */
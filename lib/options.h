@@ -48,7 +48,24 @@ static OPTION config_options_default[] = {
 {"radius_timeout",	OT_INT, ST_UNDEF, NULL},
 {"radius_retries",	OT_INT,	ST_UNDEF, NULL},
 {"radius_deadtime",	OT_INT, ST_UNDEF, NULL},
+{"radius_deadline",	OT_INT, ST_UNDEF, NULL},
 {"bindaddr",		OT_STR, ST_UNDEF, NULL},
+{"md5_backend",		OT_STR, ST_UNDEF, NULL},
+{"require_message_authenticator", OT_STR, ST_UNDEF, NULL},
+{"server_hash_key",	OT_STR, ST_UNDEF, NULL},
+{"daemon_socket",	OT_STR, ST_UNDEF, NULL},
+{"server_health_shm",	OT_STR, ST_UNDEF, NULL},
+{"server_max_outstanding", OT_INT, ST_UNDEF, NULL},
+{"server_rate",		OT_INT, ST_UNDEF, NULL},
+{"server_burst",	OT_INT, ST_UNDEF, NULL},
+{"server_overload",	OT_STR, ST_UNDEF, NULL},
+{"server_priority",	OT_STR, ST_UNDEF, NULL},
+{"server_breaker_window", OT_INT, ST_UNDEF, NULL},
+{"server_breaker_errors", OT_INT, ST_UNDEF, NULL},
+{"server_breaker_latency", OT_INT, ST_UNDEF, NULL},
+{"server_breaker_latency_factor", OT_INT, ST_UNDEF, NULL},
+{"server_breaker_eject", OT_INT, ST_UNDEF, NULL},
+{"server_breaker_probes", OT_INT, ST_UNDEF, NULL},
 /* local options */
 {"login_local",		OT_STR, ST_UNDEF, NULL},
 };
@@ -4,6 +4,11 @@
  * public domain source code
  */
 
+#include <config.h>
+#include <includes.h>
+#include <freeradius-client.h>
+#include "util.h"
+
 /*
  *  FORCE MD5 TO USE OUR MD5 HEADER FILE!
  *
@@ -11,6 +16,382 @@
  */
 #include "rc-md5.h"
 
+#ifdef HAVE_OPENSSL
+# include <openssl/evp.h>
+#endif
+
+#ifdef HAVE_PTHREAD_CREATE
+# include <pthread.h>
+#endif
+
+/* Length of the messages hashed by rc_md5_benchmark(); a typical RADIUS packet */
+#define MD5_BENCH_LEN		128
+#define MD5_BENCH_ROUNDS	3
+#define MD5_BENCH_ITERATIONS	256
+
+/** An MD5 implementation that can be selected at runtime */
+struct rc_md5_backend {
+	char const	*name;
+	int		(*available)(void);
+	void		(*calc)(unsigned char *, unsigned char const *, size_t);
+	void		(*init)(RC_MD5_CTX *);
+	void		(*update)(RC_MD5_CTX *, void const *, size_t);
+	void		(*final)(unsigned char *, RC_MD5_CTX *);
+	void		(*copy)(RC_MD5_CTX *, RC_MD5_CTX const *);
+	void		(*cleanup)(RC_MD5_CTX *);
+};
+
+/*
+ *	Bundled implementation (md5.c)
+ */
+static int md5_bundled_available(void)
+{
+	return 1;
+}
+
+static void md5_bundled_calc(unsigned char *output, unsigned char const *input, size_t inlen)
+{
+	MD5_CTX	context;
+
+	MD5Init(&context);
+	MD5Update(&context, input, inlen);
+	MD5Final(output, &context);
+}
+
+static void md5_bundled_init(RC_MD5_CTX *ctx)
+{
+	MD5Init(&ctx->u.bundled);
+}
+
+static void md5_bundled_update(RC_MD5_CTX *ctx, void const *input, size_t inlen)
+{
+	MD5Update(&ctx->u.bundled, input, inlen);
+}
+
+static void md5_bundled_final(unsigned char *output, RC_MD5_CTX *ctx)
+{
+	MD5Final(output, &ctx->u.bundled);
+}
+
+static void md5_bundled_copy(RC_MD5_CTX *dst, RC_MD5_CTX const *src)
+{
+	memcpy(&dst->u.bundled, &src->u.bundled, sizeof(dst->u.bundled));
+}
+
+static void md5_bundled_cleanup(RC_MD5_CTX *ctx)
+{
+	memset(&ctx->u.bundled, 0, sizeof(ctx->u.bundled));
+}
+
+static struct rc_md5_backend const md5_bundled = {
+	"bundled", md5_bundled_available, md5_bundled_calc,
+	md5_bundled_init, md5_bundled_update, md5_bundled_final,
+	md5_bundled_copy, md5_bundled_cleanup
+};
+
+#ifdef HAVE_NETTLE
+/*
+ *	nettle
+ */
+static int md5_nettle_available(void)
+{
+	return 1;
+}
+
+static void md5_nettle_calc(unsigned char *output, unsigned char const *input, size_t inlen)
+{
+	struct md5_ctx	context;
+
+	md5_init(&context);
+	md5_update(&context, inlen, input);
+	md5_digest(&context, MD5_DIGEST_SIZE, output);
+}
+
+static void md5_nettle_init(RC_MD5_CTX *ctx)
+{
+	md5_init(&ctx->u.nettle);
+}
+
+static void md5_nettle_update(RC_MD5_CTX *ctx, void const *input, size_t inlen)
+{
+	md5_update(&ctx->u.nettle, inlen, input);
+}
+
+static void md5_nettle_final(unsigned char *output, RC_MD5_CTX *ctx)
+{
+	md5_digest(&ctx->u.nettle, MD5_DIGEST_SIZE, output);
+	memset(&ctx->u.nettle, 0, sizeof(ctx->u.nettle));
+}
+
+static void md5_nettle_copy(RC_MD5_CTX *dst, RC_MD5_CTX const *src)
+{
+	memcpy(&dst->u.nettle, &src->u.nettle, sizeof(dst->u.nettle));
+}
+
+static void md5_nettle_cleanup(RC_MD5_CTX *ctx)
+{
+	memset(&ctx->u.nettle, 0, sizeof(ctx->u.nettle));
+}
+
+static struct rc_md5_backend const md5_nettle = {
+	"nettle", md5_nettle_available, md5_nettle_calc,
+	md5_nettle_init, md5_nettle_update, md5_nettle_final,
+	md5_nettle_copy, md5_nettle_cleanup
+};
+#endif /* HAVE_NETTLE */
+
+#ifdef HAVE_OPENSSL
+/*
+ *	OpenSSL EVP
+ */
+static EVP_MD const *md5_evp_md = NULL;
+
+static int md5_openssl_available(void)
+{
+	if (md5_evp_md == NULL) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+		/* Fetch once, instead of an implicit fetch on every EVP_DigestInit_ex() */
+		md5_evp_md = EVP_MD_fetch(NULL, "MD5", NULL);
+#else
+		md5_evp_md = EVP_md5();
+#endif
+	}
+
+	/* e.g. a FIPS provider refuses MD5 */
+	return md5_evp_md != NULL;
+}
+
+static void md5_openssl_calc(unsigned char *output, unsigned char const *input, size_t inlen)
+{
+	if (EVP_Digest(input, inlen, output, NULL, md5_evp_md, NULL) != 1) {
+		rc_log(LOG_CRIT, "rc_md5_calc: EVP_Digest failed");
+		memset(output, 0, MD5_DIGEST_LENGTH);
+	}
+}
+
+static void md5_openssl_init(RC_MD5_CTX *ctx)
+{
+	ctx->u.evp = EVP_MD_CTX_new();
+	if (ctx->u.evp == NULL || EVP_DigestInit_ex(ctx->u.evp, md5_evp_md, NULL) != 1)
+		rc_log(LOG_CRIT, "rc_md5_init: EVP_DigestInit_ex failed");
+}
+
+static void md5_openssl_update(RC_MD5_CTX *ctx, void const *input, size_t inlen)
+{
+	if (ctx->u.evp != NULL)
+		EVP_DigestUpdate(ctx->u.evp, input, inlen);
+}
+
+static void md5_openssl_final(unsigned char *output, RC_MD5_CTX *ctx)
+{
+	if (ctx->u.evp == NULL || EVP_DigestFinal_ex(ctx->u.evp, output, NULL) != 1)
+		memset(output, 0, MD5_DIGEST_LENGTH);
+	EVP_MD_CTX_free(ctx->u.evp);
+	ctx->u.evp = NULL;
+}
+
+static void md5_openssl_copy(RC_MD5_CTX *dst, RC_MD5_CTX const *src)
+{
+	dst->u.evp = EVP_MD_CTX_new();
+	if (dst->u.evp == NULL || src->u.evp == NULL ||
+	    EVP_MD_CTX_copy_ex(dst->u.evp, src->u.evp) != 1)
+		rc_log(LOG_CRIT, "rc_md5_copy: EVP_MD_CTX_copy_ex failed");
+}
+
+static void md5_openssl_cleanup(RC_MD5_CTX *ctx)
+{
+	EVP_MD_CTX_free(ctx->u.evp);
+	ctx->u.evp = NULL;
+}
+
+static struct rc_md5_backend const md5_openssl = {
+	"openssl", md5_openssl_available, md5_openssl_calc,
+	md5_openssl_init, md5_openssl_update, md5_openssl_final,
+	md5_openssl_copy, md5_openssl_cleanup
+};
+#endif /* HAVE_OPENSSL */
+
+static struct rc_md5_backend const *md5_backends[] = {
+	&md5_bundled,
+#ifdef HAVE_NETTLE
+	&md5_nettle,
+#endif
+#ifdef HAVE_OPENSSL
+	&md5_openssl,
+#endif
+	NULL
+};
+
+#define MD5_NUM_BACKENDS	((sizeof(md5_backends) / sizeof(md5_backends[0])) - 1)
+
+/*
+ *  The backend in use is one per process, not per handle: every handle
+ *  and every thread hashes with it.  It is read and written atomically,
+ *  as rc_read_config() on one handle may set it while requests on
+ *  another are being signed.  NULL until chosen, and then "auto".
+ */
+static struct rc_md5_backend const *md5_backend = NULL;
+
+/* the result of the "auto" benchmark, which runs at most once */
+static struct rc_md5_backend const *md5_fastest = NULL;
+#ifdef HAVE_PTHREAD_CREATE
+static pthread_once_t md5_fastest_once = PTHREAD_ONCE_INIT;
+#endif
+
+static struct rc_md5_backend const *md5_find_backend(char const *name)
+{
+	int i;
+
+	for (i = 0; md5_backends[i] != NULL; i++) {
+		if (strcasecmp(md5_backends[i]->name, name) == 0)
+			return md5_backends[i];
+	}
+
+	return NULL;
+}
+
+static double md5_bench_backend(struct rc_md5_backend const *backend)
+{
+	unsigned char	input[MD5_BENCH_LEN], output[MD5_DIGEST_LENGTH];
+	double		start, elapsed, best = -1;
+	int		i, round;
+
+	memset(input, 0x5a, sizeof(input));
+
+	for (round = 0; round < MD5_BENCH_ROUNDS; round++) {
+		start = rc_getmtime();
+		for (i = 0; i < MD5_BENCH_ITERATIONS; i++) {
+			backend->calc(output, input, sizeof(input));
+			input[0] = output[0];
+		}
+		elapsed = rc_getmtime() - start;
+		if (best < 0 || elapsed < best)
+			best = elapsed;
+	}
+
+	return best * 1e9 / MD5_BENCH_ITERATIONS;
+}
+
+/** Pick the fastest available backend on this host
+ *
+ * @return the selected backend, the bundled one if there is no choice to make.
+ */
+static struct rc_md5_backend const *md5_select_fastest(void)
+{
+	struct rc_md5_backend const *best = &md5_bundled;
+	double ns, best_ns = -1;
+	int i;
+
+	if (MD5_NUM_BACKENDS == 1)
+		return best;
+
+	for (i = 0; md5_backends[i] != NULL; i++) {
+		if (!md5_backends[i]->available())
+			continue;
+
+		ns = md5_bench_backend(md5_backends[i]);
+		if (best_ns < 0 || ns < best_ns) {
+			best_ns = ns;
+			best = md5_backends[i];
+		}
+	}
+
+	return best;
+}
+
+static void md5_pick_fastest(void)
+{
+	md5_fastest = md5_select_fastest();
+}
+
+/** Get the fastest backend, benchmarking them on the first call only
+ *
+ * @return the selected backend.
+ */
+static struct rc_md5_backend const *md5_auto_backend(void)
+{
+#ifdef HAVE_PTHREAD_CREATE
+	pthread_once(&md5_fastest_once, md5_pick_fastest);
+#else
+	if (md5_fastest == NULL)
+		md5_pick_fastest();
+#endif
+	return md5_fastest;
+}
+
+static struct rc_md5_backend const *md5_get_backend(void)
+{
+	struct rc_md5_backend const *backend;
+
+	backend = __atomic_load_n(&md5_backend, __ATOMIC_ACQUIRE);
+	if (backend == NULL)
+		backend = md5_auto_backend();
+
+	return backend;
+}
+
+/** Select the MD5 implementation used by the library
+ *
+ * The choice is process-wide, not per handle: it applies to every handle and
+ * thread, and the last call wins, including the one made by rc_read_config() for
+ * the md5_backend option. Computations already in progress finish with the
+ * backend they started with. Without a call to this function the fastest available
+ * backend is picked on first use, as with "auto".
+ *
+ * @param name one of "bundled", "nettle", "openssl" or "auto" to benchmark the
+ *	available backends and pick the fastest one; the benchmark runs once per
+ *	process and later calls reuse its result.
+ * @return 0 on success, -1 if the backend is unknown or not usable on this host.
+ */
+int rc_md5_set_backend(char const *name)
+{
+	struct rc_md5_backend const *backend;
+
+	if (strcasecmp(name, "auto") == 0) {
+		__atomic_store_n(&md5_backend, md5_auto_backend(), __ATOMIC_RELEASE);
+		return 0;
+	}
+
+	backend = md5_find_backend(name);
+	if (backend == NULL) {
+		rc_log(LOG_ERR, "rc_md5_set_backend: unknown or unsupported MD5 backend: %s", name);
+		return -1;
+	}
+	if (!backend->available()) {
+		rc_log(LOG_ERR, "rc_md5_set_backend: MD5 backend %s is not usable on this host", name);
+		return -1;
+	}
+
+	__atomic_store_n(&md5_backend, backend, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/** Get the name of the MD5 implementation in use
+ *
+ * @return the backend name.
+ */
+char const *rc_md5_get_backend(void)
+{
+	return md5_get_backend()->name;
+}
+
+/** Measure an MD5 backend on this host
+ *
+ * @param name the backend name, or %NULL for the one in use.
+ * @return the time in nanoseconds to hash a 128-byte message, or -1 if the
+ *	backend is unknown or not usable.
+ */
+double rc_md5_benchmark(char const *name)
+{
+	struct rc_md5_backend const *backend;
+
+	backend = (name != NULL) ? md5_find_backend(name) : md5_get_backend();
+	if (backend == NULL || !backend->available())
+		return -1;
+
+	return md5_bench_backend(backend);
+}
+
 /** Hash the provided data using MD5
  *
  * @param[out] output will hold a 16-byte checksum.
@@ -20,10 +401,56 @@
 void rc_md5_calc(unsigned char *output, unsigned char const *input,
 		 size_t inlen)
 {
-	MD5_CTX	context;
+	md5_get_backend()->calc(output, input, inlen);
+}
 
-	MD5Init(&context);
-	MD5Update(&context, input, inlen);
-	MD5Final(output, &context);
+/** Start an incremental MD5 computation with the backend in use
+ *
+ * @param ctx the context to initialise; release it with rc_md5_final() or rc_md5_cleanup().
+ */
+void rc_md5_init(RC_MD5_CTX *ctx)
+{
+	ctx->backend = md5_get_backend();
+	ctx->backend->init(ctx);
+}
+
+/** Add data to an incremental MD5 computation
+ *
+ * @param ctx an initialised context.
+ * @param input pointer to data to hash.
+ * @param inlen the length of input.
+ */
+void rc_md5_update(RC_MD5_CTX *ctx, void const *input, size_t inlen)
+{
+	ctx->backend->update(ctx, input, inlen);
 }
 
+/** Finish an incremental MD5 computation and release the context
+ *
+ * @param[out] output will hold a 16-byte checksum.
+ * @param ctx an initialised context.
+ */
+void rc_md5_final(unsigned char *output, RC_MD5_CTX *ctx)
+{
+	ctx->backend->final(output, ctx);
+}
+
+/** Duplicate an incremental MD5 computation
+ *
+ * @param dst an uninitialised context; release it with rc_md5_final() or rc_md5_cleanup().
+ * @param src an initialised context.
+ */
+void rc_md5_copy(RC_MD5_CTX *dst, RC_MD5_CTX const *src)
+{
+	dst->backend = src->backend;
+	src->backend->copy(dst, src);
+}
+
+/** Release a context without producing a digest
+ *
+ * @param ctx an initialised context.
+ */
+void rc_md5_cleanup(RC_MD5_CTX *ctx)
+{
+	ctx->backend->cleanup(ctx);
+}
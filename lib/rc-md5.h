@@ -9,20 +9,54 @@
 #ifndef _RC_MD5_H
 #define _RC_MD5_H
 
-#include "config.h"
+/* config.h must come first in the file including this one */
 #include <stdlib.h>
 
 #ifdef HAVE_NETTLE
+#include <nettle/md5.h>
+#endif
 
-#include <nettle/md5-compat.h>
-
-#else
-
+/*
+ *  The bundled implementation is always built, the others are
+ *  selected at runtime when configure found them.
+ */
 #include "md5.h"
 
-#endif /* HAVE_NETTLE */
+struct rc_md5_backend;
+
+/** An incremental MD5 computation, bound to the backend that started it */
+typedef struct rc_md5_ctx {
+	struct rc_md5_backend const *backend;
+	union {
+		MD5_CTX		bundled;
+#ifdef HAVE_NETTLE
+		struct md5_ctx	nettle;
+#endif
+#ifdef HAVE_OPENSSL
+		void		*evp;		//!< an EVP_MD_CTX, kept opaque so that OpenSSL headers stay in rc-md5.c.
+#endif
+	} u;
+} RC_MD5_CTX;
 
 void rc_md5_calc(unsigned char *output, unsigned char const *input,
 		     size_t inputlen);
 
+void rc_md5_init(RC_MD5_CTX *ctx);
+void rc_md5_update(RC_MD5_CTX *ctx, void const *input, size_t inputlen);
+void rc_md5_final(unsigned char *output, RC_MD5_CTX *ctx);
+void rc_md5_copy(RC_MD5_CTX *dst, RC_MD5_CTX const *src);
+void rc_md5_cleanup(RC_MD5_CTX *ctx);
+
+/** An incremental HMAC-MD5 computation, see hmac.c */
+typedef struct rc_hmac_ctx {
+	RC_MD5_CTX	inner;
+	RC_MD5_CTX	outer;
+} RC_HMAC_CTX;
+
+struct rc_conf;
+
+void rc_hmac_md5_init(struct rc_conf const *rh, RC_HMAC_CTX *ctx, char const *secret);
+void rc_hmac_md5_update(RC_HMAC_CTX *ctx, void const *data, size_t len);
+void rc_hmac_md5_final(unsigned char *digest, RC_HMAC_CTX *ctx);
+
 #endif /* _RC_MD5_H */
@@ -0,0 +1,274 @@
+/*
+ * reload.c	Atomically replaceable configuration snapshots.
+ *
+ * License:	BSD
+ *
+ */
+
+#include <config.h>
+#include <includes.h>
+#include <freeradius-client.h>
+#include "util.h"
+
+#define RELOAD_SLOTS		8
+#define RELOAD_SLOT_SHIFT	48
+#define RELOAD_COUNT_MASK	(((uint64_t)1 << RELOAD_SLOT_SHIFT) - 1)
+#define RELOAD_BIAS		((int64_t)1 << 56)
+
+/*
+ *  Snapshots are reference counted in two halves, so that taking a
+ *  reference is a single atomic add on a word every reader shares and
+ *  dropping one is a single atomic subtract on the snapshot itself.
+ *
+ *  'current' holds the slot of the published snapshot in its top bits
+ *  and the number of rc_reload_acquire() calls made on it below.  Each
+ *  rc_reload_release() subtracts one from the per-slot count, which
+ *  starts at RELOAD_BIAS so it cannot reach zero while published.
+ *  Replacing the snapshot swaps 'current' and moves the acquisitions
+ *  it saw over to the slot, minus the bias; whoever brings the slot
+ *  to zero, the reloader or the last reader, destroys the handle.
+ */
+struct rc_reload {
+	char		*config_file;
+	uint64_t	current;
+	rc_handle	*slot[RELOAD_SLOTS];
+	int64_t		refs[RELOAD_SLOTS];
+	int		busy;			//!< set while a reload is building a snapshot.
+};
+
+/** Destroy the handle of a slot and make the slot reusable
+ *
+ * @param rl the reload state.
+ * @param i the slot.
+ */
+static void reload_slot_free(RC_RELOAD *rl, int i)
+{
+	rc_handle *rh;
+
+	rh = __atomic_load_n(&rl->slot[i], __ATOMIC_ACQUIRE);
+	rc_destroy(rh);
+	__atomic_store_n(&rl->slot[i], NULL, __ATOMIC_RELEASE);
+}
+
+/** Carry the deadtime of servers over to a new snapshot
+ *
+ * @param dst the servers of the new snapshot.
+ * @param src the servers of the old snapshot.
+ */
+static void reload_copy_deadtime(SERVER *dst, SERVER const *src)
+{
+	int i, j;
+
+	if (dst == NULL || src == NULL)
+		return;
+
+	for (i = 0; i < dst->max; i++) {
+		for (j = 0; j < src->max; j++) {
+			if (dst->port[i] == src->port[j] && strcmp(dst->name[i], src->name[j]) == 0) {
+				dst->deadtime_ends[i] = src->deadtime_ends[j];
+				break;
+			}
+		}
+	}
+}
+
+/** Read the configuration, dictionary, mapfile and servers file into a new handle
+ *
+ * @param rl the reload state.
+ * @param old the snapshot being replaced, or NULL.
+ * @return the new handle, or NULL on failure.
+ */
+static rc_handle *reload_snapshot(RC_RELOAD *rl, rc_handle const *old)
+{
+	rc_handle	*rh;
+	char		*file;
+
+	rh = rc_read_config(rl->config_file);
+	if (rh == NULL)
+		return NULL;
+
+	if (rc_read_dictionary(rh, rc_conf_str(rh, "dictionary")) != 0)
+		goto fail;
+
+	/* like the servers file, a mapfile that does not exist is skipped */
+	if ((file = rc_conf_str(rh, "mapfile")) != NULL && access(file, F_OK) == 0 &&
+	    rc_read_mapfile(rh, file) != 0)
+		goto fail;
+
+	/* a servers file that does not exist is only an error once it is needed */
+	if (rh->opts.servers != NULL && access(rh->opts.servers, F_OK) == 0 &&
+	    rc_read_servers(rh) != 0)
+		goto fail;
+
+	if (old != NULL) {
+		reload_copy_deadtime(rh->opts.authserver, old->opts.authserver);
+		reload_copy_deadtime(rh->opts.acctserver, old->opts.acctserver);
+
+		if (rc_trace_copy(rh, old) != 0)
+			goto fail;
+
+		rc_stats_free(rh->stats);
+		rh->stats = rc_stats_ref(old->stats);
+	}
+
+	return rh;
+
+fail:
+	rc_destroy(rh);
+	return NULL;
+}
+
+/** Read a configuration file into a snapshot that can be reloaded
+ *
+ * The configuration, the dictionary it names, the mapfile and the
+ * servers file are read together.  Threads use the snapshot through rc_reload_acquire()
+ * and rc_reload_release(); rc_reload() replaces it.
+ *
+ * @param config_file the path of radiusclient.conf.
+ * @return the reload state (free with rc_reload_close()), or NULL on failure.
+ */
+RC_RELOAD *rc_reload_open(char const *config_file)
+{
+	RC_RELOAD *rl;
+
+	rl = malloc(sizeof(*rl));
+	if (rl == NULL) {
+		rc_log(LOG_CRIT, "rc_reload_open: out of memory");
+		return NULL;
+	}
+	memset(rl, 0, sizeof(*rl));
+
+	rl->config_file = strdup(config_file);
+	if (rl->config_file == NULL) {
+		rc_log(LOG_CRIT, "rc_reload_open: out of memory");
+		free(rl);
+		return NULL;
+	}
+
+	rl->slot[0] = reload_snapshot(rl, NULL);
+	if (rl->slot[0] == NULL) {
+		free(rl->config_file);
+		free(rl);
+		return NULL;
+	}
+	rl->refs[0] = RELOAD_BIAS;
+	rl->current = 0;
+
+	return rl;
+}
+
+/** Re-read the configuration and publish it as the current snapshot
+ *
+ * Requests already running keep the snapshot they acquired, which is
+ * destroyed once the last of them releases it.  Per-server statistics,
+ * the trace callback and the deadtime of servers that are still listed
+ * carry over to the new snapshot.
+ *
+ * @param rl the reload state.
+ * @return 0 on success, -1 on failure, in which case the current snapshot is kept.
+ */
+int rc_reload(RC_RELOAD *rl)
+{
+	rc_handle	*rh, *old;
+	uint64_t	prev, next;
+	int		i, busy = 0;
+
+	if (!__atomic_compare_exchange_n(&rl->busy, &busy, 1, 0,
+					 __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+		rc_log(LOG_ERR, "rc_reload: a reload is already in progress");
+		return -1;
+	}
+
+	for (i = 0; i < RELOAD_SLOTS; i++) {
+		if (__atomic_load_n(&rl->slot[i], __ATOMIC_ACQUIRE) == NULL)
+			break;
+	}
+	if (i == RELOAD_SLOTS) {
+		rc_log(LOG_ERR, "rc_reload: too many old configurations still in use");
+		__atomic_store_n(&rl->busy, 0, __ATOMIC_RELEASE);
+		return -1;
+	}
+
+	/* only the reloader changes which slot is current */
+	old = rl->slot[__atomic_load_n(&rl->current, __ATOMIC_RELAXED) >> RELOAD_SLOT_SHIFT];
+
+	rh = reload_snapshot(rl, old);
+	if (rh == NULL) {
+		rc_log(LOG_ERR, "rc_reload: keeping the current configuration");
+		__atomic_store_n(&rl->busy, 0, __ATOMIC_RELEASE);
+		return -1;
+	}
+
+	rl->refs[i] = RELOAD_BIAS;
+	__atomic_store_n(&rl->slot[i], rh, __ATOMIC_RELEASE);
+
+	next = (uint64_t)i << RELOAD_SLOT_SHIFT;
+	prev = __atomic_exchange_n(&rl->current, next, __ATOMIC_ACQ_REL);
+
+	i = prev >> RELOAD_SLOT_SHIFT;
+	if (__atomic_add_fetch(&rl->refs[i], (int64_t)(prev & RELOAD_COUNT_MASK) - RELOAD_BIAS,
+			       __ATOMIC_ACQ_REL) == 0)
+		reload_slot_free(rl, i);
+
+	__atomic_store_n(&rl->busy, 0, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/** Take a reference to the current snapshot
+ *
+ * Never blocks.  Every handle returned must be given back with
+ * rc_reload_release() once the request using it has finished.
+ *
+ * @param rl the reload state.
+ * @return a handle to parsed configuration.
+ */
+rc_handle *rc_reload_acquire(RC_RELOAD *rl)
+{
+	uint64_t cur;
+
+	cur = __atomic_fetch_add(&rl->current, 1, __ATOMIC_ACQUIRE);
+	return __atomic_load_n(&rl->slot[cur >> RELOAD_SLOT_SHIFT], __ATOMIC_ACQUIRE);
+}
+
+/** Drop a reference taken with rc_reload_acquire()
+ *
+ * @param rl the reload state.
+ * @param rh the handle returned by rc_reload_acquire().
+ */
+void rc_reload_release(RC_RELOAD *rl, rc_handle *rh)
+{
+	int i;
+
+	for (i = 0; i < RELOAD_SLOTS; i++) {
+		if (__atomic_load_n(&rl->slot[i], __ATOMIC_ACQUIRE) == rh)
+			break;
+	}
+	if (i == RELOAD_SLOTS) {
+		rc_log(LOG_CRIT, "rc_reload_release: handle was not acquired from this reload state");
+		return;
+	}
+
+	if (__atomic_sub_fetch(&rl->refs[i], 1, __ATOMIC_ACQ_REL) == 0)
+		reload_slot_free(rl, i);
+}
+
+/** Free the reload state and every snapshot
+ *
+ * All handles acquired must have been released.
+ *
+ * @param rl the reload state, may be NULL.
+ */
+void rc_reload_close(RC_RELOAD *rl)
+{
+	int i;
+
+	if (rl == NULL)
+		return;
+
+	for (i = 0; i < RELOAD_SLOTS; i++) {
+		if (rl->slot[i] != NULL)
+			rc_destroy(rl->slot[i]);
+	}
+	free(rl->config_file);
+	free(rl);
+}
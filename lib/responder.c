@@ -0,0 +1,523 @@
+/*
+ * responder.c	A stand-in RADIUS server on loopback, with fault injection,
+ *		for hermetic tests and benchmarks.
+ *
+ * License:	BSD
+ *
+ */
+
+#include <config.h>
+#include <includes.h>
+#include <freeradius-client.h>
+#include <poll.h>
+#include "util.h"
+#include "rc-md5.h"
+
+#ifdef HAVE_PTHREAD_CREATE
+# include <pthread.h>
+#endif
+
+#define	SA(p)	((struct sockaddr *)(p))
+
+#define RESPONDER_MAX_PACKET	4096
+#define RESPONDER_QUEUE		1024	//!< replies waiting out their delay.
+#define RESPONDER_HOLD		1.0	//!< seconds a reordered reply waits at most for the next one.
+#define RESPONDER_TICK		50	//!< milliseconds between checks for rc_responder_stop().
+
+/* a reply waiting to be sent */
+struct responder_reply {
+	double			when;
+	struct sockaddr_storage	to;
+	socklen_t		tolen;
+	int			len;
+	uint8_t			data[1];
+};
+
+struct rc_responder {
+	rc_handle const		*rh;
+	int			fd;
+	int			port;
+	int			stop;
+	char			secret[MAX_SECRET_LENGTH + 1];
+	int			access_code;
+	double			loss, duplicate, reorder, bad_auth;
+	double			delay, jitter;		//!< seconds.
+	uint64_t		rng;
+	uint8_t			access_attrs[RESPONDER_MAX_PACKET];
+	int			access_len;
+	uint8_t			acct_attrs[RESPONDER_MAX_PACKET];
+	int			acct_len;
+	struct responder_reply	*queue[RESPONDER_QUEUE];	//!< by send time.
+	int			queued;
+	struct responder_reply	*held;			//!< reordered, sent after the next reply.
+	double			held_until;
+	RC_RESPONDER_STATS	stats;
+#ifdef HAVE_PTHREAD_CREATE
+	pthread_t		tid;
+#endif
+};
+
+/** Draw from the fault generator
+ *
+ * @param r the responder.
+ * @return a number in [0, 1).
+ */
+static double responder_rand(struct rc_responder *r)
+{
+	/* xorshift64*, so that a seed replays the same faults */
+	r->rng ^= r->rng >> 12;
+	r->rng ^= r->rng << 25;
+	r->rng ^= r->rng >> 27;
+	return ((r->rng * 0x2545F4914F6CDD1DULL) >> 11) / 9007199254740992.0;
+}
+
+static int responder_chance(struct rc_responder *r, double p)
+{
+	return p > 0 && responder_rand(r) < p;
+}
+
+/** Encode reply attributes once, with the library's own codec
+ *
+ * @param r the responder.
+ * @param vp the attributes.
+ * @param[out] out the encoded attributes.
+ * @return their length, or -1 if they do not fit.
+ */
+static int responder_encode(struct rc_responder *r, VALUE_PAIR *vp, uint8_t *out)
+{
+	uint8_t		buf[BUFFER_LEN];
+	AUTH_HDR	*auth = (AUTH_HDR *)buf;
+	int		len;
+
+	if (vp == NULL)
+		return 0;
+
+	memset(auth, 0, AUTH_HDR_LEN);
+	auth->code = PW_ACCESS_ACCEPT;
+	len = rc_pack_list(r->rh, vp, r->secret, auth, RESPONDER_MAX_PACKET - (AUTH_VECTOR_LEN + 2));
+	if (len < 0) {
+		rc_log(LOG_ERR, "rc_responder_start: reply attributes are too long");
+		return -1;
+	}
+	memcpy(out, auth->data, len);
+
+	return len;
+}
+
+/** Check the authenticators of a request
+ *
+ * @param r the responder.
+ * @param pkt the request.
+ * @param len its length.
+ * @return 0 if it is valid, -1 otherwise.
+ */
+static int responder_verify(struct rc_responder *r, uint8_t *pkt, int len)
+{
+	AUTH_HDR	*auth = (AUTH_HDR *)pkt;
+	uint8_t		*attr, *msg_auth = NULL;
+	uint8_t		zero[AUTH_VECTOR_LEN], saved[AUTH_VECTOR_LEN], digest[AUTH_VECTOR_LEN];
+	RC_MD5_CTX	ctx;
+
+	for (attr = auth->data; attr < pkt + len; attr += attr[1]) {
+		if (attr + 2 > pkt + len || attr[1] < 2 || attr + attr[1] > pkt + len)
+			return -1;
+		if (attr[0] == PW_MESSAGE_AUTHENTICATOR) {
+			if (attr[1] != AUTH_VECTOR_LEN + 2)
+				return -1;
+			msg_auth = attr + 2;
+		}
+	}
+
+	memset(zero, 0, sizeof(zero));
+	if (auth->code == PW_ACCOUNTING_REQUEST) {
+		rc_md5_init(&ctx);
+		rc_md5_update(&ctx, pkt, AUTH_HDR_LEN - AUTH_VECTOR_LEN);
+		rc_md5_update(&ctx, zero, AUTH_VECTOR_LEN);
+		rc_md5_update(&ctx, auth->data, len - AUTH_HDR_LEN);
+		rc_md5_update(&ctx, r->secret, strlen(r->secret));
+		rc_md5_final(digest, &ctx);
+		return memcmp(digest, auth->vector, AUTH_VECTOR_LEN) == 0 ? 0 : -1;
+	}
+
+	/* RFC 5997 makes it mandatory in Status-Server */
+	if (msg_auth == NULL)
+		return auth->code == PW_STATUS_SERVER ? -1 : 0;
+
+	memcpy(saved, msg_auth, AUTH_VECTOR_LEN);
+	memset(msg_auth, 0, AUTH_VECTOR_LEN);
+	rc_hmac_md5(r->rh, digest, pkt, len, r->secret);
+	memcpy(msg_auth, saved, AUTH_VECTOR_LEN);
+
+	return memcmp(digest, saved, AUTH_VECTOR_LEN) == 0 ? 0 : -1;
+}
+
+/** Queue a reply by the time it is due
+ *
+ * @param r the responder.
+ * @param reply the reply.
+ */
+static void responder_queue(struct rc_responder *r, struct responder_reply *reply)
+{
+	int i;
+
+	if (r->queued == RESPONDER_QUEUE) {
+		RC_STATS_INC(&r->stats, lost);
+		free(reply);
+		return;
+	}
+
+	for (i = r->queued; i > 0 && r->queue[i - 1]->when > reply->when; i--)
+		r->queue[i] = r->queue[i - 1];
+	r->queue[i] = reply;
+	r->queued++;
+}
+
+/** Answer a request, or drop it as configured
+ *
+ * @param r the responder.
+ * @param pkt the request.
+ * @param len its length.
+ * @param from the client.
+ * @param fromlen the length of from.
+ */
+static void responder_answer(struct rc_responder *r, uint8_t *pkt, int len,
+			     struct sockaddr_storage const *from, socklen_t fromlen)
+{
+	AUTH_HDR		*req = (AUTH_HDR *)pkt, *auth;
+	struct responder_reply	*reply;
+	uint8_t			*p, *msg_auth = NULL, *attr, *attrs;
+	uint8_t			digest[AUTH_VECTOR_LEN];
+	int			code, attrs_len, secretlen = strlen(r->secret);
+
+	if (len < AUTH_HDR_LEN || ntohs(req->length) < AUTH_HDR_LEN || ntohs(req->length) > len) {
+		RC_STATS_INC(&r->stats, invalid);
+		return;
+	}
+	len = ntohs(req->length);
+
+	switch (req->code) {
+	case PW_ACCESS_REQUEST:
+		code = r->access_code;
+		attrs = r->access_attrs;
+		attrs_len = r->access_len;
+		break;
+	case PW_ACCOUNTING_REQUEST:
+		code = PW_ACCOUNTING_RESPONSE;
+		attrs = r->acct_attrs;
+		attrs_len = r->acct_len;
+		break;
+	case PW_STATUS_SERVER:
+		code = PW_ACCESS_ACCEPT;
+		attrs = NULL;
+		attrs_len = 0;
+		break;
+	default:
+		RC_STATS_INC(&r->stats, invalid);
+		return;
+	}
+
+	if (responder_verify(r, pkt, len) != 0) {
+		RC_STATS_INC(&r->stats, invalid);
+		return;
+	}
+	RC_STATS_INC(&r->stats, requests);
+
+	if (responder_chance(r, r->loss)) {
+		RC_STATS_INC(&r->stats, lost);
+		return;
+	}
+
+	/* the secret is appended for the response authenticator */
+	reply = malloc(sizeof(*reply) + RESPONDER_MAX_PACKET + secretlen);
+	if (reply == NULL) {
+		RC_STATS_INC(&r->stats, lost);
+		return;
+	}
+	auth = (AUTH_HDR *)reply->data;
+	auth->code = code;
+	auth->id = req->id;
+	memcpy(auth->vector, req->vector, AUTH_VECTOR_LEN);
+
+	p = auth->data;
+	if (code != PW_ACCOUNTING_RESPONSE) {
+		*p++ = PW_MESSAGE_AUTHENTICATOR;
+		*p++ = AUTH_VECTOR_LEN + 2;
+		msg_auth = p;
+		memset(p, 0, AUTH_VECTOR_LEN);
+		p += AUTH_VECTOR_LEN;
+	}
+	if (attrs_len > 0) {
+		memcpy(p, attrs, attrs_len);
+		p += attrs_len;
+	}
+
+	/* Proxy-State goes back unchanged, as a real server does */
+	for (attr = req->data; attr < pkt + len; attr += attr[1]) {
+		if (attr[0] != PW_PROXY_STATE)
+			continue;
+		if (p + attr[1] > reply->data + RESPONDER_MAX_PACKET)
+			break;
+		memcpy(p, attr, attr[1]);
+		p += attr[1];
+	}
+
+	reply->len = p - reply->data;
+	auth->length = htons(reply->len);
+
+	if (msg_auth != NULL) {
+		rc_hmac_md5(r->rh, digest, reply->data, reply->len, r->secret);
+		memcpy(msg_auth, digest, AUTH_VECTOR_LEN);
+	}
+	memcpy(p, r->secret, secretlen);
+	rc_md5_calc(digest, reply->data, reply->len + secretlen);
+	memcpy(auth->vector, digest, AUTH_VECTOR_LEN);
+
+	if (responder_chance(r, r->bad_auth)) {
+		auth->vector[0] ^= 0xff;
+		RC_STATS_INC(&r->stats, corrupted);
+	}
+
+	memcpy(&reply->to, from, fromlen);
+	reply->tolen = fromlen;
+	reply->when = rc_getmtime() + r->delay;
+	if (r->jitter > 0)
+		reply->when += r->jitter * responder_rand(r);
+
+	responder_queue(r, reply);
+}
+
+static void responder_sendto(struct rc_responder *r, struct responder_reply const *reply)
+{
+	if (sendto(r->fd, reply->data, reply->len, 0, SA(&reply->to), reply->tolen) == reply->len)
+		RC_STATS_INC(&r->stats, replies);
+}
+
+/** Send a reply that is due, with duplication and reordering
+ *
+ * @param r the responder.
+ * @param reply the reply, freed here unless it is held back.
+ * @param now the current time.
+ */
+static void responder_send(struct rc_responder *r, struct responder_reply *reply, double now)
+{
+	if (r->held == NULL && responder_chance(r, r->reorder)) {
+		RC_STATS_INC(&r->stats, reordered);
+		r->held = reply;
+		r->held_until = now + RESPONDER_HOLD;
+		return;
+	}
+
+	responder_sendto(r, reply);
+	if (responder_chance(r, r->duplicate)) {
+		RC_STATS_INC(&r->stats, duplicated);
+		responder_sendto(r, reply);
+	}
+	free(reply);
+
+	if (r->held != NULL) {
+		responder_sendto(r, r->held);
+		free(r->held);
+		r->held = NULL;
+	}
+}
+
+static void *responder_run(void *arg)
+{
+	struct rc_responder	*r = arg;
+	struct pollfd		pfd;
+	struct sockaddr_storage	from;
+	socklen_t		fromlen;
+	uint8_t			pkt[RESPONDER_MAX_PACKET];
+	double			now, wait;
+	int			i, n, len;
+
+	while (!__atomic_load_n(&r->stop, __ATOMIC_ACQUIRE)) {
+		now = rc_getmtime();
+		wait = RESPONDER_TICK / 1000.0;
+		if (r->queued > 0 && r->queue[0]->when - now < wait)
+			wait = r->queue[0]->when - now;
+		if (r->held != NULL && r->held_until - now < wait)
+			wait = r->held_until - now;
+
+		pfd.fd = r->fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, wait > 0 ? (int)(wait * 1000) + 1 : 0) < 0 && errno != EINTR) {
+			rc_log(LOG_ERR, "rc_responder: poll: %s", strerror(errno));
+			break;
+		}
+
+		/* a bounded batch, so that due replies are not starved */
+		for (i = 0; i < 64 && (pfd.revents & POLLIN) != 0; i++) {
+			fromlen = sizeof(from);
+			len = recvfrom(r->fd, pkt, sizeof(pkt), MSG_DONTWAIT, SA(&from), &fromlen);
+			if (len < 0)
+				break;
+			responder_answer(r, pkt, len, &from, fromlen);
+		}
+
+		now = rc_getmtime();
+		for (n = 0; n < r->queued && r->queue[n]->when <= now; n++)
+			responder_send(r, r->queue[n], now);
+		if (n > 0) {
+			r->queued -= n;
+			memmove(r->queue, r->queue + n, r->queued * sizeof(r->queue[0]));
+		}
+
+		if (r->held != NULL && r->held_until <= now) {
+			responder_sendto(r, r->held);
+			free(r->held);
+			r->held = NULL;
+		}
+	}
+
+	return NULL;
+}
+
+/** Start a stand-in RADIUS server on loopback
+ *
+ * It answers Access-Request with conf->access_code, Accounting-Request
+ * with Accounting-Response and Status-Server with Access-Accept, using
+ * this library's codec, and drops requests that fail verification.  The
+ * faults in conf are drawn independently for every request.  It runs on
+ * a thread of its own until rc_responder_stop().
+ *
+ * @param rh a handle to parsed configuration with a dictionary; it must
+ *	outlive the responder.
+ * @param conf the replies and faults; the pairs are encoded at once and
+ *	not kept.
+ * @return the responder, or NULL on failure.
+ */
+RC_RESPONDER *rc_responder_start(rc_handle const *rh, RC_RESPONDER_CONF const *conf)
+{
+#ifdef HAVE_PTHREAD_CREATE
+	struct rc_responder	*r;
+	struct sockaddr_storage	ss;
+	socklen_t		sslen;
+	sigset_t		set, old;
+	int			rc;
+
+	if (conf->secret == NULL || strlen(conf->secret) > MAX_SECRET_LENGTH) {
+		rc_log(LOG_ERR, "rc_responder_start: missing or too long secret");
+		return NULL;
+	}
+
+	r = calloc(1, sizeof(*r));
+	if (r == NULL) {
+		rc_log(LOG_CRIT, "rc_responder_start: out of memory");
+		return NULL;
+	}
+	r->rh = rh;
+	strcpy(r->secret, conf->secret);
+	r->access_code = conf->access_code != 0 ? conf->access_code : PW_ACCESS_ACCEPT;
+	r->loss = conf->loss;
+	r->duplicate = conf->duplicate;
+	r->reorder = conf->reorder;
+	r->bad_auth = conf->bad_auth;
+	r->delay = conf->delay_ms / 1000.0;
+	r->jitter = conf->jitter_ms / 1000.0;
+	r->rng = conf->seed;
+	while (r->rng == 0)
+		rc_random_bytes(&r->rng, sizeof(r->rng));
+
+	if ((r->access_len = responder_encode(r, conf->access_pairs, r->access_attrs)) < 0 ||
+	    (r->acct_len = responder_encode(r, conf->acct_pairs, r->acct_attrs)) < 0) {
+		free(r);
+		return NULL;
+	}
+
+	memset(&ss, 0, sizeof(ss));
+	if (conf->ipv6) {
+		((struct sockaddr_in6 *)&ss)->sin6_family = AF_INET6;
+		((struct sockaddr_in6 *)&ss)->sin6_addr = in6addr_loopback;
+		((struct sockaddr_in6 *)&ss)->sin6_port = htons(conf->port);
+		sslen = sizeof(struct sockaddr_in6);
+	} else {
+		((struct sockaddr_in *)&ss)->sin_family = AF_INET;
+		((struct sockaddr_in *)&ss)->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		((struct sockaddr_in *)&ss)->sin_port = htons(conf->port);
+		sslen = sizeof(struct sockaddr_in);
+	}
+
+	r->fd = socket(ss.ss_family, SOCK_DGRAM, 0);
+	if (r->fd < 0 || bind(r->fd, SA(&ss), sslen) < 0 ||
+	    getsockname(r->fd, SA(&ss), &sslen) < 0) {
+		rc_log(LOG_ERR, "rc_responder_start: can't listen on port %u: %s",
+		       conf->port, strerror(errno));
+		if (r->fd >= 0)
+			close(r->fd);
+		free(r);
+		return NULL;
+	}
+	fcntl(r->fd, F_SETFD, FD_CLOEXEC);
+	r->port = ntohs(conf->ipv6 ? ((struct sockaddr_in6 *)&ss)->sin6_port
+				   : ((struct sockaddr_in *)&ss)->sin_port);
+
+	/* signals are for the threads of the application */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, &old);
+	rc = pthread_create(&r->tid, NULL, responder_run, r);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (rc != 0) {
+		rc_log(LOG_ERR, "rc_responder_start: can't start a thread: %s", strerror(rc));
+		close(r->fd);
+		free(r);
+		return NULL;
+	}
+
+	return r;
+#else
+	rc_log(LOG_ERR, "rc_responder_start: needs thread support");
+	return NULL;
+#endif
+}
+
+/** The UDP port a responder listens on
+ *
+ * @param r the responder.
+ * @return the port, useful when it was started with port 0.
+ */
+int rc_responder_port(RC_RESPONDER const *r)
+{
+	return r->port;
+}
+
+/** Copy the counters of a responder
+ *
+ * @param r the responder.
+ * @param[out] stats the counters.
+ */
+void rc_responder_stats(RC_RESPONDER const *r, RC_RESPONDER_STATS *stats)
+{
+	stats->requests = __atomic_load_n(&r->stats.requests, __ATOMIC_RELAXED);
+	stats->invalid = __atomic_load_n(&r->stats.invalid, __ATOMIC_RELAXED);
+	stats->replies = __atomic_load_n(&r->stats.replies, __ATOMIC_RELAXED);
+	stats->lost = __atomic_load_n(&r->stats.lost, __ATOMIC_RELAXED);
+	stats->duplicated = __atomic_load_n(&r->stats.duplicated, __ATOMIC_RELAXED);
+	stats->reordered = __atomic_load_n(&r->stats.reordered, __ATOMIC_RELAXED);
+	stats->corrupted = __atomic_load_n(&r->stats.corrupted, __ATOMIC_RELAXED);
+}
+
+/** Stop a responder and free it
+ *
+ * Replies still waiting out their delay are dropped.
+ *
+ * @param r the responder, may be NULL.
+ */
+void rc_responder_stop(RC_RESPONDER *r)
+{
+	int i;
+
+	if (r == NULL)
+		return;
+
+#ifdef HAVE_PTHREAD_CREATE
+	__atomic_store_n(&r->stop, 1, __ATOMIC_RELEASE);
+	pthread_join(r->tid, NULL);
+#endif
+	close(r->fd);
+	for (i = 0; i < r->queued; i++)
+		free(r->queue[i]);
+	free(r->held);
+	free(r);
+}
@@ -0,0 +1,201 @@
+/*
+ * ring.c	Consistent hashing of requests onto a pool of servers.
+ *
+ * License:	BSD
+ *
+ */
+
+#include <config.h>
+#include <includes.h>
+#include <freeradius-client.h>
+#include "util.h"
+
+#define RING_VNODES		160	//!< points on the ring per server.
+#define RING_SEEN_WORDS		4	//!< servers tracked without malloc, in units of 64.
+
+/*
+ *  Every server owns RING_VNODES points, placed by hashing its name and
+ *  port, so adding or removing one server only moves the keys between
+ *  its points and their predecessors: about 1/n of them.  A key goes to
+ *  the owner of the first point at or after its hash; walking on from
+ *  there gives the order in which to fail over.
+ */
+struct rc_ring_point {
+	uint32_t	hash;
+	int		server;
+};
+
+struct rc_server_ring {
+	int			servers;	//!< srv->max when the ring was built.
+	int			points;
+	struct rc_ring_point	point[1];
+};
+
+/** Hash a buffer to 32 bits
+ *
+ * FNV-1a, followed by a finaliser so that keys differing only in their
+ * last bytes still land far apart on the ring.
+ *
+ * @param data the buffer.
+ * @param len the length of data.
+ * @return the hash.
+ */
+static uint32_t ring_hash(void const *data, size_t len)
+{
+	uint8_t const	*p = data;
+	uint64_t	h = 0xcbf29ce484222325ULL;
+	size_t		i;
+
+	for (i = 0; i < len; i++) {
+		h ^= p[i];
+		h *= 0x100000001b3ULL;
+	}
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+
+	return (uint32_t)(h >> 32);
+}
+
+static int ring_point_cmp(void const *a, void const *b)
+{
+	struct rc_ring_point const *pa = a, *pb = b;
+
+	if (pa->hash != pb->hash)
+		return pa->hash < pb->hash ? -1 : 1;
+
+	return pa->server - pb->server;
+}
+
+/** Build the consistent hash ring of a server pool
+ *
+ * Does nothing if the ring already covers every server of the pool.
+ *
+ * @param srv the server pool.
+ * @return 0 on success, -1 when out of memory.
+ */
+int rc_server_ring_build(SERVER *srv)
+{
+	struct rc_server_ring	*ring;
+	char			buf[512];
+	int			i, v, n, len;
+
+	if (srv->ring != NULL && srv->ring->servers == srv->max)
+		return 0;
+
+	rc_server_ring_free(srv);
+	if (srv->max == 0)
+		return 0;
+
+	ring = malloc(sizeof(*ring) + (size_t)srv->max * RING_VNODES * sizeof(ring->point[0]));
+	if (ring == NULL) {
+		rc_log(LOG_CRIT, "rc_server_ring_build: out of memory");
+		return -1;
+	}
+
+	n = 0;
+	for (i = 0; i < srv->max; i++) {
+		for (v = 0; v < RING_VNODES; v++) {
+			len = snprintf(buf, sizeof(buf), "%s:%u-%d", srv->name[i], srv->port[i], v);
+			if (len >= (int)sizeof(buf))
+				len = sizeof(buf) - 1;
+			ring->point[n].hash = ring_hash(buf, len);
+			ring->point[n].server = i;
+			n++;
+		}
+	}
+	qsort(ring->point, n, sizeof(ring->point[0]), ring_point_cmp);
+
+	ring->servers = srv->max;
+	ring->points = n;
+	srv->ring = ring;
+
+	return 0;
+}
+
+/** Free the consistent hash ring of a server pool
+ *
+ * @param srv the server pool.
+ */
+void rc_server_ring_free(SERVER *srv)
+{
+	free(srv->ring);
+	srv->ring = NULL;
+}
+
+/** Order the servers of a pool for a request, by consistent hashing of a key
+ *
+ * The first server is the one owning the key; the others follow in ring
+ * order, so that failing over from a dead server spreads its keys over
+ * the rest of the pool instead of piling them onto one neighbour.
+ *
+ * @param srv the server pool, with a ring built by rc_server_ring_build().
+ * @param key the attribute whose value is hashed.
+ * @param[out] order receives srv->max server indexes.
+ * @return 0 on success, -1 if the pool has no ring or memory ran out.
+ */
+int rc_server_ring_order(SERVER const *srv, VALUE_PAIR const *key, int *order)
+{
+	struct rc_server_ring const	*ring = srv->ring;
+	uint64_t			seen_buf[RING_SEEN_WORDS], *seen = seen_buf;
+	uint8_t				buf[4];
+	uint32_t			h;
+	int				lo, hi, mid, i, n, s, words;
+
+	if (ring == NULL || ring->servers != srv->max)
+		return -1;
+
+	switch (key->type) {
+	case PW_TYPE_STRING:
+	case PW_TYPE_IPV6ADDR:
+	case PW_TYPE_IPV6PREFIX:
+		h = ring_hash(key->strvalue, key->lvalue);
+		break;
+
+	default:
+		buf[0] = key->lvalue >> 24;
+		buf[1] = key->lvalue >> 16;
+		buf[2] = key->lvalue >> 8;
+		buf[3] = key->lvalue;
+		h = ring_hash(buf, sizeof(buf));
+		break;
+	}
+
+	/* first point at or after the hash, wrapping around */
+	lo = 0;
+	hi = ring->points;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (ring->point[mid].hash < h)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	words = (srv->max + 63) / 64;
+	if (words > RING_SEEN_WORDS) {
+		seen = malloc(words * sizeof(*seen));
+		if (seen == NULL) {
+			rc_log(LOG_CRIT, "rc_server_ring_order: out of memory");
+			return -1;
+		}
+	}
+	memset(seen, 0, words * sizeof(*seen));
+
+	n = 0;
+	for (i = 0; i < ring->points && n < srv->max; i++) {
+		s = ring->point[(lo + i) % ring->points].server;
+		if (seen[s / 64] & (1ULL << (s % 64)))
+			continue;
+		seen[s / 64] |= 1ULL << (s % 64);
+		order[n++] = s;
+	}
+
+	if (seen != seen_buf)
+		free(seen);
+
+	return 0;
+}
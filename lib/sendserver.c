@@ -19,80 +19,140 @@
 #include <config.h>
 #include <includes.h>
 #include <freeradius-client.h>
-#include <pathnames.h>
-
-#if (defined(__APPLE__) || defined(__FreeBSD__)) && defined(HAVE_GETENTROPY)
-# include <sys/random.h>
-#endif
 
 #include "util.h"
+#include "rc-md5.h"
 
 #define	SA(p)	((struct sockaddr *)(p))
 
 static void rc_random_vector (unsigned char *);
-static int rc_check_reply (AUTH_HDR *, int, char const *, unsigned char const *, unsigned char);
+
+/** The length of the value of an attribute as packed by rc_pack_list()
+ *
+ * @param vp a pointer to a #VALUE_PAIR.
+ * @return the length, or -1 if the type is not sent.
+ */
+static int rc_pack_value_len (VALUE_PAIR const *vp)
+{
+	int length;
+
+	if (vp->attribute == PW_USER_PASSWORD)
+	{
+		/* Chop off password at AUTH_PASS_LEN, pad to whole vectors */
+		length = vp->lvalue;
+		if (length > AUTH_PASS_LEN)
+			length = AUTH_PASS_LEN;
+		return (length+(AUTH_VECTOR_LEN-1)) & ~(AUTH_VECTOR_LEN-1);
+	}
+
+	switch (vp->type)
+	{
+	  case PW_TYPE_STRING:
+	  case PW_TYPE_IPV6PREFIX:
+		return vp->lvalue;
+
+	  case PW_TYPE_IPV6ADDR:
+		return 16;
+
+	  case PW_TYPE_INTEGER:
+	  case PW_TYPE_IPADDR:
+	  case PW_TYPE_DATE:
+		return sizeof (uint32_t);
+
+	  default:
+		return -1;
+	}
+}
 
 /** Packs an attribute value pair list into a buffer
  *
+ * Access-Request and Status-Server packets get a Message-Authenticator
+ * as their first attribute, replacing any the caller supplied.  It is
+ * computed here, so the request authenticator must already be set.
+ *
+ * Attributes that cannot be encoded, as their number is above 255 or
+ * their value is too long, are skipped.
+ *
+ * @param rh a handle to parsed configuration.
  * @param vp a pointer to a #VALUE_PAIR.
  * @param secret the secret used by the server.
  * @param auth a pointer to #AUTH_HDR.
- * @return The number of octets packed.
+ * @param size the room at auth, header included; at most %RC_MAX_PACKET_LEN are used.
+ * @return The number of octets packed, or -1 if the attributes do not fit.
  */
-static int rc_pack_list (VALUE_PAIR *vp, char *secret, AUTH_HDR *auth)
+int rc_pack_list (rc_handle const *rh, VALUE_PAIR *vp, char *secret, AUTH_HDR *auth, size_t size)
 {
-	int             length, i, pc, padded_length;
+	int             length, i, pc, need;
 	int             total_length = 0;
 	size_t			secretlen;
 	uint32_t           lvalue, vendor;
 	unsigned char   passbuf[MAX(AUTH_PASS_LEN, CHAP_VALUE_LENGTH)];
 	unsigned char   md5buf[256];
-	unsigned char   *buf, *vector, *vsa_length_ptr;
+	unsigned char   *buf, *end, *vector;
+	unsigned char   *msg_auth = NULL;
+
+	if (size > RC_MAX_PACKET_LEN)
+		size = RC_MAX_PACKET_LEN;
+	if (size < AUTH_HDR_LEN)
+		return -1;
 
 	buf = auth->data;
+	end = (unsigned char *) auth + size;
 
-	while (vp != NULL)
+	if (auth->code == PW_ACCESS_REQUEST || auth->code == PW_STATUS_SERVER)
 	{
-		vsa_length_ptr = NULL;
+		if (buf + AUTH_VECTOR_LEN + 2 > end)
+			return -1;
+		*buf++ = PW_MESSAGE_AUTHENTICATOR;
+		*buf++ = AUTH_VECTOR_LEN + 2;
+		msg_auth = buf;
+		memset(buf, 0, AUTH_VECTOR_LEN);
+		buf += AUTH_VECTOR_LEN;
+		total_length += AUTH_VECTOR_LEN + 2;
+	}
+
+	for (; vp != NULL; vp = vp->next)
+	{
+		if (msg_auth != NULL && vp->attribute == PW_MESSAGE_AUTHENTICATOR && vp->vendor == 0)
+			continue;
+
+		/* check the whole attribute before writing any of it */
+		length = rc_pack_value_len(vp);
+		need = length + 2 + (vp->vendor != 0 ? 6 : 0);
+		if (vp->attribute > 0xff || length < 0 || need > 0xff)
+		{
+			rc_log(LOG_ERR, "rc_pack_list: cannot encode attribute %u of vendor %u, skipped",
+			       vp->attribute, vp->vendor);
+			continue;
+		}
+		if (buf + need > end)
+		{
+			rc_log(LOG_ERR, "rc_pack_list: attributes do not fit in a RADIUS packet");
+			return -1;
+		}
+
 		if (vp->vendor != 0) {
 			*buf++ = PW_VENDOR_SPECIFIC;
-			vsa_length_ptr = buf;
-			*buf++ = 6;
+			*buf++ = need;
 			vendor = htonl(vp->vendor);
 			memcpy(buf, &vendor, sizeof(uint32_t));
 			buf += 4;
-			total_length += 6;
 		}
 
-		if (vp->attribute > 0xff) continue;
-
 		*buf++ = (vp->attribute & 0xff);
+		*buf++ = length + 2;
+		total_length += need;
 
-		switch (vp->attribute)
+		if (vp->attribute == PW_USER_PASSWORD)
 		{
-		 case PW_USER_PASSWORD:
-
-		  /* Encrypt the password */
-
-		  /* Chop off password at AUTH_PASS_LEN */
-		  length = vp->lvalue;
-		  if (length > AUTH_PASS_LEN)
-			length = AUTH_PASS_LEN;
-
-		  /* Calculate the padded length */
-		  padded_length = (length+(AUTH_VECTOR_LEN-1)) & ~(AUTH_VECTOR_LEN-1);
-
-		  /* Record the attribute length */
-		  *buf++ = padded_length + 2;
-		  if (vsa_length_ptr != NULL) *vsa_length_ptr += padded_length + 2;
-
 		  /* Pad the password with zeros */
 		  memset ((char *) passbuf, '\0', AUTH_PASS_LEN);
-		  memcpy ((char *) passbuf, vp->strvalue, (size_t) length);
+		  memcpy ((char *) passbuf, vp->strvalue, MIN((size_t) vp->lvalue, (size_t) AUTH_PASS_LEN));
 
+		  /* Encrypt the password */
 		  secretlen = strlen (secret);
 		  vector = (unsigned char *)auth->vector;
-		  for(i = 0; i < padded_length; i += AUTH_VECTOR_LEN)
+		  for(i = 0; i < length; i += AUTH_VECTOR_LEN)
 		  {
 		  	/* Calculate the MD5 digest*/
 		  	strcpy ((char *) md5buf, secret);
@@ -109,58 +169,32 @@ static int rc_pack_list (VALUE_PAIR *vp, char *secret, AUTH_HDR *auth)
 				*buf++ ^= passbuf[pc];
 		  	}
 		  }
+		  continue;
+		}
 
-		  total_length += padded_length + 2;
-
-		  break;
-		 default:
-		  switch (vp->type)
-		  {
-		    case PW_TYPE_STRING:
-			length = vp->lvalue;
-			*buf++ = length + 2;
-			if (vsa_length_ptr != NULL) *vsa_length_ptr += length + 2;
-			memcpy (buf, vp->strvalue, (size_t) length);
-			buf += length;
-			total_length += length + 2;
-			break;
-
-		    case PW_TYPE_IPV6ADDR:
-			length = 16;
-			*buf++ = length + 2;
-			if (vsa_length_ptr != NULL) *vsa_length_ptr += length + 2;
-			memcpy (buf, vp->strvalue, (size_t) length);
-			buf += length;
-			total_length += length + 2;
-			break;
-
-		    case PW_TYPE_IPV6PREFIX:
-			length = vp->lvalue;
-			*buf++ = length + 2;
-			if (vsa_length_ptr != NULL) *vsa_length_ptr += length + 2;
-			memcpy (buf, vp->strvalue, (size_t) length);
-			buf += length;
-			total_length += length + 2;
-			break;
-
-		    case PW_TYPE_INTEGER:
-		    case PW_TYPE_IPADDR:
-		    case PW_TYPE_DATE:
-			*buf++ = sizeof (uint32_t) + 2;
-			if (vsa_length_ptr != NULL) *vsa_length_ptr += sizeof(uint32_t) + 2;
+		switch (vp->type)
+		{
+		  case PW_TYPE_INTEGER:
+		  case PW_TYPE_IPADDR:
+		  case PW_TYPE_DATE:
 			lvalue = htonl (vp->lvalue);
 			memcpy (buf, (char *) &lvalue, sizeof (uint32_t));
-			buf += sizeof (uint32_t);
-			total_length += sizeof (uint32_t) + 2;
 			break;
 
-		    default:
+		  default:
+			memcpy (buf, vp->strvalue, (size_t) length);
 			break;
-		  }
-		  break;
 		}
-		vp = vp->next;
+		buf += length;
 	}
+
+	if (msg_auth != NULL)
+	{
+		auth->length = htons ((unsigned short) (total_length + AUTH_HDR_LEN));
+		rc_hmac_md5(rh, msg_auth, (unsigned char *) auth,
+			    total_length + AUTH_HDR_LEN, secret);
+	}
+
 	return total_length;
 }
 
@@ -188,15 +222,44 @@ static void strappend(char *dest, unsigned max_size, int *pos, const char *src)
 	return;
 }
 
+/** The round trip a server usually takes
+ *
+ * @param rh a handle to parsed configuration.
+ * @param stats the counters of the server, or NULL.
+ * @param data the request.
+ * @param flags %AUTH or %ACCT.
+ * @return the median latency seen by this handle, as cached by rc_stats_median(),
+ *	else the smoothed round trip shared by other processes, else 0, in seconds.
+ */
+static double expected_rtt(rc_handle const *rh, RC_SERVER_STATS *stats,
+			   SEND_DATA const *data, unsigned flags)
+{
+	RC_SERVER_HEALTH health;
+	uint64_t median;
+
+	if (stats != NULL && (median = rc_stats_median(stats)) > 0)
+		return median / 1000000.0;
+
+	if (rc_health_get(rh, data->server, data->svc_port, flags, &health) == 0)
+		return health.srtt / 1000000.0;
+
+	return 0;
+}
+
 /** Sends a request to a RADIUS server and waits for the reply
+ *
+ * With data->deadline set, waits never go past it, and a packet is only
+ * sent while the time left exceeds the usual round trip of the server;
+ * after that the last packet sent may still be answered until the
+ * deadline.
  *
  * @param rh a handle to parsed configuration
  * @param data a pointer to a #SEND_DATA structure
  * @param msg must be an array of %PW_MAX_MSG_SIZE or %NULL; will contain the concatenation of
  *	any %PW_REPLY_MESSAGE received.
  * @param flags must be %AUTH or %ACCT
- * @return %OK_RC (0) on success, %TIMEOUT_RC on timeout %REJECT_RC on access reject, or negative
- *	on failure as return value.
+ * @return %OK_RC (0) on success, %TIMEOUT_RC on timeout %REJECT_RC on access reject,
+ *	%DEADLINE_RC when the deadline passed, or negative on failure as return value.
  */
 int rc_send_server (rc_handle const *rh, SEND_DATA *data, char *msg, unsigned flags)
 {
@@ -222,12 +285,18 @@ int rc_send_server (rc_handle const *rh, SEND_DATA *data, char *msg, unsigned fl
 	int		retries;
 	VALUE_PAIR 	*vp;
 	struct pollfd	pfd;
-	double		start_time, timeout;
+	double		start_time, timeout, wait, left, expect = 0;
+	double		first_send = 0, reply_time;
+	uint64_t	rtt = 0;
+	RC_SERVER_STATS	*stats;
 
 	server_name = data->server;
 	if (server_name == NULL || server_name[0] == '\0')
 		return ERROR_RC;
 
+	stats = rc_stats_server(rh, server_name, data->svc_port, flags);
+	RC_STATS_INC(stats, requests);
+
 	if(data->secret != NULL)
 	{
 		// no need to look up the secret from configuration
@@ -236,13 +305,15 @@ int rc_send_server (rc_handle const *rh, SEND_DATA *data, char *msg, unsigned fl
 		if(auth_addr == NULL)
 		{
 			rc_log(LOG_ERR, "rc_send_server: unable to resolve server: %s", server_name);
-			return ERROR_RC;
+			result = ERROR_RC;
+			goto cleanup;
 		}
 	}
 	else if (rc_find_server_addr (rh, server_name, &auth_addr, secret, flags) != 0)
 	{
 		rc_log(LOG_ERR, "rc_send_server: unable to find server: %s", server_name);
-		return ERROR_RC;
+		result = ERROR_RC;
+		goto cleanup;
 	}
 
 	rc_own_bind_addr(rh, &our_sockaddr);
@@ -287,6 +358,9 @@ int rc_send_server (rc_handle const *rh, SEND_DATA *data, char *msg, unsigned fl
 		goto cleanup;
 	}
 
+	if (data->deadline > 0)
+		expect = expected_rtt(rh, stats, data, flags);
+
 	retry_max = data->retries;	/* Max. numbers to try for reply */
 	retries = 0;			/* Init retry cnt for blocking call */
 
@@ -325,7 +399,15 @@ int rc_send_server (rc_handle const *rh, SEND_DATA *data, char *msg, unsigned fl
 
 	if (data->code == PW_ACCOUNTING_REQUEST)
 	{
-		total_length = rc_pack_list(data->send_pairs, secret, auth) + AUTH_HDR_LEN;
+		total_length = rc_pack_list(rh, data->send_pairs, secret, auth, sizeof(send_buffer) - MAX_SECRET_LENGTH);
+		if (total_length < 0)
+		{
+			close (sockfd);
+			memset (secret, '\0', sizeof (secret));
+			result = ERROR_RC;
+			goto cleanup;
+		}
+		total_length += AUTH_HDR_LEN;
 
 		auth->length = htons ((unsigned short) total_length);
 
@@ -340,11 +422,21 @@ int rc_send_server (rc_handle const *rh, SEND_DATA *data, char *msg, unsigned fl
 		rc_random_vector (vector);
 		memcpy ((char *) auth->vector, (char *) vector, AUTH_VECTOR_LEN);
 
-		total_length = rc_pack_list(data->send_pairs, secret, auth) + AUTH_HDR_LEN;
+		total_length = rc_pack_list(rh, data->send_pairs, secret, auth, sizeof(send_buffer));
+		if (total_length < 0)
+		{
+			close (sockfd);
+			memset (secret, '\0', sizeof (secret));
+			result = ERROR_RC;
+			goto cleanup;
+		}
+		total_length += AUTH_HDR_LEN;
 
 		auth->length = htons ((unsigned short) total_length);
 	}
 
+	RC_TRACE(rh, RC_TRACE_ENCODED, data, 0);
+
 	getnameinfo(SA(&our_sockaddr), SS_LEN(&our_sockaddr), NULL, 0, our_addr_txt, sizeof(our_addr_txt), NI_NUMERICHOST);
 	getnameinfo(auth_addr->ai_addr, auth_addr->ai_addrlen, NULL, 0, auth_addr_txt, sizeof(auth_addr_txt), NI_NUMERICHOST);
 
@@ -353,19 +445,46 @@ int rc_send_server (rc_handle const *rh, SEND_DATA *data, char *msg, unsigned fl
 
 	for (;;)
 	{
-		do {
-			result = sendto (sockfd, (char *) auth, (unsigned int)total_length, 
-				(int) 0, SA(auth_addr->ai_addr), auth_addr->ai_addrlen);
-		} while (result == -1 && errno == EINTR);
-		if (result == -1) {
-			rc_log(LOG_ERR, "%s: socket: %s", __FUNCTION__, strerror(errno));
+		wait = data->timeout;
+		left = wait;
+		if (data->deadline > 0) {
+			left = data->deadline - rc_getmtime();
+			if (left <= 0 || (retries == 0 && left <= expect)) {
+				rc_log(LOG_ERR, "rc_send_server: no time left for RADIUS server %s:%u",
+				       auth_addr_txt, data->svc_port);
+				close (sockfd);
+				memset (secret, '\0', sizeof (secret));
+				result = DEADLINE_RC;
+				goto cleanup;
+			}
+			if (wait > left)
+				wait = left;
+		}
+
+		if (retries == 0) {
+			first_send = rc_getmtime();
+			RC_TRACE(rh, RC_TRACE_SENT, data, 0);
+		} else if (left > expect) {
+			RC_STATS_INC(stats, retransmits);
+			RC_TRACE(rh, RC_TRACE_RETRANSMIT, data, retries);
+		}
+
+		/* too late for a retransmission to be answered: wait for the last one */
+		if (retries == 0 || left > expect) {
+			do {
+				result = sendto (sockfd, (char *) auth, (unsigned int)total_length, 
+					(int) 0, SA(auth_addr->ai_addr), auth_addr->ai_addrlen);
+			} while (result == -1 && errno == EINTR);
+			if (result == -1) {
+				rc_log(LOG_ERR, "%s: socket: %s", __FUNCTION__, strerror(errno));
+			}
 		}
 
 		pfd.fd = sockfd;
 		pfd.events = POLLIN;
 		pfd.revents = 0;
 		start_time = rc_getmtime();
-		for (timeout = data->timeout; timeout > 0;
+		for (timeout = wait; timeout > 0;
 		    timeout -= rc_getmtime() - start_time) {
 			result = poll(&pfd, 1, timeout * 1000);
 			if (result != -1 || errno != EINTR)
@@ -385,7 +504,18 @@ int rc_send_server (rc_handle const *rh, SEND_DATA *data, char *msg, unsigned fl
 		/*
 		 * Timed out waiting for response.  Retry "retry_max" times
 		 * before giving up.  If retry_max = 0, don't retry at all.
+		 * A wait cut short by the deadline is not the server's fault.
 		 */
+		if (wait < data->timeout)
+		{
+			rc_log(LOG_ERR,
+				"rc_send_server: deadline passed waiting for RADIUS server %s:%u",
+				 auth_addr_txt, data->svc_port);
+			close (sockfd);
+			memset (secret, '\0', sizeof (secret));
+			result = DEADLINE_RC;
+			goto cleanup;
+		}
 		if (retries++ >= retry_max)
 		{
 			rc_log(LOG_ERR,
@@ -403,6 +533,7 @@ int rc_send_server (rc_handle const *rh, SEND_DATA *data, char *msg, unsigned fl
 				   (int) sizeof (recv_buffer),
 				   (int) 0, SA(auth_addr->ai_addr), &salen);
 	} while(length == -1 && errno == EINTR);
+	reply_time = rc_getmtime();
 
 	if (length <= 0)
 	{
@@ -415,6 +546,7 @@ int rc_send_server (rc_handle const *rh, SEND_DATA *data, char *msg, unsigned fl
 	}
 
 	recv_auth = (AUTH_HDR *)recv_buffer;
+	RC_TRACE(rh, RC_TRACE_RECEIVED, data, 0);
 
 	if (length < AUTH_HDR_LEN || length < ntohs(recv_auth->length)) {
 		rc_log(LOG_ERR, "rc_send_server: recvfrom: %s:%d: reply is too short",
@@ -440,7 +572,8 @@ int rc_send_server (rc_handle const *rh, SEND_DATA *data, char *msg, unsigned fl
 			       server_name, data->svc_port);
 			close(sockfd);
 			memset(secret, '\0', sizeof(secret));
-			return ERROR_RC;
+			result = BADRESP_RC;
+			goto cleanup;
 		}
 
 		if (attr[1] < 2) {
@@ -448,7 +581,8 @@ int rc_send_server (rc_handle const *rh, SEND_DATA *data, char *msg, unsigned fl
 			       server_name, data->svc_port);
 			close(sockfd);
 			memset(secret, '\0', sizeof(secret));
-			return ERROR_RC;
+			result = BADRESP_RC;
+			goto cleanup;
 		}
 
 		if ((attr + attr[1]) > (recv_buffer + length)) {
@@ -456,13 +590,20 @@ int rc_send_server (rc_handle const *rh, SEND_DATA *data, char *msg, unsigned fl
 			       server_name, data->svc_port);
 			close(sockfd);
 			memset(secret, '\0', sizeof(secret));
-			return ERROR_RC;
+			result = BADRESP_RC;
+			goto cleanup;
 		}
 
 		attr += attr[1];
 	}
 
-	result = rc_check_reply (recv_auth, BUFFER_LEN, secret, vector, data->seq_nbr);
+	result = rc_check_reply (rh, recv_auth, secret, vector, data->seq_nbr);
+	RC_TRACE(rh, RC_TRACE_VERIFIED, data, result);
+	if (result == OK_RC) {
+		rtt = (uint64_t)((reply_time - first_send) * 1000000);
+		if (stats != NULL)
+			rc_hist_record(&stats->latency, rtt);
+	}
 
 	length = ntohs(recv_auth->length)  - AUTH_HDR_LEN;
 	if (length > 0) {
@@ -515,30 +656,149 @@ int rc_send_server (rc_handle const *rh, SEND_DATA *data, char *msg, unsigned fl
  	if (auth_addr)
  		freeaddrinfo(auth_addr);
 
+	switch (result) {
+	case OK_RC:
+		RC_STATS_INC(stats, accepts);
+		break;
+	case REJECT_RC:
+		RC_STATS_INC(stats, rejects);
+		break;
+	case TIMEOUT_RC:
+		RC_STATS_INC(stats, timeouts);
+		break;
+	case BADRESP_RC:
+		RC_STATS_INC(stats, badresp);
+		break;
+	case DEADLINE_RC:
+		RC_STATS_INC(stats, deadline);
+		break;
+	default:
+		RC_STATS_INC(stats, errors);
+		break;
+	}
+	rc_health_update(rh, server_name, data->svc_port, flags, result, rtt);
+
 	return result;
 }
 
+#ifdef DIGEST_DEBUG
+/** Log a buffer in hex, 32 octets per line
+ *
+ * @param title a line logged before the data.
+ * @param data the buffer to log.
+ * @param len the length of the buffer.
+ */
+static void rc_digest_dump(char const *title, uint8_t const *data, size_t len)
+{
+	uint8_t const	*ptr;
+	char		buf[65];
+	int		i;
+
+	rc_log(LOG_ERR, "%s", title);
+	for (ptr = data; ptr < data + len; ptr += 32) {
+		buf[0] = '\0';
+		for (i = 0; i < 32; i++) {
+			if (ptr + i >= data + len)
+				break;
+			sprintf(buf + i * 2, "%.2X", ptr[i]);
+		}
+		rc_log(LOG_ERR, "  %s", buf);
+	}
+}
+#endif
+
+/** Verify the Message-Authenticator of a reply
+ *
+ * The HMAC covers the reply with the request authenticator in place of
+ * the response authenticator and the attribute value zeroed; both are
+ * substituted while hashing, the reply itself is left untouched.
+ *
+ * @param rh a handle to parsed configuration.
+ * @param auth a pointer to #AUTH_HDR.
+ * @param totallen the length of the reply.
+ * @param secret the secret used by the server.
+ * @param vector the request authenticator.
+ * @return %OK_RC upon success, %BADRESP_RC if the attribute is invalid, or missing when required.
+ */
+static int rc_check_msg_auth (rc_handle const *rh, AUTH_HDR const *auth, int totallen,
+			      char const *secret, unsigned char const *vector)
+{
+	uint8_t const	*attr, *end;
+	uint8_t const	*msg_auth = NULL;
+	uint8_t const	*data = (uint8_t const *) auth;
+	unsigned char	calc_digest[AUTH_VECTOR_LEN];
+	unsigned char	zero[AUTH_VECTOR_LEN];
+	RC_HMAC_CTX	ctx;
+
+	end = data + totallen;
+	for (attr = auth->data; attr + 2 <= end && attr[1] >= 2; attr += attr[1])
+	{
+		if (attr + attr[1] > end)
+		{
+			rc_log(LOG_ERR, "rc_check_reply: received RADIUS server response with an attribute past its end");
+			return BADRESP_RC;
+		}
+
+		if (attr[0] != PW_MESSAGE_AUTHENTICATOR)
+			continue;
+
+		if (msg_auth != NULL || attr[1] != AUTH_VECTOR_LEN + 2)
+		{
+			rc_log(LOG_ERR, "rc_check_reply: received malformed Message-Authenticator in RADIUS server response");
+			return BADRESP_RC;
+		}
+		msg_auth = attr + 2;
+	}
+
+	if (msg_auth == NULL)
+	{
+		if (rh->opts.require_message_authenticator &&
+		    (auth->code == PW_ACCESS_ACCEPT || auth->code == PW_ACCESS_REJECT ||
+		     auth->code == PW_ACCESS_CHALLENGE))
+		{
+			rc_log(LOG_ERR, "rc_check_reply: RADIUS server response lacks the required Message-Authenticator");
+			return BADRESP_RC;
+		}
+		return OK_RC;
+	}
+
+	memset(zero, 0, sizeof(zero));
+	rc_hmac_md5_init(rh, &ctx, secret);
+	rc_hmac_md5_update(&ctx, data, AUTH_HDR_LEN - AUTH_VECTOR_LEN);
+	rc_hmac_md5_update(&ctx, vector, AUTH_VECTOR_LEN);
+	rc_hmac_md5_update(&ctx, auth->data, msg_auth - auth->data);
+	rc_hmac_md5_update(&ctx, zero, AUTH_VECTOR_LEN);
+	rc_hmac_md5_update(&ctx, msg_auth + AUTH_VECTOR_LEN, end - (msg_auth + AUTH_VECTOR_LEN));
+	rc_hmac_md5_final(calc_digest, &ctx);
+
+	if (memcmp(msg_auth, calc_digest, AUTH_VECTOR_LEN) != 0)
+	{
+		rc_log(LOG_ERR, "rc_check_reply: received invalid Message-Authenticator from RADIUS server");
+		return BADRESP_RC;
+	}
+
+	return OK_RC;
+}
+
 /** Verify items in returned packet
  *
+ * The reply is only read, so it may live in a shared or read-only buffer.
+ *
+ * @param rh a handle to parsed configuration.
  * @param auth a pointer to #AUTH_HDR.
- * @param bufferlen the available buffer length.
  * @param secret the secret used by the server.
  * @param vector a random vector of %AUTH_VECTOR_LEN.
  * @param seq_nbr a unique sequence number.
  * @return %OK_RC upon success, %BADRESP_RC if anything looks funny.
  */
-static int rc_check_reply (AUTH_HDR *auth, int bufferlen, char const *secret, unsigned char const *vector, uint8_t seq_nbr)
+int rc_check_reply (rc_handle const *rh, AUTH_HDR const *auth, char const *secret,
+		    unsigned char const *vector, uint8_t seq_nbr)
 {
-	int             secretlen;
 	int             totallen;
 	unsigned char   calc_digest[AUTH_VECTOR_LEN];
-	unsigned char   reply_digest[AUTH_VECTOR_LEN];
-#ifdef DIGEST_DEBUG
-	uint8_t		*ptr;
-#endif
+	RC_MD5_CTX	ctx;
 
 	totallen = ntohs (auth->length);
-	secretlen = (int)strlen (secret);
 
 	/* Do sanity checks on packet length */
 	if ((totallen < 20) || (totallen > 4096))
@@ -547,13 +807,6 @@ static int rc_check_reply (AUTH_HDR *auth, int bufferlen, char const *secret, un
 		return BADRESP_RC;
 	}
 
-	/* Verify buffer space, should never trigger with current buffer size and check above */
-	if ((totallen + secretlen) > bufferlen)
-	{
-		rc_log(LOG_ERR, "rc_check_reply: not enough buffer space to verify RADIUS server response");
-		return BADRESP_RC;
-	}
-
 	/* Verify that id (seq. number) matches what we sent */
 	if (auth->id != seq_nbr)
 	{
@@ -561,64 +814,30 @@ static int rc_check_reply (AUTH_HDR *auth, int bufferlen, char const *secret, un
 		return BADRESP_RC;
 	}
 
-	/* Verify the reply digest */
-	memcpy ((char *) reply_digest, (char *) auth->vector, AUTH_VECTOR_LEN);
-	memcpy ((char *) auth->vector, (char *) vector, AUTH_VECTOR_LEN);
-	memcpy ((char *) auth + totallen, secret, secretlen);
+	/* Verify the reply digest: MD5(code, id, length, request vector, attributes, secret) */
 #ifdef DIGEST_DEBUG
-        rc_log(LOG_ERR, "Calculating digest on:");
-        for (ptr = (u_char *)auth; ptr < ((u_char *)auth) + totallen + secretlen; ptr += 32) {
-                char buf[65];
-                int i;
-
-                buf[0] = '\0';
-                for (i = 0; i < 32; i++) {
-                        if (ptr + i >= ((u_char *)auth) + totallen + secretlen)
-                                break;
-                        sprintf(buf + i * 2, "%.2X", ptr[i]);
-                }
-                rc_log(LOG_ERR, "  %s", buf);
-        }
+	rc_digest_dump("Calculating digest on reply:", (uint8_t const *) auth, totallen);
+	rc_digest_dump("with request vector:", vector, AUTH_VECTOR_LEN);
 #endif
-	rc_md5_calc (calc_digest, (unsigned char *) auth, totallen + secretlen);
+	rc_md5_init(&ctx);
+	rc_md5_update(&ctx, auth, AUTH_HDR_LEN - AUTH_VECTOR_LEN);
+	rc_md5_update(&ctx, vector, AUTH_VECTOR_LEN);
+	rc_md5_update(&ctx, auth->data, totallen - AUTH_HDR_LEN);
+	rc_md5_update(&ctx, secret, strlen (secret));
+	rc_md5_final(calc_digest, &ctx);
 #ifdef DIGEST_DEBUG
-	rc_log(LOG_ERR, "Calculated digest is:");
-        for (ptr = (u_char *)calc_digest; ptr < ((u_char *)calc_digest) + 16; ptr += 32) {
-                char buf[65];
-                int i;
-
-                buf[0] = '\0';
-                for (i = 0; i < 32; i++) {
-                        if (ptr + i >= ((u_char *)calc_digest) + 16)
-                                break;
-                        sprintf(buf + i * 2, "%.2X", ptr[i]);
-                }
-                rc_log(LOG_ERR, "  %s", buf);
-        }
-	rc_log(LOG_ERR, "Reply digest is:");
-        for (ptr = (u_char *)reply_digest; ptr < ((u_char *)reply_digest) + 16; ptr += 32) {
-                char buf[65];
-                int i;
-
-                buf[0] = '\0';
-                for (i = 0; i < 32; i++) {
-                        if (ptr + i >= ((u_char *)reply_digest) + 16)
-                                break;
-                        sprintf(buf + i * 2, "%.2X", ptr[i]);
-                }
-                rc_log(LOG_ERR, "  %s", buf);
-        }
+	rc_digest_dump("Calculated digest is:", calc_digest, AUTH_VECTOR_LEN);
+	rc_digest_dump("Reply digest is:", auth->vector, AUTH_VECTOR_LEN);
 #endif
 
-	if (memcmp ((char *) reply_digest, (char *) calc_digest,
+	if (memcmp ((char const *) auth->vector, (char *) calc_digest,
 		    AUTH_VECTOR_LEN) != 0)
 	{
 		rc_log(LOG_ERR, "rc_check_reply: received invalid reply digest from RADIUS server");
 		return BADRESP_RC;
 	}
 
-	return OK_RC;
-
+	return rc_check_msg_auth(rh, auth, totallen, secret, vector);
 }
 
 /** Generates a random vector of AUTH_VECTOR_LEN octets
@@ -627,50 +846,5 @@ static int rc_check_reply (AUTH_HDR *auth, int bufferlen, char const *secret, un
  */
 static void rc_random_vector (unsigned char *vector)
 {
-	int             randno;
-	int             i;
-#if defined(HAVE_GETENTROPY)
-	if (getentropy(vector, AUTH_VECTOR_LEN) >= 0) {
-		return;
-	} /* else fall through */
-#elif defined(HAVE_DEV_URANDOM)
-	int		fd;
-
-/* well, I added this to increase the security for user passwords.
-   we use /dev/urandom here, as /dev/random might block and we don't
-   need that much randomness. BTW, great idea, Ted!     -lf, 03/18/95	*/
-
-	if ((fd = open(_PATH_DEV_URANDOM, O_RDONLY)) >= 0)
-	{
-		unsigned char *pos;
-		int readcount;
-
-		i = AUTH_VECTOR_LEN;
-		pos = vector;
-		while (i > 0)
-		{
-			readcount = read(fd, (char *)pos, i);
-			if (readcount >= 0) {
-				pos += readcount;
-				i -= readcount;
-			} else {
-				if (errno != EINTR && errno != EAGAIN)
-					goto fallback;
-			}
-		}
-
-		close(fd);
-		return;
-	} /* else fall through */
-#endif
- fallback:
-	for (i = 0; i < AUTH_VECTOR_LEN;)
-	{
-		randno = rc_random();
-		memcpy ((char *) vector, (char *) &randno, sizeof (int));
-		vector += sizeof (int);
-		i += sizeof (int);
-	}
-
-	return;
+	rc_random_bytes(vector, AUTH_VECTOR_LEN);
 }
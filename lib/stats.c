@@ -0,0 +1,345 @@
+/*
+ * stats.c	Per-server request counters and latency histograms.
+ *
+ * License:	BSD
+ *
+ */
+
+#include <config.h>
+#include <includes.h>
+#include <freeradius-client.h>
+#include "util.h"
+
+#define HIST_SUB_COUNT		(1 << RC_HIST_SUB_BITS)
+#define STATS_MEDIAN_EVERY	64	//!< replies between two updates of the cached median.
+
+/*
+ *  Like the HMAC key cache, entries are published once by
+ *  compare-and-swap and only freed with the handle; after that every
+ *  update is a relaxed atomic add, so concurrent rc_send_server()
+ *  calls never wait on each other.
+ */
+struct stats_entry {
+	RC_SERVER_STATS	stats;		//!< first, as entries are handed out as the RC_SERVER_STATS.
+	uint64_t	median;		//!< cached latency median, see rc_stats_median().
+	uint64_t	median_count;	//!< latency.count when it was computed.
+};
+
+struct rc_stats {
+	int			refs;		//!< handles sharing the counters, see rc_reload().
+	struct stats_entry	*slot[RC_STATS_MAX_SERVERS];
+	struct stats_entry	other;		//!< everything beyond the last slot.
+};
+
+/** Map a value to its histogram bucket
+ *
+ * @param value the value.
+ * @return bucket index.
+ */
+static int hist_bucket(uint64_t value)
+{
+	int e;
+
+	if (value < HIST_SUB_COUNT)
+		return (int)value;
+
+	e = 63 - __builtin_clzll(value);
+	if (e > RC_HIST_MAX_BITS - 1)
+		return RC_HIST_BUCKETS - 1;
+
+	return ((e - RC_HIST_SUB_BITS + 1) << RC_HIST_SUB_BITS) +
+		(int)((value >> (e - RC_HIST_SUB_BITS)) & (HIST_SUB_COUNT - 1));
+}
+
+/** The largest value that maps to a histogram bucket
+ *
+ * @param bucket bucket index.
+ * @return upper bound of the bucket.
+ */
+static uint64_t hist_bucket_high(int bucket)
+{
+	int e, sub;
+
+	if (bucket < HIST_SUB_COUNT)
+		return bucket;
+
+	e = (bucket >> RC_HIST_SUB_BITS) + RC_HIST_SUB_BITS - 1;
+	sub = bucket & (HIST_SUB_COUNT - 1);
+
+	return (((uint64_t)(HIST_SUB_COUNT + sub) + 1) << (e - RC_HIST_SUB_BITS)) - 1;
+}
+
+/** Record a value in a histogram
+ *
+ * Safe to call from several threads on the same histogram, and while
+ * rc_hist_percentile() reads it.
+ *
+ * @param hist the histogram.
+ * @param value the value, typically a latency in microseconds.
+ */
+void rc_hist_record(RC_HISTOGRAM *hist, uint64_t value)
+{
+	uint64_t max;
+
+	__atomic_add_fetch(&hist->bucket[hist_bucket(value)], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&hist->sum, value, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&hist->count, 1, __ATOMIC_RELAXED);
+
+	max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+	while (value > max &&
+	       !__atomic_compare_exchange_n(&hist->max, &max, value, 1,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/** Estimate a percentile of the recorded values
+ *
+ * The result is the upper bound of the bucket holding the value, but
+ * never more than the largest value recorded.
+ *
+ * @param hist the histogram.
+ * @param pct the percentile, between 0 and 100 (e.g. 99.9).
+ * @return the estimate, or 0 for an empty histogram.
+ */
+uint64_t rc_hist_percentile(RC_HISTOGRAM const *hist, double pct)
+{
+	uint64_t	total = 0, rank, seen = 0, high, max;
+	int		i;
+
+	/* other threads may be recording: the estimate is then approximate */
+	for (i = 0; i < RC_HIST_BUCKETS; i++)
+		total += __atomic_load_n(&hist->bucket[i], __ATOMIC_RELAXED);
+	if (total == 0)
+		return 0;
+
+	if (pct < 0)
+		pct = 0;
+	if (pct > 100)
+		pct = 100;
+
+	rank = (uint64_t)(pct / 100.0 * (double)total + 0.5);
+	if (rank == 0)
+		rank = 1;
+
+	for (i = 0; i < RC_HIST_BUCKETS; i++) {
+		seen += __atomic_load_n(&hist->bucket[i], __ATOMIC_RELAXED);
+		if (seen >= rank)
+			break;
+	}
+	if (i == RC_HIST_BUCKETS)
+		i--;
+
+	high = hist_bucket_high(i);
+	max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+	return (max != 0 && high > max) ? max : high;
+}
+
+/** Add the values of one histogram to another
+ *
+ * @param dst the histogram to add to.
+ * @param src the histogram to add.
+ */
+void rc_hist_merge(RC_HISTOGRAM *dst, RC_HISTOGRAM const *src)
+{
+	int i;
+
+	for (i = 0; i < RC_HIST_BUCKETS; i++)
+		dst->bucket[i] += src->bucket[i];
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if (src->max > dst->max)
+		dst->max = src->max;
+}
+
+/** Allocate the counters of a handle
+ *
+ * @return the counters, or NULL when out of memory.
+ */
+struct rc_stats *rc_stats_new(void)
+{
+	struct rc_stats *stats;
+
+	stats = malloc(sizeof(*stats));
+	if (stats == NULL) {
+		rc_log(LOG_CRIT, "rc_stats_new: out of memory");
+		return NULL;
+	}
+	memset(stats, 0, sizeof(*stats));
+	stats->refs = 1;
+	strcpy(stats->other.stats.server, "*");
+
+	return stats;
+}
+
+/** Share the counters of a handle with another one
+ *
+ * @param stats the counters.
+ * @return stats.
+ */
+struct rc_stats *rc_stats_ref(struct rc_stats *stats)
+{
+	__atomic_add_fetch(&stats->refs, 1, __ATOMIC_RELAXED);
+	return stats;
+}
+
+/** Drop a reference to the counters of a handle, freeing them with the last
+ *
+ * @param stats the counters, may be NULL.
+ */
+void rc_stats_free(struct rc_stats *stats)
+{
+	int i;
+
+	if (stats == NULL)
+		return;
+
+	if (__atomic_sub_fetch(&stats->refs, 1, __ATOMIC_ACQ_REL) != 0)
+		return;
+
+	for (i = 0; i < RC_STATS_MAX_SERVERS; i++)
+		free(stats->slot[i]);
+	free(stats);
+}
+
+static int stats_match(RC_SERVER_STATS const *s, char const *server, int port, unsigned type)
+{
+	return s->port == port && s->type == type && strcmp(s->server, server) == 0;
+}
+
+/** Find the counters of a server, adding them on first use
+ *
+ * @param rh a handle to parsed configuration.
+ * @param server the server name.
+ * @param port the destination port, or 0.
+ * @param type %AUTH or %ACCT.
+ * @return the counters, or NULL if the handle keeps none.
+ */
+RC_SERVER_STATS *rc_stats_server(rc_handle const *rh, char const *server, int port, unsigned type)
+{
+	struct rc_stats		*stats = rh->stats;
+	struct stats_entry	*entry, *found;
+	int			i;
+
+	if (stats == NULL)
+		return NULL;
+
+	for (i = 0; i < RC_STATS_MAX_SERVERS; i++) {
+		found = __atomic_load_n(&stats->slot[i], __ATOMIC_ACQUIRE);
+		if (found == NULL)
+			break;
+		if (stats_match(&found->stats, server, port, type))
+			return &found->stats;
+	}
+
+	if (i == RC_STATS_MAX_SERVERS || strlen(server) >= sizeof(entry->stats.server))
+		return &stats->other.stats;
+
+	entry = malloc(sizeof(*entry));
+	if (entry == NULL)
+		return &stats->other.stats;
+	memset(entry, 0, sizeof(*entry));
+	strcpy(entry->stats.server, server);
+	entry->stats.port = port;
+	entry->stats.type = type;
+
+	for (; i < RC_STATS_MAX_SERVERS; i++) {
+		found = NULL;
+		if (__atomic_compare_exchange_n(&stats->slot[i], &found, entry, 0,
+						__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return &entry->stats;
+
+		/* another thread added a server first */
+		if (stats_match(&found->stats, server, port, type)) {
+			free(entry);
+			return &found->stats;
+		}
+	}
+
+	free(entry);
+	return &stats->other.stats;
+}
+
+static void stats_copy(RC_SERVER_STATS *dst, RC_SERVER_STATS const *src)
+{
+	int i;
+
+	memcpy(dst->server, src->server, sizeof(dst->server));
+	dst->port = src->port;
+	dst->type = src->type;
+	dst->requests = __atomic_load_n(&src->requests, __ATOMIC_RELAXED);
+	dst->retransmits = __atomic_load_n(&src->retransmits, __ATOMIC_RELAXED);
+	dst->timeouts = __atomic_load_n(&src->timeouts, __ATOMIC_RELAXED);
+	dst->accepts = __atomic_load_n(&src->accepts, __ATOMIC_RELAXED);
+	dst->rejects = __atomic_load_n(&src->rejects, __ATOMIC_RELAXED);
+	dst->badresp = __atomic_load_n(&src->badresp, __ATOMIC_RELAXED);
+	dst->errors = __atomic_load_n(&src->errors, __ATOMIC_RELAXED);
+	dst->deadtime_enter = __atomic_load_n(&src->deadtime_enter, __ATOMIC_RELAXED);
+	dst->deadtime_exit = __atomic_load_n(&src->deadtime_exit, __ATOMIC_RELAXED);
+	dst->busy = __atomic_load_n(&src->busy, __ATOMIC_RELAXED);
+	dst->deadline = __atomic_load_n(&src->deadline, __ATOMIC_RELAXED);
+
+	dst->latency.count = __atomic_load_n(&src->latency.count, __ATOMIC_RELAXED);
+	dst->latency.sum = __atomic_load_n(&src->latency.sum, __ATOMIC_RELAXED);
+	dst->latency.max = __atomic_load_n(&src->latency.max, __ATOMIC_RELAXED);
+	for (i = 0; i < RC_HIST_BUCKETS; i++)
+		dst->latency.bucket[i] = __atomic_load_n(&src->latency.bucket[i], __ATOMIC_RELAXED);
+}
+
+/** Copy the counters of every server a handle has talked to
+ *
+ * Each counter is read atomically, but the snapshot as a whole is not:
+ * requests in flight may be counted in some fields and not yet in others.
+ *
+ * @param rh a handle to parsed configuration.
+ * @param stats an array to fill.
+ * @param max the number of entries in stats; %RC_STATS_MAX_SERVERS + 1 is always enough.
+ * @return the number of entries filled in.
+ */
+int rc_stats_snapshot(rc_handle const *rh, RC_SERVER_STATS *stats, int max)
+{
+	struct stats_entry	*entry;
+	int			i, n = 0;
+
+	if (rh->stats == NULL)
+		return 0;
+
+	for (i = 0; i < RC_STATS_MAX_SERVERS && n < max; i++) {
+		entry = __atomic_load_n(&rh->stats->slot[i], __ATOMIC_ACQUIRE);
+		if (entry == NULL)
+			break;
+		stats_copy(&stats[n++], &entry->stats);
+	}
+
+	if (n < max && __atomic_load_n(&rh->stats->other.stats.requests, __ATOMIC_RELAXED) != 0)
+		stats_copy(&stats[n++], &rh->stats->other.stats);
+
+	return n;
+}
+
+/** The median latency of a server, for checks on the request path
+ *
+ * The histogram is only scanned again after %STATS_MEDIAN_EVERY more
+ * replies, by whichever thread notices first; other callers get the
+ * cached value in the meantime.
+ *
+ * @param stats counters returned by rc_stats_server().
+ * @return the median in microseconds, or 0 before any reply.
+ */
+uint64_t rc_stats_median(RC_SERVER_STATS *stats)
+{
+	struct stats_entry	*entry = (struct stats_entry *)stats;
+	uint64_t		count, last;
+
+	count = __atomic_load_n(&stats->latency.count, __ATOMIC_RELAXED);
+	last = __atomic_load_n(&entry->median_count, __ATOMIC_RELAXED);
+
+	/* the first reply, and every STATS_MEDIAN_EVERY after it */
+	if ((last == 0 && count > 0) || count - last >= STATS_MEDIAN_EVERY) {
+		if (__atomic_compare_exchange_n(&entry->median_count, &last, count, 0,
+						__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			__atomic_store_n(&entry->median, rc_hist_percentile(&stats->latency, 50),
+					 __ATOMIC_RELAXED);
+	}
+
+	return __atomic_load_n(&entry->median, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,87 @@
+/*
+ * trace.c	Request lifecycle callbacks.
+ *
+ * License:	BSD
+ *
+ */
+
+#include <config.h>
+#include <includes.h>
+#include <freeradius-client.h>
+#include "util.h"
+
+struct rc_trace_hook {
+	rc_trace_fn	fn;
+	void		*ctx;
+};
+
+/** Register a callback for the lifecycle stages of every request
+ *
+ * The callback runs synchronously in the thread sending the request, so it
+ * should only record the event.  Register it before the handle is shared
+ * between threads; without one each stage costs a single branch.
+ *
+ * @param rh a handle to parsed configuration.
+ * @param fn the callback, or NULL to remove it.
+ * @param ctx passed to the callback unchanged.
+ * @return 0 on success, -1 when out of memory.
+ */
+int rc_trace_set(rc_handle *rh, rc_trace_fn fn, void *ctx)
+{
+	struct rc_trace_hook *hook;
+
+	if (fn == NULL) {
+		free(rh->trace);
+		rh->trace = NULL;
+		return 0;
+	}
+
+	hook = rh->trace;
+	if (hook == NULL) {
+		hook = malloc(sizeof(*hook));
+		if (hook == NULL) {
+			rc_log(LOG_CRIT, "rc_trace_set: out of memory");
+			return -1;
+		}
+	}
+	hook->fn = fn;
+	hook->ctx = ctx;
+	rh->trace = hook;
+
+	return 0;
+}
+
+/** Register the callback of one handle on another
+ *
+ * @param dst the handle to register on.
+ * @param src the handle whose callback is copied, may have none.
+ * @return 0 on success, -1 when out of memory.
+ */
+int rc_trace_copy(rc_handle *dst, rc_handle const *src)
+{
+	if (src->trace == NULL)
+		return rc_trace_set(dst, NULL, NULL);
+
+	return rc_trace_set(dst, src->trace->fn, src->trace->ctx);
+}
+
+/** Report a lifecycle stage to the registered callback
+ *
+ * Use through RC_TRACE(), which skips the call when there is no callback.
+ *
+ * @param rh a handle to parsed configuration.
+ * @param stage the stage reached.
+ * @param data the request.
+ * @param value stage specific, see #RC_TRACE_STAGE.
+ */
+void rc_trace_emit(rc_handle const *rh, RC_TRACE_STAGE stage, SEND_DATA const *data, int value)
+{
+	RC_TRACE_EVENT event;
+
+	event.stage = stage;
+	event.time = rc_getmtime();
+	event.data = data;
+	event.value = value;
+
+	rh->trace->fn(rh->trace->ctx, &event);
+}
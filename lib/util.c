@@ -251,6 +251,15 @@ rc_handle *rc_new(void)
                 return NULL;
         }
 	memset(rh, 0, sizeof(*rh));
+
+	rh->hmac_cache = rc_hmac_cache_new();
+	rh->stats = rc_stats_new();
+	if (rh->hmac_cache == NULL || rh->stats == NULL) {
+		rc_hmac_cache_free(rh->hmac_cache);
+		rc_stats_free(rh->stats);
+		free(rh);
+		return NULL;
+	}
 	return rh;
 }
 
@@ -263,6 +272,11 @@ void rc_destroy(rc_handle *rh)
 	rc_map2id_free(rh);
 	rc_dict_free(rh);
 	rc_config_free(rh);
+	rc_admit_free(rh);
+	rc_hmac_cache_free(rh->hmac_cache);
+	rc_stats_free(rh->stats);
+	rc_health_detach(rh);
+	free(rh->trace);
 	free(rh);
 }
 
@@ -338,21 +352,17 @@ double rc_getmtime(void)
     return timespec.tv_sec + ((double)timespec.tv_nsec) / 1000000000.0;
 }
 
-/** Returns a pseudo-random number
- * It ensures, that the PRNG is initialised properly.
+/** Returns a random number
+ * It is drawn from the same per-thread generator as rc_random_bytes().
  *
- * @return pseudo-random number
+ * @return random number between 0 and 2^31 - 1, like random().
  */
 long int rc_random(void)
 {
-	static int initialised = 0;
-	if (0 == initialised)
-	{
-		srandom((unsigned int)(time(NULL)+getpid()));
-		initialised = 1;
-	}
+	uint32_t r;
 
-	return random();
+	rc_random_bytes(&r, sizeof(r));
+	return (long int)(r & 0x7fffffff);
 }
 
 /*
@@ -47,6 +47,63 @@ struct addrinfo *rc_getaddrinfo (char const *host, unsigned flags);
 void rc_own_bind_addr(rc_handle const *rh, struct sockaddr_storage *lia);
 
 long int rc_random(void);
+void rc_random_bytes(void *out, size_t len);
+
+struct rc_hmac_cache *rc_hmac_cache_new(void);
+void rc_hmac_cache_free(struct rc_hmac_cache *cache);
+void rc_hmac_md5(rc_handle const *rh, unsigned char *digest, unsigned char const *data,
+		 size_t len, char const *secret);
+int rc_md5_calc_multi_set_lanes(int lanes);
+
+#define RC_MAX_PACKET_LEN	4096	//!< the largest RADIUS packet, RFC 2865.
+
+int rc_pack_list(rc_handle const *rh, VALUE_PAIR *vp, char *secret, AUTH_HDR *auth, size_t size);
+int rc_check_reply(rc_handle const *rh, AUTH_HDR const *auth, char const *secret,
+		   unsigned char const *vector, uint8_t seq_nbr);
+
+struct rc_stats *rc_stats_new(void);
+struct rc_stats *rc_stats_ref(struct rc_stats *stats);
+void rc_stats_free(struct rc_stats *stats);
+RC_SERVER_STATS *rc_stats_server(rc_handle const *rh, char const *server, int port, unsigned type);
+uint64_t rc_stats_median(RC_SERVER_STATS *stats);
+
+/* bump a counter of a possibly NULL RC_SERVER_STATS */
+#define RC_STATS_INC(s, field) \
+  do { if ((s) != NULL) __atomic_add_fetch(&(s)->field, 1, __ATOMIC_RELAXED); } while (0)
+
+int rc_daemon_aaa(rc_handle const *rh, uint32_t client_port, VALUE_PAIR *send, VALUE_PAIR **received,
+		  char *msg, int add_nas_port, int request_type, int prio, double deadline, int *result);
+
+int rc_server_admit_build(rc_handle *rh, SERVER *srv);
+void rc_server_admit_free(SERVER *srv);
+void rc_admit_free(rc_handle *rh);
+int rc_prio_class(VALUE_PAIR *send, int request_type);
+int rc_admit(rc_handle const *rh, SERVER *srv, int s, int prio, double until);
+void rc_admit_done(rc_handle const *rh, SERVER *srv, int s);
+
+int rc_server_breaker_build(SERVER *srv);
+void rc_server_breaker_free(SERVER *srv);
+int rc_breaker_allow(rc_handle const *rh, SERVER *srv, int s);
+int rc_breaker_ejected(SERVER const *srv, int s);
+void rc_breaker_done(rc_handle const *rh, SERVER *srv, int s, int ticket, int result, double latency);
+
+void rc_health_attach(rc_handle *rh, char const *filename);
+void rc_health_detach(rc_handle *rh);
+int rc_health_dead(rc_handle const *rh, char const *server, int port, unsigned type);
+void rc_health_mark_dead(rc_handle const *rh, char const *server, int port, unsigned type, int deadtime);
+void rc_health_update(rc_handle const *rh, char const *server, int port, unsigned type,
+		      int result, uint64_t rtt);
+
+int rc_server_ring_build(SERVER *srv);
+void rc_server_ring_free(SERVER *srv);
+int rc_server_ring_order(SERVER const *srv, VALUE_PAIR const *key, int *order);
+
+int rc_trace_copy(rc_handle *dst, rc_handle const *src);
+void rc_trace_emit(rc_handle const *rh, RC_TRACE_STAGE stage, SEND_DATA const *data, int value);
+
+/* report a lifecycle stage; a single well-predicted branch when no hook is set */
+#define RC_TRACE(rh, stage, data, value) \
+  do { if (__builtin_expect((rh)->trace != NULL, 0)) rc_trace_emit((rh), (stage), (data), (value)); } while (0)
 
 #endif /* UTIL_H */
 
@@ -18,15 +18,35 @@ static char	rcsid[] =
 #include <messages.h>
 #include <pathnames.h>
 
+#ifdef HAVE_PTHREAD_CREATE
+# include <pthread.h>
+#endif
+
+#define STREAM_WINDOW_MAX	1024
+
 static char *pname;
 
+/* shared by the workers of the streaming mode */
+struct stream {
+	rc_handle	*rh;
+	uint32_t	client_port;
+	unsigned long	records;	//!< records read so far.
+	unsigned long	failed;
+	int		eof;
+#ifdef HAVE_PTHREAD_CREATE
+	pthread_mutex_t	lock;		//!< serialises reading stdin.
+#endif
+};
+
 void usage(void)
 {
-	fprintf(stderr,"Usage: %s [-Vh] [-f <config_file>] [-i <client_port>]\n\n", pname);
+	fprintf(stderr,"Usage: %s [-Vhb] [-f <config_file>] [-i <client_port>] [-w <window>]\n\n", pname);
 	fprintf(stderr,"  -V            output version information\n");
 	fprintf(stderr,"  -h            output this text\n");
 	fprintf(stderr,"  -f		filename of alternate config file\n");
 	fprintf(stderr,"  -i            ttyname to send to the server\n");
+	fprintf(stderr,"  -b            read blank-line separated records until end of input\n");
+	fprintf(stderr,"  -w		number of records in flight with -b (default 1)\n");
 	exit(ERROR_RC);
 }
 
@@ -36,6 +56,154 @@ void version(void)
 	exit(ERROR_RC);
 }
 
+/** Send one accounting record and log the outcome
+ *
+ * @param rh a handle to parsed configuration.
+ * @param client_port the client port number to use.
+ * @param send the record.
+ * @param[out] type the Acct-Status-Type name.
+ * @param[out] username the User-Name, valid as long as send.
+ * @return the result of rc_acct().
+ */
+static int acct_record(rc_handle *rh, uint32_t client_port, VALUE_PAIR *send,
+		       char const **type, char const **username)
+{
+	VALUE_PAIR	*vp;
+	DICT_VALUE	*dval;
+	char const	*service, *fproto;
+	int		result;
+
+	*username = service = *type = "(unknown)";
+	fproto = NULL;
+
+	if ((vp = rc_avpair_get(send, PW_ACCT_STATUS_TYPE, 0)) != NULL)
+			if ((dval = rc_dict_getval(rh, vp->lvalue, vp->name)) != NULL) {
+				*type = dval->name;
+			}
+
+	if ((vp = rc_avpair_get(send, PW_USER_NAME, 0)) != NULL)
+			*username = vp->strvalue;
+
+	if ((vp = rc_avpair_get(send, PW_SERVICE_TYPE, 0)) != NULL)
+			if ((dval = rc_dict_getval(rh, vp->lvalue, vp->name)) != NULL) {
+				service = dval->name;
+			}
+
+	if (vp && (vp->lvalue == PW_FRAMED) &&
+		((vp = rc_avpair_get(send, PW_FRAMED_PROTOCOL, 0)) != NULL))
+			if ((dval = rc_dict_getval(rh, vp->lvalue, vp->name)) != NULL) {
+				fproto = dval->name;
+			}
+
+	result = rc_acct(rh, client_port, send);
+	rc_log(LOG_NOTICE, "accounting %s, type %s, username %s, service %s%s%s",
+	       (result == OK_RC) ? "OK" : "FAILED",
+	       *type, *username, service,(fproto)?"/":"", (fproto)?fproto:"");
+
+	return result;
+}
+
+/** Read records from stdin and send them until the input ends
+ *
+ * Any number of these run at once, one per record in flight.  Each
+ * record produces a line "<record> <result> <type> <username>" on
+ * stdout as soon as it completes, so lines may come out of order.
+ *
+ * @param arg the #stream.
+ * @return NULL.
+ */
+static void *stream_worker(void *arg)
+{
+	struct stream	*st = arg;
+	VALUE_PAIR	*send;
+	char const	*type, *username;
+	unsigned long	record = 0;
+	int		r, result;
+
+	for (;;) {
+#ifdef HAVE_PTHREAD_CREATE
+		pthread_mutex_lock(&st->lock);
+#endif
+		r = st->eof ? 0 : rc_avpair_readin_record(st->rh, stdin, &send);
+		if (r == 0)
+			st->eof = 1;
+		else
+			record = ++st->records;
+#ifdef HAVE_PTHREAD_CREATE
+		pthread_mutex_unlock(&st->lock);
+#endif
+		if (r == 0)
+			break;
+
+		if (r < 0) {
+			result = ERROR_RC;
+			type = username = "(malformed)";
+		} else {
+			result = acct_record(st->rh, st->client_port, send, &type, &username);
+		}
+
+		if (result != OK_RC)
+			__atomic_add_fetch(&st->failed, 1, __ATOMIC_RELAXED);
+
+		printf("%lu %d %s %s\n", record, result, type, username);
+		rc_avpair_free(send);
+	}
+
+	return NULL;
+}
+
+/** Stream records from stdin, keeping up to window of them in flight
+ *
+ * @param rh a handle to parsed configuration.
+ * @param client_port the client port number to use.
+ * @param window the number of records in flight.
+ * @return %OK_RC if every record was accounted, %ERROR_RC otherwise.
+ */
+static int acct_stream(rc_handle *rh, uint32_t client_port, int window)
+{
+	struct stream	st;
+#ifdef HAVE_PTHREAD_CREATE
+	pthread_t	*tids;
+	int		i, n;
+#endif
+
+	memset(&st, 0, sizeof(st));
+	st.rh = rh;
+	st.client_port = client_port;
+
+	/* results are read by the program feeding us, as they complete */
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+#ifdef HAVE_PTHREAD_CREATE
+	pthread_mutex_init(&st.lock, NULL);
+
+	tids = calloc(window, sizeof(*tids));
+	if (tids == NULL) {
+		rc_log(LOG_CRIT, "%s: out of memory", pname);
+		return ERROR_RC;
+	}
+
+	for (n = 0; n < window - 1; n++) {
+		if (pthread_create(&tids[n], NULL, stream_worker, &st) != 0) {
+			rc_log(LOG_WARNING, "%s: only %d records in flight", pname, n + 1);
+			break;
+		}
+	}
+	stream_worker(&st);
+	for (i = 0; i < n; i++)
+		pthread_join(tids[i], NULL);
+
+	free(tids);
+	pthread_mutex_destroy(&st.lock);
+#else
+	if (window > 1)
+		rc_log(LOG_WARNING, "%s: built without threads, sending one record at a time", pname);
+	stream_worker(&st);
+#endif
+
+	return (st.failed == 0) ? OK_RC : ERROR_RC;
+}
+
 int
 main (int argc, char **argv)
 {
@@ -43,9 +211,8 @@ main (int argc, char **argv)
 	VALUE_PAIR	*send = NULL;
    	uint32_t		client_port;
    	int			c;
-	VALUE_PAIR	*vp;
-	DICT_VALUE  *dval;
-	char *username, *service, *fproto, *type;
+	int			stream = 0, window = 1;
+	char const *username, *type;
 	char *path_radiusclient_conf = RC_CONFIG_FILE;
 	char *ttyn = NULL;
 	rc_handle *rh;
@@ -56,7 +223,7 @@ main (int argc, char **argv)
 
 	rc_openlog(pname);
 
-	while ((c = getopt(argc,argv,"f:i:hV")) > 0)
+	while ((c = getopt(argc,argv,"f:i:w:bhV")) > 0)
 	{
 		switch(c)
 		{
@@ -66,6 +233,18 @@ main (int argc, char **argv)
 			case 'i':
 				ttyn = optarg;
 				break;
+			case 'b':
+				stream = 1;
+				break;
+			case 'w':
+				window = atoi(optarg);
+				if (window < 1 || window > STREAM_WINDOW_MAX) {
+					fprintf(stderr, "%s: window must be between 1 and %d\n",
+						pname, STREAM_WINDOW_MAX);
+					exit(ERROR_RC);
+				}
+				stream = 1;
+				break;
 			case 'V':
 				version();
 				break;
@@ -106,43 +285,15 @@ main (int argc, char **argv)
 		}
 	}
 
-	if ((send = rc_avpair_readin(rh, stdin))) {
-
-		username = service = type = "(unknown)";
-		fproto = NULL;
-
-		if ((vp = rc_avpair_get(send, PW_ACCT_STATUS_TYPE, 0)) != NULL)
-				if ((dval = rc_dict_getval(rh, vp->lvalue, vp->name)) != NULL) {
-					type = dval->name;
-				}
-
-		if ((vp = rc_avpair_get(send, PW_USER_NAME, 0)) != NULL)
-				username = vp->strvalue;
-
-		if ((vp = rc_avpair_get(send, PW_SERVICE_TYPE, 0)) != NULL)
-				if ((dval = rc_dict_getval(rh, vp->lvalue, vp->name)) != NULL) {
-					service = dval->name;
-				}
-
-		if (vp && (vp->lvalue == PW_FRAMED) &&
-			((vp = rc_avpair_get(send, PW_FRAMED_PROTOCOL, 0)) != NULL))
-				if ((dval = rc_dict_getval(rh, vp->lvalue, vp->name)) != NULL) {
-					fproto = dval->name;
-				}
+	if (stream)
+		exit(acct_stream(rh, client_port, window));
 
-		result = rc_acct(rh, client_port, send);
+	if ((send = rc_avpair_readin(rh, stdin))) {
+		result = acct_record(rh, client_port, send, &type, &username);
 		if (result == OK_RC)
-		{
 			fprintf(stderr, SC_ACCT_OK);
-			rc_log(LOG_NOTICE, "accounting OK, type %s, username %s, service %s%s%s",
-				   type, username, service,(fproto)?"/":"", (fproto)?fproto:"");
-		}
 		else
-		{
 			fprintf(stderr, SC_ACCT_FAILED, result);
-			rc_log(LOG_NOTICE, "accounting FAILED, type %s, username %s, service %s%s%s",
-				   type, username, service,(fproto)?"/":"", (fproto)?fproto:"");
-		}
 		rc_avpair_free(send);
 	}
 
@@ -0,0 +1,209 @@
+/*
+ * radclientd.c	Local daemon sending RADIUS requests on behalf of short-lived programs.
+ *
+ * License:	BSD
+ *
+ */
+
+static char	rcsid[] =
+		"$Id: radclientd.c $";
+
+#include <config.h>
+#include <includes.h>
+#include <freeradius-client.h>
+#include <pathnames.h>
+
+#ifdef HAVE_PTHREAD_CREATE
+# include <pthread.h>
+#endif
+
+static char *pname;
+
+static volatile sig_atomic_t got_hup, got_term;
+
+/* one client connection */
+struct conn {
+	RC_RELOAD	*rl;
+	int		fd;
+};
+
+void usage(void)
+{
+	fprintf(stderr,"Usage: %s [-Vh] [-f <config_file>] [-s <socket>] [-m <mode>]\n\n", pname);
+	fprintf(stderr,"  -V            output version information\n");
+	fprintf(stderr,"  -h            output this text\n");
+	fprintf(stderr,"  -f		filename of alternate config file\n");
+	fprintf(stderr,"  -s		listen on this socket instead of daemon_socket\n");
+	fprintf(stderr,"  -m		octal permissions of the socket (default 0600)\n");
+	fprintf(stderr,"\nRuns in the foreground; SIGHUP re-reads the configuration.\n");
+	exit(ERROR_RC);
+}
+
+void version(void)
+{
+	fprintf(stderr,"%s: %s\n", pname ,rcsid);
+	exit(ERROR_RC);
+}
+
+static void on_signal(int sig)
+{
+	if (sig == SIGHUP)
+		got_hup = 1;
+	else
+		got_term = 1;
+}
+
+static void *conn_worker(void *arg)
+{
+	struct conn *c = arg;
+
+	rc_daemon_serve(c->rl, c->fd);
+	free(c);
+
+	return NULL;
+}
+
+/** Serve a connection, on a thread of its own where there are threads
+ *
+ * @param rl the configuration.
+ * @param fd the connection.
+ */
+static void conn_start(RC_RELOAD *rl, int fd)
+{
+	struct conn	*c;
+#ifdef HAVE_PTHREAD_CREATE
+	pthread_t	tid;
+	pthread_attr_t	attr;
+	sigset_t	set, old;
+#endif
+
+	c = malloc(sizeof(*c));
+	if (c == NULL) {
+		rc_log(LOG_CRIT, "%s: out of memory", pname);
+		close(fd);
+		return;
+	}
+	c->rl = rl;
+	c->fd = fd;
+
+#ifdef HAVE_PTHREAD_CREATE
+	/* signals must interrupt accept() in the main thread, not a worker */
+	sigemptyset(&set);
+	sigaddset(&set, SIGHUP);
+	sigaddset(&set, SIGTERM);
+	sigaddset(&set, SIGINT);
+	pthread_sigmask(SIG_BLOCK, &set, &old);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&tid, &attr, conn_worker, c) != 0) {
+		rc_log(LOG_ERR, "%s: can't start a thread, serving the connection inline", pname);
+		conn_worker(c);
+	}
+	pthread_attr_destroy(&attr);
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+#else
+	conn_worker(c);
+#endif
+}
+
+int main (int argc, char **argv)
+{
+	char			*path_radiusclient_conf = RC_CONFIG_FILE;
+	char			*path_socket = NULL, *end;
+	mode_t			mode = 0600;
+	struct sigaction	sa;
+	RC_RELOAD		*rl;
+	rc_handle		*rh;
+	int			c, fd, conn;
+
+	extern char *optarg;
+
+	pname = (pname = strrchr(argv[0],'/'))?pname+1:argv[0];
+
+	rc_openlog(pname);
+
+	while ((c = getopt(argc,argv,"hVf:s:m:")) > 0)
+	{
+		switch(c) {
+			case 'f':
+				path_radiusclient_conf = optarg;
+				break;
+			case 's':
+				path_socket = optarg;
+				break;
+			case 'm':
+				mode = strtoul(optarg, &end, 8);
+				if (*end != '\0' || mode > 0777) {
+					fprintf(stderr, "%s: bad socket mode: %s\n", pname, optarg);
+					exit(ERROR_RC);
+				}
+				break;
+			case 'V':
+				version();
+				break;
+			case 'h':
+				usage();
+				break;
+			default:
+				exit(ERROR_RC);
+				break;
+		}
+	}
+
+	if ((rl = rc_reload_open(path_radiusclient_conf)) == NULL)
+		exit(ERROR_RC);
+
+	if (path_socket == NULL) {
+		rh = rc_reload_acquire(rl);
+		if (rc_conf_str(rh, "daemon_socket") != NULL)
+			path_socket = strdup(rc_conf_str(rh, "daemon_socket"));
+		rc_reload_release(rl, rh);
+		if (path_socket == NULL) {
+			fprintf(stderr, "%s: no daemon_socket in %s and no -s given\n",
+				pname, path_radiusclient_conf);
+			exit(ERROR_RC);
+		}
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGHUP, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &sa, NULL);
+
+	if ((fd = rc_daemon_listen(path_socket, mode)) < 0)
+		exit(ERROR_RC);
+
+	rc_log(LOG_INFO, "%s: listening on %s", pname, path_socket);
+
+	while (!got_term) {
+		if (got_hup) {
+			got_hup = 0;
+			if (rc_reload(rl) == 0)
+				rc_log(LOG_INFO, "%s: configuration reloaded", pname);
+		}
+
+		conn = accept(fd, NULL, NULL);
+		if (conn < 0) {
+			if (errno != EINTR) {
+				rc_log(LOG_ERR, "%s: accept: %s", pname, strerror(errno));
+				sleep(1);
+			}
+			continue;
+		}
+		fcntl(conn, F_SETFD, FD_CLOEXEC);
+
+		conn_start(rl, conn);
+	}
+
+	/* connections still being served keep the configuration, so it is not freed */
+	unlink(path_socket);
+	rc_log(LOG_INFO, "%s: exiting", pname);
+
+	exit(OK_RC);
+}
@@ -26,42 +26,172 @@
  * $Id: radiusclient.c,v 1.8 2010/02/04 10:30:26 aland Exp $
  */
 
+#include <config.h>
+
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#ifdef HAVE_PTHREAD_CREATE
+#include <pthread.h>
+#endif
+
 #include <freeradius-client.h>
 
 #define BUF_LEN 4096
+#define OUTSTANDING_MAX 1024
+
+/* shared by the workers of -s -n */
+struct server_ctx {
+    void *rh;
+    int nas_port;
+    unsigned long seq;          /* requests read so far */
+    int eof;
+#ifdef HAVE_PTHREAD_CREATE
+    pthread_mutex_t lock;       /* serialises reading stdin */
+#endif
+};
 
-int process(void *, VALUE_PAIR *, int, int);
+int process(void *, VALUE_PAIR *, int, int, char *, size_t);
 
 static void
 usage(void)
 {
 
-    fprintf(stderr, "usage: radiusclient [-f config_file] [-p nas_port] [-s | [-a] a1=v1 [a2=v2[...[aN=vN]...]]]\n");
+    fprintf(stderr, "usage: radiusclient [-f config_file] [-p nas_port] [-s [-n outstanding] | [-a] a1=v1 [a2=v2[...[aN=vN]...]]]\n");
     exit(1);
 }
 
+/*
+ * Read one request for -s: a line saying "ACCT" (or anything else for
+ * authentication) followed by attribute lines up to a blank line.
+ * Returns the number of attribute lines that could not be parsed and
+ * sets *eof once the input is exhausted.
+ */
+static int
+read_request(void *rh, VALUE_PAIR **send, int *acct, int *eof)
+{
+    int i, ecount, firstline, theend;
+    size_t len;
+    VALUE_PAIR **vp;
+    char *cp;
+    char lbuf[4096];
+
+    *send = NULL;
+    vp = send;
+    ecount = 0;
+    firstline = 1;
+    *acct = 0;
+    do {
+        len = 0;
+        cp = rc_fgetln(stdin, &len);
+        theend = 1;
+        if (cp != NULL && len > 0) {
+            if (firstline != 0) {
+                if (len >= 4 && memcmp(cp, "ACCT", 4) == 0)
+                    *acct = 1;
+                firstline = 0;
+                theend = 0;
+                continue;
+            }
+            for (i = 0; i < len; i++) {
+                if (!isspace(cp[i])) {
+                    theend = 0;
+                    break;
+                }
+            }
+            if (theend == 0) {
+                memcpy(lbuf, cp, len);
+                lbuf[len] = '\0';
+                if (rc_avpair_parse(rh, lbuf, vp) < 0) {
+                    fprintf(stderr, "%s: can't parse AV pair\n", lbuf);
+                    ecount++;
+                } else {
+                    vp = &(*send)->next;
+                }
+            }
+        }
+    } while (theend == 0);
+
+    *eof = (cp == NULL || len == 0);
+    return ecount;
+}
+
+/*
+ * Serve requests from stdin until it ends.  Several of these run at
+ * once with -n; each result is written as "<seq> <result>", the reply
+ * attributes and a blank line, as soon as the request completes.
+ */
+static void *
+server_worker(void *arg)
+{
+    struct server_ctx *ctx = arg;
+    VALUE_PAIR *send;
+    unsigned long seq;
+    int acct, ecount, eof, rc;
+    char buf[BUF_LEN];
+
+    for (;;) {
+#ifdef HAVE_PTHREAD_CREATE
+        pthread_mutex_lock(&ctx->lock);
+#endif
+        if (ctx->eof) {
+#ifdef HAVE_PTHREAD_CREATE
+            pthread_mutex_unlock(&ctx->lock);
+#endif
+            break;
+        }
+        ecount = read_request(ctx->rh, &send, &acct, &eof);
+        ctx->eof = eof;
+        /* a trailing blank record at the end of input is not a request */
+        seq = (send != NULL || ecount != 0 || !eof) ? ++ctx->seq : 0;
+#ifdef HAVE_PTHREAD_CREATE
+        pthread_mutex_unlock(&ctx->lock);
+#endif
+        if (seq == 0)
+            break;
+
+        buf[0] = '\0';
+        if (send != NULL && ecount == 0)
+            rc = process(ctx->rh, send, acct, ctx->nas_port, buf, sizeof(buf));
+        else
+            rc = -1;
+
+        flockfile(stdout);
+        printf("%lu %d\n%s\n", seq, rc, buf);
+        fflush(stdout);
+        funlockfile(stdout);
+
+        if (send != NULL)
+            rc_avpair_free(send);
+    }
+
+    return NULL;
+}
+
 int
 main(int argc, char *argv[])
 {
-    int i, nas_port, ch, acct, server, ecount, firstline, theend;
+    int i, nas_port, ch, acct, server, ecount, eof, outstanding;
     void *rh;
-    size_t len;
     VALUE_PAIR *send, **vp;
-    char *rc_conf, *cp;
-    char lbuf[4096];
+    char *rc_conf;
+    char buf[BUF_LEN];
+    struct server_ctx ctx;
+#ifdef HAVE_PTHREAD_CREATE
+    pthread_t *tids;
+    int n;
+#endif
 
     rc_conf = RC_CONFIG_FILE;
     nas_port = 5060;
 
     acct = 0;
     server = 0;
-    while ((ch = getopt(argc, argv, "af:p:s")) != -1) {
+    outstanding = 0;
+    while ((ch = getopt(argc, argv, "af:n:p:s")) != -1) {
         switch (ch) {
         case 'f':
             rc_conf = optarg;
@@ -79,6 +209,14 @@ main(int argc, char *argv[])
             server = 1;
             break;
 
+        case 'n':
+            outstanding = atoi(optarg);
+            if (outstanding < 1 || outstanding > OUTSTANDING_MAX) {
+                fprintf(stderr, "outstanding requests must be between 1 and %d\n", OUTSTANDING_MAX);
+                exit(1);
+            }
+            break;
+
         default:
             usage();
         }
@@ -86,7 +224,8 @@ main(int argc, char *argv[])
     argc -= optind;
     argv += optind;
 
-    if ((argc == 0 && server == 0) || (argc != 0 && server != 0))
+    if ((argc == 0 && server == 0) || (argc != 0 && server != 0) ||
+        (outstanding != 0 && server == 0))
         usage();
 
     if ((rh = rc_read_config(rc_conf)) == NULL) {
@@ -109,70 +248,63 @@ main(int argc, char *argv[])
             }
             vp = &send->next;
         }
-        exit(process(rh, send, acct, nas_port));
+        i = process(rh, send, acct, nas_port, buf, sizeof(buf));
+        printf("%s", buf);
+        exit(i);
     }
-    while (1 == 1) {
-        send = NULL;
-        vp = &send;
-        ecount = 0;
-        firstline = 1;
-        acct = 0;
-        do {
-            len = 0;
-            cp = rc_fgetln(stdin, &len);
-            theend = 1;
-            if (cp != NULL && len > 0) {
-                if (firstline != 0) {
-                    if (len >= 4 && memcmp(cp, "ACCT", 4) == 0)
-                        acct = 1;
-                    firstline = 0;
-                    theend = 0;
-                    continue;
-                }
-                for (i = 0; i < len; i++) {
-                    if (!isspace(cp[i])) {
-                        theend = 0;
-                        break;
-                    }
-                }
-                if (theend == 0) {
-                    memcpy(lbuf, cp, len);
-                    lbuf[len] = '\0';
-                    if (rc_avpair_parse(rh, lbuf, vp) < 0) {
-                        fprintf(stderr, "%s: can't parse AV pair\n", lbuf);
-                        ecount++;
-                    } else {
-                        vp = &send->next;
-                    }
-                }
-            }
-        } while (theend == 0);
-        if (send != NULL && ecount == 0)
-            printf("%d\n\n", process(rh, send, acct, nas_port));
-        else
+
+    if (outstanding != 0) {
+        memset(&ctx, 0, sizeof(ctx));
+        ctx.rh = rh;
+        ctx.nas_port = nas_port;
+#ifdef HAVE_PTHREAD_CREATE
+        pthread_mutex_init(&ctx.lock, NULL);
+        if ((tids = calloc(outstanding, sizeof(*tids))) == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        for (n = 0; n < outstanding - 1; n++) {
+            if (pthread_create(&tids[n], NULL, server_worker, &ctx) != 0)
+                break;
+        }
+        server_worker(&ctx);
+        for (i = 0; i < n; i++)
+            pthread_join(tids[i], NULL);
+        free(tids);
+#else
+        server_worker(&ctx);
+#endif
+        exit(0);
+    }
+
+    do {
+        ecount = read_request(rh, &send, &acct, &eof);
+        buf[0] = '\0';
+        if (send != NULL && ecount == 0) {
+            i = process(rh, send, acct, nas_port, buf, sizeof(buf));
+            printf("%s%d\n\n", buf, i);
+        } else
             printf("%d\n\n", -1);
         fflush(stdout);
         if (send != NULL)
             rc_avpair_free(send);
-		if (cp == NULL || len == 0)
-            break;
-    }
+    } while (!eof);
     exit(0);
 }
 
 int
-process(void *rh, VALUE_PAIR *send, int acct, int nas_port)
+process(void *rh, VALUE_PAIR *send, int acct, int nas_port, char *buf, size_t buflen)
 {
     VALUE_PAIR *received;
     char msg[PW_MAX_MSG_SIZE];
-    char buf[BUF_LEN];
     int i;
 
+    buf[0] = '\0';
     received = NULL;
     if (acct == 0) {
         i = rc_auth(rh, nas_port, send, &received, msg);
         if (received != NULL) {
-            printf("%s", rc_avpair_log(rh, received, buf, BUF_LEN));
+            rc_avpair_log(rh, received, buf, buflen);
             rc_avpair_free(received);
         }
     } else {
@@ -0,0 +1,1222 @@
+/*
+ * radpcap.c	Decodes the RADIUS packets of pcap and pcapng captures,
+ *		timing the decoder, and optionally replays their requests.
+ *
+ * License:	BSD
+ *
+ */
+
+static char	rcsid[] =
+		"$Id: radpcap.c $";
+
+#include <config.h>
+#include <includes.h>
+#include <freeradius-client.h>
+#include <pathnames.h>
+#include "util.h"
+#include "rc-md5.h"
+#include <math.h>
+
+#ifdef HAVE_PTHREAD_CREATE
+# include <pthread.h>
+#endif
+
+#define MAX_CAPLEN	(1 << 24)		//!< larger records are taken as corruption.
+#define MAX_IFACES	256			//!< interfaces of a pcapng section.
+#define MAX_PORTS	32
+#define MAX_WORKERS	4096
+#define MATCH_BUCKETS	(1 << 16)		//!< outstanding requests remembered.
+#define UNKNOWN_SLOTS	1024			//!< distinct unknown attributes counted.
+
+#define PCAP_MAGIC	0xa1b2c3d4
+#define PCAP_MAGIC_NS	0xa1b23c4d
+#define PCAPNG_SHB	0x0a0d0d0a
+#define PCAPNG_BOM	0x1a2b3c4d
+#define PCAPNG_IDB	1
+#define PCAPNG_PB	2
+#define PCAPNG_SPB	3
+#define PCAPNG_EPB	6
+
+static char *pname;
+
+static volatile sig_atomic_t got_term;
+
+/* a capture file, classic pcap or pcapng */
+struct capture {
+	FILE		*fp;
+	char const	*name;
+	int		ng;
+	int		swapped;		//!< written in the other byte order.
+	uint32_t	linktype;		//!< of classic pcap.
+	double		tsdiv;			//!< of classic pcap, time units per second.
+	int		nifaces;
+	struct {
+		uint32_t	linktype;
+		double		tsdiv;
+	} iface[MAX_IFACES];
+	double		last_ts;
+	uint8_t		*buf;
+	size_t		size;
+};
+
+/* one end of a UDP flow */
+struct endpoint {
+	uint8_t		addr[16];
+	uint16_t	port;
+	uint8_t		family;
+};
+
+/* a RADIUS packet of the capture; its bytes are in the packet store */
+struct packet {
+	double		ts;
+	size_t		off;
+	uint16_t	len;
+	uint8_t		matched;		//!< a reply whose request was seen.
+	uint8_t		vector[AUTH_VECTOR_LEN];	//!< of that request.
+};
+
+/* outcome of validating a packet */
+enum check_result {
+	CHECK_OK = 0,
+	CHECK_MALFORMED,
+	CHECK_BAD_AUTH,
+	CHECK_UNMATCHED,			//!< a reply to a request not captured.
+	CHECK_UNVERIFIED,			//!< no secret, or nothing to verify.
+	CHECK_RESULTS
+};
+
+static char const *check_names[CHECK_RESULTS] = {
+	"ok", "malformed", "bad authenticator", "reply without request", "not verified"
+};
+
+/* a request remembered to check its reply */
+struct match {
+	struct endpoint	client, server;
+	uint8_t		id;
+	uint8_t		used;
+	uint8_t		vector[AUTH_VECTOR_LEN];
+};
+
+struct unknown {
+	uint32_t	vendor;
+	uint32_t	attr;
+	uint64_t	count;
+};
+
+/* everything read from the captures */
+struct trace {
+	uint8_t		*data;			//!< the packet store.
+	size_t		used, size;
+	struct packet	*packets;
+	size_t		npackets, maxpackets;
+
+	uint64_t	frames;
+	uint64_t	not_ip;
+	uint64_t	fragments;
+	uint64_t	not_radius;
+	uint64_t	truncated;
+	uint64_t	codes[256];
+};
+
+/* replay of the requests, shared by every worker */
+struct replay {
+	rc_handle	*rh;
+	struct trace const *trace;
+	char const	*secret;
+	double		speed;
+	double		start;
+	double		first_ts;
+	size_t		next;			//!< under lock.
+#ifdef HAVE_PTHREAD_CREATE
+	pthread_mutex_t	lock;
+#endif
+	uint64_t	sent;
+	uint64_t	result[4];		//!< ok, reject, timeout, error.
+	RC_HISTOGRAM	latency;		//!< usec, from when it was due.
+};
+
+static uint16_t	ports[MAX_PORTS] = { 1812, 1813, 1645, 1646, 3799 };
+static int	nports = 5;
+
+static struct match	*matches;
+static struct unknown	unknowns[UNKNOWN_SLOTS];
+static uint64_t		unknown_other;
+
+void usage(void)
+{
+	fprintf(stderr,"Usage: %s [-Vhv] [-f <config_file>] [-s <secret>] [-P <ports>] [-n <passes>]\n", pname);
+	fprintf(stderr,"       [-r <speed>] [-c <concurrency>] file ...\n\n");
+	fprintf(stderr,"  -V            output version information\n");
+	fprintf(stderr,"  -h            output this text\n");
+	fprintf(stderr,"  -v            log what the decoder complains about\n");
+	fprintf(stderr,"  -f		filename of alternate config file, for the dictionary and\n");
+	fprintf(stderr,"		the servers to replay to\n");
+	fprintf(stderr,"  -s		shared secret of the captured traffic, to verify authenticators\n");
+	fprintf(stderr,"		and to replay passwords\n");
+	fprintf(stderr,"  -P		comma separated RADIUS ports (default 1812,1813,1645,1646,3799)\n");
+	fprintf(stderr,"  -n		decode every packet this many times (default 1)\n");
+	fprintf(stderr,"  -r		replay the requests at this many times their captured pace\n");
+	fprintf(stderr,"  -c		replayed requests outstanding at most (default 64)\n");
+	fprintf(stderr,"\nFiles may be pcap or pcapng, of Ethernet, Linux cooked, loopback or raw IP.\n");
+	exit(ERROR_RC);
+}
+
+void version(void)
+{
+	fprintf(stderr,"%s: %s\n", pname ,rcsid);
+	exit(ERROR_RC);
+}
+
+static void on_signal(int sig)
+{
+	got_term = 1;
+}
+
+static uint16_t get16(struct capture const *cap, uint8_t const *p)
+{
+	uint16_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return cap->swapped ? (uint16_t)((v >> 8) | (v << 8)) : v;
+}
+
+static uint32_t get32(struct capture const *cap, uint8_t const *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	if (cap->swapped)
+		v = (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+	return v;
+}
+
+/** Read bytes of the capture into its buffer, growing it as needed
+ *
+ * @param cap the capture.
+ * @param off where in the buffer.
+ * @param len how many bytes.
+ * @return 0 on success, -1 at the end of the file or on error.
+ */
+static int cap_read(struct capture *cap, size_t off, size_t len)
+{
+	uint8_t	*buf;
+	size_t	size;
+
+	if (off + len > cap->size) {
+		for (size = cap->size ? cap->size : 65536; size < off + len; size *= 2)
+			;
+		if ((buf = realloc(cap->buf, size)) == NULL) {
+			fprintf(stderr, "%s: out of memory\n", pname);
+			return -1;
+		}
+		cap->buf = buf;
+		cap->size = size;
+	}
+	return fread(cap->buf + off, 1, len, cap->fp) == len ? 0 : -1;
+}
+
+/** Open a capture and read its file header
+ *
+ * @param cap the capture, zeroed.
+ * @param name the file.
+ * @return 0 on success, -1 on failure.
+ */
+static int cap_open(struct capture *cap, char const *name)
+{
+	uint32_t	magic;
+
+	cap->name = name;
+	if ((cap->fp = fopen(name, "rb")) == NULL) {
+		fprintf(stderr, "%s: can't open %s: %s\n", pname, name, strerror(errno));
+		return -1;
+	}
+	if (cap_read(cap, 0, 4) < 0)
+		goto bad;
+	memcpy(&magic, cap->buf, 4);
+
+	if (magic == PCAPNG_SHB) {
+		/* the section header is read like any other block */
+		cap->ng = 1;
+		rewind(cap->fp);
+		return 0;
+	}
+
+	if (cap_read(cap, 4, 20) < 0)
+		goto bad;
+	cap->tsdiv = 1000000.0;
+	if (magic == PCAP_MAGIC || magic == PCAP_MAGIC_NS) {
+		cap->swapped = 0;
+	} else {
+		cap->swapped = 1;
+		magic = get32(cap, cap->buf);
+		if (magic != PCAP_MAGIC && magic != PCAP_MAGIC_NS)
+			goto bad;
+	}
+	if (magic == PCAP_MAGIC_NS)
+		cap->tsdiv = 1000000000.0;
+	cap->linktype = get32(cap, cap->buf + 20) & 0xffff;
+	return 0;
+
+bad:
+	fprintf(stderr, "%s: %s is not a pcap or pcapng file\n", pname, name);
+	fclose(cap->fp);
+	free(cap->buf);
+	return -1;
+}
+
+/** Parse the options of a pcapng interface description
+ *
+ * Only the timestamp resolution matters here.
+ *
+ * @param cap the capture.
+ * @param p the options.
+ * @param len their length.
+ * @return time units per second.
+ */
+static double idb_tsdiv(struct capture const *cap, uint8_t const *p, size_t len)
+{
+	uint16_t	code, olen;
+	double		div = 1000000.0;
+
+	while (len >= 4) {
+		code = get16(cap, p);
+		olen = get16(cap, p + 2);
+		if (code == 0 || 4 + (size_t)olen > len)
+			break;
+		if (code == 9 && olen >= 1) {	/* if_tsresol */
+			if (p[4] & 0x80)
+				div = ldexp(1.0, p[4] & 0x7f);
+			else
+				div = pow(10.0, p[4]);
+		}
+		olen = (olen + 3) & ~3;
+		if (4 + (size_t)olen > len)
+			break;
+		p += 4 + olen;
+		len -= 4 + olen;
+	}
+	return div;
+}
+
+/** Read the next captured frame
+ *
+ * @param cap the capture.
+ * @param linktype where to store its link type.
+ * @param ts where to store its time, in seconds.
+ * @param data where to store its bytes, valid until the next call.
+ * @param caplen where to store how many were captured.
+ * @return 1 for a frame, 0 at the end, -1 on a corrupt file.
+ */
+static int cap_next(struct capture *cap, uint32_t *linktype, double *ts,
+		    uint8_t const **data, size_t *caplen)
+{
+	uint32_t	type, blen, iface, bom;
+	uint8_t		*b;
+
+	if (!cap->ng) {
+		if (cap_read(cap, 0, 16) < 0)
+			return 0;
+		*caplen = get32(cap, cap->buf + 8);
+		if (*caplen > MAX_CAPLEN)
+			return -1;
+		*ts = get32(cap, cap->buf) + get32(cap, cap->buf + 4) / cap->tsdiv;
+		*linktype = cap->linktype;
+		if (cap_read(cap, 16, *caplen) < 0)
+			return -1;
+		*data = cap->buf + 16;
+		return 1;
+	}
+
+	for (;;) {
+		if (cap_read(cap, 0, 8) < 0)
+			return 0;
+		memcpy(&type, cap->buf, 4);
+		if (type == PCAPNG_SHB) {
+			/* a new section may change the byte order */
+			if (cap_read(cap, 8, 4) < 0)
+				return -1;
+			memcpy(&bom, cap->buf + 8, 4);
+			cap->swapped = (bom != PCAPNG_BOM);
+			if (get32(cap, cap->buf + 8) != PCAPNG_BOM)
+				return -1;
+			blen = get32(cap, cap->buf + 4);
+			if (blen < 28 || (blen & 3) || blen > MAX_CAPLEN || cap_read(cap, 12, blen - 12) < 0)
+				return -1;
+			cap->nifaces = 0;
+			continue;
+		}
+
+		type = get32(cap, cap->buf);
+		blen = get32(cap, cap->buf + 4);
+		if (blen < 12 || (blen & 3) || blen > MAX_CAPLEN || cap_read(cap, 8, blen - 8) < 0)
+			return -1;
+		b = cap->buf + 8;
+		blen -= 12;			/* the body, without the trailing length */
+
+		switch (type) {
+		case PCAPNG_IDB:
+			if (blen < 8)
+				return -1;
+			if (cap->nifaces < MAX_IFACES) {
+				cap->iface[cap->nifaces].linktype = get16(cap, b);
+				cap->iface[cap->nifaces].tsdiv = idb_tsdiv(cap, b + 8, blen - 8);
+				cap->nifaces++;
+			}
+			continue;
+
+		case PCAPNG_EPB:
+		case PCAPNG_PB:
+			if (blen < 20)
+				return -1;
+			iface = (type == PCAPNG_EPB) ? get32(cap, b) : get16(cap, b);
+			*caplen = get32(cap, b + 12);
+			if ((int)iface >= cap->nifaces || *caplen > blen - 20)
+				return -1;
+			*ts = ((double)get32(cap, b + 4) * 4294967296.0 + get32(cap, b + 8)) /
+			      cap->iface[iface].tsdiv;
+			cap->last_ts = *ts;
+			*linktype = cap->iface[iface].linktype;
+			*data = b + 20;
+			return 1;
+
+		case PCAPNG_SPB:
+			if (blen < 4 || cap->nifaces == 0)
+				return -1;
+			*caplen = get32(cap, b);
+			if (*caplen > blen - 4)
+				*caplen = blen - 4;
+			*ts = cap->last_ts;
+			*linktype = cap->iface[0].linktype;
+			*data = b + 4;
+			return 1;
+
+		default:
+			continue;
+		}
+	}
+}
+
+/** Find the UDP payload of a frame
+ *
+ * @param trace counts frames that are not IP, or fragments.
+ * @param linktype the link type.
+ * @param p the frame.
+ * @param len its captured length.
+ * @param src where to store the source.
+ * @param dst where to store the destination.
+ * @param payload where to store the UDP payload.
+ * @return its length, or -1 if the frame is not UDP.
+ */
+static int udp_payload(struct trace *trace, uint32_t linktype, uint8_t const *p, size_t len,
+		       struct endpoint *src, struct endpoint *dst, uint8_t const **payload)
+{
+	uint16_t	ethertype;
+	size_t		hlen;
+	int		next;
+
+	switch (linktype) {
+	case 0:					/* BSD loopback, host byte order */
+	case 108:				/* OpenBSD loopback */
+		if (len < 4)
+			goto not_ip;
+		p += 4;
+		len -= 4;
+		break;
+
+	case 1:					/* Ethernet */
+		if (len < 14)
+			goto not_ip;
+		ethertype = (p[12] << 8) | p[13];
+		p += 14;
+		len -= 14;
+		while ((ethertype == 0x8100 || ethertype == 0x88a8 || ethertype == 0x9100) && len >= 4) {
+			ethertype = (p[2] << 8) | p[3];
+			p += 4;
+			len -= 4;
+		}
+		if (ethertype != 0x0800 && ethertype != 0x86dd)
+			goto not_ip;
+		break;
+
+	case 113:				/* Linux cooked */
+		if (len < 16)
+			goto not_ip;
+		p += 16;
+		len -= 16;
+		break;
+
+	case 276:				/* Linux cooked, version 2 */
+		if (len < 20)
+			goto not_ip;
+		p += 20;
+		len -= 20;
+		break;
+
+	case 12:				/* raw IP */
+	case 14:
+	case 101:
+	case 228:				/* IPv4 */
+	case 229:				/* IPv6 */
+		break;
+
+	default:
+		goto not_ip;
+	}
+
+	if (len < 1)
+		goto not_ip;
+
+	memset(src, 0, sizeof(*src));
+	memset(dst, 0, sizeof(*dst));
+
+	if ((p[0] >> 4) == 4) {
+		hlen = (p[0] & 0x0f) * 4;
+		if (len < 20 || hlen < 20 || len < hlen)
+			goto not_ip;
+		if (((p[6] << 8) | p[7]) & 0x3fff) {
+			trace->fragments++;
+			return -1;
+		}
+		if (((p[2] << 8) | p[3]) < len)
+			len = (p[2] << 8) | p[3];
+		next = p[9];
+		src->family = dst->family = AF_INET;
+		memcpy(src->addr, p + 12, 4);
+		memcpy(dst->addr, p + 16, 4);
+	} else if ((p[0] >> 4) == 6) {
+		if (len < 40)
+			goto not_ip;
+		if (40 + (size_t)((p[4] << 8) | p[5]) < len)
+			len = 40 + ((p[4] << 8) | p[5]);
+		next = p[6];
+		src->family = dst->family = AF_INET6;
+		memcpy(src->addr, p + 8, 16);
+		memcpy(dst->addr, p + 24, 16);
+		hlen = 40;
+		while (next == 0 || next == 43 || next == 60 || next == 44) {
+			if (next == 44) {
+				trace->fragments++;
+				return -1;
+			}
+			if (len < hlen + 8)
+				goto not_ip;
+			next = p[hlen];
+			hlen += (p[hlen + 1] + 1) * 8;
+		}
+	} else {
+		goto not_ip;
+	}
+
+	if (next != IPPROTO_UDP || len < hlen + 8)
+		return -1;
+	p += hlen;
+	len -= hlen;
+
+	src->port = (p[0] << 8) | p[1];
+	dst->port = (p[2] << 8) | p[3];
+	if (((p[4] << 8) | p[5]) >= 8 && ((size_t)((p[4] << 8) | p[5])) < len)
+		len = (p[4] << 8) | p[5];
+	*payload = p + 8;
+	return (int)(len - 8);
+
+not_ip:
+	trace->not_ip++;
+	return -1;
+}
+
+static int is_radius_port(uint16_t port)
+{
+	int i;
+
+	for (i = 0; i < nports; i++) {
+		if (ports[i] == port)
+			return 1;
+	}
+	return 0;
+}
+
+static int is_request(uint8_t code)
+{
+	return code == PW_ACCESS_REQUEST || code == PW_ACCOUNTING_REQUEST ||
+	       code == PW_STATUS_SERVER || code == 40 || code == 43;
+}
+
+/** Find the slot of a request, given the flow and id
+ *
+ * @param client the client.
+ * @param server the server.
+ * @param id the RADIUS id.
+ * @return the slot.
+ */
+static struct match *match_slot(struct endpoint const *client, struct endpoint const *server, uint8_t id)
+{
+	uint32_t	h = 2166136261u;
+	unsigned	i;
+
+	for (i = 0; i < 16; i++)
+		h = (h ^ client->addr[i]) * 16777619u;
+	h = (h ^ client->port) * 16777619u;
+	h = (h ^ server->port) * 16777619u;
+	h = (h ^ id) * 16777619u;
+	return &matches[h & (MATCH_BUCKETS - 1)];
+}
+
+static int same_flow(struct match const *m, struct endpoint const *client,
+		     struct endpoint const *server, uint8_t id)
+{
+	return m->used && m->id == id && m->client.port == client->port &&
+	       m->server.port == server->port &&
+	       memcmp(m->client.addr, client->addr, 16) == 0 &&
+	       memcmp(m->server.addr, server->addr, 16) == 0;
+}
+
+/** Keep a RADIUS payload, pairing replies with the requests they answer
+ *
+ * A request is forgotten once another one of the same flow and id, or
+ * of the same hash slot, comes along.
+ *
+ * @param trace the trace.
+ * @param ts the time of the frame.
+ * @param p the payload.
+ * @param len its length.
+ * @param src the source.
+ * @param dst the destination.
+ * @return 0 on success, -1 when out of memory.
+ */
+static int trace_add(struct trace *trace, double ts, uint8_t const *p, size_t len,
+		     struct endpoint const *src, struct endpoint const *dst)
+{
+	struct packet	*pkt;
+	struct match	*m;
+	void		*n;
+	size_t		size;
+
+	if (len > 0xffff)
+		len = 0xffff;
+
+	if (trace->npackets == trace->maxpackets) {
+		size = trace->maxpackets ? trace->maxpackets * 2 : 4096;
+		if ((n = realloc(trace->packets, size * sizeof(*trace->packets))) == NULL)
+			return -1;
+		trace->packets = n;
+		trace->maxpackets = size;
+	}
+	if (trace->used + len > trace->size) {
+		for (size = trace->size ? trace->size : 1 << 20; size < trace->used + len; size *= 2)
+			;
+		if ((n = realloc(trace->data, size)) == NULL)
+			return -1;
+		trace->data = n;
+		trace->size = size;
+	}
+
+	pkt = &trace->packets[trace->npackets++];
+	memset(pkt, 0, sizeof(*pkt));
+	pkt->ts = ts;
+	pkt->off = trace->used;
+	pkt->len = (uint16_t)len;
+	memcpy(trace->data + trace->used, p, len);
+	trace->used += len;
+
+	if (len < AUTH_HDR_LEN)
+		return 0;
+	trace->codes[p[0]]++;
+
+	if (is_request(p[0])) {
+		m = match_slot(src, dst, p[1]);
+		m->client = *src;
+		m->server = *dst;
+		m->id = p[1];
+		m->used = 1;
+		memcpy(m->vector, p + 4, AUTH_VECTOR_LEN);
+	} else {
+		m = match_slot(dst, src, p[1]);
+		if (same_flow(m, dst, src, p[1])) {
+			pkt->matched = 1;
+			memcpy(pkt->vector, m->vector, AUTH_VECTOR_LEN);
+		}
+	}
+	return 0;
+}
+
+/** Read the RADIUS packets of a capture
+ *
+ * @param trace the trace to add them to.
+ * @param name the file.
+ * @return 0 on success, -1 on failure.
+ */
+static int trace_load(struct trace *trace, char const *name)
+{
+	struct capture	cap;
+	struct endpoint	src, dst;
+	uint8_t const	*frame, *payload;
+	uint32_t	linktype;
+	size_t		caplen;
+	double		ts;
+	int		rc, len;
+
+	memset(&cap, 0, sizeof(cap));
+	if (cap_open(&cap, name) < 0)
+		return -1;
+
+	while ((rc = cap_next(&cap, &linktype, &ts, &frame, &caplen)) > 0) {
+		trace->frames++;
+		len = udp_payload(trace, linktype, frame, caplen, &src, &dst, &payload);
+		if (len < 0)
+			continue;
+		if (!is_radius_port(src.port) && !is_radius_port(dst.port)) {
+			trace->not_radius++;
+			continue;
+		}
+		if (len < AUTH_HDR_LEN || ((payload[2] << 8) | payload[3]) > len)
+			trace->truncated++;
+		if (trace_add(trace, ts, payload, len, &src, &dst) < 0) {
+			fprintf(stderr, "%s: out of memory\n", pname);
+			rc = -1;
+			break;
+		}
+	}
+	if (rc < 0)
+		fprintf(stderr, "%s: %s is corrupt after %llu frames\n", pname, name,
+			(unsigned long long)trace->frames);
+
+	fclose(cap.fp);
+	free(cap.buf);
+	return rc;
+}
+
+/** Count an attribute the dictionary does not know
+ *
+ * @param vendor its vendor, 0 for none.
+ * @param attr the attribute, 0 for a whole VSA of an unknown vendor.
+ */
+static void count_unknown(uint32_t vendor, uint32_t attr)
+{
+	uint32_t	h = (vendor * 2654435761u) ^ (attr * 40503u);
+	unsigned	i, slot;
+
+	for (i = 0; i < UNKNOWN_SLOTS; i++) {
+		slot = (h + i) & (UNKNOWN_SLOTS - 1);
+		if (unknowns[slot].count == 0) {
+			unknowns[slot].vendor = vendor;
+			unknowns[slot].attr = attr;
+		}
+		if (unknowns[slot].vendor == vendor && unknowns[slot].attr == attr) {
+			unknowns[slot].count++;
+			return;
+		}
+	}
+	unknown_other++;
+}
+
+/** Check the attributes of a packet are well formed, counting unknown ones
+ *
+ * @param rh a handle to parsed configuration.
+ * @param p the attributes.
+ * @param len their length.
+ * @param census non-zero to count unknown attributes.
+ * @return 0 if well formed, -1 if not.
+ */
+static int walk_attributes(rc_handle const *rh, uint8_t const *p, size_t len, int census)
+{
+	uint8_t const	*end = p + len, *v, *vend;
+	uint32_t	vendor;
+
+	while (p < end) {
+		if (end - p < 2 || p[1] < 2 || p[1] > end - p)
+			return -1;
+		if (p[0] == PW_VENDOR_SPECIFIC && p[1] >= 6) {
+			vendor = ((uint32_t)p[2] << 24) | (p[3] << 16) | (p[4] << 8) | p[5];
+			if (rc_dict_getvend(rh, vendor) == NULL) {
+				if (census)
+					count_unknown(vendor, 0);
+			} else {
+				for (v = p + 6, vend = p + p[1]; v < vend; v += v[1]) {
+					if (vend - v < 2 || v[1] < 2 || v[1] > vend - v)
+						return -1;
+					if (census && rc_dict_get_vendor_attr(rh, v[0], vendor) == NULL)
+						count_unknown(vendor, v[0]);
+				}
+			}
+		} else if (census && rc_dict_getattr(rh, p[0]) == NULL) {
+			count_unknown(0, p[0]);
+		}
+		p += p[1];
+	}
+	return 0;
+}
+
+/** Verify the Message-Authenticator of a request, if it has one
+ *
+ * @param rh a handle to parsed configuration.
+ * @param p the packet.
+ * @param len its length.
+ * @param secret the shared secret.
+ * @return %CHECK_OK, %CHECK_BAD_AUTH, or %CHECK_UNVERIFIED without one.
+ */
+static int check_msg_auth(rc_handle const *rh, uint8_t const *p, size_t len, char const *secret)
+{
+	uint8_t const	*a, *ma = NULL;
+	unsigned char	digest[AUTH_VECTOR_LEN], zero[AUTH_VECTOR_LEN];
+	RC_HMAC_CTX	ctx;
+
+	for (a = p + AUTH_HDR_LEN; a < p + len; a += a[1]) {
+		if (a[0] == PW_MESSAGE_AUTHENTICATOR && a[1] == AUTH_VECTOR_LEN + 2)
+			ma = a + 2;
+	}
+	if (ma == NULL)
+		return CHECK_UNVERIFIED;
+
+	memset(zero, 0, sizeof(zero));
+	rc_hmac_md5_init(rh, &ctx, secret);
+	rc_hmac_md5_update(&ctx, p, ma - p);
+	rc_hmac_md5_update(&ctx, zero, AUTH_VECTOR_LEN);
+	rc_hmac_md5_update(&ctx, ma + AUTH_VECTOR_LEN, p + len - (ma + AUTH_VECTOR_LEN));
+	rc_hmac_md5_final(digest, &ctx);
+	return memcmp(digest, ma, AUTH_VECTOR_LEN) == 0 ? CHECK_OK : CHECK_BAD_AUTH;
+}
+
+/** Validate a packet, the way the client validates a reply
+ *
+ * Replies go through rc_check_reply() with the authenticator of their
+ * request. Accounting, CoA and Disconnect requests have their request
+ * authenticator checked, the other requests their Message-Authenticator.
+ *
+ * @param rh a handle to parsed configuration.
+ * @param pkt the packet.
+ * @param p its bytes.
+ * @param secret the shared secret, NULL to check the structure only.
+ * @param census non-zero to count unknown attributes.
+ * @return a #check_result.
+ */
+static int check_packet(rc_handle const *rh, struct packet const *pkt, uint8_t const *p,
+			char const *secret, int census)
+{
+	unsigned char	digest[AUTH_VECTOR_LEN], zero[AUTH_VECTOR_LEN];
+	RC_MD5_CTX	ctx;
+	size_t		len;
+
+	if (pkt->len < AUTH_HDR_LEN)
+		return CHECK_MALFORMED;
+	len = (p[2] << 8) | p[3];
+	if (len < AUTH_HDR_LEN || len > pkt->len || len > 4096)
+		return CHECK_MALFORMED;
+	if (walk_attributes(rh, p + AUTH_HDR_LEN, len - AUTH_HDR_LEN, census) < 0)
+		return CHECK_MALFORMED;
+
+	if (secret == NULL)
+		return CHECK_UNVERIFIED;
+
+	switch (p[0]) {
+	case PW_ACCESS_REQUEST:
+	case PW_STATUS_SERVER:
+		return check_msg_auth(rh, p, len, secret);
+
+	case PW_ACCOUNTING_REQUEST:
+	case 40:				/* Disconnect-Request */
+	case 43:				/* CoA-Request */
+		memset(zero, 0, sizeof(zero));
+		rc_md5_init(&ctx);
+		rc_md5_update(&ctx, p, 4);
+		rc_md5_update(&ctx, zero, AUTH_VECTOR_LEN);
+		rc_md5_update(&ctx, p + AUTH_HDR_LEN, len - AUTH_HDR_LEN);
+		rc_md5_update(&ctx, secret, strlen(secret));
+		rc_md5_final(digest, &ctx);
+		return memcmp(digest, p + 4, AUTH_VECTOR_LEN) == 0 ? CHECK_OK : CHECK_BAD_AUTH;
+
+	default:
+		if (!pkt->matched)
+			return CHECK_UNMATCHED;
+		return rc_check_reply(rh, (AUTH_HDR const *)p, secret, pkt->vector, p[1]) == OK_RC ?
+			CHECK_OK : CHECK_BAD_AUTH;
+	}
+}
+
+/** Recover the User-Password of a captured Access-Request
+ *
+ * @param vp the pair, decrypted in place.
+ * @param vector the request authenticator.
+ * @param secret the shared secret.
+ */
+static void decrypt_password(VALUE_PAIR *vp, uint8_t const *vector, char const *secret)
+{
+	unsigned char	key[AUTH_VECTOR_LEN], prev[AUTH_VECTOR_LEN];
+	RC_MD5_CTX	ctx;
+	size_t		i, j;
+
+	memcpy(prev, vector, AUTH_VECTOR_LEN);
+	for (i = 0; i + AUTH_VECTOR_LEN <= vp->lvalue; i += AUTH_VECTOR_LEN) {
+		rc_md5_init(&ctx);
+		rc_md5_update(&ctx, secret, strlen(secret));
+		rc_md5_update(&ctx, prev, AUTH_VECTOR_LEN);
+		rc_md5_final(key, &ctx);
+		memcpy(prev, vp->strvalue + i, AUTH_VECTOR_LEN);
+		for (j = 0; j < AUTH_VECTOR_LEN; j++)
+			vp->strvalue[i + j] ^= key[j];
+	}
+	/* the padding goes */
+	vp->strvalue[i < vp->lvalue ? i : vp->lvalue] = '\0';
+	vp->lvalue = strlen(vp->strvalue);
+}
+
+/** Turn a captured request into pairs that can be sent again
+ *
+ * Message-Authenticator is dropped, as the library adds its own;
+ * User-Password is decrypted with the secret; a CHAP-Password whose
+ * challenge was the request authenticator gets a CHAP-Challenge, as
+ * the new request will have another authenticator.
+ *
+ * @param rh a handle to parsed configuration.
+ * @param p the packet.
+ * @param secret the shared secret, or NULL.
+ * @return the pairs, or NULL.
+ */
+static VALUE_PAIR *replay_pairs(rc_handle const *rh, uint8_t const *p, char const *secret)
+{
+	VALUE_PAIR	*vps, *vp, **prev;
+	size_t		len = (p[2] << 8) | p[3];
+
+	vps = rc_avpair_gen(rh, NULL, p + AUTH_HDR_LEN, len - AUTH_HDR_LEN, 0);
+
+	for (prev = &vps; (vp = *prev) != NULL; ) {
+		if (vp->attribute == PW_MESSAGE_AUTHENTICATOR && vp->vendor == 0) {
+			*prev = vp->next;
+			vp->next = NULL;
+			rc_avpair_free(vp);
+			continue;
+		}
+		if (vp->attribute == PW_USER_PASSWORD && vp->vendor == 0 &&
+		    p[0] == PW_ACCESS_REQUEST && secret != NULL)
+			decrypt_password(vp, p + 4, secret);
+		prev = &vp->next;
+	}
+
+	if (p[0] == PW_ACCESS_REQUEST && rc_avpair_get(vps, PW_CHAP_PASSWORD, 0) != NULL &&
+	    rc_avpair_get(vps, PW_CHAP_CHALLENGE, 0) == NULL)
+		rc_avpair_add(rh, &vps, PW_CHAP_CHALLENGE, p + 4, AUTH_VECTOR_LEN, 0);
+
+	return vps;
+}
+
+/** Replay requests as they fall due, until there are none left
+ *
+ * @param arg the #replay.
+ * @return NULL.
+ */
+static void *replay_worker(void *arg)
+{
+	struct replay		*rp = arg;
+	struct trace const	*trace = rp->trace;
+	struct packet const	*pkt;
+	VALUE_PAIR		*send, *received;
+	struct timespec		ts;
+	char			msg[PW_MAX_MSG_SIZE];
+	uint8_t const		*p;
+	double			due, left, done;
+	int			rc, slot;
+
+	for (;;) {
+#ifdef HAVE_PTHREAD_CREATE
+		pthread_mutex_lock(&rp->lock);
+#endif
+		while (rp->next < trace->npackets &&
+		       (trace->packets[rp->next].len < AUTH_HDR_LEN ||
+			(trace->data[trace->packets[rp->next].off] != PW_ACCESS_REQUEST &&
+			 trace->data[trace->packets[rp->next].off] != PW_ACCOUNTING_REQUEST)))
+			rp->next++;
+		pkt = rp->next < trace->npackets ? &trace->packets[rp->next++] : NULL;
+#ifdef HAVE_PTHREAD_CREATE
+		pthread_mutex_unlock(&rp->lock);
+#endif
+		if (pkt == NULL || got_term)
+			break;
+
+		due = rp->start + (pkt->ts - rp->first_ts) / rp->speed;
+		while (!got_term && (left = due - rc_getmtime()) > 0) {
+			ts.tv_sec = (time_t)left;
+			ts.tv_nsec = (long)((left - (double)ts.tv_sec) * 1000000000.0);
+			nanosleep(&ts, NULL);
+		}
+		if (got_term)
+			break;
+
+		p = trace->data + pkt->off;
+		if (((p[2] << 8) | p[3]) > pkt->len) {
+			rc = ERROR_RC;
+		} else {
+			send = replay_pairs(rp->rh, p, rp->secret);
+			received = NULL;
+			if (p[0] == PW_ACCESS_REQUEST)
+				rc = rc_auth_proxy(rp->rh, send, &received, msg);
+			else
+				rc = rc_acct_proxy(rp->rh, send);
+			rc_avpair_free(send);
+			rc_avpair_free(received);
+		}
+		done = rc_getmtime();
+
+		rc_hist_record(&rp->latency, (uint64_t)((done - due) * 1000000.0));
+		slot = rc == OK_RC ? 0 : rc == REJECT_RC ? 1 : rc == TIMEOUT_RC ? 2 : 3;
+		__atomic_add_fetch(&rp->result[slot], 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&rp->sent, 1, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+static void replay(rc_handle *rh, struct trace const *trace, char const *secret,
+		   double speed, int workers)
+{
+	struct replay	*rp;
+	size_t		i;
+#ifdef HAVE_PTHREAD_CREATE
+	pthread_t	*tids;
+	int		w;
+#endif
+
+	if ((rp = calloc(1, sizeof(*rp))) == NULL) {
+		fprintf(stderr, "%s: out of memory\n", pname);
+		return;
+	}
+	rp->rh = rh;
+	rp->trace = trace;
+	rp->secret = secret;
+	rp->speed = speed;
+	for (i = 0; i < trace->npackets; i++) {
+		if (i == 0 || trace->packets[i].ts < rp->first_ts)
+			rp->first_ts = trace->packets[i].ts;
+	}
+	rp->start = rc_getmtime();
+
+#ifdef HAVE_PTHREAD_CREATE
+	pthread_mutex_init(&rp->lock, NULL);
+	if ((tids = calloc(workers, sizeof(*tids))) == NULL)
+		workers = 0;
+	for (w = 0; w < workers; w++) {
+		if (pthread_create(&tids[w], NULL, replay_worker, rp) != 0)
+			break;
+	}
+	workers = w;
+	if (workers == 0)
+		replay_worker(rp);
+	for (w = 0; w < workers; w++)
+		pthread_join(tids[w], NULL);
+	free(tids);
+	pthread_mutex_destroy(&rp->lock);
+#else
+	(void)workers;
+	replay_worker(rp);
+#endif
+
+	printf("\nreplayed     %llu requests at %gx in %.3f s (ok %llu, reject %llu, timeout %llu, error %llu)\n",
+	       (unsigned long long)rp->sent, speed, rc_getmtime() - rp->start,
+	       (unsigned long long)rp->result[0], (unsigned long long)rp->result[1],
+	       (unsigned long long)rp->result[2], (unsigned long long)rp->result[3]);
+	printf("latency      p50 %.3f ms, p99 %.3f ms, p99.9 %.3f ms, max %.3f ms (from when due)\n",
+	       rc_hist_percentile(&rp->latency, 50) / 1000.0,
+	       rc_hist_percentile(&rp->latency, 99) / 1000.0,
+	       rc_hist_percentile(&rp->latency, 99.9) / 1000.0,
+	       rp->latency.max / 1000.0);
+	free(rp);
+}
+
+static char const *code_name(int code)
+{
+	switch (code) {
+	case PW_ACCESS_REQUEST:		return "Access-Request";
+	case PW_ACCESS_ACCEPT:		return "Access-Accept";
+	case PW_ACCESS_REJECT:		return "Access-Reject";
+	case PW_ACCOUNTING_REQUEST:	return "Accounting-Request";
+	case PW_ACCOUNTING_RESPONSE:	return "Accounting-Response";
+	case PW_ACCESS_CHALLENGE:	return "Access-Challenge";
+	case PW_STATUS_SERVER:		return "Status-Server";
+	case 40:			return "Disconnect-Request";
+	case 41:			return "Disconnect-ACK";
+	case 42:			return "Disconnect-NAK";
+	case 43:			return "CoA-Request";
+	case 44:			return "CoA-ACK";
+	case 45:			return "CoA-NAK";
+	default:			return NULL;
+	}
+}
+
+static int by_count(void const *a, void const *b)
+{
+	uint64_t x = ((struct unknown const *)a)->count, y = ((struct unknown const *)b)->count;
+
+	return x < y ? 1 : x > y ? -1 : 0;
+}
+
+int main (int argc, char **argv)
+{
+	char		*path_radiusclient_conf = RC_CONFIG_FILE;
+	char		*secret = NULL, *p;
+	rc_handle	*rh;
+	struct trace	trace;
+	struct sigaction sa;
+	struct packet const *pkt;
+	VALUE_PAIR	*vps, *vp;
+	uint64_t	checks[CHECK_RESULTS], pairs = 0, bytes = 0, decoded = 0;
+	double		speed = 0, start, elapsed;
+	int		c, i, passes = 1, pass, verbose = 0, workers = 64;
+	size_t		n;
+
+	extern int optind;
+	extern char *optarg;
+
+	pname = (pname = strrchr(argv[0],'/'))?pname+1:argv[0];
+
+	rc_openlog(pname);
+
+	while ((c = getopt(argc,argv,"hVvf:s:P:n:r:c:")) > 0)
+	{
+		switch(c) {
+			case 'f':
+				path_radiusclient_conf = optarg;
+				break;
+			case 's':
+				secret = optarg;
+				break;
+			case 'P':
+				for (nports = 0, p = strtok(optarg, ","); p != NULL && nports < MAX_PORTS;
+				     p = strtok(NULL, ","))
+					ports[nports++] = atoi(p);
+				break;
+			case 'n':
+				passes = atoi(optarg);
+				break;
+			case 'r':
+				speed = atof(optarg);
+				if (speed <= 0)
+					usage();
+				break;
+			case 'c':
+				workers = atoi(optarg);
+				break;
+			case 'v':
+				verbose = 1;
+				break;
+			case 'V':
+				version();
+				break;
+			case 'h':
+				usage();
+				break;
+			default:
+				exit(ERROR_RC);
+				break;
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc == 0 || passes < 1 || workers < 1 || workers > MAX_WORKERS)
+		usage();
+
+	/* an unknown attribute is not worth a log line per packet */
+	if (!verbose)
+		rc_log_set_level(LOG_CRIT);
+
+	if ((rh = rc_read_config(path_radiusclient_conf)) == NULL)
+		exit(ERROR_RC);
+
+	if (rc_read_dictionary(rh, rc_conf_str(rh, "dictionary")) != 0)
+		exit(ERROR_RC);
+
+	if ((matches = calloc(MATCH_BUCKETS, sizeof(*matches))) == NULL) {
+		fprintf(stderr, "%s: out of memory\n", pname);
+		exit(ERROR_RC);
+	}
+
+	memset(&trace, 0, sizeof(trace));
+	for (i = 0; i < argc; i++) {
+		if (trace_load(&trace, argv[i]) < 0 && trace.npackets == 0)
+			exit(ERROR_RC);
+	}
+
+	printf("frames       %llu (not IP %llu, fragments %llu, other UDP %llu)\n",
+	       (unsigned long long)trace.frames, (unsigned long long)trace.not_ip,
+	       (unsigned long long)trace.fragments, (unsigned long long)trace.not_radius);
+	printf("RADIUS       %llu packets, %llu truncated\n",
+	       (unsigned long long)trace.npackets, (unsigned long long)trace.truncated);
+	for (i = 0; i < 256; i++) {
+		if (trace.codes[i] == 0)
+			continue;
+		if (code_name(i) != NULL)
+			printf("  %-22s %llu\n", code_name(i), (unsigned long long)trace.codes[i]);
+		else
+			printf("  code %-17d %llu\n", i, (unsigned long long)trace.codes[i]);
+	}
+
+	/* the decoder, timed over every pass; the first one also counts */
+	memset(checks, 0, sizeof(checks));
+	start = rc_getmtime();
+	for (pass = 0; pass < passes && !got_term; pass++) {
+		for (n = 0; n < trace.npackets; n++) {
+			pkt = &trace.packets[n];
+			p = (char *)trace.data + pkt->off;
+			c = check_packet(rh, pkt, (uint8_t const *)p, secret, pass == 0);
+			if (pass == 0)
+				checks[c]++;
+			bytes += pkt->len;
+			decoded++;
+			if (c == CHECK_MALFORMED)
+				continue;
+			vps = rc_avpair_gen(rh, NULL, (uint8_t const *)p + AUTH_HDR_LEN,
+					    ((p[2] & 0xff) << 8 | (p[3] & 0xff)) - AUTH_HDR_LEN, 0);
+			for (vp = vps; vp != NULL; vp = vp->next)
+				pairs++;
+			rc_avpair_free(vps);
+		}
+	}
+	elapsed = rc_getmtime() - start;
+
+	printf("\ndecoded      %llu packets in %.3f s, %d pass%s\n", (unsigned long long)decoded,
+	       elapsed, passes, passes == 1 ? "" : "es");
+	if (elapsed > 0 && decoded > 0)
+		printf("throughput   %.0f packets/s, %.1f MB/s, %.0f attributes/s, %.0f ns/packet\n",
+		       decoded / elapsed, bytes / elapsed / 1000000.0, pairs / elapsed,
+		       elapsed * 1000000000.0 / decoded);
+
+	printf("\nvalidation%s\n", secret == NULL ? " (structure only, no secret)" : "");
+	for (i = 0; i < CHECK_RESULTS; i++) {
+		if (checks[i] != 0)
+			printf("  %-22s %llu\n", check_names[i], (unsigned long long)checks[i]);
+	}
+
+	qsort(unknowns, UNKNOWN_SLOTS, sizeof(unknowns[0]), by_count);
+	if (unknowns[0].count != 0) {
+		printf("\nunknown attributes\n");
+		for (i = 0; i < UNKNOWN_SLOTS && i < 20 && unknowns[i].count != 0; i++) {
+			if (unknowns[i].vendor == 0)
+				printf("  attribute %-14u %llu\n", unknowns[i].attr,
+				       (unsigned long long)unknowns[i].count);
+			else if (unknowns[i].attr == 0)
+				printf("  vendor %-10u (all) %llu\n", unknowns[i].vendor,
+				       (unsigned long long)unknowns[i].count);
+			else
+				printf("  vendor %-10u %-4u %llu\n", unknowns[i].vendor, unknowns[i].attr,
+				       (unsigned long long)unknowns[i].count);
+		}
+		if (unknown_other != 0)
+			printf("  others                 %llu\n", (unsigned long long)unknown_other);
+	}
+
+	if (speed > 0) {
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = on_signal;
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGTERM, &sa, NULL);
+		sigaction(SIGINT, &sa, NULL);
+		if (secret == NULL && trace.codes[PW_ACCESS_REQUEST] != 0)
+			fprintf(stderr, "%s: without -s, passwords are replayed as captured\n", pname);
+		replay(rh, &trace, secret, speed, workers);
+	}
+
+	free(trace.packets);
+	free(trace.data);
+	free(matches);
+	rc_destroy(rh);
+
+	return 0;
+}
@@ -0,0 +1,511 @@
+/*
+ * radperf.c	Open-loop load generator for RADIUS servers.
+ *
+ * License:	BSD
+ *
+ */
+
+static char	rcsid[] =
+		"$Id: radperf.c $";
+
+#include <config.h>
+#include <includes.h>
+#include <freeradius-client.h>
+#include <pathnames.h>
+#include <math.h>
+
+#ifdef HAVE_PTHREAD_CREATE
+# include <pthread.h>
+#endif
+
+#define MAX_WORKERS	4096
+#define TEMPLATE_LEN	4096
+
+static char *pname;
+
+static volatile sig_atomic_t got_term;
+
+/* the outcomes counted, by return code of rc_auth()/rc_acct() */
+enum perf_result {
+	PERF_OK = 0,
+	PERF_REJECT,
+	PERF_TIMEOUT,
+	PERF_BUSY,
+	PERF_DEADLINE,
+	PERF_ERROR,
+	PERF_RESULTS
+};
+
+static char const *result_names[PERF_RESULTS] = {
+	"ok", "reject", "timeout", "busy", "deadline", "error"
+};
+
+/* one run, shared by every worker */
+struct perf {
+	rc_handle	*rh;
+	int		acct;
+	uint32_t	nas_port;
+	char const	*template;
+	unsigned	users;
+	double		rate;			//!< requests per second.
+	int		poisson;		//!< exponential gaps rather than constant ones.
+	uint64_t	limit;			//!< requests to send, 0 for no limit.
+	double		start;			//!< rc_getmtime() of the first send.
+	double		end;			//!< no send is scheduled at or after this.
+
+	/* the schedule; under lock */
+	uint64_t	next_seq;
+	double		next_time;
+	uint64_t	rng;
+#ifdef HAVE_PTHREAD_CREATE
+	pthread_mutex_t	lock;
+#endif
+
+	/* updated atomically */
+	uint64_t	result[PERF_RESULTS];
+	uint64_t	late;			//!< sends that left over 1ms after their time.
+	double		last_done;
+	RC_HISTOGRAM	latency;		//!< from scheduled send to completion, in usec.
+	RC_HISTOGRAM	service;		//!< from actual send to completion, in usec.
+};
+
+void usage(void)
+{
+	fprintf(stderr,"Usage: %s [-Vhjx] [-f <config_file>] [-m auth|acct] [-r <rate>] [-d <seconds>]\n", pname);
+	fprintf(stderr,"       [-n <requests>] [-c <concurrency>] [-u <users>] [-t <template>]\n");
+	fprintf(stderr,"       [-p <nas_port>] [-S <seed>]\n\n");
+	fprintf(stderr,"  -V            output version information\n");
+	fprintf(stderr,"  -h            output this text\n");
+	fprintf(stderr,"  -f		filename of alternate config file\n");
+	fprintf(stderr,"  -m		send authentication (default) or accounting requests\n");
+	fprintf(stderr,"  -r		requests per second to send (default 100)\n");
+	fprintf(stderr,"  -x		send at constant intervals rather than Poisson arrivals\n");
+	fprintf(stderr,"  -d		seconds to send for (default 10)\n");
+	fprintf(stderr,"  -n		stop after this many requests\n");
+	fprintf(stderr,"  -c		requests outstanding at most (default 64)\n");
+	fprintf(stderr,"  -u		number of distinct users (default 1000)\n");
+	fprintf(stderr,"  -t		attributes of each request; %%u is replaced by the user\n");
+	fprintf(stderr,"		number, %%n by the request number\n");
+	fprintf(stderr,"  -p		NAS port of the requests (default 0)\n");
+	fprintf(stderr,"  -S		seed of the arrivals\n");
+	fprintf(stderr,"  -j            output the report as JSON\n");
+	fprintf(stderr,"\nLatency is measured from when each request was due to be sent, so that\n");
+	fprintf(stderr,"a server falling behind is not hidden by requests waiting for a worker.\n");
+	exit(ERROR_RC);
+}
+
+void version(void)
+{
+	fprintf(stderr,"%s: %s\n", pname ,rcsid);
+	exit(ERROR_RC);
+}
+
+static void on_signal(int sig)
+{
+	got_term = 1;
+}
+
+/** Draw a uniform number in (0, 1]
+ *
+ * @param state the xorshift64* state, not 0.
+ * @return the number.
+ */
+static double uniform(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return ((x * 2685821657736338717ULL >> 11) + 1) / 9007199254740992.0;
+}
+
+/** Expand a request template
+ *
+ * @param template the template.
+ * @param user the user number, for %u.
+ * @param seq the request number, for %n.
+ * @param out the buffer.
+ * @param size its size.
+ * @return 0 on success, -1 if the result does not fit.
+ */
+static int expand(char const *template, unsigned user, uint64_t seq, char *out, size_t size)
+{
+	size_t	len = 0;
+	int	n;
+
+	for (; *template != '\0'; template++) {
+		if (*template == '%' && template[1] == 'u') {
+			n = snprintf(out + len, size - len, "%u", user);
+			template++;
+		} else if (*template == '%' && template[1] == 'n') {
+			n = snprintf(out + len, size - len, "%llu", (unsigned long long)seq);
+			template++;
+		} else if (*template == '%' && template[1] == '%') {
+			n = snprintf(out + len, size - len, "%%");
+			template++;
+		} else {
+			n = snprintf(out + len, size - len, "%c", *template);
+		}
+		if (n < 0 || (size_t)n >= size - len)
+			return -1;
+		len += n;
+	}
+	return 0;
+}
+
+/** Claim the next request of the schedule
+ *
+ * @param perf the run.
+ * @param seq where to store the request number.
+ * @param due where to store when it is due, as rc_getmtime().
+ * @return 1 if there is one, 0 once the run is over.
+ */
+static int next_request(struct perf *perf, uint64_t *seq, double *due)
+{
+	int more;
+
+#ifdef HAVE_PTHREAD_CREATE
+	pthread_mutex_lock(&perf->lock);
+#endif
+	more = !got_term && perf->next_time < perf->end &&
+	       (perf->limit == 0 || perf->next_seq < perf->limit);
+	if (more) {
+		*seq = perf->next_seq++;
+		*due = perf->next_time;
+		if (perf->poisson)
+			perf->next_time += -log(uniform(&perf->rng)) / perf->rate;
+		else
+			perf->next_time += 1.0 / perf->rate;
+	}
+#ifdef HAVE_PTHREAD_CREATE
+	pthread_mutex_unlock(&perf->lock);
+#endif
+	return more;
+}
+
+static void sleep_until(double when)
+{
+	struct timespec	ts;
+	double		left;
+
+	while (!got_term && (left = when - rc_getmtime()) > 0) {
+		ts.tv_sec = (time_t)left;
+		ts.tv_nsec = (long)((left - (double)ts.tv_sec) * 1000000000.0);
+		nanosleep(&ts, NULL);
+	}
+}
+
+static enum perf_result classify(int rc)
+{
+	switch (rc) {
+	case OK_RC:
+		return PERF_OK;
+	case REJECT_RC:
+		return PERF_REJECT;
+	case TIMEOUT_RC:
+		return PERF_TIMEOUT;
+	case BUSY_RC:
+		return PERF_BUSY;
+	case DEADLINE_RC:
+		return PERF_DEADLINE;
+	default:
+		return PERF_ERROR;
+	}
+}
+
+/** Send requests as they fall due, until the schedule ends
+ *
+ * @param arg the #perf.
+ * @return NULL.
+ */
+static void *worker(void *arg)
+{
+	struct perf	*perf = arg;
+	VALUE_PAIR	*send, *received;
+	char		text[TEMPLATE_LEN];
+	char		msg[PW_MAX_MSG_SIZE];
+	uint64_t	seq;
+	double		due, sent, done, prev;
+	int		rc;
+
+	while (next_request(perf, &seq, &due)) {
+		sleep_until(due);
+		if (got_term)
+			break;
+
+		send = NULL;
+		received = NULL;
+		if (expand(perf->template, (unsigned)(seq % perf->users), seq, text, sizeof(text)) < 0 ||
+		    rc_avpair_parse(perf->rh, text, &send) < 0) {
+			rc = ERROR_RC;
+			sent = rc_getmtime();
+		} else {
+			sent = rc_getmtime();
+			if (perf->acct)
+				rc = rc_acct(perf->rh, perf->nas_port, send);
+			else
+				rc = rc_auth(perf->rh, perf->nas_port, send, &received, msg);
+		}
+		done = rc_getmtime();
+
+		rc_hist_record(&perf->latency, (uint64_t)((done - due) * 1000000.0));
+		rc_hist_record(&perf->service, (uint64_t)((done - sent) * 1000000.0));
+		__atomic_add_fetch(&perf->result[classify(rc)], 1, __ATOMIC_RELAXED);
+		if (sent - due > 0.001)
+			__atomic_add_fetch(&perf->late, 1, __ATOMIC_RELAXED);
+
+#ifdef HAVE_PTHREAD_CREATE
+		pthread_mutex_lock(&perf->lock);
+#endif
+		prev = perf->last_done;
+		if (done > prev)
+			perf->last_done = done;
+#ifdef HAVE_PTHREAD_CREATE
+		pthread_mutex_unlock(&perf->lock);
+#endif
+
+		rc_avpair_free(send);
+		rc_avpair_free(received);
+	}
+
+	return NULL;
+}
+
+/* percentiles of the summary, and the steps of the full distribution */
+static double const summary_pct[] = { 50, 75, 90, 95, 99, 99.9, 99.99, 100 };
+
+/** Print a latency histogram as HdrHistogram's percentile distribution
+ *
+ * Each halving of the distance to 100% is split into five steps, so the
+ * tail is shown in as much detail as the body.
+ *
+ * @param name the title.
+ * @param hist the histogram, in usec.
+ */
+static void print_distribution(char const *name, RC_HISTOGRAM const *hist)
+{
+	double	pct, step;
+	int	i;
+
+	printf("\n%s\n%12s %14s %10s %14s\n", name, "Value(ms)", "Percentile", "TotalCount", "1/(1-Percentile)");
+	if (hist->count == 0)
+		return;
+
+	for (step = 50, pct = 0; step > 0.0005 && pct < 100; step /= 2) {
+		for (i = 0; i < 5 && pct < 100; i++) {
+			printf("%12.3f %14.12f %10llu", rc_hist_percentile(hist, pct) / 1000.0, pct / 100,
+			       (unsigned long long)(pct / 100 * hist->count + 0.5));
+			printf(" %14.2f\n", 100 / (100 - pct));
+			pct += step / 5;
+		}
+	}
+	printf("%12.3f %14.12f %10llu %14s\n", hist->max / 1000.0, 1.0, (unsigned long long)hist->count, "inf");
+	printf("#[Mean    = %12.3f, Max   = %12.3f]\n", (double)hist->sum / hist->count / 1000.0, hist->max / 1000.0);
+	printf("#[Total count    = %12llu]\n", (unsigned long long)hist->count);
+}
+
+/** Print the outcome of a run
+ *
+ * @param perf the run.
+ * @param json non-zero for a JSON object, otherwise text.
+ */
+static void report(struct perf const *perf, int json)
+{
+	uint64_t	total = 0;
+	double		elapsed;
+	unsigned	i;
+
+	for (i = 0; i < PERF_RESULTS; i++)
+		total += perf->result[i];
+	elapsed = perf->last_done > perf->start ? perf->last_done - perf->start : 0;
+
+	if (json) {
+		printf("{\"requests\":%llu", (unsigned long long)total);
+		for (i = 0; i < PERF_RESULTS; i++)
+			printf(",\"%s\":%llu", result_names[i], (unsigned long long)perf->result[i]);
+		printf(",\"late\":%llu,\"seconds\":%.3f,\"offered_rate\":%.1f,\"throughput\":%.1f",
+		       (unsigned long long)perf->late, elapsed, perf->rate,
+		       elapsed > 0 ? total / elapsed : 0.0);
+		printf(",\"latency_ms\":{");
+		for (i = 0; i < sizeof(summary_pct) / sizeof(summary_pct[0]); i++)
+			printf("%s\"p%g\":%.3f", i ? "," : "", summary_pct[i],
+			       rc_hist_percentile(&perf->latency, summary_pct[i]) / 1000.0);
+		printf("},\"service_ms\":{");
+		for (i = 0; i < sizeof(summary_pct) / sizeof(summary_pct[0]); i++)
+			printf("%s\"p%g\":%.3f", i ? "," : "", summary_pct[i],
+			       rc_hist_percentile(&perf->service, summary_pct[i]) / 1000.0);
+		printf("}}\n");
+		return;
+	}
+
+	printf("requests     %llu", (unsigned long long)total);
+	for (i = 0; i < PERF_RESULTS; i++)
+		printf("%s %s %llu", i ? "," : " (", result_names[i], (unsigned long long)perf->result[i]);
+	printf(")\n");
+	printf("duration     %.3f s\n", elapsed);
+	printf("offered      %.1f req/s (%s)\n", perf->rate, perf->poisson ? "Poisson" : "constant");
+	printf("throughput   %.1f req/s\n", elapsed > 0 ? total / elapsed : 0.0);
+	printf("late sends   %llu\n", (unsigned long long)perf->late);
+	printf("\n%10s %14s %14s\n", "percentile", "latency(ms)", "service(ms)");
+	for (i = 0; i < sizeof(summary_pct) / sizeof(summary_pct[0]); i++)
+		printf("%10g %14.3f %14.3f\n", summary_pct[i],
+		       rc_hist_percentile(&perf->latency, summary_pct[i]) / 1000.0,
+		       rc_hist_percentile(&perf->service, summary_pct[i]) / 1000.0);
+
+	print_distribution("Latency from scheduled send, corrected for coordinated omission", &perf->latency);
+}
+
+int main (int argc, char **argv)
+{
+	char		*path_radiusclient_conf = RC_CONFIG_FILE;
+	char		text[TEMPLATE_LEN];
+	struct perf	*perf;
+	struct sigaction sa;
+	VALUE_PAIR	*check = NULL;
+	double		duration = 10;
+	int		c, i, json = 0, workers = 64;
+	uint64_t	seed = 0;
+#ifdef HAVE_PTHREAD_CREATE
+	pthread_t	*tids;
+#endif
+
+	extern char *optarg;
+
+	pname = (pname = strrchr(argv[0],'/'))?pname+1:argv[0];
+
+	rc_openlog(pname);
+
+	perf = calloc(1, sizeof(*perf));
+	if (perf == NULL) {
+		fprintf(stderr, "%s: out of memory\n", pname);
+		exit(ERROR_RC);
+	}
+	perf->rate = 100;
+	perf->poisson = 1;
+	perf->users = 1000;
+
+	while ((c = getopt(argc,argv,"hVjxf:m:r:d:n:c:u:t:p:S:")) > 0)
+	{
+		switch(c) {
+			case 'f':
+				path_radiusclient_conf = optarg;
+				break;
+			case 'm':
+				if (strcmp(optarg, "acct") == 0)
+					perf->acct = 1;
+				else if (strcmp(optarg, "auth") != 0)
+					usage();
+				break;
+			case 'r':
+				perf->rate = atof(optarg);
+				break;
+			case 'x':
+				perf->poisson = 0;
+				break;
+			case 'd':
+				duration = atof(optarg);
+				break;
+			case 'n':
+				perf->limit = strtoull(optarg, NULL, 10);
+				break;
+			case 'c':
+				workers = atoi(optarg);
+				break;
+			case 'u':
+				perf->users = atoi(optarg);
+				break;
+			case 't':
+				perf->template = optarg;
+				break;
+			case 'p':
+				perf->nas_port = atoi(optarg);
+				break;
+			case 'S':
+				seed = strtoull(optarg, NULL, 0);
+				break;
+			case 'j':
+				json = 1;
+				break;
+			case 'V':
+				version();
+				break;
+			case 'h':
+				usage();
+				break;
+			default:
+				exit(ERROR_RC);
+				break;
+		}
+	}
+
+	if (perf->rate <= 0 || duration <= 0 || perf->users == 0 ||
+	    workers < 1 || workers > MAX_WORKERS) {
+		fprintf(stderr, "%s: -r, -d and -u must be positive, -c between 1 and %d\n", pname, MAX_WORKERS);
+		exit(ERROR_RC);
+	}
+
+	if (perf->template == NULL)
+		perf->template = perf->acct ?
+			"User-Name=user%u Acct-Status-Type=Start Acct-Session-Id=%n" :
+			"User-Name=user%u Password=password%u";
+
+	if ((perf->rh = rc_read_config(path_radiusclient_conf)) == NULL)
+		exit(ERROR_RC);
+
+	if (rc_read_dictionary(perf->rh, rc_conf_str(perf->rh, "dictionary")) != 0)
+		exit(ERROR_RC);
+
+	if (expand(perf->template, 0, 0, text, sizeof(text)) < 0 ||
+	    rc_avpair_parse(perf->rh, text, &check) < 0) {
+		fprintf(stderr, "%s: can't parse the template: %s\n", pname, perf->template);
+		exit(ERROR_RC);
+	}
+	rc_avpair_free(check);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+
+	if (seed == 0)
+		seed = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32);
+	perf->rng = seed;
+	perf->start = rc_getmtime();
+	perf->next_time = perf->start;
+	perf->end = perf->start + duration;
+
+#ifdef HAVE_PTHREAD_CREATE
+	pthread_mutex_init(&perf->lock, NULL);
+	tids = calloc(workers, sizeof(*tids));
+	if (tids == NULL) {
+		fprintf(stderr, "%s: out of memory\n", pname);
+		exit(ERROR_RC);
+	}
+	for (i = 0; i < workers; i++) {
+		if (pthread_create(&tids[i], NULL, worker, perf) != 0) {
+			fprintf(stderr, "%s: can only start %d workers\n", pname, i);
+			break;
+		}
+	}
+	workers = i;
+	if (workers == 0)
+		worker(perf);
+	for (i = 0; i < workers; i++)
+		pthread_join(tids[i], NULL);
+	free(tids);
+	pthread_mutex_destroy(&perf->lock);
+#else
+	(void)i;
+	worker(perf);
+#endif
+
+	report(perf, json);
+
+	rc_destroy(perf->rh);
+	free(perf);
+
+	return 0;
+}
@@ -0,0 +1,193 @@
+/*
+ * radresponder.c	A stand-in RADIUS server on loopback, with fault injection.
+ *
+ * License:	BSD
+ *
+ */
+
+static char	rcsid[] =
+		"$Id: radresponder.c $";
+
+#include <config.h>
+#include <includes.h>
+#include <freeradius-client.h>
+#include <pathnames.h>
+
+static char *pname;
+
+static volatile sig_atomic_t got_term;
+
+void usage(void)
+{
+	fprintf(stderr,"Usage: %s [-Vh6] [-f <config_file>] [-p <port>] [-s <secret>] [-c <code>]\n", pname);
+	fprintf(stderr,"       [-a <pairs>] [-A <pairs>] [-l <%%>] [-D <%%>] [-o <%%>] [-b <%%>]\n");
+	fprintf(stderr,"       [-d <ms>] [-j <ms>] [-S <seed>]\n\n");
+	fprintf(stderr,"  -V            output version information\n");
+	fprintf(stderr,"  -h            output this text\n");
+	fprintf(stderr,"  -f		filename of alternate config file, for the dictionary\n");
+	fprintf(stderr,"  -6		listen on ::1 rather than 127.0.0.1\n");
+	fprintf(stderr,"  -p		UDP port (default: any free one)\n");
+	fprintf(stderr,"  -s		shared secret (default testing123)\n");
+	fprintf(stderr,"  -c		answer to Access-Request: accept, reject or challenge\n");
+	fprintf(stderr,"  -a		attributes of that answer, as \"Attr = value ...\"\n");
+	fprintf(stderr,"  -A		attributes of Accounting-Response\n");
+	fprintf(stderr,"  -l		percentage of requests left unanswered\n");
+	fprintf(stderr,"  -D		percentage of replies sent twice\n");
+	fprintf(stderr,"  -o		percentage of replies sent after the next one\n");
+	fprintf(stderr,"  -b		percentage of replies with a bad authenticator\n");
+	fprintf(stderr,"  -d		milliseconds added before every reply\n");
+	fprintf(stderr,"  -j		random extra milliseconds, up to this\n");
+	fprintf(stderr,"  -S		seed of the faults, to replay them\n");
+	fprintf(stderr,"\nPrints \"port <n>\" once listening, and its counters on SIGTERM or SIGINT.\n");
+	exit(ERROR_RC);
+}
+
+void version(void)
+{
+	fprintf(stderr,"%s: %s\n", pname ,rcsid);
+	exit(ERROR_RC);
+}
+
+static void on_signal(int sig)
+{
+	got_term = 1;
+}
+
+static double percent(char const *arg)
+{
+	char	*end;
+	double	p = strtod(arg, &end);
+
+	if (*end != '\0' || p < 0 || p > 100) {
+		fprintf(stderr, "%s: bad percentage: %s\n", pname, arg);
+		exit(ERROR_RC);
+	}
+	return p / 100;
+}
+
+int main (int argc, char **argv)
+{
+	char			*path_radiusclient_conf = RC_CONFIG_FILE;
+	char			*access_text = NULL, *acct_text = NULL;
+	RC_RESPONDER_CONF	conf;
+	RC_RESPONDER_STATS	stats;
+	RC_RESPONDER		*r;
+	struct sigaction	sa;
+	rc_handle		*rh;
+	int			c;
+
+	extern char *optarg;
+
+	pname = (pname = strrchr(argv[0],'/'))?pname+1:argv[0];
+
+	rc_openlog(pname);
+
+	memset(&conf, 0, sizeof(conf));
+	conf.secret = "testing123";
+
+	while ((c = getopt(argc,argv,"hV6f:p:s:c:a:A:l:D:o:b:d:j:S:")) > 0)
+	{
+		switch(c) {
+			case 'f':
+				path_radiusclient_conf = optarg;
+				break;
+			case '6':
+				conf.ipv6 = 1;
+				break;
+			case 'p':
+				conf.port = atoi(optarg);
+				break;
+			case 's':
+				conf.secret = optarg;
+				break;
+			case 'c':
+				if (strcmp(optarg, "accept") == 0)
+					conf.access_code = PW_ACCESS_ACCEPT;
+				else if (strcmp(optarg, "reject") == 0)
+					conf.access_code = PW_ACCESS_REJECT;
+				else if (strcmp(optarg, "challenge") == 0)
+					conf.access_code = PW_ACCESS_CHALLENGE;
+				else
+					usage();
+				break;
+			case 'a':
+				access_text = optarg;
+				break;
+			case 'A':
+				acct_text = optarg;
+				break;
+			case 'l':
+				conf.loss = percent(optarg);
+				break;
+			case 'D':
+				conf.duplicate = percent(optarg);
+				break;
+			case 'o':
+				conf.reorder = percent(optarg);
+				break;
+			case 'b':
+				conf.bad_auth = percent(optarg);
+				break;
+			case 'd':
+				conf.delay_ms = atoi(optarg);
+				break;
+			case 'j':
+				conf.jitter_ms = atoi(optarg);
+				break;
+			case 'S':
+				conf.seed = strtoull(optarg, NULL, 0);
+				break;
+			case 'V':
+				version();
+				break;
+			case 'h':
+				usage();
+				break;
+			default:
+				exit(ERROR_RC);
+				break;
+		}
+	}
+
+	if ((rh = rc_read_config(path_radiusclient_conf)) == NULL)
+		exit(ERROR_RC);
+
+	if (rc_read_dictionary(rh, rc_conf_str(rh, "dictionary")) != 0)
+		exit(ERROR_RC);
+
+	if ((access_text != NULL && rc_avpair_parse(rh, access_text, &conf.access_pairs) < 0) ||
+	    (acct_text != NULL && rc_avpair_parse(rh, acct_text, &conf.acct_pairs) < 0)) {
+		fprintf(stderr, "%s: can't parse the reply attributes\n", pname);
+		exit(ERROR_RC);
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+
+	if ((r = rc_responder_start(rh, &conf)) == NULL)
+		exit(ERROR_RC);
+	rc_avpair_free(conf.access_pairs);
+	rc_avpair_free(conf.acct_pairs);
+
+	printf("port %d\n", rc_responder_port(r));
+	fflush(stdout);
+
+	while (!got_term)
+		pause();
+
+	rc_responder_stats(r, &stats);
+	rc_responder_stop(r);
+	rc_destroy(rh);
+
+	printf("requests %llu\ninvalid %llu\nreplies %llu\nlost %llu\n"
+	       "duplicated %llu\nreordered %llu\ncorrupted %llu\n",
+	       (unsigned long long)stats.requests, (unsigned long long)stats.invalid,
+	       (unsigned long long)stats.replies, (unsigned long long)stats.lost,
+	       (unsigned long long)stats.duplicated, (unsigned long long)stats.reordered,
+	       (unsigned long long)stats.corrupted);
+
+	return 0;
+}
@@ -0,0 +1,730 @@
+/*
+ * radsim.c	Simulates the sessions of a NAS, for accounting capacity tests.
+ *
+ * License:	BSD
+ *
+ */
+
+static char	rcsid[] =
+		"$Id: radsim.c $";
+
+#include <config.h>
+#include <includes.h>
+#include <freeradius-client.h>
+#include <pathnames.h>
+#include <math.h>
+
+#ifdef HAVE_PTHREAD_CREATE
+# include <pthread.h>
+#endif
+
+#define MAX_SESSIONS	(1 << 24)		//!< each gets an address of 10/8.
+#define MAX_WORKERS	4096
+#define MEAN_PACKET	700			//!< bytes, to derive packet counts.
+
+static char *pname;
+
+static volatile sig_atomic_t got_term;
+
+/* what a session does next */
+enum sim_state {
+	SIM_AUTH = 0,				//!< Access-Request of a new session.
+	SIM_START,				//!< Accounting Start.
+	SIM_INTERIM,				//!< Interim-Update.
+	SIM_STOP,				//!< Accounting Stop.
+	SIM_STATES
+};
+
+static char const *state_names[SIM_STATES] = {
+	"auth", "start", "interim", "stop"
+};
+
+/* one subscriber line of the NAS; it runs one session after another */
+struct session {
+	uint32_t	serial;			//!< number of the current session.
+	uint32_t	rate;			//!< bytes per second it downloads.
+	double		started;		//!< rc_getmtime() of its Start.
+	double		ends;			//!< when it is to stop.
+	uint8_t		state;
+};
+
+struct event {
+	double		due;
+	uint32_t	slot;
+};
+
+/* counters of one kind of request */
+struct sim_kind {
+	uint64_t	ok;
+	uint64_t	failed;
+	RC_HISTOGRAM	latency;		//!< usec.
+};
+
+/* the simulation, shared by every worker */
+struct sim {
+	rc_handle	*rh;
+	uint32_t	nsessions;
+	uint32_t	users;
+	char const	*user_prefix;
+	char const	*password;
+	VALUE_PAIR	*extra;			//!< added to every request.
+	double		interval;		//!< seconds between Interim-Updates.
+	double		lifetime;		//!< mean seconds of a session.
+	double		rate;			//!< bytes per second of a session, on average.
+	double		start;
+	double		end;
+	int		graceful;		//!< stop every session once the run ends.
+	uint32_t	run_id;
+
+	struct session	*sessions;
+
+	/* under lock */
+	struct event	*heap;
+	uint32_t	nevents;
+	uint32_t	next_serial;
+	uint64_t	rng;
+	int		draining;
+#ifdef HAVE_PTHREAD_CREATE
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+#endif
+
+	/* updated atomically */
+	int64_t		active;			//!< sessions between Start and Stop.
+	int64_t		peak;
+	struct sim_kind	kind[SIM_STATES];
+	RC_HISTOGRAM	lag;			//!< usec each request was sent late.
+};
+
+/* attributes of the dictionary the requests are built from */
+static DICT_ATTR *attr_user_name, *attr_password, *attr_service_type,
+	*attr_framed_protocol, *attr_framed_ip, *attr_calling_station,
+	*attr_status_type, *attr_session_id, *attr_authentic, *attr_session_time,
+	*attr_input_octets, *attr_output_octets, *attr_input_gigawords,
+	*attr_output_gigawords, *attr_input_packets, *attr_output_packets,
+	*attr_terminate_cause, *attr_event_timestamp;
+
+void usage(void)
+{
+	fprintf(stderr,"Usage: %s [-Vhg] [-f <config_file>] [-n <sessions>] [-r <rate>] [-l <seconds>]\n", pname);
+	fprintf(stderr,"       [-i <seconds>] [-b <bytes/s>] [-d <seconds>] [-c <concurrency>]\n");
+	fprintf(stderr,"       [-u <users>] [-U <prefix>] [-P <password>] [-a <pairs>] [-s <seconds>] [-S <seed>]\n\n");
+	fprintf(stderr,"  -V            output version information\n");
+	fprintf(stderr,"  -h            output this text\n");
+	fprintf(stderr,"  -f		filename of alternate config file\n");
+	fprintf(stderr,"  -n		concurrent sessions (default 1000)\n");
+	fprintf(stderr,"  -r		new sessions per second while ramping up (default 100)\n");
+	fprintf(stderr,"  -l		mean session length in seconds (default 3600); each session\n");
+	fprintf(stderr,"		that stops is replaced, so this sets the churn\n");
+	fprintf(stderr,"  -i		seconds between Interim-Updates (default 300)\n");
+	fprintf(stderr,"  -b		mean bytes per second of a session (default 10000)\n");
+	fprintf(stderr,"  -d		seconds to run for (default 60)\n");
+	fprintf(stderr,"  -g		send a Stop for every session at the end\n");
+	fprintf(stderr,"  -c		requests outstanding at most (default 64)\n");
+	fprintf(stderr,"  -u		number of distinct users (default: the sessions)\n");
+	fprintf(stderr,"  -U		prefix of the user names (default \"user\")\n");
+	fprintf(stderr,"  -P		password of the users (default \"password\")\n");
+	fprintf(stderr,"  -a		attributes added to every request, as \"Attr=value ...\"\n");
+	fprintf(stderr,"  -s		seconds between progress lines, 0 for none (default 10)\n");
+	fprintf(stderr,"  -S		seed of the simulation\n");
+	exit(ERROR_RC);
+}
+
+void version(void)
+{
+	fprintf(stderr,"%s: %s\n", pname ,rcsid);
+	exit(ERROR_RC);
+}
+
+static void on_signal(int sig)
+{
+	got_term = 1;
+}
+
+/** Draw a uniform number in (0, 1]
+ *
+ * @param state the xorshift64* state, not 0.
+ * @return the number.
+ */
+static double uniform(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return ((x * 2685821657736338717ULL >> 11) + 1) / 9007199254740992.0;
+}
+
+/* the event heap, ordered by due time; called under lock */
+
+static void heap_push(struct sim *sim, double due, uint32_t slot)
+{
+	struct event	ev = { due, slot };
+	uint32_t	i = sim->nevents++, parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (sim->heap[parent].due <= due)
+			break;
+		sim->heap[i] = sim->heap[parent];
+		i = parent;
+	}
+	sim->heap[i] = ev;
+}
+
+static struct event heap_pop(struct sim *sim)
+{
+	struct event	top = sim->heap[0], last = sim->heap[--sim->nevents];
+	uint32_t	i = 0, child;
+
+	while ((child = 2 * i + 1) < sim->nevents) {
+		if (child + 1 < sim->nevents && sim->heap[child + 1].due < sim->heap[child].due)
+			child++;
+		if (last.due <= sim->heap[child].due)
+			break;
+		sim->heap[i] = sim->heap[child];
+		i = child;
+	}
+	if (sim->nevents > 0)
+		sim->heap[i] = last;
+	return top;
+}
+
+/** Add an attribute, if the dictionary has it
+ *
+ * @param sim the simulation.
+ * @param list the request.
+ * @param attr the attribute, NULL to skip it.
+ * @param value the value, a uint32_t for integers and addresses or a string.
+ * @return 0 on success, -1 on failure.
+ */
+static int add(struct sim const *sim, VALUE_PAIR **list, DICT_ATTR const *attr, void const *value)
+{
+	if (attr == NULL)
+		return 0;
+	if (rc_avpair_add(sim->rh, list, attr->value, value,
+			  attr->type == PW_TYPE_STRING ? -1 : 0, attr->vendor) == NULL)
+		return -1;
+	return 0;
+}
+
+static int add_int(struct sim const *sim, VALUE_PAIR **list, DICT_ATTR const *attr, uint32_t value)
+{
+	return add(sim, list, attr, &value);
+}
+
+/** Build the request a session sends next
+ *
+ * @param sim the simulation.
+ * @param slot the session.
+ * @param now the time of the request.
+ * @param draining non-zero once the run has ended.
+ * @param list where to store the request.
+ * @return 0 on success, -1 on failure.
+ */
+static int build(struct sim const *sim, uint32_t slot, double now, int draining, VALUE_PAIR **list)
+{
+	struct session const *s = &sim->sessions[slot];
+	VALUE_PAIR	*vp;
+	char		buf[AUTH_STRING_LEN + 1];
+	uint64_t	in, out;
+	double		elapsed;
+	int		rc = 0;
+
+	*list = NULL;
+
+	snprintf(buf, sizeof(buf), "%s%u", sim->user_prefix, s->serial % sim->users);
+	rc |= add(sim, list, attr_user_name, buf);
+	snprintf(buf, sizeof(buf), "02-%02X-%02X-%02X-%02X-%02X", sim->run_id & 0xff,
+		 (s->serial >> 24) & 0xff, (s->serial >> 16) & 0xff,
+		 (s->serial >> 8) & 0xff, s->serial & 0xff);
+	rc |= add(sim, list, attr_calling_station, buf);
+	rc |= add_int(sim, list, attr_framed_ip, 0x0a000000 + slot);
+
+	if (s->state == SIM_AUTH) {
+		rc |= add(sim, list, attr_password, sim->password);
+		rc |= add_int(sim, list, attr_service_type, PW_FRAMED);
+		rc |= add_int(sim, list, attr_framed_protocol, PW_PPP);
+	} else {
+		snprintf(buf, sizeof(buf), "%08X%08X", sim->run_id, s->serial);
+		rc |= add(sim, list, attr_session_id, buf);
+		rc |= add_int(sim, list, attr_status_type,
+			      s->state == SIM_START ? PW_STATUS_START :
+			      s->state == SIM_STOP ? PW_STATUS_STOP : PW_STATUS_ALIVE);
+		rc |= add_int(sim, list, attr_authentic, PW_RADIUS);
+		rc |= add_int(sim, list, attr_event_timestamp, (uint32_t)time(NULL));
+
+		if (s->state != SIM_START) {
+			/* counters grow with the session, 8 bytes down for 1 up */
+			elapsed = now - s->started;
+			in = (uint64_t)(elapsed * s->rate);
+			out = in / 8;
+			rc |= add_int(sim, list, attr_session_time, (uint32_t)elapsed);
+			rc |= add_int(sim, list, attr_input_octets, (uint32_t)in);
+			rc |= add_int(sim, list, attr_output_octets, (uint32_t)out);
+			if ((in >> 32) != 0)
+				rc |= add_int(sim, list, attr_input_gigawords, (uint32_t)(in >> 32));
+			if ((out >> 32) != 0)
+				rc |= add_int(sim, list, attr_output_gigawords, (uint32_t)(out >> 32));
+			rc |= add_int(sim, list, attr_input_packets, (uint32_t)(in / MEAN_PACKET));
+			rc |= add_int(sim, list, attr_output_packets, (uint32_t)(out / MEAN_PACKET));
+		}
+		if (s->state == SIM_STOP)
+			rc |= add_int(sim, list, attr_terminate_cause,
+				      draining ? PW_NAS_REQUEST : PW_USER_REQUEST);
+	}
+
+	for (vp = sim->extra; vp != NULL; vp = vp->next) {
+		if (rc_avpair_add(sim->rh, list, vp->attribute,
+				  vp->type == PW_TYPE_STRING ? (void const *)vp->strvalue : (void const *)&vp->lvalue,
+				  vp->lvalue, vp->vendor) == NULL)
+			rc = -1;
+	}
+
+	if (rc != 0) {
+		rc_avpair_free(*list);
+		*list = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/** Send the next request of a session and move it on
+ *
+ * @param sim the simulation.
+ * @param slot the session.
+ * @param due when the request was due.
+ * @param draining non-zero once the run has ended.
+ * @param rng the worker's random state.
+ * @return when the session is next due.
+ */
+static double step(struct sim *sim, uint32_t slot, double due, int draining, uint64_t *rng)
+{
+	struct session	*s = &sim->sessions[slot];
+	struct sim_kind	*kind = &sim->kind[s->state];
+	VALUE_PAIR	*send, *received = NULL;
+	char		msg[PW_MAX_MSG_SIZE];
+	double		now, done, next;
+	int64_t		active, peak;
+	int		rc;
+
+	if (s->state == SIM_AUTH)
+		s->serial = __atomic_fetch_add(&sim->next_serial, 1, __ATOMIC_RELAXED);
+
+	now = rc_getmtime();
+	if (now > due)
+		rc_hist_record(&sim->lag, (uint64_t)((now - due) * 1000000.0));
+
+	if (build(sim, slot, now, draining, &send) < 0) {
+		rc = ERROR_RC;
+	} else if (s->state == SIM_AUTH) {
+		rc = rc_auth(sim->rh, slot, send, &received, msg);
+	} else {
+		rc = rc_acct(sim->rh, slot, send);
+	}
+	done = rc_getmtime();
+
+	rc_hist_record(&kind->latency, (uint64_t)((done - now) * 1000000.0));
+	__atomic_add_fetch(rc == OK_RC ? &kind->ok : &kind->failed, 1, __ATOMIC_RELAXED);
+	rc_avpair_free(send);
+	rc_avpair_free(received);
+
+	switch (s->state) {
+	case SIM_AUTH:
+		if (rc != OK_RC) {
+			/* try again as a new session, a second or so later */
+			return done + -log(uniform(rng));
+		}
+		s->state = SIM_START;
+		return done;
+
+	case SIM_START:
+		s->started = now;
+		s->ends = now + -log(uniform(rng)) * sim->lifetime;
+		s->rate = (uint32_t)(-log(uniform(rng)) * sim->rate);
+		active = __atomic_add_fetch(&sim->active, 1, __ATOMIC_RELAXED);
+		peak = __atomic_load_n(&sim->peak, __ATOMIC_RELAXED);
+		while (active > peak &&
+		       !__atomic_compare_exchange_n(&sim->peak, &peak, active, 1,
+						    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			;
+		/* the first update is spread over an interval, so that
+		 * sessions started together do not stay in step */
+		next = now + uniform(rng) * sim->interval;
+		break;
+
+	case SIM_INTERIM:
+		next = due + sim->interval;
+		break;
+
+	default:
+		__atomic_sub_fetch(&sim->active, 1, __ATOMIC_RELAXED);
+		s->state = SIM_AUTH;
+		return done;
+	}
+
+	if (next >= s->ends) {
+		s->state = SIM_STOP;
+		return s->ends;
+	}
+	s->state = SIM_INTERIM;
+	return next;
+}
+
+/** Run sessions as they fall due, until the simulation ends
+ *
+ * Once it ends, a graceful run goes on to stop every session that has
+ * started, at once.
+ *
+ * @param arg the #sim.
+ * @return NULL.
+ */
+static void *worker(void *arg)
+{
+	struct sim	*sim = arg;
+	struct event	ev;
+	uint64_t	rng;
+	double		now, next;
+	int		draining;
+#ifdef HAVE_PTHREAD_CREATE
+	struct timespec	until;
+	struct timeval	tv;
+	double		wake;
+#endif
+
+#ifdef HAVE_PTHREAD_CREATE
+	pthread_mutex_lock(&sim->lock);
+#endif
+	rng = sim->rng = sim->rng * 6364136223846793005ULL + 1442695040888963407ULL;
+	if (rng == 0)
+		rng = 1;
+
+	for (;;) {
+		now = rc_getmtime();
+		if (!sim->draining && (got_term || now >= sim->end))
+			sim->draining = 1;
+
+		if (sim->draining) {
+			/* sessions not yet started are dropped */
+			while (sim->nevents > 0 &&
+			       (!sim->graceful || sim->sessions[sim->heap[0].slot].state < SIM_INTERIM))
+				heap_pop(sim);
+			if (sim->nevents == 0)
+				break;
+			ev = heap_pop(sim);
+			sim->sessions[ev.slot].state = SIM_STOP;
+			ev.due = now;
+		} else if (sim->nevents > 0 && sim->heap[0].due <= now) {
+			ev = heap_pop(sim);
+		} else {
+#ifdef HAVE_PTHREAD_CREATE
+			/* sleep until the next event, or the end, but wake up
+			 * often enough to notice a signal */
+			wake = sim->nevents > 0 ? sim->heap[0].due : sim->end;
+			if (wake > sim->end)
+				wake = sim->end;
+			if (wake > now + 0.1)
+				wake = now + 0.1;
+			gettimeofday(&tv, NULL);
+			wake = tv.tv_sec + tv.tv_usec / 1000000.0 + (wake - now);
+			until.tv_sec = (time_t)wake;
+			until.tv_nsec = (long)((wake - (double)until.tv_sec) * 1000000000.0);
+			pthread_cond_timedwait(&sim->cond, &sim->lock, &until);
+#else
+			rc_mdelay(1);
+#endif
+			continue;
+		}
+		draining = sim->draining;
+#ifdef HAVE_PTHREAD_CREATE
+		pthread_mutex_unlock(&sim->lock);
+#endif
+
+		next = step(sim, ev.slot, ev.due, draining, &rng);
+
+#ifdef HAVE_PTHREAD_CREATE
+		pthread_mutex_lock(&sim->lock);
+#endif
+		/* a session that started while the run ended still gets its Stop */
+		if (!sim->draining ||
+		    (sim->graceful && sim->sessions[ev.slot].state >= SIM_INTERIM)) {
+			heap_push(sim, next, ev.slot);
+#ifdef HAVE_PTHREAD_CREATE
+			pthread_cond_signal(&sim->cond);
+#endif
+		}
+	}
+
+#ifdef HAVE_PTHREAD_CREATE
+	pthread_cond_broadcast(&sim->cond);
+	pthread_mutex_unlock(&sim->lock);
+#endif
+	return NULL;
+}
+
+/** Print one line of progress
+ *
+ * @param sim the simulation.
+ * @param prev the request counts at the previous line, updated.
+ * @param seconds since the previous line.
+ */
+static void progress(struct sim *sim, uint64_t *prev, double seconds)
+{
+	uint64_t	n;
+	int		i;
+
+	printf("%8.1fs active %-9lld", rc_getmtime() - sim->start,
+	       (long long)__atomic_load_n(&sim->active, __ATOMIC_RELAXED));
+	for (i = 0; i < SIM_STATES; i++) {
+		n = __atomic_load_n(&sim->kind[i].ok, __ATOMIC_RELAXED) +
+		    __atomic_load_n(&sim->kind[i].failed, __ATOMIC_RELAXED);
+		printf(" %s %.1f/s", state_names[i], (n - prev[i]) / seconds);
+		prev[i] = n;
+	}
+	printf(" lag p99 %.3fs\n", rc_hist_percentile(&sim->lag, 99) / 1000000.0);
+	fflush(stdout);
+}
+
+static void report(struct sim const *sim, double elapsed)
+{
+	int	i;
+
+	printf("\nduration     %.3f s\n", elapsed);
+	printf("sessions     %lld active at the end, %lld at most, %u started\n",
+	       (long long)sim->active, (long long)sim->peak, sim->next_serial);
+	printf("\n%-8s %12s %10s %10s %10s %10s %10s\n", "request", "ok", "failed", "req/s",
+	       "p50(ms)", "p99(ms)", "max(ms)");
+	for (i = 0; i < SIM_STATES; i++)
+		printf("%-8s %12llu %10llu %10.1f %10.3f %10.3f %10.3f\n", state_names[i],
+		       (unsigned long long)sim->kind[i].ok, (unsigned long long)sim->kind[i].failed,
+		       elapsed > 0 ? (sim->kind[i].ok + sim->kind[i].failed) / elapsed : 0.0,
+		       rc_hist_percentile(&sim->kind[i].latency, 50) / 1000.0,
+		       rc_hist_percentile(&sim->kind[i].latency, 99) / 1000.0,
+		       sim->kind[i].latency.max / 1000.0);
+	printf("\nbehind schedule: p50 %.3f s, p99 %.3f s, max %.3f s\n",
+	       rc_hist_percentile(&sim->lag, 50) / 1000000.0,
+	       rc_hist_percentile(&sim->lag, 99) / 1000000.0,
+	       sim->lag.max / 1000000.0);
+}
+
+int main (int argc, char **argv)
+{
+	char		*path_radiusclient_conf = RC_CONFIG_FILE;
+	char		*extra_text = NULL;
+	struct sim	*sim;
+	struct sigaction sa;
+	uint64_t	seed = 0, prev[SIM_STATES];
+	double		ramp = 100, duration = 60, every = 10, last, now;
+	int		c, workers = 64;
+	uint32_t	i;
+#ifdef HAVE_PTHREAD_CREATE
+	pthread_t	*tids;
+	int		w;
+#endif
+
+	extern char *optarg;
+
+	pname = (pname = strrchr(argv[0],'/'))?pname+1:argv[0];
+
+	rc_openlog(pname);
+
+	sim = calloc(1, sizeof(*sim));
+	if (sim == NULL) {
+		fprintf(stderr, "%s: out of memory\n", pname);
+		exit(ERROR_RC);
+	}
+	sim->nsessions = 1000;
+	sim->user_prefix = "user";
+	sim->password = "password";
+	sim->interval = 300;
+	sim->lifetime = 3600;
+	sim->rate = 10000;
+
+	while ((c = getopt(argc,argv,"hVgf:n:r:l:i:b:d:c:u:U:P:a:s:S:")) > 0)
+	{
+		switch(c) {
+			case 'f':
+				path_radiusclient_conf = optarg;
+				break;
+			case 'n':
+				sim->nsessions = strtoul(optarg, NULL, 10);
+				break;
+			case 'r':
+				ramp = atof(optarg);
+				break;
+			case 'l':
+				sim->lifetime = atof(optarg);
+				break;
+			case 'i':
+				sim->interval = atof(optarg);
+				break;
+			case 'b':
+				sim->rate = atof(optarg);
+				break;
+			case 'd':
+				duration = atof(optarg);
+				break;
+			case 'g':
+				sim->graceful = 1;
+				break;
+			case 'c':
+				workers = atoi(optarg);
+				break;
+			case 'u':
+				sim->users = strtoul(optarg, NULL, 10);
+				break;
+			case 'U':
+				sim->user_prefix = optarg;
+				break;
+			case 'P':
+				sim->password = optarg;
+				break;
+			case 'a':
+				extra_text = optarg;
+				break;
+			case 's':
+				every = atof(optarg);
+				break;
+			case 'S':
+				seed = strtoull(optarg, NULL, 0);
+				break;
+			case 'V':
+				version();
+				break;
+			case 'h':
+				usage();
+				break;
+			default:
+				exit(ERROR_RC);
+				break;
+		}
+	}
+
+	if (sim->nsessions == 0 || sim->nsessions > MAX_SESSIONS || ramp <= 0 ||
+	    sim->lifetime <= 0 || sim->interval <= 0 || sim->rate < 0 || duration <= 0 ||
+	    every < 0 || workers < 1 || workers > MAX_WORKERS) {
+		fprintf(stderr, "%s: -n must be between 1 and %d, -c between 1 and %d, "
+			"-r, -l, -i and -d positive\n", pname, MAX_SESSIONS, MAX_WORKERS);
+		exit(ERROR_RC);
+	}
+	if (sim->users == 0)
+		sim->users = sim->nsessions;
+
+	if ((sim->rh = rc_read_config(path_radiusclient_conf)) == NULL)
+		exit(ERROR_RC);
+
+	if (rc_read_dictionary(sim->rh, rc_conf_str(sim->rh, "dictionary")) != 0)
+		exit(ERROR_RC);
+
+	/* whatever the dictionary calls them; those it lacks are left out */
+	attr_user_name = rc_dict_getattr(sim->rh, PW_USER_NAME);
+	attr_password = rc_dict_getattr(sim->rh, PW_USER_PASSWORD);
+	attr_service_type = rc_dict_getattr(sim->rh, PW_SERVICE_TYPE);
+	attr_framed_protocol = rc_dict_getattr(sim->rh, PW_FRAMED_PROTOCOL);
+	attr_framed_ip = rc_dict_getattr(sim->rh, PW_FRAMED_IP_ADDRESS);
+	attr_calling_station = rc_dict_getattr(sim->rh, PW_CALLING_STATION_ID);
+	attr_status_type = rc_dict_getattr(sim->rh, PW_ACCT_STATUS_TYPE);
+	attr_session_id = rc_dict_getattr(sim->rh, PW_ACCT_SESSION_ID);
+	attr_authentic = rc_dict_getattr(sim->rh, PW_ACCT_AUTHENTIC);
+	attr_session_time = rc_dict_getattr(sim->rh, PW_ACCT_SESSION_TIME);
+	attr_input_octets = rc_dict_getattr(sim->rh, PW_ACCT_INPUT_OCTETS);
+	attr_output_octets = rc_dict_getattr(sim->rh, PW_ACCT_OUTPUT_OCTETS);
+	attr_input_gigawords = rc_dict_getattr(sim->rh, PW_ACCT_INPUT_GIGAWORDS);
+	attr_output_gigawords = rc_dict_getattr(sim->rh, PW_ACCT_OUTPUT_GIGAWORDS);
+	attr_input_packets = rc_dict_getattr(sim->rh, PW_ACCT_INPUT_PACKETS);
+	attr_output_packets = rc_dict_getattr(sim->rh, PW_ACCT_OUTPUT_PACKETS);
+	attr_terminate_cause = rc_dict_getattr(sim->rh, PW_ACCT_TERMINATE_CAUSE);
+	attr_event_timestamp = rc_dict_getattr(sim->rh, PW_EVENT_TIMESTAMP);
+
+	if (attr_user_name == NULL || attr_status_type == NULL) {
+		fprintf(stderr, "%s: the dictionary lacks User-Name or Acct-Status-Type\n", pname);
+		exit(ERROR_RC);
+	}
+
+	if (extra_text != NULL && rc_avpair_parse(sim->rh, extra_text, &sim->extra) < 0) {
+		fprintf(stderr, "%s: can't parse the attributes: %s\n", pname, extra_text);
+		exit(ERROR_RC);
+	}
+
+	sim->sessions = calloc(sim->nsessions, sizeof(*sim->sessions));
+	sim->heap = calloc(sim->nsessions, sizeof(*sim->heap));
+	if (sim->sessions == NULL || sim->heap == NULL) {
+		fprintf(stderr, "%s: out of memory\n", pname);
+		exit(ERROR_RC);
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+
+	if (seed == 0)
+		seed = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32);
+	sim->rng = seed;
+	sim->run_id = (uint32_t)(seed ^ (seed >> 32));
+	sim->start = rc_getmtime();
+	sim->end = sim->start + duration;
+
+	/* sessions come up at the ramp rate, already in heap order */
+	for (i = 0; i < sim->nsessions; i++)
+		heap_push(sim, sim->start + i / ramp, i);
+
+	memset(prev, 0, sizeof(prev));
+
+#ifdef HAVE_PTHREAD_CREATE
+	pthread_mutex_init(&sim->lock, NULL);
+	pthread_cond_init(&sim->cond, NULL);
+	tids = calloc(workers, sizeof(*tids));
+	if (tids == NULL) {
+		fprintf(stderr, "%s: out of memory\n", pname);
+		exit(ERROR_RC);
+	}
+	for (w = 0; w < workers; w++) {
+		if (pthread_create(&tids[w], NULL, worker, sim) != 0) {
+			fprintf(stderr, "%s: can only start %d workers\n", pname, w);
+			break;
+		}
+	}
+	workers = w;
+	if (workers == 0) {
+		worker(sim);
+	} else {
+		last = sim->start;
+		pthread_mutex_lock(&sim->lock);
+		while (sim->nevents > 0 || !sim->draining) {
+			pthread_mutex_unlock(&sim->lock);
+			rc_mdelay(100);
+			now = rc_getmtime();
+			if (every > 0 && now - last >= every && !sim->draining) {
+				progress(sim, prev, now - last);
+				last = now;
+			}
+			pthread_mutex_lock(&sim->lock);
+		}
+		pthread_mutex_unlock(&sim->lock);
+	}
+	for (w = 0; w < workers; w++)
+		pthread_join(tids[w], NULL);
+	free(tids);
+	pthread_cond_destroy(&sim->cond);
+	pthread_mutex_destroy(&sim->lock);
+#else
+	(void)last;
+	(void)now;
+	(void)every;
+	worker(sim);
+#endif
+
+	report(sim, rc_getmtime() - sim->start);
+
+	rc_avpair_free(sim->extra);
+	rc_destroy(sim->rh);
+	free(sim->sessions);
+	free(sim->heap);
+	free(sim);
+
+	return 0;
+}
@@ -9,13 +9,6 @@
  *
  */
 
-/* FIX ME FIX ME FIX ME
- * This is broken, now that send_server requires the secret to be passed
- * It will need to be collected as an additional argument on command line
- */
-
-#define FIX_ME_SECRET "fixme"
-
 static char	rcsid[] =
 		"$Id: radstatus.c,v 1.8 2007/04/13 14:20:44 pnixon Exp $";
 
@@ -25,15 +18,47 @@ static char	rcsid[] =
 #include <pathnames.h>
 #include <messages.h>
 
+#ifdef HAVE_PTHREAD_CREATE
+# include <pthread.h>
+#endif
+
 static char *pname;
 
+/* the outcome of a probe, written under probe_set.lock */
+struct probe_status {
+	int		result;
+	int		done;
+	double		rtt;			//!< seconds.
+	char		msg[PW_MAX_MSG_SIZE];
+};
+
+/* one server being probed */
+struct probe {
+	rc_handle	*rh;
+	char		*name;
+	char		*secret;
+	unsigned short	port;
+	struct probe_status status;
+	struct probe_set *set;
+};
+
+/* all probes, which run at once and share a deadline */
+struct probe_set {
+	int		pending;
+#ifdef HAVE_PTHREAD_CREATE
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+#endif
+};
 
 void usage(void)
 {
-	fprintf(stderr,"Usage: %s [-Vh] [-f <config_file>] [server[:port[:secret]] ...\n\n", pname);
+	fprintf(stderr,"Usage: %s [-Vhj] [-f <config_file>] [-t <seconds>] [server[:port[:secret]] ...\n\n", pname);
 	fprintf(stderr,"  -V            output version information\n");
 	fprintf(stderr,"  -h            output this text\n");
 	fprintf(stderr,"  -f		filename of alternate config file\n");
+	fprintf(stderr,"  -t		give up on servers not answering within this many seconds\n");
+	fprintf(stderr,"  -j            output one JSON object per server\n");
 	exit(ERROR_RC);
 }
 
@@ -43,14 +68,191 @@ void version(void)
 	exit(ERROR_RC);
 }
 
+static char const *status_name(struct probe_status const *st)
+{
+	if (!st->done)
+		return "timeout";
+
+	switch (st->result) {
+	case OK_RC:
+		return "ok";
+	case TIMEOUT_RC:
+		return "timeout";
+	case REJECT_RC:
+		return "reject";
+	case BADRESP_RC:
+		return "badresp";
+	default:
+		return "error";
+	}
+}
+
+/** Probe one server, recording its status and round-trip time
+ *
+ * @param arg the #probe.
+ * @return NULL.
+ */
+static void *probe_run(void *arg)
+{
+	struct probe	*pr = arg;
+	double		start, rtt;
+	int		result;
+	char		msg[PW_MAX_MSG_SIZE];
+
+	/* main may be reading pr->status past the deadline, so fill it in only
+	 * under the lock */
+	msg[0] = '\0';
+	start = rc_getmtime();
+	result = rc_check(pr->rh, pr->name, pr->secret, pr->port, msg);
+	rtt = rc_getmtime() - start;
+
+#ifdef HAVE_PTHREAD_CREATE
+	pthread_mutex_lock(&pr->set->lock);
+#endif
+	pr->status.rtt = rtt;
+	pr->status.result = result;
+	strcpy(pr->status.msg, msg);
+	pr->status.done = 1;
+	pr->set->pending--;
+#ifdef HAVE_PTHREAD_CREATE
+	pthread_cond_signal(&pr->set->cond);
+	pthread_mutex_unlock(&pr->set->lock);
+#endif
+
+	return NULL;
+}
+
+/** Probe every server at once and wait for them, but no longer than the deadline
+ *
+ * Probes still running at the deadline are left behind and reported as
+ * timed out.
+ *
+ * @param probes the servers.
+ * @param n the number of servers.
+ * @param set the shared state.
+ * @param deadline seconds to wait.
+ * @param out where to copy the status of each probe, as it was at the deadline.
+ */
+static void probe_all(struct probe *probes, int n, struct probe_set *set, double deadline,
+		      struct probe_status *out)
+{
+	int		i;
+#ifdef HAVE_PTHREAD_CREATE
+	pthread_t	tid;
+	pthread_attr_t	attr;
+	struct timeval	now;
+	struct timespec	until;
+	double		end;
+
+	pthread_mutex_init(&set->lock, NULL);
+	pthread_cond_init(&set->cond, NULL);
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	gettimeofday(&now, NULL);
+	end = now.tv_sec + now.tv_usec / 1000000.0 + deadline;
+	until.tv_sec = (time_t)end;
+	until.tv_nsec = (long)((end - (double)until.tv_sec) * 1000000000.0);
+
+	set->pending = n;
+	for (i = 0; i < n; i++) {
+		probes[i].set = set;
+		if (pthread_create(&tid, &attr, probe_run, &probes[i]) != 0)
+			probe_run(&probes[i]);
+	}
+	pthread_attr_destroy(&attr);
+
+	pthread_mutex_lock(&set->lock);
+	while (set->pending > 0) {
+		if (pthread_cond_timedwait(&set->cond, &set->lock, &until) == ETIMEDOUT)
+			break;
+	}
+	/* late probes may still finish, so copy the results under the lock */
+	for (i = 0; i < n; i++)
+		out[i] = probes[i].status;
+	pthread_mutex_unlock(&set->lock);
+#else
+	(void)deadline;
+	set->pending = n;
+	for (i = 0; i < n; i++) {
+		probes[i].set = set;
+		probe_run(&probes[i]);
+		out[i] = probes[i].status;
+	}
+#endif
+}
+
+/** Print a string as a JSON string literal
+ *
+ * @param s the string.
+ */
+static void json_string(char const *s)
+{
+	putchar('"');
+	for (; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\')
+			printf("\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			printf("\\u%04x", (unsigned char)*s);
+		else
+			putchar(*s);
+	}
+	putchar('"');
+}
+
+/** Print the outcome of a probe
+ *
+ * @param pr the probe.
+ * @param st its status, copied by probe_all(); the message is rewritten for output.
+ * @param json non-zero for a JSON object, otherwise a line of text.
+ */
+static void probe_print(struct probe const *pr, struct probe_status *st, int json)
+{
+	char	*p;
+	int	answered = st->done && (st->result == OK_RC || st->result == REJECT_RC);
+
+	if (!st->done)
+		st->msg[0] = '\0';
+
+	/* Reply-Message lines, separated by ';' on output */
+	for (p = st->msg; *p != '\0'; p++) {
+		if (*p == '\n' || *p == '\r')
+			*p = (p[1] != '\0' && p[1] != '\n' && p[1] != '\r') ? ';' : '\0';
+	}
+
+	if (json) {
+		printf("{\"server\":");
+		json_string(pr->name);
+		printf(",\"port\":%u,\"status\":\"%s\"", pr->port, status_name(st));
+		if (answered)
+			printf(",\"rtt_ms\":%.3f", st->rtt * 1000.0);
+		else
+			printf(",\"rtt_ms\":null");
+		printf(",\"reply_message\":");
+		json_string(st->msg);
+		printf("}\n");
+		return;
+	}
+
+	printf("%s:%u\t%s\t", pr->name, pr->port, status_name(st));
+	if (answered)
+		printf("%.3f ms", st->rtt * 1000.0);
+	else
+		printf("-");
+	printf("\t%s\n", st->msg);
+}
+
 int main (int argc, char **argv)
 {
-	int	result = ERROR_RC;
-   	int	c,i;
-	char	*p, msg[PW_MAX_MSG_SIZE];
+	int	c, i, j, n, json = 0, failed = 0;
+	double	deadline = 0;
+	char	*p, *q;
 	SERVER	*srv;
 	char	*path_radiusclient_conf = RC_CONFIG_FILE;
 	rc_handle *rh;
+	struct probe *probes;
+	struct probe_status *status;
+	struct probe_set set;
 
 	extern int optind;
 
@@ -58,12 +260,22 @@ int main (int argc, char **argv)
 
 	rc_openlog(pname);
 
-	while ((c = getopt(argc,argv,"hVf:")) > 0)
+	while ((c = getopt(argc,argv,"hVjf:t:")) > 0)
 	{
 		switch(c) {
 			case 'f':
 				path_radiusclient_conf = optarg;
 				break;
+			case 't':
+				deadline = atof(optarg);
+				if (deadline <= 0) {
+					fprintf(stderr, "%s: -t must be positive\n", pname);
+					exit(ERROR_RC);
+				}
+				break;
+			case 'j':
+				json = 1;
+				break;
 			case 'V':
 				version();
 				break;
@@ -85,46 +297,68 @@ int main (int argc, char **argv)
 	if (rc_read_dictionary(rh, rc_conf_str(rh, "dictionary")) != 0)
 		exit (ERROR_RC);
 
+	/* by default, as long as one probe may take */
+	if (deadline == 0)
+		deadline = (double)rh->opts.radius_timeout * (rh->opts.radius_retries + 1) + 1;
+
+	if (argc > 0) {
+		n = argc;
+	} else {
+		n = rh->opts.authserver->max + rh->opts.acctserver->max;
+	}
+
+	probes = calloc(n > 0 ? n : 1, sizeof(*probes));
+	status = calloc(n > 0 ? n : 1, sizeof(*status));
+	if (probes == NULL || status == NULL) {
+		fprintf(stderr, "%s: out of memory\n", pname);
+		exit(ERROR_RC);
+	}
+
 	if (argc > 0) {
 		for (i = 0; i < argc; i++) {
-			if ((p = strchr(argv[i], ':')) == NULL) {
-				result = rc_check(rh, argv[i],FIX_ME_SECRET,rc_getport(AUTH), msg);
-			} else if (!strcmp(p+1, "auth")) {
-				*p = '\0';
-				result = rc_check(rh, argv[i],FIX_ME_SECRET,rc_getport(AUTH), msg);
-			} else if (!strcmp(p+1, "acct")) {
-				*p = '\0';
-				result = rc_check(rh, argv[i],FIX_ME_SECRET,rc_getport(ACCT), msg);
-			} else {
-				*p = '\0';
-				result = rc_check(rh, argv[i],FIX_ME_SECRET,atoi(p+1), msg);
+			probes[i].rh = rh;
+			probes[i].name = argv[i];
+			probes[i].secret = NULL;		/* looked up like any other server */
+			probes[i].port = rc_getport(AUTH);
+			if ((p = strchr(argv[i], ':')) == NULL)
+				continue;
+			*p++ = '\0';
+			if ((q = strchr(p, ':')) != NULL) {
+				*q++ = '\0';
+				probes[i].secret = q;
 			}
-			if (result == OK_RC)
-				fputs(msg, stdout);
-			else
-				printf(SC_STATUS_FAILED);
+			if (!strcmp(p, "acct"))
+				probes[i].port = rc_getport(ACCT);
+			else if (*p != '\0' && strcmp(p, "auth") != 0)
+				probes[i].port = atoi(p);
 		}
 	} else {
-		srv = rc_conf_srv(rh, "authserver");
-		for(i=0; i<srv->max ; i++)
-		{
-			result = rc_check(rh, srv->name[i], srv->secret[i], srv->port[i], msg);
-			if (result == OK_RC)
-				fputs(msg, stdout);
-			else
-				printf(SC_STATUS_FAILED);
+		i = 0;
+		srv = rh->opts.authserver;
+		for (j = 0; j < srv->max; j++, i++) {
+			probes[i].rh = rh;
+			probes[i].name = srv->name[j];
+			probes[i].secret = srv->secret[j];
+			probes[i].port = srv->port[j];
 		}
-
-		srv = rc_conf_srv(rh, "acctserver");
-		for(i=0; i<srv->max ; i++)
-		{
-			result = rc_check(rh, srv->name[i], srv->secret[i], srv->port[i], msg);
-			if (result == OK_RC)
-				fputs(msg, stdout);
-			else
-				printf(SC_STATUS_FAILED);
+		srv = rh->opts.acctserver;
+		for (j = 0; j < srv->max; j++, i++) {
+			probes[i].rh = rh;
+			probes[i].name = srv->name[j];
+			probes[i].secret = srv->secret[j];
+			probes[i].port = srv->port[j];
 		}
 	}
 
-	return 0;
+	probe_all(probes, n, &set, deadline, status);
+
+	for (i = 0; i < n; i++) {
+		probe_print(&probes[i], &status[i], json);
+		if (!status[i].done || status[i].result != OK_RC)
+			failed++;
+	}
+	fflush(stdout);
+
+	/* probes past the deadline are still running; do not wait for them */
+	_exit(failed ? ERROR_RC : OK_RC);
 }
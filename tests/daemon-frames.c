@@ -0,0 +1,186 @@
+/*
+ * daemon-frames.c	Sends hand-made frames to radclientd and checks its answers;
+ *			run by daemon-tests.sh.
+ *
+ * License:	BSD
+ *
+ */
+
+#include <config.h>
+#include <includes.h>
+#include <freeradius-client.h>
+#include <sys/un.h>
+#include "daemon.h"
+
+#define FRAMES_TIMEOUT		10	//!< seconds to wait for an answer.
+#define FRAMES_MAX_PAIRS	100
+
+/* a request being built */
+struct frame {
+	struct daemon_hdr	hdr;
+	char			body[FRAMES_MAX_PAIRS * (sizeof(struct daemon_pair) + AUTH_STRING_LEN)];
+};
+
+static char *pname;
+
+static void frame_init(struct frame *f)
+{
+	memset(&f->hdr, 0, sizeof(f->hdr));
+	f->hdr.magic = DAEMON_MAGIC;
+	f->hdr.code = PW_ACCOUNTING_REQUEST;
+	f->hdr.prio = RC_PRIO_DEFAULT;
+}
+
+/** Append a pair to a request
+ *
+ * @param f the request.
+ * @param name the attribute name.
+ * @param attribute the attribute number.
+ * @param type its type.
+ * @param lvalue the value of integers, or the length of strings.
+ * @param value the bytes of strings, NULL for integers.
+ */
+static void frame_add(struct frame *f, char const *name, uint32_t attribute, int type,
+		      uint32_t lvalue, char const *value)
+{
+	struct daemon_pair dp;
+
+	memset(&dp, 0, sizeof(dp));
+	strncpy(dp.name, name, NAME_LENGTH);
+	dp.attribute = attribute;
+	dp.type = type;
+	dp.lvalue = lvalue;
+	dp.len = (value != NULL) ? lvalue : 0;
+
+	memcpy(f->body + f->hdr.length, &dp, sizeof(dp));
+	f->hdr.length += sizeof(dp);
+	if (value != NULL) {
+		memcpy(f->body + f->hdr.length, value, dp.len);
+		f->hdr.length += dp.len;
+	}
+	f->hdr.pairs++;
+}
+
+static int frames_connect(char const *path)
+{
+	struct sockaddr_un	sun;
+	struct timeval		tv;
+	int			fd;
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	snprintf(sun.sun_path, sizeof(sun.sun_path), "%s", path);
+	if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	tv.tv_sec = FRAMES_TIMEOUT;
+	tv.tv_usec = 0;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	return fd;
+}
+
+/** Send a request and compare the result in the answer
+ *
+ * @param fd the connection.
+ * @param f the request.
+ * @param what what the request is, for the report.
+ * @param expect the result expected.
+ * @return 0 if the answer came and carries the result, -1 otherwise.
+ */
+static int frames_check(int fd, struct frame const *f, char const *what, int expect)
+{
+	struct daemon_hdr	hdr;
+	char			skip[512];
+	size_t			left;
+	ssize_t			n;
+
+	if (write(fd, f, sizeof(f->hdr) + f->hdr.length) != (ssize_t)(sizeof(f->hdr) + f->hdr.length)) {
+		fprintf(stderr, "%s: %s: can't send: %s\n", pname, what, strerror(errno));
+		return -1;
+	}
+
+	if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) || hdr.magic != DAEMON_MAGIC) {
+		fprintf(stderr, "%s: %s: no answer\n", pname, what);
+		return -1;
+	}
+	for (left = hdr.length; left > 0; left -= n) {
+		n = read(fd, skip, left < sizeof(skip) ? left : sizeof(skip));
+		if (n <= 0) {
+			fprintf(stderr, "%s: %s: truncated answer\n", pname, what);
+			return -1;
+		}
+	}
+
+	if (hdr.code != expect) {
+		fprintf(stderr, "%s: %s: result %d, expected %d\n", pname, what, hdr.code, expect);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void frame_valid(struct frame *f)
+{
+	frame_init(f);
+	frame_add(f, "User-Name", PW_USER_NAME, PW_TYPE_STRING, 4, "test");
+	frame_add(f, "Acct-Status-Type", PW_ACCT_STATUS_TYPE, PW_TYPE_INTEGER, PW_STATUS_START, NULL);
+	frame_add(f, "Acct-Session-Id", PW_ACCT_SESSION_ID, PW_TYPE_STRING, 1, "1");
+}
+
+int main(int argc, char **argv)
+{
+	static struct frame	f;
+	char			value[AUTH_STRING_LEN];
+	int			fd, i, failed = 0;
+
+	pname = argv[0];
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <socket>\n", pname);
+		exit(ERROR_RC);
+	}
+
+	fd = frames_connect(argv[1]);
+	if (fd < 0) {
+		fprintf(stderr, "%s: can't connect to %s: %s\n", pname, argv[1], strerror(errno));
+		exit(ERROR_RC);
+	}
+
+	/* more than a RADIUS packet holds */
+	frame_init(&f);
+	memset(value, 'x', sizeof(value));
+	for (i = 0; i < FRAMES_MAX_PAIRS; i++)
+		frame_add(&f, "User-Name", PW_USER_NAME, PW_TYPE_STRING, sizeof(value), value);
+	if (frames_check(fd, &f, "oversized request", ERROR_RC) != 0)
+		failed++;
+
+	/* an attribute number that does not fit in a RADIUS attribute */
+	frame_valid(&f);
+	frame_add(&f, "Bogus", 300, PW_TYPE_INTEGER, 1, NULL);
+	if (frames_check(fd, &f, "attribute 300", ERROR_RC) != 0)
+		failed++;
+
+	/* the same connection is still served */
+	frame_valid(&f);
+	if (frames_check(fd, &f, "request after rejected ones", OK_RC) != 0)
+		failed++;
+	close(fd);
+
+	/* and so are new ones */
+	fd = frames_connect(argv[1]);
+	if (fd < 0) {
+		fprintf(stderr, "%s: radclientd is gone: %s\n", pname, strerror(errno));
+		exit(ERROR_RC);
+	}
+	if (frames_check(fd, &f, "request on a new connection", OK_RC) != 0)
+		failed++;
+	close(fd);
+
+	exit(failed ? ERROR_RC : OK_RC);
+}
@@ -0,0 +1,74 @@
+#!/bin/sh
+
+# License: BSD
+
+# Sends radclientd requests it must refuse, then checks that it still
+# answers; radresponder stands in for the server.
+
+srcdir="${srcdir:-.}"
+
+RESPONDER=../src/radresponder
+DAEMON=../src/radclientd
+FRAMES=./daemon-frames
+SOCKET=`pwd`/daemon-test.sock
+PIDS=""
+
+cleanup() {
+	test -n "$PIDS" && kill $PIDS 2>/dev/null
+	rm -f daemon-temp.conf daemon-responder.port $SOCKET
+}
+trap cleanup 0
+
+# write_conf <port>: points the client at the responder
+write_conf() {
+	sed -e 's|^dictionary.*|dictionary '$srcdir'/../etc/dictionary|' \
+	    -e 's|^mapfile.*|mapfile '$srcdir'/../etc/port-id-map|' \
+	    -e 's|^servers.*|servers /dev/null|' \
+	    -e '/^authserver/d' -e '/^acctserver/d' \
+	    -e 's|^radius_timeout.*|radius_timeout 3|' \
+	    -e 's|^radius_retries.*|radius_retries 1|' \
+	    <$srcdir/radiusclient.conf >daemon-temp.conf
+	echo "authserver 127.0.0.1:$1:testing123" >>daemon-temp.conf
+	echo "acctserver 127.0.0.1:$1:testing123" >>daemon-temp.conf
+}
+
+write_conf 1812
+$RESPONDER -f daemon-temp.conf >daemon-responder.port &
+PIDS="$PIDS $!"
+PORT=""
+for i in 1 2 3 4 5 6 7 8 9 10; do
+	PORT=`sed -n 's/^port //p' daemon-responder.port`
+	test -n "$PORT" && break
+	sleep 1
+done
+if test -z "$PORT";then
+	echo "radresponder did not start"
+	exit 1
+fi
+write_conf $PORT
+
+$DAEMON -f daemon-temp.conf -s $SOCKET &
+DAEMON_PID=$!
+PIDS="$PIDS $DAEMON_PID"
+for i in 1 2 3 4 5 6 7 8 9 10; do
+	test -S $SOCKET && break
+	sleep 1
+done
+if test ! -S $SOCKET;then
+	echo "radclientd did not start"
+	exit 1
+fi
+
+$FRAMES $SOCKET
+if test $? != 0;then
+	echo "Error in radclientd handling of bad requests"
+	exit 1
+fi
+
+kill -0 $DAEMON_PID 2>/dev/null
+if test $? != 0;then
+	echo "radclientd died"
+	exit 1
+fi
+
+exit 0
@@ -0,0 +1,108 @@
+/*
+ * md5-multi-test.c	Checks rc_md5_calc_multi() against rc_md5_calc() with each
+ *			lane implementation available on this host.
+ *
+ * License:	BSD
+ *
+ */
+
+#include <config.h>
+#include <includes.h>
+#include <freeradius-client.h>
+#include "util.h"
+#include "rc-md5.h"
+
+#define TEST_MAX_COUNT	19		//!< more than two groups of the widest lanes.
+#define TEST_MAX_LEN	300
+
+/* lengths around the padding boundaries: the tail takes one block up to 55
+ * bytes and two from 56, and whole blocks are read in place */
+static size_t const lengths[] = { 0, 1, 55, 56, 63, 64, 65, 119, 120, 127, 128, 200, TEST_MAX_LEN };
+
+#define NUM_LENGTHS	(sizeof(lengths) / sizeof(lengths[0]))
+
+static unsigned char	data[TEST_MAX_COUNT][TEST_MAX_LEN];
+static unsigned char	digest[TEST_MAX_COUNT][MD5_DIGEST_LENGTH];
+
+/** Hash count buffers at once and compare with hashing each of them alone
+ *
+ * @param lanes the implementation under test, for the report.
+ * @param len the length of each buffer.
+ * @param count the number of buffers.
+ * @return 0 if every digest matches, -1 otherwise.
+ */
+static int check(int lanes, size_t const *len, unsigned int count)
+{
+	unsigned char		*output[TEST_MAX_COUNT];
+	unsigned char const	*input[TEST_MAX_COUNT];
+	unsigned char		expect[MD5_DIGEST_LENGTH];
+	unsigned int		i;
+
+	for (i = 0; i < count; i++) {
+		input[i] = data[i];
+		output[i] = digest[i];
+		memset(digest[i], 0, MD5_DIGEST_LENGTH);
+	}
+
+	rc_md5_calc_multi(output, input, len, count);
+
+	for (i = 0; i < count; i++) {
+		rc_md5_calc(expect, data[i], len[i]);
+		if (memcmp(expect, digest[i], MD5_DIGEST_LENGTH) != 0) {
+			fprintf(stderr, "%d lanes: buffer %u of %u, %zu bytes: wrong digest\n",
+				lanes, i, count, len[i]);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int main(void)
+{
+	static int const	impl[] = { 1, 4, 8 };
+	size_t			len[TEST_MAX_COUNT];
+	unsigned int		count, i, j, k;
+	int			failed = 0;
+
+	for (i = 0; i < TEST_MAX_COUNT; i++)
+		for (j = 0; j < TEST_MAX_LEN; j++)
+			data[i][j] = (unsigned char)(i * 131 + j * 7 + 1);
+
+	srandom(1);
+	for (k = 0; k < sizeof(impl) / sizeof(impl[0]); k++) {
+		if (rc_md5_calc_multi_set_lanes(impl[k]) != 0) {
+			printf("%d lanes: not supported here, skipped\n", impl[k]);
+			continue;
+		}
+
+		for (count = 1; count <= TEST_MAX_COUNT; count++) {
+			/* all buffers of one length */
+			for (j = 0; j < NUM_LENGTHS; j++) {
+				for (i = 0; i < count; i++)
+					len[i] = lengths[j];
+				if (check(impl[k], len, count) != 0)
+					failed++;
+			}
+
+			/* mixed lengths, so that lanes finish at different blocks */
+			for (j = 0; j < 20; j++) {
+				for (i = 0; i < count; i++)
+					len[i] = (j % 2) ? lengths[random() % NUM_LENGTHS]
+							 : (size_t)(random() % (TEST_MAX_LEN + 1));
+				if (check(impl[k], len, count) != 0)
+					failed++;
+			}
+		}
+		printf("%d lanes: %s\n", impl[k], failed ? "FAILED" : "ok");
+	}
+
+	/* and whatever is picked by default */
+	rc_md5_calc_multi_set_lanes(0);
+	for (i = 0; i < TEST_MAX_COUNT; i++)
+		len[i] = lengths[i % NUM_LENGTHS];
+	if (check(0, len, TEST_MAX_COUNT) != 0)
+		failed++;
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,645 @@
+/*
+ * rcbench.c	Microbenchmarks of the codec, MD5, dictionary and configuration
+ *		code, reported as JSON.
+ *
+ * License:	BSD
+ *
+ */
+
+#define _GNU_SOURCE		/* RTLD_NEXT */
+
+#include <config.h>
+#include <includes.h>
+#include <freeradius-client.h>
+#include <time.h>
+#include "util.h"
+
+#ifdef HAVE_DLFCN_H
+# include <dlfcn.h>
+#endif
+
+#ifndef BENCH_DICTIONARY
+# define BENCH_DICTIONARY	"../etc/dictionary"
+#endif
+
+#define BENCH_SECRET		"testing123"
+#define BENCH_MAX_RUNS		31
+
+static char *pname;
+
+/* state shared by the benchmarks, set up once */
+struct bench_ctx {
+	rc_handle	*rh;			//!< handle with the dictionary loaded.
+	rc_handle	*cold;			//!< handle whose dictionary is reloaded.
+	char const	*config;		//!< the temporary configuration file.
+	char const	*dictionary;
+	VALUE_PAIR	*auth_pairs;		//!< an Access-Request.
+	VALUE_PAIR	*acct_pairs;		//!< an Accounting-Request.
+	unsigned char	vector[AUTH_VECTOR_LEN];
+	unsigned char	reply[BUFFER_LEN];	//!< an Access-Accept answering vector.
+	int		reply_len;
+	unsigned char	md5_in[1024];
+	unsigned	sink;			//!< keeps results alive.
+};
+
+struct bench {
+	char const	*name;
+	void		(*run)(struct bench_ctx *, uint64_t);
+	double		min_time;		//!< seconds per run, as a multiple of -t.
+};
+
+/*
+ *  Allocation counting: malloc() and friends defined here take the place
+ *  of the C library's for the whole process, count while a benchmark
+ *  runs and pass the calls on to the next definition.
+ */
+#if defined(HAVE_DLFCN_H) && defined(RTLD_NEXT)
+# define BENCH_ALLOCS
+
+static void	*(*real_malloc)(size_t);
+static void	*(*real_calloc)(size_t, size_t);
+static void	*(*real_realloc)(void *, size_t);
+static void	(*real_free)(void *);
+
+static int	counting;
+static uint64_t	allocs;			//!< calls of malloc(), calloc() and realloc().
+static uint64_t	alloc_bytes;
+
+/* dlsym() may allocate before the real functions are known */
+static char	boot_heap[4096] __attribute__((aligned(16)));
+static size_t	boot_used;
+static int	resolving;
+
+static void *boot_alloc(size_t size)
+{
+	void *p;
+
+	size = (size + 15) & ~(size_t)15;
+	if (size > sizeof(boot_heap) - boot_used)
+		return NULL;
+	p = boot_heap + boot_used;
+	boot_used += size;
+	return p;
+}
+
+static int in_boot_heap(void const *p)
+{
+	return (char const *)p >= boot_heap && (char const *)p < boot_heap + sizeof(boot_heap);
+}
+
+static void alloc_resolve(void)
+{
+	resolving = 1;
+	real_malloc = dlsym(RTLD_NEXT, "malloc");
+	real_calloc = dlsym(RTLD_NEXT, "calloc");
+	real_realloc = dlsym(RTLD_NEXT, "realloc");
+	real_free = dlsym(RTLD_NEXT, "free");
+	resolving = 0;
+}
+
+void *malloc(size_t size)
+{
+	if (__builtin_expect(real_malloc == NULL, 0)) {
+		if (resolving)
+			return boot_alloc(size);
+		alloc_resolve();
+	}
+	if (counting) {
+		allocs++;
+		alloc_bytes += size;
+	}
+	return real_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	if (__builtin_expect(real_calloc == NULL, 0)) {
+		if (resolving)
+			return nmemb != 0 && size > SIZE_MAX / nmemb ? NULL : boot_alloc(nmemb * size);
+		alloc_resolve();
+	}
+	if (counting) {
+		allocs++;
+		alloc_bytes += nmemb * size;
+	}
+	return real_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	void *p;
+
+	if (__builtin_expect(in_boot_heap(ptr), 0)) {
+		p = malloc(size);
+		if (p != NULL) {
+			size_t left = boot_heap + sizeof(boot_heap) - (char *)ptr;
+			memcpy(p, ptr, size < left ? size : left);
+		}
+		return p;
+	}
+	if (__builtin_expect(real_realloc == NULL, 0)) {
+		if (resolving)
+			return NULL;
+		alloc_resolve();
+	}
+	if (counting) {
+		allocs++;
+		alloc_bytes += size;
+	}
+	return real_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+	if (ptr == NULL || in_boot_heap(ptr))
+		return;
+	if (__builtin_expect(real_free == NULL, 0))
+		alloc_resolve();
+	real_free(ptr);
+}
+#endif
+
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ *  The benchmarks.  Each runs its operation n times on inputs fixed at
+ *  setup, so that runs and versions compare.
+ */
+static void bench_pack_auth(struct bench_ctx *ctx, uint64_t n)
+{
+	unsigned char	buf[BUFFER_LEN];
+	AUTH_HDR	*auth = (AUTH_HDR *)buf;
+	char		secret[] = BENCH_SECRET;
+
+	while (n-- > 0) {
+		auth->code = PW_ACCESS_REQUEST;
+		auth->id = 1;
+		memcpy(auth->vector, ctx->vector, AUTH_VECTOR_LEN);
+		ctx->sink += rc_pack_list(ctx->rh, ctx->auth_pairs, secret, auth, sizeof(buf));
+	}
+}
+
+static void bench_pack_acct(struct bench_ctx *ctx, uint64_t n)
+{
+	unsigned char	buf[BUFFER_LEN];
+	AUTH_HDR	*auth = (AUTH_HDR *)buf;
+	char		secret[] = BENCH_SECRET;
+
+	while (n-- > 0) {
+		auth->code = PW_ACCOUNTING_REQUEST;
+		auth->id = 1;
+		memset(auth->vector, 0, AUTH_VECTOR_LEN);
+		ctx->sink += rc_pack_list(ctx->rh, ctx->acct_pairs, secret, auth, sizeof(buf));
+	}
+}
+
+static void bench_avpair_gen(struct bench_ctx *ctx, uint64_t n)
+{
+	AUTH_HDR const	*auth = (AUTH_HDR const *)ctx->reply;
+	VALUE_PAIR	*vp;
+
+	while (n-- > 0) {
+		vp = rc_avpair_gen(ctx->rh, NULL, auth->data, ctx->reply_len - AUTH_HDR_LEN, 0);
+		ctx->sink += vp != NULL;
+		rc_avpair_free(vp);
+	}
+}
+
+static void bench_check_reply(struct bench_ctx *ctx, uint64_t n)
+{
+	while (n-- > 0)
+		ctx->sink += rc_check_reply(ctx->rh, (AUTH_HDR const *)ctx->reply, BENCH_SECRET,
+					    ctx->vector, 1);
+}
+
+static void bench_md5(struct bench_ctx *ctx, uint64_t n, size_t len)
+{
+	unsigned char digest[16];
+
+	while (n-- > 0) {
+		rc_md5_calc(digest, ctx->md5_in, len);
+		ctx->sink += digest[0];
+	}
+}
+
+static void bench_md5_64(struct bench_ctx *ctx, uint64_t n)
+{
+	bench_md5(ctx, n, 64);
+}
+
+static void bench_md5_1024(struct bench_ctx *ctx, uint64_t n)
+{
+	bench_md5(ctx, n, 1024);
+}
+
+static char const *attr_names[8] = {
+	"User-Name", "Framed-IP-Address", "Acct-Session-Id", "Service-Type",
+	"Calling-Station-Id", "Acct-Output-Octets", "Session-Timeout", "NAS-Identifier"
+};
+static uint32_t const attr_ids[8] = {
+	PW_USER_NAME, PW_FRAMED_IP_ADDRESS, PW_ACCT_SESSION_ID, PW_SERVICE_TYPE,
+	PW_CALLING_STATION_ID, PW_ACCT_OUTPUT_OCTETS, PW_SESSION_TIMEOUT, PW_NAS_IDENTIFIER
+};
+static char const *value_names[4] = { "Framed-User", "PPP", "Stop", "Login-User" };
+static struct { uint32_t value; char const *attr; } const values[4] = {
+	{ PW_FRAMED, "Service-Type" }, { PW_PPP, "Framed-Protocol" },
+	{ PW_STATUS_STOP, "Acct-Status-Type" }, { PW_LOGIN, "Service-Type" }
+};
+
+static void bench_dict_findattr(struct bench_ctx *ctx, uint64_t n)
+{
+	while (n-- > 0)
+		ctx->sink += rc_dict_findattr(ctx->rh, attr_names[n & 7]) != NULL;
+}
+
+static void bench_dict_getattr(struct bench_ctx *ctx, uint64_t n)
+{
+	while (n-- > 0)
+		ctx->sink += rc_dict_getattr(ctx->rh, attr_ids[n & 7]) != NULL;
+}
+
+static void bench_dict_findval(struct bench_ctx *ctx, uint64_t n)
+{
+	while (n-- > 0)
+		ctx->sink += rc_dict_findval(ctx->rh, value_names[n & 3]) != NULL;
+}
+
+static void bench_dict_getval(struct bench_ctx *ctx, uint64_t n)
+{
+	while (n-- > 0)
+		ctx->sink += rc_dict_getval(ctx->rh, values[n & 3].value, values[n & 3].attr) != NULL;
+}
+
+static char const parse_text[] =
+	"User-Name = alice@example.com NAS-Port-Id = 42 Service-Type = Framed-User "
+	"Framed-IP-Address = 10.0.0.1 Calling-Station-Id = \"00-11-22-33-44-55\"";
+
+static void bench_avpair_parse(struct bench_ctx *ctx, uint64_t n)
+{
+	VALUE_PAIR *vp;
+
+	while (n-- > 0) {
+		vp = NULL;
+		ctx->sink += rc_avpair_parse(ctx->rh, parse_text, &vp);
+		rc_avpair_free(vp);
+	}
+}
+
+static void bench_read_config(struct bench_ctx *ctx, uint64_t n)
+{
+	rc_handle *rh;
+
+	while (n-- > 0) {
+		rh = rc_read_config(ctx->config);
+		ctx->sink += rh != NULL;
+		if (rh != NULL)
+			rc_destroy(rh);
+	}
+}
+
+static void bench_read_dictionary(struct bench_ctx *ctx, uint64_t n)
+{
+	while (n-- > 0) {
+		rc_dict_free(ctx->cold);
+		ctx->sink += rc_read_dictionary(ctx->cold, ctx->dictionary);
+	}
+}
+
+static struct bench const benches[] = {
+	{ "rc_pack_list/access_request",	bench_pack_auth,	1 },
+	{ "rc_pack_list/accounting_request",	bench_pack_acct,	1 },
+	{ "rc_avpair_gen/access_accept",	bench_avpair_gen,	1 },
+	{ "rc_check_reply/access_accept",	bench_check_reply,	1 },
+	{ "rc_md5_calc/64",			bench_md5_64,		1 },
+	{ "rc_md5_calc/1024",			bench_md5_1024,		1 },
+	{ "rc_dict_findattr",			bench_dict_findattr,	1 },
+	{ "rc_dict_getattr",			bench_dict_getattr,	1 },
+	{ "rc_dict_findval",			bench_dict_findval,	1 },
+	{ "rc_dict_getval",			bench_dict_getval,	1 },
+	{ "rc_avpair_parse",			bench_avpair_parse,	1 },
+	{ "cold/rc_read_config",		bench_read_config,	2 },
+	{ "cold/rc_read_dictionary",		bench_read_dictionary,	2 },
+	{ NULL, NULL, 0 }
+};
+
+/** Append an attribute to a packet being built
+ *
+ * @param p where the attribute goes.
+ * @param type the attribute number.
+ * @param value the value.
+ * @param len the length of the value.
+ * @return the end of the attribute.
+ */
+static unsigned char *put_attr(unsigned char *p, int type, void const *value, size_t len)
+{
+	*p++ = type;
+	*p++ = len + 2;
+	memcpy(p, value, len);
+	return p + len;
+}
+
+static unsigned char *put_int(unsigned char *p, int type, uint32_t value)
+{
+	value = htonl(value);
+	return put_attr(p, type, &value, sizeof(value));
+}
+
+/** Build an Access-Accept to the request with ctx->vector, as a server would
+ *
+ * @param ctx the benchmark state.
+ */
+static void build_reply(struct bench_ctx *ctx)
+{
+	AUTH_HDR	*auth = (AUTH_HDR *)ctx->reply;
+	unsigned char	*p = auth->data, *msg_auth;
+	unsigned char	zero[AUTH_VECTOR_LEN] = { 0 };
+	unsigned char	digest[AUTH_VECTOR_LEN];
+	char const	*welcome = "Welcome, alice";
+	char const	*class = "bench-class-0123456789";
+
+	auth->code = PW_ACCESS_ACCEPT;
+	auth->id = 1;
+	memcpy(auth->vector, ctx->vector, AUTH_VECTOR_LEN);
+
+	msg_auth = p + 2;
+	p = put_attr(p, PW_MESSAGE_AUTHENTICATOR, zero, sizeof(zero));
+	p = put_int(p, PW_SERVICE_TYPE, PW_FRAMED);
+	p = put_int(p, PW_FRAMED_PROTOCOL, PW_PPP);
+	p = put_int(p, PW_FRAMED_IP_ADDRESS, 0x0a000001);
+	p = put_int(p, PW_FRAMED_MTU, 1500);
+	p = put_int(p, PW_SESSION_TIMEOUT, 3600);
+	p = put_attr(p, PW_REPLY_MESSAGE, welcome, strlen(welcome));
+	p = put_attr(p, PW_CLASS, class, strlen(class));
+
+	ctx->reply_len = p - ctx->reply;
+	auth->length = htons(ctx->reply_len);
+
+	/* Message-Authenticator over the packet with the request authenticator */
+	rc_hmac_md5(ctx->rh, digest, ctx->reply, ctx->reply_len, BENCH_SECRET);
+	memcpy(msg_auth, digest, AUTH_VECTOR_LEN);
+
+	/* then the response authenticator, MD5 of the packet and the secret */
+	memcpy(p, BENCH_SECRET, strlen(BENCH_SECRET));
+	rc_md5_calc(digest, ctx->reply, ctx->reply_len + strlen(BENCH_SECRET));
+	memcpy(auth->vector, digest, AUTH_VECTOR_LEN);
+}
+
+/** Set up the handles and inputs of the benchmarks
+ *
+ * @param ctx the benchmark state.
+ * @param path where to write the configuration file.
+ * @return 0 on success, -1 on failure.
+ */
+static int bench_setup(struct bench_ctx *ctx, char *path)
+{
+	FILE		*fp;
+	int		fd;
+	uint32_t	ip = 0xc0a80001, port = 42, i;
+	uint32_t	service = PW_FRAMED, proto = PW_PPP, status = PW_STATUS_STOP;
+	uint32_t	in = 123456789, out = 987654321, stime = 3600, delay = 0;
+	VALUE_PAIR	*vp = NULL;
+
+	fd = mkstemp(path);
+	if (fd < 0 || (fp = fdopen(fd, "w")) == NULL) {
+		fprintf(stderr, "%s: can't create %s: %s\n", pname, path, strerror(errno));
+		return -1;
+	}
+	fprintf(fp, "authserver 127.0.0.1:1812:" BENCH_SECRET "\n"
+		"acctserver 127.0.0.1:1813:" BENCH_SECRET "\n"
+		"servers /dev/null\ndictionary %s\nmapfile /dev/null\n"
+		"radius_timeout 5\nradius_retries 3\nradius_deadtime 0\n"
+		"login_tries 4\nlogin_timeout 60\nnologin /etc/nologin\n", ctx->dictionary);
+	fclose(fp);
+	ctx->config = path;
+
+	ctx->rh = rc_read_config(path);
+	ctx->cold = rc_read_config(path);
+	if (ctx->rh == NULL || ctx->cold == NULL ||
+	    rc_read_dictionary(ctx->rh, ctx->dictionary) != 0 ||
+	    rc_read_dictionary(ctx->cold, ctx->dictionary) != 0) {
+		fprintf(stderr, "%s: can't load %s\n", pname, ctx->dictionary);
+		return -1;
+	}
+
+	if (rc_avpair_add(ctx->rh, &ctx->auth_pairs, PW_USER_NAME, "alice@example.com", -1, 0) == NULL ||
+	    rc_avpair_add(ctx->rh, &ctx->auth_pairs, PW_USER_PASSWORD, "correct horse battery", -1, 0) == NULL ||
+	    rc_avpair_add(ctx->rh, &ctx->auth_pairs, PW_NAS_IP_ADDRESS, &ip, 0, 0) == NULL ||
+	    rc_avpair_add(ctx->rh, &ctx->auth_pairs, PW_NAS_PORT, &port, 0, 0) == NULL ||
+	    rc_avpair_add(ctx->rh, &ctx->auth_pairs, PW_SERVICE_TYPE, &service, 0, 0) == NULL ||
+	    rc_avpair_add(ctx->rh, &ctx->auth_pairs, PW_FRAMED_PROTOCOL, &proto, 0, 0) == NULL ||
+	    rc_avpair_add(ctx->rh, &ctx->auth_pairs, PW_CALLING_STATION_ID, "00-11-22-33-44-55", -1, 0) == NULL ||
+	    rc_avpair_add(ctx->rh, &ctx->auth_pairs, PW_NAS_IDENTIFIER, "bench-nas", -1, 0) == NULL)
+		return -1;
+
+	if (rc_avpair_add(ctx->rh, &ctx->acct_pairs, PW_ACCT_STATUS_TYPE, &status, 0, 0) == NULL ||
+	    rc_avpair_add(ctx->rh, &ctx->acct_pairs, PW_ACCT_SESSION_ID, "4D2F1A9C", -1, 0) == NULL ||
+	    rc_avpair_add(ctx->rh, &ctx->acct_pairs, PW_USER_NAME, "alice@example.com", -1, 0) == NULL ||
+	    rc_avpair_add(ctx->rh, &ctx->acct_pairs, PW_NAS_IP_ADDRESS, &ip, 0, 0) == NULL ||
+	    rc_avpair_add(ctx->rh, &ctx->acct_pairs, PW_NAS_PORT, &port, 0, 0) == NULL ||
+	    rc_avpair_add(ctx->rh, &ctx->acct_pairs, PW_ACCT_INPUT_OCTETS, &in, 0, 0) == NULL ||
+	    rc_avpair_add(ctx->rh, &ctx->acct_pairs, PW_ACCT_OUTPUT_OCTETS, &out, 0, 0) == NULL ||
+	    rc_avpair_add(ctx->rh, &ctx->acct_pairs, PW_ACCT_SESSION_TIME, &stime, 0, 0) == NULL ||
+	    rc_avpair_add(ctx->rh, &ctx->acct_pairs, PW_ACCT_DELAY_TIME, &delay, 0, 0) == NULL)
+		return -1;
+
+	for (i = 0; i < AUTH_VECTOR_LEN; i++)
+		ctx->vector[i] = i * 17 + 3;
+	for (i = 0; i < sizeof(ctx->md5_in); i++)
+		ctx->md5_in[i] = i * 31 + 7;
+
+	build_reply(ctx);
+	if (rc_check_reply(ctx->rh, (AUTH_HDR const *)ctx->reply, BENCH_SECRET, ctx->vector, 1) != OK_RC) {
+		fprintf(stderr, "%s: the sample reply does not verify\n", pname);
+		return -1;
+	}
+	if (rc_avpair_parse(ctx->rh, parse_text, &vp) != 0) {
+		fprintf(stderr, "%s: the sample pairs do not parse\n", pname);
+		return -1;
+	}
+	rc_avpair_free(vp);
+
+	return 0;
+}
+
+static int cmp_u64(void const *a, void const *b)
+{
+	uint64_t x = *(uint64_t const *)a, y = *(uint64_t const *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/** Run a benchmark and print its result
+ *
+ * The number of operations per run is raised until a run takes min_time;
+ * then runs are repeated and the median reported, which keeps a stray
+ * interruption from moving the result.
+ *
+ * @param ctx the benchmark state.
+ * @param b the benchmark.
+ * @param min_time seconds per run.
+ * @param runs the number of runs.
+ * @param out where to print.
+ * @param first whether this is the first result printed.
+ */
+static void bench_run(struct bench_ctx *ctx, struct bench const *b, double min_time, int runs,
+		      FILE *out, int first)
+{
+	uint64_t	n = 1, start, elapsed, ns[BENCH_MAX_RUNS];
+	double		target = min_time * b->min_time * 1e9;
+	int		i;
+
+	for (;;) {
+		start = bench_now();
+		b->run(ctx, n);
+		elapsed = bench_now() - start;
+		if (elapsed >= target)
+			break;
+		if (elapsed < target / 100)
+			n *= 100;
+		else
+			n = n * (target * 1.2 / elapsed) + 1;
+	}
+
+#ifdef BENCH_ALLOCS
+	allocs = alloc_bytes = 0;
+	counting = 1;
+#endif
+	for (i = 0; i < runs; i++) {
+		start = bench_now();
+		b->run(ctx, n);
+		ns[i] = bench_now() - start;
+	}
+#ifdef BENCH_ALLOCS
+	counting = 0;
+#endif
+	qsort(ns, runs, sizeof(ns[0]), cmp_u64);
+
+	fprintf(out, "%s    {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.2f, "
+		"\"ns_per_op_min\": %.2f, \"ns_per_op_max\": %.2f, ",
+		first ? "" : ",\n", b->name, (unsigned long long)n,
+		(double)ns[runs / 2] / n, (double)ns[0] / n, (double)ns[runs - 1] / n);
+#ifdef BENCH_ALLOCS
+	fprintf(out, "\"allocs_per_op\": %.2f, \"bytes_per_op\": %.1f}",
+		(double)allocs / (n * runs), (double)alloc_bytes / (n * runs));
+#else
+	fprintf(out, "\"allocs_per_op\": null, \"bytes_per_op\": null}");
+#endif
+	fflush(out);
+}
+
+static int selected(char const *name, int argc, char **argv)
+{
+	int i;
+
+	if (argc == 0)
+		return 1;
+	for (i = 0; i < argc; i++)
+		if (strstr(name, argv[i]) != NULL)
+			return 1;
+	return 0;
+}
+
+void usage(void)
+{
+	fprintf(stderr,"Usage: %s [-hl] [-d <dictionary>] [-t <ms>] [-r <runs>] [-o <file>] [name ...]\n\n", pname);
+	fprintf(stderr,"  -h            output this text\n");
+	fprintf(stderr,"  -l            list the benchmarks\n");
+	fprintf(stderr,"  -d		dictionary to load (default %s)\n", BENCH_DICTIONARY);
+	fprintf(stderr,"  -t		milliseconds per run (default 200)\n");
+	fprintf(stderr,"  -r		runs per benchmark, the median is reported (default 5)\n");
+	fprintf(stderr,"  -o		write the JSON results to this file\n");
+	fprintf(stderr,"  name		run only the benchmarks whose names contain one of these\n");
+	exit(ERROR_RC);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_ctx	ctx;
+	struct bench const	*b;
+	char			path[] = "/tmp/rcbench.XXXXXX";
+	FILE			*out = stdout;
+	double			min_time = 0.2;
+	int			c, runs = 5, first = 1, rc = 0;
+
+	if ((pname = strrchr(argv[0], '/')) == NULL)
+		pname = argv[0];
+	else
+		pname++;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.dictionary = BENCH_DICTIONARY;
+
+	while ((c = getopt(argc, argv, "hld:t:r:o:")) > 0)
+	{
+		switch (c) {
+			case 'l':
+				for (b = benches; b->name != NULL; b++)
+					printf("%s\n", b->name);
+				exit(0);
+			case 'd':
+				ctx.dictionary = optarg;
+				break;
+			case 't':
+				min_time = atof(optarg) / 1000;
+				if (min_time <= 0)
+					usage();
+				break;
+			case 'r':
+				runs = atoi(optarg);
+				if (runs < 1 || runs > BENCH_MAX_RUNS)
+					usage();
+				break;
+			case 'o':
+				out = fopen(optarg, "w");
+				if (out == NULL) {
+					fprintf(stderr, "%s: can't open %s: %s\n", pname, optarg, strerror(errno));
+					exit(ERROR_RC);
+				}
+				break;
+			case 'h':
+			default:
+				usage();
+				break;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	rc_openlog(pname);
+	if (bench_setup(&ctx, path) != 0)
+		rc = ERROR_RC;
+
+	if (rc == 0) {
+		fprintf(out, "{\n  \"version\": \"%s\",\n  \"md5_backend\": \"%s\",\n"
+			"  \"ms_per_run\": %g,\n  \"runs\": %d,\n  \"benchmarks\": [\n",
+			VERSION, rc_md5_get_backend(), min_time * 1000, runs);
+		for (b = benches; b->name != NULL; b++) {
+			if (!selected(b->name, argc, argv))
+				continue;
+			bench_run(&ctx, b, min_time, runs, out, first);
+			first = 0;
+		}
+		fprintf(out, "\n  ]\n}\n");
+		if (ctx.sink == 0)
+			fprintf(stderr, "%s: no benchmark did any work\n", pname);
+	}
+
+	if (ctx.config != NULL)
+		unlink(ctx.config);
+	rc_avpair_free(ctx.auth_pairs);
+	rc_avpair_free(ctx.acct_pairs);
+	if (ctx.rh != NULL)
+		rc_destroy(ctx.rh);
+	if (ctx.cold != NULL)
+		rc_destroy(ctx.cold);
+	if (out != stdout)
+		fclose(out);
+
+	return rc;
+}
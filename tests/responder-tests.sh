@@ -0,0 +1,134 @@
+#!/bin/sh
+
+# License: BSD
+
+# Runs radiusclient against radresponder on the loopback interface; unlike
+# basic-tests.sh this needs no external server.
+
+srcdir="${srcdir:-.}"
+
+RESPONDER=../src/radresponder
+CLIENT=../src/radiusclient
+TMPFILE=responder-tmp.out
+PIDS=""
+
+cleanup() {
+	test -n "$PIDS" && kill $PIDS 2>/dev/null
+	rm -f $TMPFILE responder-temp.conf responder-*.port
+}
+trap cleanup 0
+
+# start_responder <name> [radresponder options]: sets $PORT
+start_responder() {
+	name=$1
+	shift
+	$RESPONDER -f responder-temp.conf "$@" >responder-$name.port &
+	PIDS="$PIDS $!"
+	PORT=""
+	for i in 1 2 3 4 5 6 7 8 9 10; do
+		PORT=`sed -n 's/^port //p' responder-$name.port`
+		test -n "$PORT" && break
+		sleep 1
+	done
+	if test -z "$PORT";then
+		echo "radresponder $name did not start"
+		exit 1
+	fi
+}
+
+# write_conf [<port>...]: points the client at the given responders; with
+# none, at a placeholder so that radresponder can read the file
+write_conf() {
+	test $# = 0 && set -- 1812
+	sed -e 's|^dictionary.*|dictionary '$srcdir'/../etc/dictionary|' \
+	    -e 's|^mapfile.*|mapfile '$srcdir'/../etc/port-id-map|' \
+	    -e 's|^servers.*|servers /dev/null|' \
+	    -e '/^authserver/d' -e '/^acctserver/d' \
+	    -e 's|^radius_timeout.*|radius_timeout 3|' \
+	    -e 's|^radius_retries.*|radius_retries 1|' \
+	    <$srcdir/radiusclient.conf >responder-temp.conf
+	for p in "$@"; do
+		echo "authserver 127.0.0.1:$p:testing123" >>responder-temp.conf
+		echo "acctserver 127.0.0.1:$p:testing123" >>responder-temp.conf
+	done
+}
+
+stop_responders() {
+	kill $PIDS 2>/dev/null
+	wait
+	PIDS=""
+}
+
+write_conf
+
+# Access-Accept carrying attributes
+start_responder accept -a "Framed-Protocol=PPP Framed-IP-Address=192.168.1.190"
+write_conf $PORT
+$CLIENT -f responder-temp.conf User-Name=test Password=test >$TMPFILE
+if test $? != 0;then
+	echo "Error in PAP auth"
+	exit 1
+fi
+
+grep "^Framed-IP-Address                = '192.168.1.190'$" $TMPFILE >/dev/null 2>&1
+if test $? != 0;then
+	echo "Error in data received from responder (Framed-IP-Address)"
+	cat $TMPFILE
+	exit 1
+fi
+
+# Accounting-Request
+$CLIENT -f responder-temp.conf -a User-Name=test Acct-Status-Type=Start Acct-Session-Id=1 >$TMPFILE
+if test $? != 0;then
+	echo "Error in accounting"
+	exit 1
+fi
+stop_responders
+
+# Access-Reject
+write_conf
+start_responder reject -c reject
+write_conf $PORT
+$CLIENT -f responder-temp.conf User-Name=test Password=test >$TMPFILE
+if test $? = 0;then
+	echo "Access-Reject was accepted"
+	exit 1
+fi
+stop_responders
+
+# replies sent twice and out of order are still matched
+write_conf
+start_responder dup -D 100 -o 50 -S 1
+write_conf $PORT
+$CLIENT -f responder-temp.conf User-Name=test Password=test >$TMPFILE
+if test $? != 0;then
+	echo "Error with duplicated replies"
+	exit 1
+fi
+stop_responders
+
+# a forged reply is rejected
+write_conf
+start_responder badauth -b 100
+write_conf $PORT
+$CLIENT -f responder-temp.conf User-Name=test Password=test >$TMPFILE
+if test $? = 0;then
+	echo "Reply with a bad authenticator was accepted"
+	exit 1
+fi
+stop_responders
+
+# a server losing every request fails over to the next one
+write_conf
+start_responder lossy -l 100
+LOSSY=$PORT
+start_responder backup
+write_conf $LOSSY $PORT
+$CLIENT -f responder-temp.conf User-Name=test Password=test >$TMPFILE
+if test $? != 0;then
+	echo "Error in failover from a lossy server"
+	exit 1
+fi
+stop_responders
+
+exit 0